@@ -0,0 +1,439 @@
+#include "alloc.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+// Sites are interned by the address of their "file:line" literal
+#define ALLOC_SITES 1024
+// How many sites the report lists by bytes allocated
+#define ALLOC_REPORT_SITES 15
+
+/*
+ * Placed in front of every block once headers are on. A multiple of 16
+ * bytes so the block itself stays aligned the way malloc aligns it.
+ */
+typedef struct AllocHeader {
+    AllocArena* arena;          // NULL for a block outside any arena
+    struct AllocHeader* prev;   // the arena's other live blocks
+    struct AllocHeader* next;
+    size_t size;
+    int site;                   // only with tracking
+    int phase;
+} AllocHeader;
+
+#define ALLOC_HEADER_SIZE 48
+
+struct AllocArena {
+    pthread_mutex_t lock;
+    AllocHeader* blocks;
+    size_t bytes;       // in live blocks, headers aside
+    uint64_t id;
+};
+
+_Static_assert(sizeof(AllocHeader) <= ALLOC_HEADER_SIZE, "allocation header too large");
+_Static_assert(_Alignof(max_align_t) <= ALLOC_HEADER_SIZE, "allocation header would misalign blocks");
+
+typedef struct {
+    size_t calls;
+    size_t bytes;       // requested in total
+    size_t liveBlocks;
+    size_t liveBytes;
+    size_t peakBytes;   // highest liveBytes seen
+} AllocCounts;
+
+typedef struct {
+    const char* name;
+    AllocCounts counts;
+} AllocSite;
+
+int allocTracking = 0;
+int allocHeaders = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// The extra slot at the end collects sites that no longer fit
+static AllocSite sites[ALLOC_SITES + 1];
+static int siteCount = 0;
+static AllocCounts phases[ALLOC_PHASES];
+static AllocCounts total;
+static _Thread_local AllocPhase currentPhase = ALLOC_EVAL;
+static _Thread_local AllocArena* currentArena = NULL;
+// Arena ids are never reused, unlike their addresses
+static uint64_t lastArenaId = 0;
+
+static const char* phaseNames[ALLOC_PHASES] = {
+    "startup", "lex", "parse", "analyze", "eval", "codegen"
+};
+
+/**
+ * @brief Find or add a site's slot; call with the lock held
+ * @return Its index, or the shared overflow slot once the table is half full
+ */
+static int siteIndex(const char* name){
+    uintptr_t hash = (uintptr_t)name * 0x9E3779B97F4A7C15ULL;
+    int index = (int)(hash >> 32) & (ALLOC_SITES - 1);
+    while(sites[index].name != NULL){
+        if(sites[index].name == name){
+            return index;
+        }
+        index = (index + 1) & (ALLOC_SITES - 1);
+    }
+    if(siteCount >= ALLOC_SITES / 2){
+        sites[ALLOC_SITES].name = "(other sites)";
+        return ALLOC_SITES;
+    }
+    sites[index].name = name;
+    siteCount++;
+    return index;
+}
+
+static void countAlloc(AllocCounts* counts, size_t size){
+    counts->calls++;
+    counts->bytes += size;
+    counts->liveBlocks++;
+    counts->liveBytes += size;
+    if(counts->liveBytes > counts->peakBytes){
+        counts->peakBytes = counts->liveBytes;
+    }
+}
+
+static void countFree(AllocCounts* counts, size_t size){
+    counts->liveBlocks--;
+    counts->liveBytes -= size;
+}
+
+// Call with the lock held
+static void record(AllocHeader* header, size_t size, const char* name){
+    header->size = size;
+    header->site = siteIndex(name);
+    header->phase = (int)currentPhase;
+    countAlloc(&sites[header->site].counts, size);
+    countAlloc(&phases[header->phase], size);
+    countAlloc(&total, size);
+}
+
+// Call with the lock held
+static void forget(AllocHeader* header){
+    countFree(&sites[header->site].counts, header->size);
+    countFree(&phases[header->phase], header->size);
+    countFree(&total, header->size);
+}
+
+// Call with the arena's lock held
+static void linkBlock(AllocArena* arena, AllocHeader* header){
+    arena->bytes += header->size;
+    header->prev = NULL;
+    header->next = arena->blocks;
+    if(arena->blocks != NULL){
+        arena->blocks->prev = header;
+    }
+    arena->blocks = header;
+}
+
+// Call with the arena's lock held
+static void unlinkBlock(AllocArena* arena, AllocHeader* header){
+    arena->bytes -= header->size;
+    if(header->prev != NULL){
+        header->prev->next = header->next;
+    }else{
+        arena->blocks = header->next;
+    }
+    if(header->next != NULL){
+        header->next->prev = header->prev;
+    }
+}
+
+/**
+ * @brief Allocate a block with a header, in this thread's arena if it has
+ *        one, recording where it came from when tracking
+ * @param zero Clear the block, as calloc does
+ */
+void* trackedAlloc(size_t size, int zero, const char* site){
+    if(size > SIZE_MAX - ALLOC_HEADER_SIZE){
+        return NULL;
+    }
+    char* raw = (char*)(zero ? calloc(1, ALLOC_HEADER_SIZE + size) : malloc(ALLOC_HEADER_SIZE + size));
+    if(raw == NULL){
+        return NULL;
+    }
+    AllocHeader* header = (AllocHeader*)raw;
+    header->arena = currentArena;
+    header->size = size;
+    if(header->arena != NULL){
+        pthread_mutex_lock(&header->arena->lock);
+        linkBlock(header->arena, header);
+        pthread_mutex_unlock(&header->arena->lock);
+    }
+    if(allocTracking){
+        pthread_mutex_lock(&lock);
+        record(header, size, site);
+        pthread_mutex_unlock(&lock);
+    }
+    return raw + ALLOC_HEADER_SIZE;
+}
+
+/**
+ * @brief Resize a block with a header; it stays in its arena, and with
+ *        tracking the new size is charged to this site and phase
+ */
+void* trackedRealloc(void* block, size_t size, const char* site){
+    if(block == NULL){
+        return trackedAlloc(size, 0, site);
+    }
+    if(size > SIZE_MAX - ALLOC_HEADER_SIZE){
+        return NULL;
+    }
+    char* raw = (char*)block - ALLOC_HEADER_SIZE;
+    AllocHeader old = *(AllocHeader*)raw;
+    // The neighbours point at the block, so it cannot move unseen
+    if(old.arena != NULL){
+        pthread_mutex_lock(&old.arena->lock);
+    }
+    char* moved = (char*)realloc(raw, ALLOC_HEADER_SIZE + size);
+    if(moved == NULL){
+        if(old.arena != NULL){
+            pthread_mutex_unlock(&old.arena->lock);
+        }
+        return NULL;
+    }
+    AllocHeader* header = (AllocHeader*)moved;
+    header->size = size;
+    if(old.arena != NULL){
+        if(old.prev != NULL){
+            old.prev->next = header;
+        }else{
+            old.arena->blocks = header;
+        }
+        if(old.next != NULL){
+            old.next->prev = header;
+        }
+        old.arena->bytes += size - old.size;
+        pthread_mutex_unlock(&old.arena->lock);
+    }
+    if(allocTracking){
+        pthread_mutex_lock(&lock);
+        forget(&old);
+        record(header, size, site);
+        pthread_mutex_unlock(&lock);
+    }
+    return moved + ALLOC_HEADER_SIZE;
+}
+
+void trackedFree(void* block){
+    if(block == NULL){
+        return;
+    }
+    AllocHeader* header = (AllocHeader*)((char*)block - ALLOC_HEADER_SIZE);
+    if(header->arena != NULL){
+        pthread_mutex_lock(&header->arena->lock);
+        unlinkBlock(header->arena, header);
+        pthread_mutex_unlock(&header->arena->lock);
+    }
+    if(allocTracking){
+        pthread_mutex_lock(&lock);
+        forget(header);
+        pthread_mutex_unlock(&lock);
+    }
+    free(header);
+}
+
+/**
+ * @brief Make an empty arena, switching headers on for good
+ * @return The arena, or NULL when out of memory
+ */
+AllocArena* allocArenaCreate(void){
+    allocHeadersEnable();
+    AllocArena* arena = (AllocArena*)calloc(1, sizeof(AllocArena));
+    if(arena != NULL){
+        pthread_mutex_init(&arena->lock, NULL);
+        arena->id = __atomic_add_fetch(&lastArenaId, 1, __ATOMIC_RELAXED);
+    }
+    return arena;
+}
+
+/**
+ * @brief Allocate this thread's blocks in an arena from now on
+ * @param arena The arena, or NULL for none
+ * @return The arena it replaces, to restore afterwards
+ */
+AllocArena* allocArenaUse(AllocArena* arena){
+    AllocArena* previous = currentArena;
+    currentArena = arena;
+    return previous;
+}
+
+/**
+ * @brief Which arena this thread allocates in, for caches of memory carved
+ *        out of a block that must not outlive its arena
+ * @return The arena's id, or 0 for none
+ */
+uint64_t allocArenaId(void){
+    return currentArena != NULL ? currentArena->id : 0;
+}
+
+/**
+ * @brief Move a block into this thread's arena, as if it had been
+ *        allocated there, so that freeing its old arena leaves it be
+ * @return 1 if it moved, 0 if it was in this arena already, and -1 if it
+ *         is in none
+ */
+int allocArenaTake(void* block){
+    AllocHeader* header = (AllocHeader*)((char*)block - ALLOC_HEADER_SIZE);
+    AllocArena* from = header->arena;
+    if(from == NULL){
+        return -1;
+    }
+    if(from == currentArena){
+        return 0;
+    }
+    pthread_mutex_lock(&from->lock);
+    unlinkBlock(from, header);
+    pthread_mutex_unlock(&from->lock);
+    header->arena = currentArena;
+    if(currentArena != NULL){
+        pthread_mutex_lock(&currentArena->lock);
+        linkBlock(currentArena, header);
+        pthread_mutex_unlock(&currentArena->lock);
+    }
+    return 1;
+}
+
+/**
+ * @brief How many bytes an arena's live blocks hold, headers aside
+ */
+size_t allocArenaBytes(AllocArena* arena){
+    pthread_mutex_lock(&arena->lock);
+    size_t bytes = arena->bytes;
+    pthread_mutex_unlock(&arena->lock);
+    return bytes;
+}
+
+/**
+ * @brief Free an arena and every block still in it
+ *
+ * Nothing may be allocating in it, and pointers into its blocks are left
+ * dangling.
+ */
+void allocArenaFree(AllocArena* arena){
+    if(arena == NULL){
+        return;
+    }
+    AllocHeader* header = arena->blocks;
+    while(header != NULL){
+        AllocHeader* next = header->next;
+        if(allocTracking){
+            pthread_mutex_lock(&lock);
+            forget(header);
+            pthread_mutex_unlock(&lock);
+        }
+        free(header);
+        header = next;
+    }
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+/**
+ * @brief Give every block a header from now on, as arenas need, without
+ *        tracking; nothing may have been allocated yet
+ */
+void allocHeadersEnable(void){
+    // Arenas are made while other threads allocate; only the first writes
+    if(!allocHeaders){
+        allocHeaders = 1;
+    }
+}
+
+static void reportAtExit(void){
+    allocReport();
+}
+
+/**
+ * @brief Start tracking allocations, and report them at exit
+ *
+ * Must be called before anything has been allocated through memAlloc.
+ */
+void allocTrackingEnable(void){
+    if(allocTracking){
+        return;
+    }
+    allocTracking = 1;
+    allocHeaders = 1;
+    atexit(reportAtExit);
+}
+
+/**
+ * @brief Charge this thread's allocations to a phase from now on
+ * @return The phase it replaces, to restore afterwards
+ */
+AllocPhase allocPhase(AllocPhase phase){
+    AllocPhase previous = currentPhase;
+    currentPhase = phase;
+    return previous;
+}
+
+// Build paths can be absolute; the file name is enough to find the line
+static const char* siteName(const char* name){
+    const char* slash = strrchr(name, '/');
+    return slash != NULL ? slash + 1 : name;
+}
+
+static int byBytes(const void* a, const void* b){
+    size_t x = (*(const AllocSite* const*)a)->counts.bytes;
+    size_t y = (*(const AllocSite* const*)b)->counts.bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int byLiveBytes(const void* a, const void* b){
+    size_t x = (*(const AllocSite* const*)a)->counts.liveBytes;
+    size_t y = (*(const AllocSite* const*)b)->counts.liveBytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void printCounts(const char* name, const AllocCounts* counts){
+    fprintf(stderr, "  %-24s %10zu %14zu %12zu %10zu %12zu\n", name, counts->calls, counts->bytes,
+            counts->peakBytes, counts->liveBlocks, counts->liveBytes);
+}
+
+/**
+ * @brief Print allocation totals by phase and by site, and what is still live, on stderr
+ */
+void allocReport(void){
+    if(!allocTracking){
+        return;
+    }
+    pthread_mutex_lock(&lock);
+
+    fprintf(stderr, "\nallocations by phase:\n");
+    fprintf(stderr, "  %-24s %10s %14s %12s %10s %12s\n", "phase", "calls", "bytes", "peak bytes", "live", "live bytes");
+    for(int phase = 0; phase < ALLOC_PHASES; phase++){
+        if(phases[phase].calls > 0){
+            printCounts(phaseNames[phase], &phases[phase]);
+        }
+    }
+    printCounts("total", &total);
+
+    AllocSite* sorted[ALLOC_SITES + 1];
+    int count = 0;
+    for(int i = 0; i <= ALLOC_SITES; i++){
+        if(sites[i].name != NULL){
+            sorted[count++] = &sites[i];
+        }
+    }
+
+    qsort(sorted, (size_t)count, sizeof(AllocSite*), byBytes);
+    fprintf(stderr, "\ntop sites by bytes allocated:\n");
+    fprintf(stderr, "  %-24s %10s %14s %12s %10s %12s\n", "site", "calls", "bytes", "peak bytes", "live", "live bytes");
+    for(int i = 0; i < count && i < ALLOC_REPORT_SITES; i++){
+        printCounts(siteName(sorted[i]->name), &sorted[i]->counts);
+    }
+
+    qsort(sorted, (size_t)count, sizeof(AllocSite*), byLiveBytes);
+    fprintf(stderr, "\nstill live: %zu blocks, %zu bytes\n", total.liveBlocks, total.liveBytes);
+    for(int i = 0; i < count && sorted[i]->counts.liveBlocks > 0; i++){
+        fprintf(stderr, "  %-24s %10zu blocks %12zu bytes\n", siteName(sorted[i]->name),
+                sorted[i]->counts.liveBlocks, sorted[i]->counts.liveBytes);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,125 @@
+#ifndef LISP_LITE_ALLOC_H
+#define LISP_LITE_ALLOC_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Every allocation the interpreter makes goes through these macros, which
+ * pass their call site along as "file.c:line".
+ *
+ * Normally they are the C library's malloc, calloc, realloc, strdup and
+ * free. After allocTrackingEnable() each block carries a small header
+ * recording its size, call site and the phase (lexing, parsing, evaluation,
+ * ...) it was allocated in, and live and peak bytes and block counts are
+ * kept per site and per phase. allocReport() prints them with a list of the
+ * sites still holding blocks, and tracking prints it at exit.
+ *
+ * Tracking has to be enabled before anything is allocated, since a block
+ * without a header cannot be freed through a tracking memFree, and cannot
+ * be turned off again.
+ *
+ * An arena owns every block a thread allocates while it is in use
+ * (allocArenaUse), and allocArenaFree frees whatever of those is still
+ * live. Arena blocks are linked through the same header, so the first
+ * allocArenaCreate switches headers on and has the same condition as
+ * tracking: embedding contexts (lisp.h) come before anything else, and
+ * --serve and --each-line, which run requests and records in arenas, call
+ * allocHeadersEnable() first thing. Structures a thread keeps across arenas
+ * are allocated with no arena in use, or moved out of one that is about to
+ * be freed with allocArenaTake. Blocks remember their arena, so any thread
+ * may free or resize them.
+ *
+ * The current phase and arena are per thread; new threads start in
+ * ALLOC_EVAL, with no arena.
+ */
+
+typedef enum {
+    ALLOC_STARTUP,
+    ALLOC_LEX,
+    ALLOC_PARSE,
+    ALLOC_ANALYZE,     // resolving names, effect analysis, marking for the JIT
+    ALLOC_EVAL,
+    ALLOC_CODEGEN,     // --emit-c and the LKS-8 backend
+    ALLOC_PHASES
+} AllocPhase;
+
+#define ALLOC_STRINGIFY(x) #x
+#define ALLOC_LINE(x) ALLOC_STRINGIFY(x)
+#define ALLOC_SITE __FILE__ ":" ALLOC_LINE(__LINE__)
+
+#define memAlloc(size) memAllocAt((size), ALLOC_SITE)
+#define memCalloc(count, size) memCallocAt((count), (size), ALLOC_SITE)
+#define memRealloc(block, size) memReallocAt((block), (size), ALLOC_SITE)
+#define memStrdup(s) memStrdupAt((s), ALLOC_SITE)
+#define memFree(block) memFreeAt(block)
+
+typedef struct AllocArena AllocArena;
+
+extern int allocTracking;
+// Tracking or an arena: every block has a header
+extern int allocHeaders;
+
+void* trackedAlloc(size_t size, int zero, const char* site);
+
+void* trackedRealloc(void* block, size_t size, const char* site);
+
+void trackedFree(void* block);
+
+void allocTrackingEnable(void);
+
+void allocHeadersEnable(void);
+
+AllocPhase allocPhase(AllocPhase phase);
+
+void allocReport(void);
+
+AllocArena* allocArenaCreate(void);
+
+AllocArena* allocArenaUse(AllocArena* arena);
+
+uint64_t allocArenaId(void);
+
+int allocArenaTake(void* block);
+
+size_t allocArenaBytes(AllocArena* arena);
+
+void allocArenaFree(AllocArena* arena);
+
+static inline void* memAllocAt(size_t size, const char* site){
+    return allocHeaders ? trackedAlloc(size, 0, site) : malloc(size);
+}
+
+static inline void* memCallocAt(size_t count, size_t size, const char* site){
+    if(!allocHeaders){
+        return calloc(count, size);
+    }
+    if(size != 0 && count > SIZE_MAX / size){
+        return NULL;
+    }
+    return trackedAlloc(count * size, 1, site);
+}
+
+static inline void* memReallocAt(void* block, size_t size, const char* site){
+    return allocHeaders ? trackedRealloc(block, size, site) : realloc(block, size);
+}
+
+static inline char* memStrdupAt(const char* s, const char* site){
+    if(!allocHeaders){
+        return strdup(s);
+    }
+    size_t length = strlen(s) + 1;
+    char* copy = (char*)trackedAlloc(length, 0, site);
+    memcpy(copy, s, length);
+    return copy;
+}
+
+static inline void memFreeAt(void* block){
+    if(allocHeaders){
+        trackedFree(block);
+    }else{
+        free(block);
+    }
+}
+
+#endif //LISP_LITE_ALLOC_H
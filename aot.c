@@ -0,0 +1,944 @@
+#include "aot.h"
+#include "bigint.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+static void append(Text* text, const char* format, ...){
+    va_list args;
+    for(;;){
+        size_t room = text->capacity - text->length;
+        va_start(args, format);
+        int needed = vsnprintf(text->data ? text->data + text->length : NULL, room, format, args);
+        va_end(args);
+        if((size_t)needed < room){
+            text->length += (size_t)needed;
+            return;
+        }
+        size_t capacity = text->capacity ? text->capacity : 1024;
+        while(capacity - text->length <= (size_t)needed){
+            capacity *= 2;
+        }
+        text->data = (char*)memRealloc(text->data, capacity);
+        text->capacity = capacity;
+    }
+}
+
+/*
+ * How an expression's value is held in the generated C: a boxed Value, or
+ * an unboxed long long or double when its type is known statically.
+ */
+typedef enum {
+    KIND_VALUE,
+    KIND_INT,
+    KIND_FLOAT
+} Kind;
+
+typedef struct {
+    Kind kind;
+    // A C expression without side effects: a local, a literal or a
+    // conversion of one, so short; the buffers built from two of them are
+    // sized to fit
+    char code[96];
+} Operand;
+
+typedef struct {
+    Node** lambdas;
+    int lambdaCount;
+    char** globals;
+    int* defCount;
+    int* directLambda;  // per global: the lambda it is always bound to, or -1
+    int globalCount;
+    Node** literals;    // string and bignum literals
+    int literalCount;
+    Text declarations;
+    Text functions;
+} Program;
+
+typedef struct {
+    Program* program;
+    Text* body;
+    int lambda;     // the lambda being compiled, -1 at the top level
+    int temps;
+    int depth;
+    int loops;      // whether a self tail call jumps back to the top
+} Function;
+
+static int lambdaIndex(Program* program, Node* node){
+    for(int i = 0; i < program->lambdaCount; i++){
+        if(program->lambdas[i] == node) return i;
+    }
+    return -1;
+}
+
+static int globalIndex(Program* program, const char* name){
+    for(int i = 0; i < program->globalCount; i++){
+        if(strcmp(program->globals[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+static int literalIndex(Program* program, Node* node){
+    for(int i = 0; i < program->literalCount; i++){
+        if(program->literals[i] == node) return i;
+    }
+    return -1;
+}
+
+static void addGlobal(Program* program, const char* name){
+    if(globalIndex(program, name) >= 0){
+        return;
+    }
+    int n = program->globalCount++;
+    program->globals = (char**)memRealloc(program->globals, sizeof(char*) * (size_t)(n + 1));
+    program->defCount = (int*)memRealloc(program->defCount, sizeof(int) * (size_t)(n + 1));
+    program->directLambda = (int*)memRealloc(program->directLambda, sizeof(int) * (size_t)(n + 1));
+    program->globals[n] = (char*)name;
+    program->defCount[n] = 0;
+    program->directLambda[n] = -1;
+}
+
+/**
+ * @brief Number the lambdas, globals and literals a subtree uses
+ */
+static void collect(Program* program, Node* node){
+    for(; node != NULL; node = node->nextNode){
+        switch(node->type){
+            case NODE_LAMBDA:
+                program->lambdas = (Node**)memRealloc(program->lambdas, sizeof(Node*) * (size_t)(program->lambdaCount + 1));
+                program->lambdas[program->lambdaCount++] = node;
+                break;
+            case NODE_VARIABLE:
+                addGlobal(program, node->val.strValue);
+                break;
+            case NODE_STRING_LITERAL:
+            case NODE_BIGINT:
+                program->literals = (Node**)memRealloc(program->literals, sizeof(Node*) * (size_t)(program->literalCount + 1));
+                program->literals[program->literalCount++] = node;
+                break;
+            case NODE_OPERATOR:
+                if(node->val.op == DEF && node->childNode != NULL && node->childNode->type == NODE_VARIABLE){
+                    addGlobal(program, node->childNode->val.strValue);
+                    program->defCount[globalIndex(program, node->childNode->val.strValue)]++;
+                }
+                break;
+            default:
+                break;
+        }
+        collect(program, node->childNode);
+    }
+}
+
+/**
+ * @brief Find globals that can be called directly: those defined exactly
+ *        once, by a top-level def of a lambda
+ */
+static void findDirectCalls(Program* program, Node* root){
+    for(Node* form = root->childNode; form != NULL; form = form->nextNode){
+        if(form->type != NODE_OPERATOR || form->val.op != DEF){
+            continue;
+        }
+        Node* name = form->childNode;
+        if(name == NULL || name->type != NODE_VARIABLE || name->nextNode == NULL || name->nextNode->type != NODE_LAMBDA){
+            continue;
+        }
+        int global = globalIndex(program, name->val.strValue);
+        if(program->defCount[global] == 1){
+            program->directLambda[global] = lambdaIndex(program, name->nextNode);
+        }
+    }
+}
+
+static void cString(Text* text, const char* s){
+    append(text, "\"");
+    for(; *s; s++){
+        unsigned char c = (unsigned char)*s;
+        if(c == '"' || c == '\\'){
+            append(text, "\\%c", c);
+        }else if(c < 32 || c > 126){
+            append(text, "\\%03o", c);
+        }else{
+            append(text, "%c", c);
+        }
+    }
+    append(text, "\"");
+}
+
+static void line(Function* fn, const char* format, ...){
+    for(int i = 0; i < fn->depth; i++){
+        append(fn->body, "    ");
+    }
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    char* buffer = (char*)memAlloc((size_t)length + 1);
+    va_start(args, format);
+    vsnprintf(buffer, (size_t)length + 1, format, args);
+    va_end(args);
+    append(fn->body, "%s\n", buffer);
+    memFree(buffer);
+}
+
+static Operand operand(Kind kind, const char* format, ...){
+    Operand op;
+    op.kind = kind;
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(op.code, sizeof(op.code), format, args);
+    va_end(args);
+    // Cut short, it would still compile, to something else
+    if(length < 0 || (size_t)length >= sizeof(op.code)){
+        fatalError(ERROR_UNSUPPORTED, "Error: --emit-c cannot hold an operand of %d characters\n", length);
+    }
+    return op;
+}
+
+static const char* cType(Kind kind){
+    switch(kind){
+        case KIND_INT: return "long long";
+        case KIND_FLOAT: return "double";
+        default: return "Value";
+    }
+}
+
+/**
+ * @brief Evaluate `expression` into a fresh local, fixing when it runs
+ */
+static Operand bind(Function* fn, Kind kind, const char* expression){
+    int temp = fn->temps++;
+    line(fn, "%s t%d = %s;", cType(kind), temp, expression);
+    return operand(kind, "t%d", temp);
+}
+
+static Operand boxed(Operand op){
+    switch(op.kind){
+        case KIND_INT: return operand(KIND_VALUE, "rtInt(%s)", op.code);
+        case KIND_FLOAT: return operand(KIND_VALUE, "rtFloat(%s)", op.code);
+        default: return op;
+    }
+}
+
+static Operand asDouble(Operand op){
+    return op.kind == KIND_INT ? operand(KIND_FLOAT, "(double)%s", op.code) : op;
+}
+
+static int countChildren(Node* node){
+    int count = 0;
+    for(Node* child = node->childNode; child != NULL; child = child->nextNode){
+        count++;
+    }
+    return count;
+}
+
+static Node* lastChild(Node* node){
+    Node* child = node->childNode;
+    while(child != NULL && child->nextNode != NULL){
+        child = child->nextNode;
+    }
+    return child;
+}
+
+static int isNumberKind(Kind kind){
+    return kind == KIND_INT || kind == KIND_FLOAT;
+}
+
+/**
+ * @brief The kind emitExpression will produce for a node
+ */
+static Kind kindOf(Node* node){
+    if(node == NULL){
+        return KIND_INT;
+    }
+    switch(node->type){
+        case NODE_VALUE: return KIND_INT;
+        case NODE_FLOAT: return KIND_FLOAT;
+        case NODE_OPERATOR: break;
+        default: return KIND_VALUE;
+    }
+
+    Node* first = node->childNode;
+    switch(node->val.op){
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV: {
+            // Integer results stay boxed even from unboxed operands, since
+            // they become bignums on overflow; rtArith checks for that inline
+            if(countChildren(node) != 2) return KIND_VALUE;
+            Kind a = kindOf(first), b = kindOf(first->nextNode);
+            return isNumberKind(a) && isNumberKind(b) && (a == KIND_FLOAT || b == KIND_FLOAT) ? KIND_FLOAT : KIND_VALUE;
+        }
+        case GT:
+        case LT:
+        case EQ:
+        case GTE:
+        case LTE:
+        case AND:
+        case OR:
+        case NOT:
+        case PRINT:
+            return KIND_INT;
+        case IF: {
+            if(countChildren(node) < 3) return KIND_INT;
+            Kind a = kindOf(first->nextNode), b = kindOf(first->nextNode->nextNode);
+            return a == b ? a : KIND_VALUE;
+        }
+        case SEQ:
+            return first == NULL ? KIND_INT : kindOf(lastChild(node));
+        case DEF:
+            if(first == NULL || first->type != NODE_VARIABLE || first->nextNode == NULL) return KIND_INT;
+            return kindOf(first->nextNode);
+        case INPUT:
+        case READ_ALL:
+        case READ_N:
+        case READ_LINES:
+        case CALL:
+        case VEC:
+        case MAKE_VEC:
+        case VEC_RANGE:
+        case VEC_REF:
+        case VEC_LEN:
+        case VEC_ADD:
+        case VEC_SUB:
+        case VEC_MUL:
+        case VEC_DIV:
+        case VEC_SUM:
+        case VEC_MIN:
+        case VEC_MAX:
+        case VEC_DOT:
+        case VEC_LT:
+        case VEC_GT:
+        case VEC_EQ:
+        case MAP:
+        case MAP_GET:
+        case MAP_PUT:
+        case MAP_DEL:
+        case MAP_HAS:
+        case MAP_SIZE:
+        case LENGTH:
+        case SUBSTRING:
+        case INDEX_OF:
+        case CONTAINS:
+        case STARTS_WITH:
+        case SPLIT:
+        case JOIN:
+        case REPLACE:
+        case UPPER:
+        case LOWER:
+        case RE_MATCH:
+        case RE_FIND:
+        case RE_REPLACE:
+        case LIST:
+        case CONS:
+        case CAR:
+        case CDR:
+        case NTH:
+        case APPEND:
+        case REVERSE:
+            return KIND_VALUE;
+        default:
+            return KIND_INT;
+    }
+}
+
+static Operand emitExpression(Function* fn, Node* node);
+
+static void emitReturn(Function* fn, Node* node);
+
+static Operand fail(Function* fn, const char* code, const char* message){
+    line(fn, "fatalError(%s, \"%s\\n\");", code, message);
+    return operand(KIND_INT, "0LL");
+}
+
+// A value needed for its side effects only
+static void emitEffect(Function* fn, Node* node){
+    Operand op = emitExpression(fn, node);
+    if(op.code[0] == 't'){
+        line(fn, "(void)%s;", op.code);
+    }
+}
+
+/**
+ * @brief Evaluate arguments in order into a Value array
+ * @return The array's name, or NULL when there are none
+ */
+static const char* emitArguments(Function* fn, Node* first, int* argc, char* name){
+    Operand values[64];
+    Operand* args = values;
+    int count = 0;
+    for(Node* n = first; n != NULL; n = n->nextNode){
+        count++;
+    }
+    if(count > 64){
+        args = (Operand*)memAlloc(sizeof(Operand) * (size_t)count);
+    }
+    int i = 0;
+    for(Node* n = first; n != NULL; n = n->nextNode){
+        args[i++] = boxed(emitExpression(fn, n));
+    }
+    *argc = count;
+    if(count == 0){
+        return NULL;
+    }
+
+    int temp = fn->temps++;
+    for(int d = 0; d < fn->depth; d++){
+        append(fn->body, "    ");
+    }
+    append(fn->body, "Value t%d[] = {", temp);
+    for(i = 0; i < count; i++){
+        append(fn->body, "%s%s", i > 0 ? ", " : "", args[i].code);
+    }
+    append(fn->body, "};\n");
+    if(args != values){
+        memFree(args);
+    }
+    sprintf(name, "t%d", temp);
+    return name;
+}
+
+static const char* operatorName(enum operators op){
+    // The enumerator, as the generated code spells it
+    switch(op){
+        case ADD: return "ADD";
+        case SUB: return "SUB";
+        case MUL: return "MUL";
+        case DIV: return "DIV";
+        case GT: return "GT";
+        case LT: return "LT";
+        case EQ: return "EQ";
+        case GTE: return "GTE";
+        case LTE: return "LTE";
+        case AND: return "AND";
+        case OR: return "OR";
+        default: return getOperatorSymbol(op);
+    }
+}
+
+static Operand emitBuiltin(Function* fn, Node* node, Kind kind){
+    char array[32];
+    int argc;
+    const char* args = emitArguments(fn, node->childNode, &argc, array);
+    char call[160];
+    snprintf(call, sizeof(call), "applyBuiltin(%s, %s, %d)%s", operatorName(node->val.op),
+             args != NULL ? args : "NULL", argc, kind == KIND_INT ? ".intValue" : "");
+    return bind(fn, kind, call);
+}
+
+static Operand emitArithmetic(Function* fn, Node* node){
+    if(countChildren(node) != 2){
+        return emitBuiltin(fn, node, KIND_VALUE);
+    }
+    enum operators op = node->val.op;
+    Operand a = emitExpression(fn, node->childNode);
+    Operand b = emitExpression(fn, node->childNode->nextNode);
+    char expression[256];
+
+    if(kindOf(node) == KIND_FLOAT){
+        // The interpreter folds + from an integer 0, and 0 + x is not
+        // always x for floats (-0.0), so keep its order of operations
+        Operand x = asDouble(a), y = asDouble(b);
+        switch(op){
+            case ADD:
+                if(a.kind == KIND_FLOAT){
+                    snprintf(expression, sizeof(expression), "(0.0 + %s) + %s", x.code, y.code);
+                }else{
+                    snprintf(expression, sizeof(expression), "%s + %s", x.code, y.code);
+                }
+                break;
+            case SUB: snprintf(expression, sizeof(expression), "%s - %s", x.code, y.code); break;
+            case MUL: snprintf(expression, sizeof(expression), "%s * %s", x.code, y.code); break;
+            default: snprintf(expression, sizeof(expression), "%s / %s", x.code, y.code); break;
+        }
+        return bind(fn, KIND_FLOAT, expression);
+    }
+
+    snprintf(expression, sizeof(expression), "rtArith(%s, %s, %s)", operatorName(op), boxed(a).code, boxed(b).code);
+    return bind(fn, KIND_VALUE, expression);
+}
+
+static Operand emitComparison(Function* fn, Node* node){
+    if(countChildren(node) != 2){
+        return emitBuiltin(fn, node, KIND_INT);
+    }
+    enum operators op = node->val.op;
+    Operand a = emitExpression(fn, node->childNode);
+    Operand b = emitExpression(fn, node->childNode->nextNode);
+    char expression[256];
+    const char* symbol = NULL;
+    switch(op){
+        case GT: symbol = ">"; break;
+        case LT: symbol = "<"; break;
+        case EQ: symbol = "=="; break;
+        case GTE: symbol = ">="; break;
+        case LTE: symbol = "<="; break;
+        case AND: symbol = "&&"; break;
+        default: symbol = "||"; break;
+    }
+
+    int logical = op == AND || op == OR;
+    if(a.kind == KIND_INT && b.kind == KIND_INT){
+        snprintf(expression, sizeof(expression), "%s %s %s", a.code, symbol, b.code);
+    }else if(!logical && isNumberKind(a.kind) && isNumberKind(b.kind)){
+        snprintf(expression, sizeof(expression), "%s %s %s", asDouble(a).code, symbol, asDouble(b).code);
+    }else{
+        snprintf(expression, sizeof(expression), "rtCompare(%s, %s, %s)", operatorName(op), boxed(a).code, boxed(b).code);
+    }
+    return bind(fn, KIND_INT, expression);
+}
+
+// Truthiness as IF sees it: the integer view of whatever the value holds
+static Operand condition(Operand op){
+    switch(op.kind){
+        case KIND_INT: return op;
+        case KIND_FLOAT: return operand(KIND_INT, "rtFloat(%s).intValue", op.code);
+        default: return operand(KIND_INT, "%s.intValue", op.code);
+    }
+}
+
+static Operand convert(Operand op, Kind kind){
+    return op.kind == kind ? op : boxed(op);
+}
+
+static Operand emitIf(Function* fn, Node* node){
+    if(countChildren(node) < 3){
+        return fail(fn, "ERROR_ARITY", "Error: Expected three arguments for IF");
+    }
+    Kind kind = kindOf(node);
+    Operand test = condition(emitExpression(fn, node->childNode));
+    int temp = fn->temps++;
+    line(fn, "%s t%d;", cType(kind), temp);
+    line(fn, "if(%s){", test.code);
+    fn->depth++;
+    line(fn, "t%d = %s;", temp, convert(emitExpression(fn, node->childNode->nextNode), kind).code);
+    fn->depth--;
+    line(fn, "}else{");
+    fn->depth++;
+    line(fn, "t%d = %s;", temp, convert(emitExpression(fn, node->childNode->nextNode->nextNode), kind).code);
+    fn->depth--;
+    line(fn, "}");
+    return operand(kind, "t%d", temp);
+}
+
+static Operand emitCall(Function* fn, Node* node){
+    Node* head = node->childNode;
+    Program* program = fn->program;
+    char array[32];
+    int argc;
+
+    int global = head->type == NODE_VARIABLE ? globalIndex(program, head->val.strValue) : -1;
+    int target = global >= 0 ? program->directLambda[global] : -1;
+    if(target >= 0){
+        Lambda* lambda = program->lambdas[target]->val.lambda;
+        Text name = {NULL, 0, 0};
+        cString(&name, head->val.strValue);
+        line(fn, "if(!g%d_set) rtUnbound(%s);", global, name.data);
+        memFree(name.data);
+
+        argc = countChildren(node) - 1;
+        if(argc != lambda->paramCount){
+            if(emitArguments(fn, head->nextNode, &argc, array) != NULL){
+                line(fn, "(void)%s;", array);
+            }
+            line(fn, "fatalError(ERROR_ARITY, \"Error: Expected %%d arguments, got %%d\\n\", %d, %d);", lambda->paramCount, argc);
+            return operand(KIND_VALUE, "rtInt(0)");
+        }
+        Text call = {NULL, 0, 0};
+        append(&call, "lambda%d(NULL", target);
+        for(Node* n = head->nextNode; n != NULL; n = n->nextNode){
+            append(&call, ", %s", boxed(emitExpression(fn, n)).code);
+        }
+        append(&call, ")");
+        Operand result = bind(fn, KIND_VALUE, call.data);
+        memFree(call.data);
+        return result;
+    }
+
+    Operand callee = emitExpression(fn, head);
+    line(fn, "rtCallable(%s);", boxed(callee).code);
+    const char* args = emitArguments(fn, head->nextNode, &argc, array);
+    char call[160];
+    snprintf(call, sizeof(call), "rtCall(%s, %s, %d)", boxed(callee).code, args != NULL ? args : "NULL", argc);
+    return bind(fn, KIND_VALUE, call);
+}
+
+static Operand emitOperator(Function* fn, Node* node){
+    Program* program = fn->program;
+    Node* first = node->childNode;
+    switch(node->val.op){
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+            return emitArithmetic(fn, node);
+        case GT:
+        case LT:
+        case EQ:
+        case GTE:
+        case LTE:
+        case AND:
+        case OR:
+            return emitComparison(fn, node);
+        case NOT: {
+            if(first == NULL){
+                return fail(fn, "ERROR_ARITY", "Error: Expected one argument for NOT");
+            }
+            Operand value = emitExpression(fn, first);
+            char expression[128];
+            if(value.kind == KIND_INT){
+                snprintf(expression, sizeof(expression), "!%s", value.code);
+            }else{
+                snprintf(expression, sizeof(expression), "rtNot(%s)", boxed(value).code);
+            }
+            return bind(fn, KIND_INT, expression);
+        }
+        case IF:
+            return emitIf(fn, node);
+        case SEQ:
+            if(first == NULL){
+                return operand(KIND_INT, "0LL");
+            }
+            for(; first->nextNode != NULL; first = first->nextNode){
+                emitEffect(fn, first);
+            }
+            return emitExpression(fn, first);
+        case DEF: {
+            if(first == NULL || first->type != NODE_VARIABLE){
+                return fail(fn, "ERROR_SYNTAX", "Error: Expected variable name");
+            }
+            if(first->nextNode == NULL){
+                return fail(fn, "ERROR_SYNTAX", "Error: Expected expression");
+            }
+            int global = globalIndex(program, first->val.strValue);
+            Operand value = emitExpression(fn, first->nextNode);
+            line(fn, "g%d = %s;", global, boxed(value).code);
+            line(fn, "g%d_set = 1;", global);
+            return value;
+        }
+        case PRINT:
+            for(; first != NULL; first = first->nextNode){
+                Operand value = emitExpression(fn, first);
+                if(value.kind == KIND_INT){
+                    line(fn, "outputInt(%s);", value.code);
+                }else{
+                    line(fn, "printValue(%s);", boxed(value).code);
+                }
+                line(fn, "outputChar('\\n');");
+            }
+            return operand(KIND_INT, "0LL");
+        case INPUT:
+            return bind(fn, KIND_VALUE, "rtInput()");
+        case READ_ALL:
+            return bind(fn, KIND_VALUE, "rtReadAll()");
+        case READ_N:
+        case READ_LINES: {
+            char expression[128];
+            Operand value = boxed(emitExpression(fn, first));
+            snprintf(expression, sizeof(expression), "%s(%s)", node->val.op == READ_N ? "rtReadN" : "rtReadLines", value.code);
+            return bind(fn, KIND_VALUE, expression);
+        }
+        case CALL:
+            return emitCall(fn, node);
+        case VEC:
+        case MAKE_VEC:
+        case VEC_RANGE:
+        case VEC_REF:
+        case VEC_LEN:
+        case VEC_ADD:
+        case VEC_SUB:
+        case VEC_MUL:
+        case VEC_DIV:
+        case VEC_SUM:
+        case VEC_MIN:
+        case VEC_MAX:
+        case VEC_DOT:
+        case VEC_LT:
+        case VEC_GT:
+        case VEC_EQ:
+        case MAP:
+        case MAP_GET:
+        case MAP_PUT:
+        case MAP_DEL:
+        case MAP_HAS:
+        case MAP_SIZE:
+        case LENGTH:
+        case SUBSTRING:
+        case INDEX_OF:
+        case CONTAINS:
+        case STARTS_WITH:
+        case SPLIT:
+        case JOIN:
+        case REPLACE:
+        case UPPER:
+        case LOWER:
+        case RE_MATCH:
+        case RE_FIND:
+        case RE_REPLACE:
+        case LIST:
+        case CONS:
+        case CAR:
+        case CDR:
+        case NTH:
+        case APPEND:
+        case REVERSE:
+            return emitBuiltin(fn, node, KIND_VALUE);
+        default:
+            return operand(KIND_INT, "0LL");
+    }
+}
+
+static Operand emitClosure(Function* fn, Node* node){
+    Lambda* lambda = node->val.lambda;
+    int index = lambdaIndex(fn->program, node);
+    Text expression = {NULL, 0, 0};
+    append(&expression, "rtClosure(lambda%d_entry, %d, %d, ", index, lambda->paramCount, lambda->captureCount);
+    if(lambda->captureCount == 0){
+        append(&expression, "NULL)");
+    }else{
+        append(&expression, "(const Value[]){");
+        for(int i = 0; i < lambda->captureCount; i++){
+            Capture* capture = &lambda->captures[i];
+            append(&expression, capture->fromClosure ? "%scaptured[%d]" : "%sp%d", i > 0 ? ", " : "", capture->slot);
+        }
+        append(&expression, "})");
+    }
+    Operand result = bind(fn, KIND_VALUE, expression.data);
+    memFree(expression.data);
+    return result;
+}
+
+/**
+ * @brief Emit the statements that evaluate a node
+ * @return Where its value ends up
+ */
+static Operand emitExpression(Function* fn, Node* node){
+    Program* program = fn->program;
+    if(node == NULL){
+        return operand(KIND_INT, "0LL");
+    }
+    switch(node->type){
+        case NODE_VALUE:
+            return operand(KIND_INT, "%lldLL", node->val.value);
+        case NODE_FLOAT:
+            if(isinf(node->val.number)){
+                return operand(KIND_FLOAT, "HUGE_VAL");
+            }
+            return operand(KIND_FLOAT, "%a", node->val.number);
+        case NODE_BIGINT:
+            return operand(KIND_VALUE, "rtBig(big%d)", literalIndex(program, node));
+        case NODE_STRING_LITERAL:
+            return operand(KIND_VALUE, "rtString(&str%d)", literalIndex(program, node));
+        case NODE_VARIABLE: {
+            int global = globalIndex(program, node->val.strValue);
+            Text expression = {NULL, 0, 0};
+            append(&expression, "g%d_set ? g%d : rtUnbound(", global, global);
+            cString(&expression, node->val.strValue);
+            append(&expression, ")");
+            // A later def may change the global, so read it now
+            Operand result = bind(fn, KIND_VALUE, expression.data);
+            memFree(expression.data);
+            return result;
+        }
+        case NODE_LOCAL:
+            return operand(KIND_VALUE, "p%d", node->slot);
+        case NODE_CAPTURED:
+            return operand(KIND_VALUE, "captured[%d]", node->slot);
+        case NODE_LAMBDA:
+            return emitClosure(fn, node);
+        default:
+            return emitOperator(fn, node);
+    }
+}
+
+/**
+ * @brief Emit a node in tail position, returning its value
+ */
+static void emitReturn(Function* fn, Node* node){
+    if(node != NULL && node->type == NODE_OPERATOR){
+        Node* first = node->childNode;
+        switch(node->val.op){
+            case IF:
+                if(countChildren(node) >= 3){
+                    Operand test = condition(emitExpression(fn, first));
+                    line(fn, "if(%s){", test.code);
+                    fn->depth++;
+                    emitReturn(fn, first->nextNode);
+                    fn->depth--;
+                    line(fn, "}else{");
+                    fn->depth++;
+                    emitReturn(fn, first->nextNode->nextNode);
+                    fn->depth--;
+                    line(fn, "}");
+                    return;
+                }
+                break;
+            case SEQ:
+                if(first != NULL){
+                    for(; first->nextNode != NULL; first = first->nextNode){
+                        emitEffect(fn, first);
+                    }
+                    emitReturn(fn, first);
+                    return;
+                }
+                break;
+            case CALL: {
+                // A self call in tail position becomes a jump back to the top
+                Program* program = fn->program;
+                int global = first->type == NODE_VARIABLE ? globalIndex(program, first->val.strValue) : -1;
+                if(fn->lambda >= 0 && global >= 0 && program->directLambda[global] == fn->lambda){
+                    Lambda* lambda = program->lambdas[fn->lambda]->val.lambda;
+                    if(countChildren(node) - 1 == lambda->paramCount){
+                        // Running this lambda means its def has happened
+                        // Every argument is evaluated before any parameter changes
+                        int* copies = (int*)memAlloc(sizeof(int) * (size_t)(lambda->paramCount + 1));
+                        int i = 0;
+                        for(Node* n = first->nextNode; n != NULL; n = n->nextNode, i++){
+                            Operand value = boxed(emitExpression(fn, n));
+                            copies[i] = fn->temps++;
+                            line(fn, "Value t%d = %s;", copies[i], value.code);
+                        }
+                        for(i = 0; i < lambda->paramCount; i++){
+                            line(fn, "p%d = t%d;", i, copies[i]);
+                        }
+                        memFree(copies);
+                        line(fn, "goto top;");
+                        fn->loops = 1;
+                        return;
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    line(fn, "return %s;", boxed(emitExpression(fn, node)).code);
+}
+
+static void emitBody(Function* fn, Node* body){
+    if(body == NULL){
+        line(fn, "return rtInt(0);");
+        return;
+    }
+    for(; body->nextNode != NULL; body = body->nextNode){
+        emitEffect(fn, body);
+    }
+    emitReturn(fn, body);
+}
+
+static void emitLambda(Program* program, int index){
+    Lambda* lambda = program->lambdas[index]->val.lambda;
+    Text body = {NULL, 0, 0};
+    Function fn = {program, &body, index, 0, 1, 0};
+    emitBody(&fn, program->lambdas[index]->childNode);
+
+    Text* out = &program->functions;
+    append(out, "static Value lambda%d(const Value* captured", index);
+    for(int i = 0; i < lambda->paramCount; i++){
+        append(out, ", Value p%d", i);
+    }
+    append(out, "){\n");
+    if(fn.loops){
+        append(out, "  top:;\n");
+    }
+    append(out, "%s}\n\n", body.data);
+    memFree(body.data);
+
+    append(out, "static Value lambda%d_entry(const Value* captured, const Value* args){\n", index);
+    append(out, "    return lambda%d(captured", index);
+    for(int i = 0; i < lambda->paramCount; i++){
+        append(out, ", args[%d]", i);
+    }
+    append(out, ");\n}\n\n");
+}
+
+/**
+ * @brief Write a program as C
+ * @param root The tree parse() returned
+ * @param out Where the translation unit goes
+ */
+void emitC(Node* root, FILE* out){
+    Program program;
+    memset(&program, 0, sizeof(program));
+    collect(&program, root);
+    findDirectCalls(&program, root);
+
+    Text* decl = &program.declarations;
+    append(decl, "// Generated by LISP_LITE --emit-c\n");
+    append(decl, "#include \"runtime.h\"\n#include <math.h>\n\n");
+    for(int i = 0; i < program.globalCount; i++){
+        append(decl, "static Value g%d; // ", i);
+        append(decl, "%s\n", program.globals[i]);
+        append(decl, "static int g%d_set;\n", i);
+    }
+    for(int i = 0; i < program.literalCount; i++){
+        Node* literal = program.literals[i];
+        if(literal->type == NODE_STRING_LITERAL){
+            const String* string = literal->val.string;
+            append(decl, "static char str%d_bytes[] = ", i);
+            cString(decl, string->data);
+            append(decl, ";\nstatic String str%d = {str%d_bytes, %zu, %zu, %d};\n",
+                   i, i, string->length, string->codePoints, string->ascii);
+        }else{
+            append(decl, "static BigInt* big%d;\n", i);
+        }
+    }
+    append(decl, "\n");
+    for(int i = 0; i < program.lambdaCount; i++){
+        Lambda* lambda = program.lambdas[i]->val.lambda;
+        append(decl, "static Value lambda%d(const Value* captured", i);
+        for(int p = 0; p < lambda->paramCount; p++){
+            append(decl, ", Value p%d", p);
+        }
+        append(decl, ");\n");
+        append(decl, "static Value lambda%d_entry(const Value* captured, const Value* args);\n", i);
+    }
+    append(decl, "\n");
+
+    for(int i = 0; i < program.lambdaCount; i++){
+        emitLambda(&program, i);
+    }
+
+    Text body = {NULL, 0, 0};
+    Function top = {&program, &body, -1, 0, 1, 0};
+    emitBody(&top, root->childNode);
+    append(&program.functions, "static Value program(void){\n%s}\n\n", body.data);
+    memFree(body.data);
+
+    Text* main = &program.functions;
+    append(main, "int main(void){\n");
+    for(int i = 0; i < program.literalCount; i++){
+        if(program.literals[i]->type == NODE_BIGINT){
+            char* digits = bigToString(program.literals[i]->val.big);
+            append(main, "    big%d = bigFromString(\"%s\");\n", i, digits);
+            memFree(digits);
+        }
+    }
+    append(main, "    outputInit(0);\n");
+    append(main, "    Value result = program();\n");
+    append(main, "    outputString(\"Result: \");\n");
+    append(main, "    printValue(result);\n");
+    append(main, "    outputChar('\\n');\n");
+    append(main, "    outputFlush();\n");
+    append(main, "    return 0;\n}\n");
+
+    fwrite(decl->data, 1, decl->length, out);
+    fwrite(program.functions.data, 1, program.functions.length, out);
+
+    memFree(decl->data);
+    memFree(program.functions.data);
+    memFree(program.lambdas);
+    memFree(program.globals);
+    memFree(program.defCount);
+    memFree(program.directLambda);
+    memFree(program.literals);
+}
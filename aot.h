@@ -0,0 +1,20 @@
+#ifndef LISP_LITE_AOT_H
+#define LISP_LITE_AOT_H
+#include "library.h"
+#include <stdio.h>
+
+/*
+ * --emit-c: translate a parsed program into one C translation unit that
+ * includes runtime.h and links against liblisp_lite. Globals become C
+ * statics, lambda parameters C parameters, and a global bound once at the
+ * top level to a lambda is called directly, with self tail calls turned
+ * into loops. Expressions whose type is known statically (comparisons,
+ * integer literals, float arithmetic) are kept unboxed in C locals.
+ * Integer + - * and / are not among them: any of them can overflow into a
+ * bignum, so they produce a boxed Value through the inline rtArith, whose
+ * checked fast path the C compiler sees through for unboxed operands.
+ */
+
+void emitC(Node* root, FILE* out);
+
+#endif //LISP_LITE_AOT_H
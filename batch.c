@@ -0,0 +1,409 @@
+#include "batch.h"
+#include "output.h"
+#include "input.h"
+#include "latency.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static void printStats(const LatencyStats* stats, unsigned long long failed, double wallSeconds, int jobs){
+    fprintf(stderr, "records:      %llu\n", stats->count);
+    fprintf(stderr, "failed:       %llu\n", failed);
+    fprintf(stderr, "jobs:         %d\n", jobs);
+    fprintf(stderr, "wall time:    %.3f s\n", wallSeconds);
+    if(stats->count == 0){
+        return;
+    }
+    fprintf(stderr, "records/s:    %.0f\n", (double)stats->count / wallSeconds);
+    fprintf(stderr, "latency mean: %.0f ns\n", stats->totalSeconds * 1e9 / (double)stats->count);
+    fprintf(stderr, "latency min:  %llu ns\n", stats->minNs);
+    fprintf(stderr, "latency p50:  %llu ns\n", latencyPercentile(stats, 0.50));
+    fprintf(stderr, "latency p99:  %llu ns\n", latencyPercentile(stats, 0.99));
+    fprintf(stderr, "latency max:  %llu ns\n", stats->maxNs);
+}
+
+// What a thread's records allocate before the values they kept are moved out
+#define RECORD_ARENA_BYTES (4 * 1024 * 1024)
+
+/*
+ * Where one thread's records allocate (alloc.h). Globals carry values from
+ * one record to the next, and nothing says which a record has dropped, so
+ * records share an arena until it holds RECORD_ARENA_BYTES and twice what
+ * was kept last time. Then the environment, and whatever it reaches, is
+ * moved to a fresh arena and both old ones are freed. With --reset-env
+ * there is nothing to keep.
+ */
+typedef struct {
+    AllocArena* records;
+    AllocArena* kept;       // the environment as of the last collection
+} RecordHeap;
+
+static AllocArena* createArena(void){
+    AllocArena* arena = allocArenaCreate();
+    if(arena == NULL){
+        fatalError(ERROR_RESOURCE, "Error: Out of memory starting a record\n");
+    }
+    return arena;
+}
+
+static void recordHeapInit(RecordHeap* heap){
+    heap->records = createArena();
+    heap->kept = createArena();
+}
+
+/**
+ * @brief Free a thread's environment and everything its records made
+ */
+static void recordHeapFree(RecordHeap* heap, EnvEntry* env){
+    env_free(env);
+    allocArenaFree(heap->records);
+    allocArenaFree(heap->kept);
+}
+
+/**
+ * @brief Once the records' arena has grown enough, keep only what the
+ *        environment still reaches
+ */
+static void collectRecords(RecordHeap* heap, EnvEntry* env){
+    size_t used = allocArenaBytes(heap->records);
+    if(used < RECORD_ARENA_BYTES || used < 2 * allocArenaBytes(heap->kept)){
+        return;
+    }
+    AllocArena* kept = createArena();
+    allocArenaUse(kept);
+    env_keep(env);
+    allocArenaUse(NULL);
+    allocArenaFree(heap->records);
+    allocArenaFree(heap->kept);
+    heap->records = createArena();
+    heap->kept = kept;
+    // Remembered results may be values just freed, or match new ones by address
+    forgetSharedResults();
+}
+
+/**
+ * @brief Evaluate the program for one record
+ * @param env The environment of the calling thread
+ * @param heap Where the calling thread's records allocate
+ * @param line The record, which this call takes ownership of
+ * @param number The record's 1-based position in the input
+ * @return 0, or 1 if the record failed
+ *
+ * An error only abandons its own record: it is reported on stderr with the
+ * record's number, and globals defined before it keep their values.
+ */
+static int runRecord(Node* AST, EnvEntry** env, RecordHeap* heap, String* line, long long number,
+                     const EachLineOptions* options, LatencyStats* stats){
+    allocArenaUse(heap->records);
+    if(options->resetEnv){
+        env_free(*env);
+        *env = NULL;
+    }
+    // Read outside the arena; the copy goes with the rest of the record
+    String* record = stringCopy(line->bytes, line->length);
+    stringFree(line);
+    env_set(env, "line", (Value){.type = VAL_STRING, .string = record});
+    env_set(env, "nr", makeIntValue(number));
+
+    int failed = 0;
+    double before = options->showStats ? nowSeconds() : 0;
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) == 0){
+        evaluateTree(AST, env);
+        errorTrapPop(&trap);
+    }else{
+        fprintf(stderr, "%s (record %lld)\n", trap.message, number);
+        resetEvaluator();
+        failed = 1;
+    }
+    if(options->showStats){
+        recordLatency(stats, nowSeconds() - before);
+    }
+
+    allocArenaUse(NULL);
+    collectRecords(heap, *env);
+    return failed;
+}
+
+/**
+ * @brief Read the next record
+ * @param number The record's 1-based position in the input
+ * @return 1 with `*line` set, 0 at end of input, or -1 if the record could
+ *         not be read (it is reported on stderr, like a record that failed)
+ */
+static int readRecord(String** line, long long number){
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) != 0){
+        fprintf(stderr, "%s (record %lld)\n", trap.message, number);
+        return -1;
+    }
+    *line = inputReadLine();
+    errorTrapPop(&trap);
+    return *line != NULL;
+}
+
+static unsigned long long runSerial(Node* AST, const EachLineOptions* options, LatencyStats* stats){
+    EnvEntry* env = NULL;
+    RecordHeap heap;
+    recordHeapInit(&heap);
+    long long number = 0;
+    unsigned long long failed = 0;
+    String* line;
+    int got;
+
+    while((got = readRecord(&line, ++number)) != 0){
+        failed += got < 0 ? 1 : runRecord(AST, &env, &heap, line, number, options, stats);
+    }
+    recordHeapFree(&heap, env);
+    return failed;
+}
+
+/* ------------------------------------------------------------- parallel */
+
+typedef struct Batch {
+    size_t sequence;
+    long long firstRecord;
+    int count;
+    String* lines[BATCH_RECORDS];     // NULL for a record that could not be read
+    char* output;
+    size_t outputLength;
+    struct Batch* next;
+} Batch;
+
+/*
+ * Work queue shared by the main thread and the workers. The main thread
+ * reads batches and writes their output; workers only evaluate.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;  // a batch was queued, or input ran out
+    pthread_cond_t batchDone;  // a worker finished a batch
+    Batch* pending;
+    Batch** pendingTail;
+    Batch* finished;
+    int inputDone;
+    Node* AST;
+    const EachLineOptions* options;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    pthread_t thread;
+    LatencyStats stats;
+    unsigned long long failed;
+} Worker;
+
+static void* workerMain(void* arg){
+    Worker* worker = (Worker*)arg;
+    Pool* pool = worker->pool;
+    EnvEntry* env = NULL;
+    RecordHeap heap;
+    recordHeapInit(&heap);
+
+    // Records come from the main thread; the program must not read stdin
+    inputDeny();
+    outputCapture();
+
+    for(;;){
+        pthread_mutex_lock(&pool->lock);
+        while(pool->pending == NULL && !pool->inputDone){
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        }
+        Batch* batch = pool->pending;
+        if(batch == NULL){
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pool->pending = batch->next;
+        if(pool->pending == NULL){
+            pool->pendingTail = &pool->pending;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        for(int i = 0; i < batch->count; i++){
+            if(batch->lines[i] == NULL){
+                worker->failed++;
+                continue;
+            }
+            worker->failed += runRecord(pool->AST, &env, &heap, batch->lines[i], batch->firstRecord + i,
+                                        pool->options, &worker->stats);
+        }
+        batch->output = outputTakeCaptured(&batch->outputLength);
+
+        pthread_mutex_lock(&pool->lock);
+        batch->next = pool->finished;
+        pool->finished = batch;
+        pthread_cond_signal(&pool->batchDone);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    recordHeapFree(&heap, env);
+    return NULL;
+}
+
+/**
+ * @brief Read up to BATCH_RECORDS lines
+ * @return The batch, or NULL at end of input
+ */
+static Batch* readBatch(size_t sequence, long long firstRecord){
+    Batch* batch = NULL;
+    String* line;
+    int got;
+
+    while((batch == NULL || batch->count < BATCH_RECORDS) &&
+          (got = readRecord(&line, firstRecord + (batch != NULL ? batch->count : 0))) != 0){
+        if(batch == NULL){
+            batch = (Batch*)memAlloc(sizeof(Batch));
+            batch->sequence = sequence;
+            batch->firstRecord = firstRecord;
+            batch->count = 0;
+        }
+        batch->lines[batch->count++] = got > 0 ? line : NULL;
+    }
+    return batch;
+}
+
+static void writeBatch(Batch* batch){
+    if(batch->output != NULL){
+        outputWrite(batch->output, batch->outputLength);
+        memFree(batch->output);
+    }
+    memFree(batch);
+}
+
+/**
+ * @brief Run records on a pool of worker threads
+ *
+ * At most `window` batches are outstanding (queued, running, or finished
+ * but waiting for an earlier one to be written), which bounds memory and,
+ * in ordered mode, lets finished batches be parked in a ring by sequence.
+ */
+static unsigned long long runParallel(Node* AST, const EachLineOptions* options, LatencyStats* stats){
+    Pool pool;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.workReady, NULL);
+    pthread_cond_init(&pool.batchDone, NULL);
+    pool.pending = NULL;
+    pool.pendingTail = &pool.pending;
+    pool.finished = NULL;
+    pool.inputDone = 0;
+    pool.AST = AST;
+    pool.options = options;
+
+    Worker* workers = (Worker*)memCalloc((size_t)options->jobs, sizeof(Worker));
+    for(int i = 0; i < options->jobs; i++){
+        workers[i].pool = &pool;
+        if(pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]) != 0){
+            fatalError(ERROR_RESOURCE, "Error: Could not start worker thread\n");
+        }
+    }
+
+    size_t window = (size_t)options->jobs * 4;
+    Batch** parked = (Batch**)memCalloc(window, sizeof(Batch*));
+    size_t issued = 0;
+    size_t written = 0;
+    long long records = 0;
+
+    for(;;){
+        Batch* batch = readBatch(issued, records + 1);
+
+        pthread_mutex_lock(&pool.lock);
+        if(batch != NULL){
+            batch->next = NULL;
+            *pool.pendingTail = batch;
+            pool.pendingTail = &batch->next;
+            pthread_cond_signal(&pool.workReady);
+            issued++;
+            records += batch->count;
+        }else{
+            pool.inputDone = 1;
+            pthread_cond_broadcast(&pool.workReady);
+        }
+
+        // Write what is ready; block only when the window is full, or at
+        // the end until everything has been written
+        for(;;){
+            Batch* done = pool.finished;
+            pool.finished = NULL;
+            if(done == NULL){
+                int mustWait = batch != NULL ? issued - written >= window : written < issued;
+                if(!mustWait){
+                    break;
+                }
+                pthread_cond_wait(&pool.batchDone, &pool.lock);
+                continue;
+            }
+
+            pthread_mutex_unlock(&pool.lock);
+            while(done != NULL){
+                Batch* next = done->next;
+                if(options->ordered){
+                    parked[done->sequence % window] = done;
+                    Batch* ready;
+                    while((ready = parked[written % window]) != NULL && ready->sequence == written){
+                        parked[written % window] = NULL;
+                        writeBatch(ready);
+                        written++;
+                    }
+                }else{
+                    writeBatch(done);
+                    written++;
+                }
+                done = next;
+            }
+            pthread_mutex_lock(&pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        if(batch == NULL){
+            break;
+        }
+    }
+
+    unsigned long long failed = 0;
+    for(int i = 0; i < options->jobs; i++){
+        pthread_join(workers[i].thread, NULL);
+        mergeStats(stats, &workers[i].stats);
+        failed += workers[i].failed;
+    }
+    memFree(parked);
+    memFree(workers);
+    pthread_cond_destroy(&pool.batchDone);
+    pthread_cond_destroy(&pool.workReady);
+    pthread_mutex_destroy(&pool.lock);
+    return failed;
+}
+
+/**
+ * @brief Run a parsed program once per line of stdin, awk style
+ * @param AST The program, lexed and parsed once up front
+ * @param options Job count, output order, environment reset and stats
+ *
+ * The record is bound to `line` and its 1-based number to `nr`. Globals
+ * defined while handling one record are seen by later records on the same
+ * thread unless resetEnv is set; with several jobs each worker has its own.
+ *
+ * @return The exit status: 0, or 1 if any record failed
+ */
+int runEachLine(Node* AST, const EachLineOptions* options){
+    LatencyStats* stats = (LatencyStats*)memCalloc(1, sizeof(LatencyStats));
+    double started = nowSeconds();
+    unsigned long long failed;
+
+    if(options->jobs > 1){
+        failed = runParallel(AST, options, stats);
+    }else{
+        failed = runSerial(AST, options, stats);
+    }
+
+    outputFlush();
+    if(options->showStats){
+        printStats(stats, failed, nowSeconds() - started, options->jobs);
+    }
+    memFree(stats);
+    return failed > 0;
+}
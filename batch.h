@@ -0,0 +1,25 @@
+#ifndef LISP_LITE_BATCH_H
+#define LISP_LITE_BATCH_H
+#include "library.h"
+
+/*
+ * Per-record execution for --each-line: the program is parsed once and then
+ * evaluated for every line of stdin. With more than one job the records are
+ * cut into batches and handed to a pool of worker threads, which share the
+ * parsed tree but each keep their own environment, value stack, inline
+ * caches and output buffer.
+ */
+
+// Records per batch handed to a worker
+#define BATCH_RECORDS 1024
+
+typedef struct {
+    int jobs;       // worker threads; 1 runs on the main thread
+    int ordered;    // write batch output in input order
+    int resetEnv;   // start every record from an empty environment
+    int showStats;  // report throughput and latency on stderr
+} EachLineOptions;
+
+int runEachLine(Node* AST, const EachLineOptions* options);
+
+#endif //LISP_LITE_BATCH_H
@@ -0,0 +1,5 @@
+(def fact (lambda (n acc)
+  (if (= n 0) acc (fact (- n 1) (* acc n)))))
+(def repeat (lambda (k last)
+  (if (= k 0) last (repeat (- k 1) (fact 1000 1)))))
+(print (repeat 20 0))
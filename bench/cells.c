@@ -0,0 +1,218 @@
+#include "library.h"
+#include "list.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Unrolled lists (list.h) against the textbook layout of one heap cell per
+ * pair. Both build a list of --length integers with cons, walk it with
+ * car and cdr, take its length, index into it, reverse it and append it to
+ * itself; each step is timed separately and the best of --runs runs kept.
+ *
+ * The unrolled side goes through evaluateListOp like the interpreter does,
+ * while the cell side is plain inline C, so the comparison if anything
+ * flatters the cells.
+ */
+
+#define DEFAULT_LENGTH 1000000
+#define DEFAULT_RUNS 3
+#define LENGTH_CALLS 10
+#define NTH_CALLS 100
+
+typedef struct Cell {
+    Value car;
+    struct Cell *cdr;
+} Cell;
+
+typedef enum {
+    STEP_BUILD,
+    STEP_WALK,
+    STEP_LENGTH,
+    STEP_NTH,
+    STEP_REVERSE,
+    STEP_APPEND,
+    STEP_COUNT
+} Step;
+
+static const char* stepNames[STEP_COUNT] = {"build", "walk", "length", "nth", "reverse", "append"};
+
+static double nowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static Cell* cellCons(Value car, Cell* cdr){
+    Cell *cell = (Cell*)memAlloc(sizeof(Cell));
+    if(cell == NULL){
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    cell->car = car;
+    cell->cdr = cdr;
+    return cell;
+}
+
+static size_t cellLength(const Cell* cell){
+    size_t length = 0;
+    for(; cell != NULL; cell = cell->cdr) length++;
+    return length;
+}
+
+static Value cellNth(const Cell* cell, size_t index){
+    while(index-- > 0) cell = cell->cdr;
+    return cell->car;
+}
+
+static Cell* cellReverse(const Cell* cell){
+    Cell *result = NULL;
+    for(; cell != NULL; cell = cell->cdr) result = cellCons(cell->car, result);
+    return result;
+}
+
+/**
+ * @brief Copy `a` in front of `b`, front to back, keeping a pointer to the tail
+ */
+static Cell* cellAppend(const Cell* a, Cell* b){
+    Cell *head = b;
+    Cell **tail = &head;
+    for(; a != NULL; a = a->cdr){
+        *tail = cellCons(a->car, b);
+        tail = &(*tail)->cdr;
+    }
+    return head;
+}
+
+static Value listOp(enum operators op, Value a, Value b, int argc){
+    Value args[2] = {a, b};
+    return evaluateListOp(op, args, argc);
+}
+
+/**
+ * @brief Time each step on unrolled lists
+ * @param times Where to store the nanoseconds per step
+ * @return A checksum, so the work is not optimized away
+ */
+static long long runUnrolled(size_t length, double* times){
+    long long check = 0;
+    double start = nowNs();
+    Value list = evaluateListOp(LIST, NULL, 0);
+    for(size_t i = length; i > 0; i--){
+        list = listOp(CONS, makeIntValue((long long)i), list, 2);
+    }
+    times[STEP_BUILD] = nowNs() - start;
+
+    start = nowNs();
+    for(Value rest = list; rest.list != NULL; rest = listOp(CDR, rest, rest, 1)){
+        check += listOp(CAR, rest, rest, 1).intValue;
+    }
+    times[STEP_WALK] = nowNs() - start;
+
+    start = nowNs();
+    for(int i = 0; i < LENGTH_CALLS; i++){
+        check += (long long)listLength(list.list);
+    }
+    times[STEP_LENGTH] = nowNs() - start;
+
+    start = nowNs();
+    for(int i = 0; i < NTH_CALLS; i++){
+        check += listOp(NTH, list, makeIntValue((long long)((size_t)i * 7919 % length)), 2).intValue;
+    }
+    times[STEP_NTH] = nowNs() - start;
+
+    start = nowNs();
+    Value reversed = listOp(REVERSE, list, list, 1);
+    times[STEP_REVERSE] = nowNs() - start;
+    check += listOp(CAR, reversed, reversed, 1).intValue;
+
+    start = nowNs();
+    Value appended = listOp(APPEND, list, list, 2);
+    times[STEP_APPEND] = nowNs() - start;
+    check += (long long)listLength(appended.list);
+    return check;
+}
+
+static long long runCells(size_t length, double* times){
+    long long check = 0;
+    double start = nowNs();
+    Cell *list = NULL;
+    for(size_t i = length; i > 0; i--){
+        list = cellCons(makeIntValue((long long)i), list);
+    }
+    times[STEP_BUILD] = nowNs() - start;
+
+    start = nowNs();
+    for(Cell *rest = list; rest != NULL; rest = rest->cdr){
+        check += rest->car.intValue;
+    }
+    times[STEP_WALK] = nowNs() - start;
+
+    start = nowNs();
+    for(int i = 0; i < LENGTH_CALLS; i++){
+        check += (long long)cellLength(list);
+    }
+    times[STEP_LENGTH] = nowNs() - start;
+
+    start = nowNs();
+    for(int i = 0; i < NTH_CALLS; i++){
+        check += cellNth(list, (size_t)i * 7919 % length).intValue;
+    }
+    times[STEP_NTH] = nowNs() - start;
+
+    start = nowNs();
+    Cell *reversed = cellReverse(list);
+    times[STEP_REVERSE] = nowNs() - start;
+    check += reversed->car.intValue;
+
+    start = nowNs();
+    Cell *appended = cellAppend(list, list);
+    times[STEP_APPEND] = nowNs() - start;
+    check += (long long)cellLength(appended);
+    return check;
+}
+
+int main(int argc, char** argv){
+    size_t length = DEFAULT_LENGTH;
+    int runs = DEFAULT_RUNS;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--length") == 0 && i + 1 < argc){
+            length = (size_t)strtoull(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--runs") == 0 && i + 1 < argc){
+            runs = atoi(argv[++i]);
+        }else{
+            fprintf(stderr, "Usage: %s [--length N] [--runs N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(length == 0 || runs < 1){
+        fprintf(stderr, "--length and --runs must be positive\n");
+        return 1;
+    }
+
+    double best[2][STEP_COUNT];
+    long long checks[2] = {0, 0};
+    for(int run = 0; run < runs; run++){
+        double times[2][STEP_COUNT];
+        checks[0] = runUnrolled(length, times[0]);
+        checks[1] = runCells(length, times[1]);
+        for(int side = 0; side < 2; side++){
+            for(int step = 0; step < STEP_COUNT; step++){
+                if(run == 0 || times[side][step] < best[side][step]) best[side][step] = times[side][step];
+            }
+        }
+    }
+    if(checks[0] != checks[1]){
+        fprintf(stderr, "Checksums differ: %lld and %lld\n", checks[0], checks[1]);
+        return 1;
+    }
+
+    printf("%zu elements, best of %d runs (ms)\n", length, runs);
+    printf("%-10s %12s %12s\n", "", "unrolled", "cons cells");
+    for(int step = 0; step < STEP_COUNT; step++){
+        printf("%-10s %12.3f %12.3f\n", stepNames[step], best[0][step] / 1e6, best[1][step] / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+(def w 1920)
+(def h 1080)
+(def area (lambda (i) (+ i (/ (* (* w h) (+ w h)) (- (* w w) (* h h))))))
+(def ratio (lambda (i) (- i (/ (* (* w h) (+ w h)) (- (* w w) (* h h))))))
+(def loop (lambda (i acc)
+  (if (= i 0)
+    acc
+    (loop (- i 1) (+ acc (area i) (ratio i) (/ (* (* w h) (+ w h)) (- (* w w) (* h h))))))))
+(print (loop 2000000 0))
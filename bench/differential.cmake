@@ -0,0 +1,80 @@
+# Runs one program through the interpreter and through --emit-c and the C
+# compiler, and fails unless both print the same stdout and stderr and exit
+# with the same status. Both read the program's own text as stdin.
+#
+#   cmake -DLISP_LITE=<interpreter> -DLIBRARY=<liblisp_lite.a> -DCOMPILER=<cc>
+#         -DINCLUDE_DIR=<source dir> -DPROGRAM=<file.lisp> -DWORK_DIR=<dir>
+#         [-DLINK_LIBRARIES="m;pthread"] -P differential.cmake
+
+foreach(variable LISP_LITE LIBRARY COMPILER INCLUDE_DIR PROGRAM WORK_DIR)
+    if(NOT DEFINED ${variable})
+        message(FATAL_ERROR "${variable} is not set")
+    endif()
+endforeach()
+
+get_filename_component(name ${PROGRAM} NAME_WE)
+file(MAKE_DIRECTORY ${WORK_DIR})
+set(source ${WORK_DIR}/${name}.c)
+set(binary ${WORK_DIR}/${name})
+
+execute_process(COMMAND ${LISP_LITE} --emit-c ${PROGRAM}
+        OUTPUT_FILE ${source}
+        ERROR_VARIABLE emitError
+        RESULT_VARIABLE emitStatus)
+if(NOT emitStatus EQUAL 0)
+    message(FATAL_ERROR "--emit-c failed (${emitStatus}):\n${emitError}")
+endif()
+
+set(linkFlags)
+foreach(library ${LINK_LIBRARIES})
+    list(APPEND linkFlags -l${library})
+endforeach()
+execute_process(COMMAND ${COMPILER} -O2 -I${INCLUDE_DIR} ${source} ${LIBRARY} ${linkFlags} -o ${binary}
+        OUTPUT_VARIABLE compileOutput
+        ERROR_VARIABLE compileOutput
+        RESULT_VARIABLE compileStatus)
+if(NOT compileStatus EQUAL 0)
+    message(FATAL_ERROR "Compiling ${source} failed (${compileStatus}):\n${compileOutput}")
+endif()
+
+execute_process(COMMAND ${LISP_LITE} ${PROGRAM}
+        INPUT_FILE ${PROGRAM}
+        OUTPUT_VARIABLE interpretedOut
+        ERROR_VARIABLE interpretedErr
+        RESULT_VARIABLE interpretedStatus)
+execute_process(COMMAND ${binary}
+        INPUT_FILE ${PROGRAM}
+        OUTPUT_VARIABLE compiledOut
+        ERROR_VARIABLE compiledErr
+        RESULT_VARIABLE compiledStatus)
+
+# The interpreter prints the source and its tree before running it, and
+# every line of the tree ends in a colour reset; the program's output is
+# what follows the last one
+string(ASCII 27 escape)
+string(FIND "${interpretedOut}" "${escape}[0m" dumpEnd REVERSE)
+if(dumpEnd EQUAL -1)
+    message(FATAL_ERROR "No tree dump in the interpreter's output:\n${interpretedOut}")
+endif()
+math(EXPR dumpEnd "${dumpEnd} + 4")
+string(SUBSTRING "${interpretedOut}" ${dumpEnd} -1 interpretedOut)
+
+set(failed FALSE)
+if(NOT interpretedStatus STREQUAL compiledStatus)
+    message(SEND_ERROR "Exit status: interpreted ${interpretedStatus}, compiled ${compiledStatus}")
+    set(failed TRUE)
+endif()
+if(NOT interpretedErr STREQUAL compiledErr)
+    message(SEND_ERROR "stderr differs\n--- interpreted\n${interpretedErr}\n--- compiled\n${compiledErr}")
+    set(failed TRUE)
+endif()
+if(NOT interpretedOut STREQUAL compiledOut)
+    # Large outputs are written out to diff by hand
+    file(WRITE ${WORK_DIR}/${name}.interpreted "${interpretedOut}")
+    file(WRITE ${WORK_DIR}/${name}.compiled "${compiledOut}")
+    message(SEND_ERROR "stdout differs; see ${WORK_DIR}/${name}.interpreted and ${name}.compiled")
+    set(failed TRUE)
+endif()
+if(NOT failed)
+    message(STATUS "${name}: same output, exit status ${compiledStatus}")
+endif()
@@ -0,0 +1,4 @@
+(if (= nr 1) (seq (def total 0) (def counts (map))) 0)
+(def total (+ total nr))
+(map-put counts line (+ 1 (map-get counts line 0)))
+(print (+ nr " " total))
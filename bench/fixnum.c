@@ -0,0 +1,173 @@
+#include "library.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+/*
+ * The cost of the fixnum overflow checks. The arithmetic of fixnum.lisp's
+ * loop, (= i 0), (* i 3), (- i 7), (/ i 5), a four-operand + and (- i 1),
+ * is run --iterations times three ways, each through a function the
+ * compiler cannot see into:
+ *
+ *   unchecked    the operators as they were before the checks: wrapping
+ *                64-bit arithmetic, no overflow or division-by-zero test
+ *   checked      the same code with the __builtin_*_overflow tests and the
+ *                division checks that guard promotion to bignums
+ *   applyBuiltin the interpreter's own operators, which also dispatch on
+ *                floats, bignums and strings
+ *
+ * The first two differ only in the checks. The best of --runs runs of
+ * each is kept.
+ */
+
+#define DEFAULT_ITERATIONS 5000000
+#define DEFAULT_RUNS 5
+
+typedef Value (*Operator)(enum operators op, Value* args, int argc);
+
+static double nowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static Value expectInt(Value value){
+    if(value.type != VAL_INT){
+        fprintf(stderr, "Error: Expected INT\n");
+        exit(1);
+    }
+    return value;
+}
+
+/**
+ * @brief The integer operators without overflow checks, as they were
+ *        before fixnums could promote (widened from int to long long)
+ */
+__attribute__((noinline))
+static Value uncheckedOperator(enum operators op, Value* args, int argc){
+    uint64_t result = (uint64_t)expectInt(args[0]).intValue;
+    switch(op){
+        case ADD:
+            for(int i = 1; i < argc; i++) result += (uint64_t)expectInt(args[i]).intValue;
+            break;
+        case SUB:
+            for(int i = 1; i < argc; i++) result -= (uint64_t)expectInt(args[i]).intValue;
+            break;
+        case MUL:
+            for(int i = 1; i < argc; i++) result *= (uint64_t)expectInt(args[i]).intValue;
+            break;
+        case DIV:
+            for(int i = 1; i < argc; i++) result = (uint64_t)((long long)result / expectInt(args[i]).intValue);
+            break;
+        default:
+            return makeIntValue((long long)result == expectInt(args[1]).intValue);
+    }
+    return makeIntValue((long long)result);
+}
+
+/**
+ * @brief uncheckedOperator with the tests the fixnum path makes before it
+ *        would fall back to bignums (the fallback itself is not needed here)
+ */
+__attribute__((noinline))
+static Value checkedOperator(enum operators op, Value* args, int argc){
+    long long result = expectInt(args[0]).intValue;
+    int overflow = 0;
+    switch(op){
+        case ADD:
+            for(int i = 1; i < argc; i++) overflow |= __builtin_add_overflow(result, expectInt(args[i]).intValue, &result);
+            break;
+        case SUB:
+            for(int i = 1; i < argc; i++) overflow |= __builtin_sub_overflow(result, expectInt(args[i]).intValue, &result);
+            break;
+        case MUL:
+            for(int i = 1; i < argc; i++) overflow |= __builtin_mul_overflow(result, expectInt(args[i]).intValue, &result);
+            break;
+        case DIV:
+            for(int i = 1; i < argc; i++){
+                long long divisor = expectInt(args[i]).intValue;
+                if(divisor == 0 || (divisor == -1 && result == LLONG_MIN)){
+                    overflow = 1;
+                    break;
+                }
+                result /= divisor;
+            }
+            break;
+        default:
+            return makeIntValue(result == expectInt(args[1]).intValue);
+    }
+    if(overflow){
+        fprintf(stderr, "Error: Left the fixnum range\n");
+        exit(1);
+    }
+    return makeIntValue(result);
+}
+
+/**
+ * @brief One pass of fixnum.lisp's loop body
+ * @return The final accumulator, so the work is not optimized away
+ */
+static long long runLoop(Operator apply, long long iterations){
+    Value i = makeIntValue(iterations);
+    Value acc = makeIntValue(0);
+    Value zero = makeIntValue(0), one = makeIntValue(1);
+    Value three = makeIntValue(3), seven = makeIntValue(7), five = makeIntValue(5);
+    for(;;){
+        Value done = apply(EQ, (Value[]){i, zero}, 2);
+        if(done.intValue){
+            return acc.intValue;
+        }
+        Value terms[4] = {acc,
+                          apply(MUL, (Value[]){i, three}, 2),
+                          apply(SUB, (Value[]){i, seven}, 2),
+                          apply(DIV, (Value[]){i, five}, 2)};
+        acc = apply(ADD, terms, 4);
+        i = apply(SUB, (Value[]){i, one}, 2);
+    }
+}
+
+int main(int argc, char** argv){
+    long long iterations = DEFAULT_ITERATIONS;
+    int runs = DEFAULT_RUNS;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--iterations") == 0 && i + 1 < argc){
+            iterations = atoll(argv[++i]);
+        }else if(strcmp(argv[i], "--runs") == 0 && i + 1 < argc){
+            runs = atoi(argv[++i]);
+        }else{
+            fprintf(stderr, "Usage: %s [--iterations N] [--runs N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(iterations < 1 || runs < 1){
+        fprintf(stderr, "--iterations and --runs must be positive\n");
+        return 1;
+    }
+
+    Operator paths[3] = {uncheckedOperator, checkedOperator, applyBuiltin};
+    const char* names[3] = {"unchecked", "checked", "applyBuiltin"};
+    double best[3] = {0, 0, 0};
+    long long results[3] = {0, 0, 0};
+    for(int run = 0; run < runs; run++){
+        for(int path = 0; path < 3; path++){
+            double start = nowNs();
+            results[path] = runLoop(paths[path], iterations);
+            double elapsed = nowNs() - start;
+            if(run == 0 || elapsed < best[path]) best[path] = elapsed;
+        }
+    }
+    if(results[0] != results[1] || results[0] != results[2]){
+        fprintf(stderr, "Results differ: %lld, %lld and %lld\n", results[0], results[1], results[2]);
+        return 1;
+    }
+
+    printf("%lld iterations, 6 operators each, best of %d runs\n", iterations, runs);
+    for(int path = 0; path < 3; path++){
+        printf("%-12s %9.2f ms %7.2f ns/operator %+7.1f %%\n", names[path], best[path] / 1e6,
+               best[path] / (double)iterations / 6.0, (best[path] / best[0] - 1.0) * 100.0);
+    }
+    return 0;
+}
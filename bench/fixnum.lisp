@@ -0,0 +1,5 @@
+(def loop (lambda (i acc)
+  (if (= i 0)
+    acc
+    (loop (- i 1) (+ acc (* i 3) (- i 7) (/ i 5))))))
+(print (loop 5000000 0))
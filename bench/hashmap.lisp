@@ -0,0 +1,17 @@
+(def m (map))
+(def fill (lambda (i)
+  (if (= i 0) 0 (seq (map-put m i (* i 2)) (fill (- i 1))))))
+(def probe (lambda (i acc)
+  (if (= i 0) acc (probe (- i 1) (+ acc (map-get m i))))))
+(fill 2000000)
+(print (map-size m))
+(print (probe 2000000 0))
+
+(def names (map))
+(def fillNames (lambda (i)
+  (if (= i 0) 0 (seq (map-put names (+ "key-" i) i) (fillNames (- i 1))))))
+(def probeNames (lambda (i acc)
+  (if (= i 0) acc (probeNames (- i 1) (+ acc (map-has names (+ "key-" i)))))))
+(fillNames 1000000)
+(print (map-size names))
+(print (probeNames 1000000 0))
@@ -0,0 +1,9 @@
+(def build (lambda (i acc) (if (= i 0) acc (build (- i 1) (cons i acc)))))
+(def sum (lambda (l acc) (if (= (length l) 0) acc (sum (cdr l) (+ acc (car l))))))
+(def probe (lambda (l i acc) (if (= i 0) acc (probe l (- i 1) (+ acc (nth l (* i 97)))))))
+(def l (build 1000000 (list)))
+(print (length l))
+(print (sum l 0))
+(print (sum (reverse l) 0))
+(print (length (append l l l)))
+(print (probe l 10000 0))
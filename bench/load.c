@@ -0,0 +1,178 @@
+#include "protocol.h"
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Load generator for `LISP_LITE --serve`. Each connection sends the same
+ * script over and over, waiting for each request to finish, and the
+ * round-trip latencies are reported together. Programs that read input get
+ * an empty stdin. With --variants K the script is sent in K spellings
+ * (padded with trailing spaces), so the server's cache sees K programs.
+ */
+
+typedef struct {
+    pthread_t thread;
+    const char* socketPath;
+    const char* script;
+    size_t length;
+    int requests;
+    int variants;
+    int offset;
+    LatencyStats stats;
+    unsigned long long failures;
+    unsigned long long outputBytes;
+    int lost;
+} Connection;
+
+/**
+ * @brief Send one request and wait for its exit frame
+ * @return Its exit status, or -1 if the connection failed
+ */
+static int roundTrip(Connection* conn, int fd, const char* text, uint32_t length){
+    if(writeFrame(fd, FRAME_RUN, text, length) != 0){
+        return -1;
+    }
+    Frame frame;
+    while(readFrame(fd, &frame) == 0){
+        int status = -2;
+        if(frame.kind == FRAME_OUTPUT){
+            conn->outputBytes += frame.length;
+        }else if(frame.kind == FRAME_READ){
+            if(writeFrame(fd, FRAME_INPUT, NULL, 0) != 0){
+                status = -1;
+            }
+        }else if(frame.kind == FRAME_EXIT){
+            status = frame.length == 1 ? (unsigned char)frame.payload[0] : 1;
+        }
+        free(frame.payload);
+        if(status != -2){
+            return status;
+        }
+    }
+    return -1;
+}
+
+static void* connectionMain(void* arg){
+    Connection* conn = (Connection*)arg;
+    int fd = connectSocket(conn->socketPath);
+    if(fd < 0){
+        conn->lost = 1;
+        return NULL;
+    }
+
+    // The script followed by up to variants - 1 spaces
+    char* text = (char*)malloc(conn->length + (size_t)conn->variants);
+    memcpy(text, conn->script, conn->length);
+    memset(text + conn->length, ' ', (size_t)conn->variants);
+
+    for(int i = 0; i < conn->requests; i++){
+        uint32_t padding = (uint32_t)((conn->offset + i) % conn->variants);
+        double before = nowSeconds();
+        int status = roundTrip(conn, fd, text, (uint32_t)conn->length + padding);
+        if(status < 0){
+            conn->lost = 1;
+            break;
+        }
+        recordLatency(&conn->stats, nowSeconds() - before);
+        if(status != 0){
+            conn->failures++;
+        }
+    }
+    free(text);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char** argv){
+    const char* socketPath = NULL;
+    const char* scriptPath = NULL;
+    int connections = 4;
+    int requests = 10000;
+    int variants = 1;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--connections") == 0 && i + 1 < argc){
+            connections = atoi(argv[++i]);
+        }else if(strcmp(argv[i], "--requests") == 0 && i + 1 < argc){
+            requests = atoi(argv[++i]);
+        }else if(strcmp(argv[i], "--variants") == 0 && i + 1 < argc){
+            variants = atoi(argv[++i]);
+        }else if(socketPath == NULL){
+            socketPath = argv[i];
+        }else if(scriptPath == NULL){
+            scriptPath = argv[i];
+        }else{
+            socketPath = NULL;
+            break;
+        }
+    }
+    if(socketPath == NULL || scriptPath == NULL || connections < 1 || requests < 1 || variants < 1){
+        fprintf(stderr, "Usage: %s SOCKET <input> [--connections C] [--requests N] [--variants K]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(scriptPath, "rb");
+    if(file == NULL){
+        fprintf(stderr, "Error: Could not open file %s\n", scriptPath);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* script = (char*)malloc((size_t)size + 1);
+    size_t length = fread(script, 1, (size_t)size, file);
+    fclose(file);
+
+    Connection* conns = (Connection*)calloc((size_t)connections, sizeof(Connection));
+    double started = nowSeconds();
+    for(int i = 0; i < connections; i++){
+        conns[i].socketPath = socketPath;
+        conns[i].script = script;
+        conns[i].length = length;
+        conns[i].requests = requests / connections + (i < requests % connections);
+        conns[i].variants = variants;
+        conns[i].offset = i;
+        if(pthread_create(&conns[i].thread, NULL, connectionMain, &conns[i]) != 0){
+            fprintf(stderr, "Error: Could not start connection thread\n");
+            return 1;
+        }
+    }
+
+    LatencyStats stats;
+    memset(&stats, 0, sizeof(stats));
+    unsigned long long failures = 0, outputBytes = 0;
+    int lost = 0;
+    for(int i = 0; i < connections; i++){
+        pthread_join(conns[i].thread, NULL);
+        mergeStats(&stats, &conns[i].stats);
+        failures += conns[i].failures;
+        outputBytes += conns[i].outputBytes;
+        lost += conns[i].lost;
+    }
+    double wall = nowSeconds() - started;
+
+    printf("requests:     %llu\n", stats.count);
+    printf("connections:  %d\n", connections);
+    printf("variants:     %d\n", variants);
+    printf("failed:       %llu\n", failures);
+    printf("output:       %llu bytes\n", outputBytes);
+    printf("wall time:    %.3f s\n", wall);
+    if(stats.count > 0){
+        printf("requests/s:   %.0f\n", (double)stats.count / wall);
+        printf("latency mean: %.0f ns\n", stats.totalSeconds * 1e9 / (double)stats.count);
+        printf("latency p50:  %llu ns\n", latencyPercentile(&stats, 0.50));
+        printf("latency p90:  %llu ns\n", latencyPercentile(&stats, 0.90));
+        printf("latency p99:  %llu ns\n", latencyPercentile(&stats, 0.99));
+        printf("latency max:  %llu ns\n", stats.maxNs);
+    }
+    if(lost > 0){
+        fprintf(stderr, "Error: %d connection%s failed\n", lost, lost == 1 ? "" : "s");
+        return 1;
+    }
+    return 0;
+}
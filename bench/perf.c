@@ -0,0 +1,597 @@
+#include "library.h"
+#include "lexer.h"
+#include "output.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*
+ * Hardware-counter benchmark for the interpreter. Each workload is lexed,
+ * parsed and evaluated in this process --runs times, and cycles,
+ * instructions, L1 data and last-level cache misses and branch misses are
+ * counted (user space only) for each of the three phases separately. The
+ * lowest value of each count over the runs is kept.
+ *
+ * With --baseline the results are compared against a file written earlier
+ * by --write-baseline. A cycle or instruction count (the wall time, when the
+ * baseline has no counters) more than --threshold percent above the
+ * baseline is a regression, and the exit status is 1. Phases that took less
+ * than a millisecond in the baseline are compared on instructions only,
+ * since their timings are mostly noise.
+ *
+ * When perf_event_open is unavailable (a container, perf_event_paranoid
+ * above 2, a CPU without a PMU) only wall time is measured.
+ */
+
+#define DEFAULT_RUNS 3
+#define DEFAULT_THRESHOLD 10.0
+#define SHORT_PHASE_NS 1e6
+
+static const char* defaultCorpus[] = {
+    "fixnum", "bignum", "vector", "hashmap", "print", "fork", "cse"
+};
+
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_EVAL,
+    PHASE_COUNT
+} Phase;
+
+static const char* phaseNames[PHASE_COUNT] = {"lex", "parse", "eval"};
+
+typedef enum {
+    METRIC_TIME,
+    METRIC_CYCLES,
+    METRIC_INSTRUCTIONS,
+    METRIC_L1D_MISSES,
+    METRIC_LLC_MISSES,
+    METRIC_BRANCH_MISSES,
+    METRIC_COUNT
+} Metric;
+
+static const char* metricNames[METRIC_COUNT] = {
+    "time_ns", "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[METRIC_COUNT] = {
+    [METRIC_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [METRIC_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [METRIC_L1D_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                               | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                               | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    [METRIC_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [METRIC_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+// One value per phase and metric; a metric that could not be counted is -1
+typedef double Sample[PHASE_COUNT][METRIC_COUNT];
+
+typedef struct {
+    int fd[METRIC_COUNT];
+    double started;
+} Counters;
+
+typedef struct {
+    char key[128];
+    double value;
+} BaselineEntry;
+
+// A baseline file flattened to "workload.phase.metric" keys
+typedef struct {
+    BaselineEntry* items;
+    int count;
+    int capacity;
+} Baseline;
+
+static double nowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------- counters */
+
+/**
+ * @brief Open every counter this machine lets us have
+ * @return How many could be opened; the rest are left at -1
+ */
+static int countersOpen(Counters* counters){
+    int opened = 0;
+    counters->fd[METRIC_TIME] = -1;
+    for(int m = METRIC_CYCLES; m < METRIC_COUNT; m++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[m].type;
+        attr.config = events[m].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // Scaled up by enabled/running if the PMU has to multiplex them
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters->fd[m] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if(counters->fd[m] >= 0){
+            opened++;
+        }
+    }
+    return opened;
+}
+
+static void countersClose(Counters* counters){
+    for(int m = 0; m < METRIC_COUNT; m++){
+        if(counters->fd[m] >= 0){
+            close(counters->fd[m]);
+        }
+    }
+}
+
+static void countersStart(Counters* counters){
+    for(int m = 0; m < METRIC_COUNT; m++){
+        if(counters->fd[m] >= 0){
+            ioctl(counters->fd[m], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fd[m], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    counters->started = nowNs();
+}
+
+static void countersStop(Counters* counters, double* values){
+    values[METRIC_TIME] = nowNs() - counters->started;
+    for(int m = METRIC_CYCLES; m < METRIC_COUNT; m++){
+        values[m] = -1;
+        if(counters->fd[m] < 0){
+            continue;
+        }
+        ioctl(counters->fd[m], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t data[3];
+        if(read(counters->fd[m], data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] > 0){
+            values[m] = (double)data[0] * ((double)data[1] / (double)data[2]);
+        }
+    }
+}
+
+/* ------------------------------------------------------------- workloads */
+
+static void discardOutput(void* user, const char* data, size_t length){
+    (void)data;
+    *(size_t*)user += length;
+}
+
+static char* readFile(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* buffer = (char*)memAlloc((size_t)length + 1);
+    size_t got = fread(buffer, 1, (size_t)length, file);
+    buffer[got] = '\0';
+    fclose(file);
+    normalizeSource(buffer, got);
+    return buffer;
+}
+
+/**
+ * @brief Lex, parse and evaluate one script, counting each phase
+ * @return 0, or -1 if it could not be read or failed with an error
+ */
+static int runOnce(const char* path, Counters* counters, Sample sample){
+    char* source = readFile(path);
+    if(source == NULL){
+        fprintf(stderr, "Error: Could not open file %s\n", path);
+        return -1;
+    }
+
+    Token* volatile tokens = NULL;
+    Node* volatile tree = NULL;
+    EnvEntry* env = NULL;
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) != 0){
+        fprintf(stderr, "%s: %s\n", path, trap.message);
+        resetEvaluator();
+        freeTokens(tokens);
+        freeTree(tree);
+        memFree(source);
+        return -1;
+    }
+
+    countersStart(counters);
+    tokens = lex(source);
+    countersStop(counters, sample[PHASE_LEX]);
+
+    countersStart(counters);
+    tree = parse(tokens);
+    countersStop(counters, sample[PHASE_PARSE]);
+
+    resetEvaluator();
+    countersStart(counters);
+    evaluateTree(tree, &env);
+    outputFlush();
+    countersStop(counters, sample[PHASE_EVAL]);
+    errorTrapPop(&trap);
+
+    env_free(env);
+    freeTokens(tokens);
+    freeTree(tree);
+    memFree(source);
+    return 0;
+}
+
+/**
+ * @brief Run a script `runs` times, keeping the lowest value of each count
+ */
+static int runWorkload(const char* path, int runs, Counters* counters, Sample best){
+    for(int run = 0; run < runs; run++){
+        Sample sample;
+        if(runOnce(path, counters, sample) != 0){
+            return -1;
+        }
+        for(int p = 0; p < PHASE_COUNT; p++){
+            for(int m = 0; m < METRIC_COUNT; m++){
+                if(run == 0 || sample[p][m] < best[p][m]){
+                    best[p][m] = sample[p][m];
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------- baseline */
+
+static void skipSpace(const char** p){
+    while(**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r'){
+        (*p)++;
+    }
+}
+
+/**
+ * @brief Read a JSON object of objects and numbers into flattened entries
+ * @param prefix The dotted path to this object, "" at the top
+ * @return 0, or -1 on anything else
+ */
+static int readObject(const char** p, const char* prefix, Baseline* baseline){
+    skipSpace(p);
+    if(**p != '{'){
+        return -1;
+    }
+    (*p)++;
+    skipSpace(p);
+    if(**p == '}'){
+        (*p)++;
+        return 0;
+    }
+    for(;;){
+        skipSpace(p);
+        if(**p != '"'){
+            return -1;
+        }
+        const char* start = ++*p;
+        while(**p != '"' && **p != '\0'){
+            (*p)++;
+        }
+        if(**p != '"'){
+            return -1;
+        }
+        char key[128];
+        int length = snprintf(key, sizeof(key), "%s%s%.*s", prefix, prefix[0] ? "." : "",
+                              (int)(*p - start), start);
+        if(length < 0 || (size_t)length >= sizeof(key)){
+            return -1;
+        }
+        (*p)++;
+        skipSpace(p);
+        if(**p != ':'){
+            return -1;
+        }
+        (*p)++;
+        skipSpace(p);
+
+        if(**p == '{'){
+            if(readObject(p, key, baseline) != 0){
+                return -1;
+            }
+        }else{
+            char* end;
+            double value = strtod(*p, &end);
+            if(end == *p){
+                return -1;
+            }
+            *p = end;
+            if(baseline->count == baseline->capacity){
+                baseline->capacity = baseline->capacity ? baseline->capacity * 2 : 64;
+                baseline->items = (BaselineEntry*)memRealloc(baseline->items,
+                                                             sizeof(BaselineEntry) * baseline->capacity);
+            }
+            strcpy(baseline->items[baseline->count].key, key);
+            baseline->items[baseline->count].value = value;
+            baseline->count++;
+        }
+
+        skipSpace(p);
+        if(**p == ','){
+            (*p)++;
+            continue;
+        }
+        if(**p == '}'){
+            (*p)++;
+            return 0;
+        }
+        return -1;
+    }
+}
+
+static int loadBaseline(const char* path, Baseline* baseline){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = (char*)memAlloc((size_t)length + 1);
+    size_t got = fread(text, 1, (size_t)length, file);
+    text[got] = '\0';
+    fclose(file);
+
+    const char* p = text;
+    int status = readObject(&p, "", baseline);
+    memFree(text);
+    return status;
+}
+
+/**
+ * @brief Look up a baseline value
+ * @return The value, or -1 if the baseline does not have it
+ */
+static double baselineValue(const Baseline* baseline, const char* workload, Phase phase, Metric metric){
+    char key[128];
+    snprintf(key, sizeof(key), "%s.%s.%s", workload, phaseNames[phase], metricNames[metric]);
+    for(int i = 0; i < baseline->count; i++){
+        if(strcmp(baseline->items[i].key, key) == 0){
+            return baseline->items[i].value;
+        }
+    }
+    return -1;
+}
+
+static void writeBaseline(FILE* out, const char** names, Sample* results, const int* ok, int count){
+    fprintf(out, "{\n");
+    int first = 1;
+    for(int w = 0; w < count; w++){
+        if(!ok[w]){
+            continue;
+        }
+        fprintf(out, "%s  \"%s\": {\n", first ? "" : ",\n", names[w]);
+        first = 0;
+        for(int p = 0; p < PHASE_COUNT; p++){
+            fprintf(out, "    \"%s\": {", phaseNames[p]);
+            int firstMetric = 1;
+            for(int m = 0; m < METRIC_COUNT; m++){
+                if(results[w][p][m] < 0){
+                    continue;
+                }
+                fprintf(out, "%s\"%s\": %.0f", firstMetric ? "" : ", ", metricNames[m], results[w][p][m]);
+                firstMetric = 0;
+            }
+            fprintf(out, "}%s\n", p + 1 < PHASE_COUNT ? "," : "");
+        }
+        fprintf(out, "  }");
+    }
+    fprintf(out, "\n}\n");
+}
+
+/* ------------------------------------------------------------- report */
+
+static void printCount(double value){
+    if(value < 0){
+        printf(" %10s", "-");
+    }else if(value >= 1e9){
+        printf(" %9.2fG", value / 1e9);
+    }else if(value >= 1e6){
+        printf(" %9.2fM", value / 1e6);
+    }else if(value >= 1e3){
+        printf(" %9.2fK", value / 1e3);
+    }else{
+        printf(" %10.0f", value);
+    }
+}
+
+/**
+ * @brief Compare one metric against the baseline and print the change
+ * @return 1 if it is a regression
+ */
+static int compare(const Baseline* baseline, const char* workload, Phase phase, Metric metric,
+                   double value, double threshold){
+    double before = baselineValue(baseline, workload, phase, metric);
+    if(before <= 0 || value < 0){
+        return 0;
+    }
+    double change = (value - before) / before * 100.0;
+    int regressed = change > threshold;
+    printf("  %s %+.1f%%%s", metricNames[metric], change, regressed ? " REGRESSION" : "");
+    return regressed;
+}
+
+/**
+ * @brief Print a workload's phases, and count the regressions against the baseline
+ */
+static int report(const char* workload, Sample results, const Baseline* baseline, double threshold){
+    int regressions = 0;
+    for(int p = 0; p < PHASE_COUNT; p++){
+        double* values = results[p];
+        printf("%-10s %-6s %10.3f", workload, phaseNames[p], values[METRIC_TIME] / 1e6);
+        for(int m = METRIC_CYCLES; m < METRIC_COUNT; m++){
+            printCount(values[m]);
+            if(m == METRIC_INSTRUCTIONS){
+                if(values[METRIC_CYCLES] > 0 && values[METRIC_INSTRUCTIONS] >= 0){
+                    printf(" %5.2f", values[METRIC_INSTRUCTIONS] / values[METRIC_CYCLES]);
+                }else{
+                    printf(" %5s", "-");
+                }
+            }
+        }
+
+        if(baseline != NULL){
+            double before = baselineValue(baseline, workload, p, METRIC_TIME);
+            int shortPhase = before >= 0 && before < SHORT_PHASE_NS;
+            int haveCounters = baselineValue(baseline, workload, p, METRIC_INSTRUCTIONS) >= 0
+                               && values[METRIC_INSTRUCTIONS] >= 0;
+            if(haveCounters){
+                regressions += compare(baseline, workload, p, METRIC_INSTRUCTIONS, values[METRIC_INSTRUCTIONS], threshold);
+                if(!shortPhase){
+                    regressions += compare(baseline, workload, p, METRIC_CYCLES, values[METRIC_CYCLES], threshold);
+                }
+            }else if(!shortPhase){
+                regressions += compare(baseline, workload, p, METRIC_TIME, values[METRIC_TIME], threshold);
+            }
+        }
+        printf("\n");
+    }
+    return regressions;
+}
+
+/* ------------------------------------------------------------- main */
+
+static void usage(const char* program){
+    fprintf(stderr, "Usage: %s [--runs N] [--threshold PERCENT] [--baseline FILE] [--write-baseline FILE]\n"
+                    "          [--corpus DIR | script.lisp ...]\n", program);
+}
+
+/**
+ * @brief The workload's name: the script's file name without ".lisp"
+ */
+static char* workloadName(const char* path){
+    const char* base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    size_t length = strlen(base);
+    if(length > 5 && strcmp(base + length - 5, ".lisp") == 0){
+        length -= 5;
+    }
+    char* name = (char*)memAlloc(length + 1);
+    memcpy(name, base, length);
+    name[length] = '\0';
+    return name;
+}
+
+int main(int argc, char** argv){
+    int runs = DEFAULT_RUNS;
+    double threshold = DEFAULT_THRESHOLD;
+    const char* baselinePath = NULL;
+    const char* writePath = NULL;
+    const char* corpus = "bench";
+    const char** scripts = (const char**)memCalloc((size_t)argc, sizeof(char*));
+    int scriptCount = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--runs") == 0 && i + 1 < argc){
+            runs = atoi(argv[++i]);
+        }else if(strcmp(argv[i], "--threshold") == 0 && i + 1 < argc){
+            threshold = atof(argv[++i]);
+        }else if(strcmp(argv[i], "--baseline") == 0 && i + 1 < argc){
+            baselinePath = argv[++i];
+        }else if(strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc){
+            writePath = argv[++i];
+        }else if(strcmp(argv[i], "--corpus") == 0 && i + 1 < argc){
+            corpus = argv[++i];
+        }else if(argv[i][0] == '-'){
+            usage(argv[0]);
+            return 1;
+        }else{
+            scripts[scriptCount++] = argv[i];
+        }
+    }
+    if(runs < 1){
+        usage(argv[0]);
+        return 1;
+    }
+
+    int count = scriptCount > 0 ? scriptCount : (int)(sizeof(defaultCorpus) / sizeof(defaultCorpus[0]));
+    char** paths = (char**)memAlloc(sizeof(char*) * count);
+    const char** names = (const char**)memAlloc(sizeof(char*) * count);
+    for(int w = 0; w < count; w++){
+        if(scriptCount > 0){
+            paths[w] = memStrdup(scripts[w]);
+        }else{
+            size_t length = strlen(corpus) + strlen(defaultCorpus[w]) + 7;
+            paths[w] = (char*)memAlloc(length);
+            snprintf(paths[w], length, "%s/%s.lisp", corpus, defaultCorpus[w]);
+        }
+        names[w] = workloadName(paths[w]);
+    }
+
+    Baseline baseline = {NULL, 0, 0};
+    if(baselinePath != NULL && loadBaseline(baselinePath, &baseline) != 0){
+        fprintf(stderr, "Error: Could not read baseline %s\n", baselinePath);
+        return 1;
+    }
+
+    Counters counters;
+    if(countersOpen(&counters) == 0){
+        fprintf(stderr, "perf_event_open unavailable (%s); measuring wall time only\n", strerror(errno));
+    }
+
+    // Workloads print to a counter instead of the terminal
+    size_t outputBytes = 0;
+    outputInit(0);
+    outputRedirect(discardOutput, &outputBytes);
+
+    printf("%-10s %-6s %10s %10s %10s %5s %10s %10s %10s\n", "workload", "phase", "ms",
+           "cycles", "instr", "IPC", "L1D miss", "LLC miss", "br miss");
+    Sample* results = (Sample*)memCalloc((size_t)count, sizeof(Sample));
+    int* ok = (int*)memCalloc((size_t)count, sizeof(int));
+    int failed = 0;
+    int regressions = 0;
+    for(int w = 0; w < count; w++){
+        if(runWorkload(paths[w], runs, &counters, results[w]) != 0){
+            failed++;
+            continue;
+        }
+        ok[w] = 1;
+        regressions += report(names[w], results[w], baselinePath != NULL ? &baseline : NULL, threshold);
+        fflush(stdout);
+    }
+    outputRedirect(NULL, NULL);
+    countersClose(&counters);
+
+    if(writePath != NULL){
+        FILE* out = fopen(writePath, "w");
+        if(out == NULL){
+            fprintf(stderr, "Error: Could not write %s\n", writePath);
+            return 1;
+        }
+        writeBaseline(out, names, results, ok, count);
+        fclose(out);
+    }
+    if(baselinePath != NULL){
+        printf("%d regression%s above %.1f%% against %s\n", regressions, regressions == 1 ? "" : "s",
+               threshold, baselinePath);
+    }
+
+    for(int w = 0; w < count; w++){
+        memFree(paths[w]);
+        memFree((char*)names[w]);
+    }
+    memFree(paths);
+    memFree(names);
+    memFree(results);
+    memFree(ok);
+    memFree(baseline.items);
+    memFree(scripts);
+    return failed > 0 || regressions > 0;
+}
@@ -0,0 +1,3 @@
+(def loop (lambda (i)
+  (if (= i 10000000) 0 (seq (print i) (loop (+ i 1))))))
+(loop 0)
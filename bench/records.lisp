@@ -0,0 +1,3 @@
+(def square (lambda (x) (* x x)))
+(def f (lambda (i acc) (if (= i 0) acc (f (- i 1) (+ acc (square i))))))
+(print (+ line " " (f 50 nr)))
@@ -0,0 +1,8 @@
+(def text (read-all))
+
+(def scan (lambda (i acc)
+  (if (= i 0) acc (scan (- i 1) (+ acc (re-match text "status=5\d\d user=9999[0-9]{2}"))))))
+(print (scan 10 0))
+(print (re-find text "items/\d+ status=[45]\d\d user=4242 "))
+(print (length (re-replace text "\d+" "N")))
+(print (re-match text "(\w+\s?)+!"))
@@ -0,0 +1,10 @@
+(def text (read-all))
+(print (length text))
+
+(def scan (lambda (i acc)
+  (if (= i 0) acc (scan (- i 1) (+ acc (contains text "status=503 path=/checkout"))))))
+(print (scan 20 0))
+(print (index-of text "user=99999"))
+(print (length (split text " user=")))
+(print (length (replace text "GET" "POST")))
+(print (length (upper text)))
@@ -0,0 +1,11 @@
+(def text (read-all))
+(print (= text (+ text "")))
+
+(def words (map))
+(def fill (lambda (i)
+  (if (= i 0) 0 (seq (map-put words (+ "слово-" i "-词") i) (fill (- i 1))))))
+(def probe (lambda (i acc)
+  (if (= i 0) acc (probe (- i 1) (+ acc (= (+ "слово-" i "-词") (+ "слово-" i "-词")))))))
+(fill 500000)
+(print (map-size words))
+(print (probe 500000 0))
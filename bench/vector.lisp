@@ -0,0 +1,16 @@
+(def n 1000000)
+(def a (vec+ (vec-range n) 0.5))
+(def b (vec* a 2.0))
+(def ints (vec-range n))
+
+(def reduce (lambda (k acc)
+  (if (= k 0)
+    acc
+    (reduce (- k 1) (+ acc (vec-dot a b) (vec-sum a) (vec-max b) (vec-min a) (vec-sum ints) (vec-max ints))))))
+(print (reduce 200 0.0))
+
+(def elementwise (lambda (k acc)
+  (if (= k 0)
+    acc
+    (elementwise (- k 1) (+ acc (vec-sum (vec+ a b)) (vec-sum (vec< a 1000.0)))))))
+(print (elementwise 10 0.0))
@@ -0,0 +1,312 @@
+#include "bigint.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static BigInt* bigAlloc(int length){
+    BigInt* big = (BigInt*)memAlloc(sizeof(BigInt) + sizeof(uint32_t) * (length > 0 ? length : 1));
+    big->sign = 0;
+    big->length = length;
+    return big;
+}
+
+/**
+ * @brief Drop leading zero limbs and fix the sign of zero
+ */
+static BigInt* bigTrim(BigInt* big, int sign){
+    while(big->length > 0 && big->limbs[big->length - 1] == 0){
+        big->length--;
+    }
+    big->sign = big->length == 0 ? 0 : sign;
+    return big;
+}
+
+static int magCompare(const BigInt* a, const BigInt* b){
+    if(a->length != b->length){
+        return a->length < b->length ? -1 : 1;
+    }
+    for(int i = a->length - 1; i >= 0; i--){
+        if(a->limbs[i] != b->limbs[i]){
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static BigInt* magAdd(const BigInt* a, const BigInt* b, int sign){
+    if(a->length < b->length){
+        const BigInt* t = a; a = b; b = t;
+    }
+    BigInt* r = bigAlloc(a->length + 1);
+    uint64_t carry = 0;
+    for(int i = 0; i < a->length; i++){
+        carry += (uint64_t)a->limbs[i] + (i < b->length ? b->limbs[i] : 0);
+        r->limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    r->limbs[a->length] = (uint32_t)carry;
+    return bigTrim(r, sign);
+}
+
+// |a| - |b|, requires |a| >= |b|
+static BigInt* magSub(const BigInt* a, const BigInt* b, int sign){
+    BigInt* r = bigAlloc(a->length);
+    int64_t borrow = 0;
+    for(int i = 0; i < a->length; i++){
+        int64_t d = (int64_t)a->limbs[i] - (i < b->length ? b->limbs[i] : 0) - borrow;
+        borrow = d < 0;
+        r->limbs[i] = (uint32_t)(d + (borrow ? ((int64_t)1 << 32) : 0));
+    }
+    return bigTrim(r, sign);
+}
+
+BigInt* bigFromInt(long long value){
+    BigInt* big = bigAlloc(2);
+    // Negate through unsigned so LLONG_MIN is fine
+    uint64_t magnitude = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+    big->limbs[0] = (uint32_t)magnitude;
+    big->limbs[1] = (uint32_t)(magnitude >> 32);
+    return bigTrim(big, value < 0 ? -1 : 1);
+}
+
+/**
+ * @brief Parse an optionally signed decimal string
+ */
+BigInt* bigFromString(const char* digits){
+    int sign = 1;
+    if(*digits == '-' || *digits == '+'){
+        sign = *digits == '-' ? -1 : 1;
+        digits++;
+    }
+
+    size_t count = strlen(digits);
+    // Each limb holds a little over 9 decimal digits
+    BigInt* big = bigAlloc((int)(count / 9 + 2));
+    big->length = 0;
+    while(*digits){
+        uint32_t chunk = 0, scale = 1;
+        for(int i = 0; i < 9 && *digits; i++, digits++){
+            chunk = chunk * 10 + (uint32_t)(*digits - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for(int i = 0; i < big->length; i++){
+            carry += (uint64_t)big->limbs[i] * scale;
+            big->limbs[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if(carry){
+            big->limbs[big->length++] = (uint32_t)carry;
+        }
+    }
+    return bigTrim(big, sign);
+}
+
+BigInt* bigAdd(const BigInt* a, const BigInt* b){
+    if(a->sign == b->sign || b->sign == 0){
+        return magAdd(a, b, a->sign ? a->sign : b->sign);
+    }
+    if(a->sign == 0){
+        return magAdd(a, b, b->sign);
+    }
+    return magCompare(a, b) >= 0 ? magSub(a, b, a->sign) : magSub(b, a, b->sign);
+}
+
+BigInt* bigSub(const BigInt* a, const BigInt* b){
+    if(b->sign == 0){
+        return magAdd(a, b, a->sign);
+    }
+    if(a->sign == 0){
+        return magAdd(a, b, -b->sign);
+    }
+    if(a->sign != b->sign){
+        return magAdd(a, b, a->sign);
+    }
+    return magCompare(a, b) >= 0 ? magSub(a, b, a->sign) : magSub(b, a, -a->sign);
+}
+
+BigInt* bigMul(const BigInt* a, const BigInt* b){
+    BigInt* r = bigAlloc(a->length + b->length);
+    memset(r->limbs, 0, sizeof(uint32_t) * (a->length + b->length));
+    for(int i = 0; i < a->length; i++){
+        uint64_t carry = 0;
+        for(int j = 0; j < b->length; j++){
+            carry += (uint64_t)a->limbs[i] * b->limbs[j] + r->limbs[i + j];
+            r->limbs[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r->limbs[i + b->length] = (uint32_t)carry;
+    }
+    return bigTrim(r, a->sign * b->sign);
+}
+
+/**
+ * @brief Divide a magnitude by a single limb in place
+ * @return The remainder
+ */
+static uint32_t magDivSmall(BigInt* a, uint32_t divisor){
+    uint64_t rem = 0;
+    for(int i = a->length - 1; i >= 0; i--){
+        uint64_t cur = (rem << 32) | a->limbs[i];
+        a->limbs[i] = (uint32_t)(cur / divisor);
+        rem = cur % divisor;
+    }
+    return (uint32_t)rem;
+}
+
+/**
+ * @brief Truncating division, like C's `/` on fixnums
+ * @param b Must not be zero
+ *
+ * Schoolbook long division (Knuth, TAOCP vol. 2, algorithm D).
+ */
+BigInt* bigDiv(const BigInt* a, const BigInt* b){
+    int sign = a->sign * b->sign;
+    if(magCompare(a, b) < 0){
+        return bigAlloc(0);
+    }
+
+    if(b->length == 1){
+        BigInt* q = bigAlloc(a->length);
+        memcpy(q->limbs, a->limbs, sizeof(uint32_t) * a->length);
+        magDivSmall(q, b->limbs[0]);
+        return bigTrim(q, sign);
+    }
+
+    int n = b->length, m = a->length - b->length;
+    int shift = __builtin_clz(b->limbs[n - 1]);
+
+    // Normalize so the divisor's top limb has its high bit set
+    uint32_t* v = (uint32_t*)memAlloc(sizeof(uint32_t) * n);
+    uint32_t* u = (uint32_t*)memAlloc(sizeof(uint32_t) * (a->length + 1));
+    for(int i = n - 1; i > 0; i--){
+        v[i] = (b->limbs[i] << shift) | (shift ? (uint32_t)((uint64_t)b->limbs[i - 1] >> (32 - shift)) : 0);
+    }
+    v[0] = b->limbs[0] << shift;
+    u[a->length] = shift ? (uint32_t)((uint64_t)a->limbs[a->length - 1] >> (32 - shift)) : 0;
+    for(int i = a->length - 1; i > 0; i--){
+        u[i] = (a->limbs[i] << shift) | (shift ? (uint32_t)((uint64_t)a->limbs[i - 1] >> (32 - shift)) : 0);
+    }
+    u[0] = a->limbs[0] << shift;
+
+    BigInt* q = bigAlloc(m + 1);
+    for(int j = m; j >= 0; j--){
+        uint64_t num = ((uint64_t)u[j + n] << 32) | u[j + n - 1];
+        uint64_t qhat = num / v[n - 1];
+        uint64_t rhat = num % v[n - 1];
+        while(qhat >= ((uint64_t)1 << 32) || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2])){
+            qhat--;
+            rhat += v[n - 1];
+            if(rhat >= ((uint64_t)1 << 32)){
+                break;
+            }
+        }
+
+        // Multiply and subtract qhat * v from u[j .. j+n]
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for(int i = 0; i < n; i++){
+            uint64_t p = qhat * v[i] + carry;
+            carry = p >> 32;
+            int64_t t = (int64_t)u[i + j] - borrow - (int64_t)(uint32_t)p;
+            u[i + j] = (uint32_t)t;
+            borrow = t < 0;
+        }
+        int64_t t = (int64_t)u[j + n] - borrow - (int64_t)carry;
+        u[j + n] = (uint32_t)t;
+
+        if(t < 0){
+            // qhat was one too large: add the divisor back
+            qhat--;
+            uint64_t c = 0;
+            for(int i = 0; i < n; i++){
+                c += (uint64_t)u[i + j] + v[i];
+                u[i + j] = (uint32_t)c;
+                c >>= 32;
+            }
+            u[j + n] += (uint32_t)c;
+        }
+        q->limbs[j] = (uint32_t)qhat;
+    }
+
+    memFree(u);
+    memFree(v);
+    return bigTrim(q, sign);
+}
+
+int bigCompare(const BigInt* a, const BigInt* b){
+    if(a->sign != b->sign){
+        return a->sign < b->sign ? -1 : 1;
+    }
+    int mag = magCompare(a, b);
+    return a->sign < 0 ? -mag : mag;
+}
+
+/**
+ * @brief Convert back to a fixnum when the value fits
+ * @return 1 and sets *out if it fits in a long long, 0 otherwise
+ */
+int bigToInt(const BigInt* a, long long* out){
+    if(a->length > 2){
+        return 0;
+    }
+    uint64_t magnitude = 0;
+    for(int i = a->length - 1; i >= 0; i--){
+        magnitude = (magnitude << 32) | a->limbs[i];
+    }
+    if(a->sign >= 0){
+        if(magnitude > (uint64_t)INT64_MAX){
+            return 0;
+        }
+        *out = (long long)magnitude;
+    }else{
+        if(magnitude > (uint64_t)INT64_MAX + 1){
+            return 0;
+        }
+        *out = (long long)(0 - magnitude);
+    }
+    return 1;
+}
+
+/**
+ * @brief Nearest double, for mixed bignum/float arithmetic
+ */
+double bigToDouble(const BigInt* a){
+    double result = 0.0;
+    for(int i = a->length - 1; i >= 0; i--){
+        result = result * 4294967296.0 + a->limbs[i];
+    }
+    return a->sign < 0 ? -result : result;
+}
+
+/**
+ * @brief Format as decimal
+ * @return A malloc'd string
+ */
+char* bigToString(const BigInt* a){
+    BigInt* work = bigAlloc(a->length);
+    memcpy(work->limbs, a->limbs, sizeof(uint32_t) * a->length);
+
+    // Peel off nine digits at a time, least significant first
+    int chunkCount = 0;
+    uint32_t* chunks = (uint32_t*)memAlloc(sizeof(uint32_t) * (a->length * 10 / 9 + 2));
+    do{
+        chunks[chunkCount++] = magDivSmall(work, 1000000000u);
+        bigTrim(work, 1);
+    }while(work->length > 0);
+
+    char* out = (char*)memAlloc((size_t)chunkCount * 9 + 2);
+    char* p = out;
+    if(a->sign < 0){
+        *p++ = '-';
+    }
+    p += sprintf(p, "%u", chunks[chunkCount - 1]);
+    for(int i = chunkCount - 2; i >= 0; i--){
+        p += sprintf(p, "%09u", chunks[i]);
+    }
+
+    memFree(chunks);
+    memFree(work);
+    return out;
+}
@@ -0,0 +1,37 @@
+#ifndef LISP_LITE_BIGINT_H
+#define LISP_LITE_BIGINT_H
+#include <stdint.h>
+
+/*
+ * Arbitrary-precision integer, used only once a result no longer fits in a
+ * 64-bit fixnum. Magnitude is stored as little-endian 32-bit limbs with no
+ * leading zero limbs; zero has length 0 and sign 0. BigInts are immutable
+ * once built, so values can share them freely.
+ */
+typedef struct BigInt {
+    int sign;
+    int length;
+    uint32_t limbs[];
+} BigInt;
+
+BigInt* bigFromInt(long long value);
+
+BigInt* bigFromString(const char* digits);
+
+BigInt* bigAdd(const BigInt* a, const BigInt* b);
+
+BigInt* bigSub(const BigInt* a, const BigInt* b);
+
+BigInt* bigMul(const BigInt* a, const BigInt* b);
+
+BigInt* bigDiv(const BigInt* a, const BigInt* b);
+
+int bigCompare(const BigInt* a, const BigInt* b);
+
+int bigToInt(const BigInt* a, long long* out);
+
+double bigToDouble(const BigInt* a);
+
+char* bigToString(const BigInt* a);
+
+#endif //LISP_LITE_BIGINT_H
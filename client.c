@@ -0,0 +1,120 @@
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * Client for `LISP_LITE --serve`: sends a program to the server and relays
+ * its output to stdout, its errors to stderr and our stdin to it, then exits
+ * with the program's status.
+ */
+
+static int writeOut(int fd, const char* data, size_t length){
+    while(length > 0){
+        ssize_t written = write(fd, data, length);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static char* readFile(const char* path, size_t* length){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = (char*)malloc((size_t)size + 1);
+    *length = fread(text, 1, (size_t)size, file);
+    fclose(file);
+    return text;
+}
+
+/**
+ * @brief Answer a read request with the next block of stdin
+ */
+static int sendInput(int fd, const Frame* request, char** buffer, size_t* capacity){
+    if(request->length != 4){
+        return -1;
+    }
+    const unsigned char* p = (const unsigned char*)request->payload;
+    size_t want = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | (size_t)p[3];
+    if(want > *capacity){
+        *buffer = (char*)realloc(*buffer, want);
+        *capacity = want;
+    }
+    ssize_t got;
+    do{
+        got = read(0, *buffer, want);
+    }while(got < 0 && errno == EINTR);
+    if(got < 0){
+        got = 0; // treat an unreadable stdin as empty
+    }
+    return writeFrame(fd, FRAME_INPUT, *buffer, (uint32_t)got);
+}
+
+int main(int argc, char** argv){
+    if(argc != 3){
+        fprintf(stderr, "Usage: %s SOCKET <input>\n", argv[0]);
+        fprintf(stderr, "       %s SOCKET --stats\n", argv[0]);
+        return 1;
+    }
+
+    int fd = connectSocket(argv[1]);
+    if(fd < 0){
+        fprintf(stderr, "Error: Could not connect to %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    int sent;
+    if(strcmp(argv[2], "--stats") == 0){
+        sent = writeFrame(fd, FRAME_STATS, NULL, 0);
+    }else{
+        size_t length;
+        char* text = readFile(argv[2], &length);
+        if(text == NULL){
+            fprintf(stderr, "Error: Could not open file %s\n", argv[2]);
+            return 1;
+        }
+        sent = writeFrame(fd, FRAME_RUN, text, (uint32_t)length);
+        free(text);
+    }
+
+    char* inputBuffer = NULL;
+    size_t inputCapacity = 0;
+    Frame frame;
+    while(sent == 0 && readFrame(fd, &frame) == 0){
+        switch(frame.kind){
+            case FRAME_OUTPUT:
+                if(writeOut(1, frame.payload, frame.length) != 0){
+                    return 1;
+                }
+                break;
+            case FRAME_ERROR:
+                fprintf(stderr, "%s\n", frame.payload != NULL ? frame.payload : "");
+                break;
+            case FRAME_READ:
+                sent = sendInput(fd, &frame, &inputBuffer, &inputCapacity);
+                break;
+            case FRAME_EXIT: {
+                int status = frame.length == 1 ? (unsigned char)frame.payload[0] : 1;
+                free(frame.payload);
+                close(fd);
+                return status;
+            }
+            default:
+                sent = -1;
+        }
+        free(frame.payload);
+    }
+    fprintf(stderr, "Error: Lost the connection to the server\n");
+    return 1;
+}
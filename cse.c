@@ -0,0 +1,459 @@
+#include "cse.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+int cseEnabled = 1;
+int cseStats = 0;
+
+static atomic_int expressionCount = 0;
+
+/*
+ * Numbers are handed back when the last node holding one is freed, and
+ * reused before new ones, so the per-thread result tables stay the size of
+ * the trees alive at once. users[] counts the nodes holding each number.
+ */
+static pthread_mutex_t numberLock = PTHREAD_MUTEX_INITIALIZER;
+static int *users = NULL;
+static int userCapacity = 0;
+static int *freeNumbers = NULL;
+static int freeNumberCount = 0;
+static int freeNumberCapacity = 0;
+// Totals over every tree shared so far, for the report
+static unsigned long nodesParsed = 0;
+static unsigned long nodesKept = 0;
+static unsigned long expressionsNumbered = 0;
+static unsigned long evaluationsSaved = 0;
+
+/*
+ * Open-addressed set of nodes; for the nodes themselves when sharing, and
+ * for the first node of each expression when numbering.
+ */
+typedef struct {
+    Node **slots;
+    size_t capacity;    // a power of two
+    size_t count;
+} NodeSet;
+
+static uint64_t mix(uint64_t hash, uint64_t value){
+    hash ^= value;
+    hash *= 0x100000001b3ULL;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t hashString(uint64_t hash, const char *s){
+    for(; *s != '\0'; s++){
+        hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t hashNode(const Node *node){
+    uint64_t hash = mix(14695981039346656037ULL, node->type);
+    switch(node->type){
+        case NODE_OPERATOR:
+            hash = mix(hash, node->val.op);
+            break;
+        case NODE_VALUE:
+            hash = mix(hash, (uint64_t)node->val.value);
+            break;
+        case NODE_FLOAT: {
+            uint64_t bits;
+            memcpy(&bits, &node->val.number, sizeof(bits));
+            hash = mix(hash, bits);
+            break;
+        }
+        case NODE_VARIABLE:
+            // Each global read has its own inline cache slot; only whether it was resolved matters
+            hash = mix(hashString(hash, node->val.strValue), node->slot >= 0);
+            break;
+        case NODE_LOCAL:
+        case NODE_CAPTURED:
+            hash = mix(hashString(hash, node->val.strValue), (uint64_t)node->slot);
+            break;
+        case NODE_STRING_LITERAL:
+            hash = hashString(hash, node->val.string->data);
+            break;
+        default:
+            break;
+    }
+    hash = mix(hash, (uintptr_t)node->childNode);
+    return mix(hash, (uintptr_t)node->nextNode);
+}
+
+static int sameNode(const Node *a, const Node *b){
+    if(a->type != b->type || a->childNode != b->childNode || a->nextNode != b->nextNode){
+        return 0;
+    }
+    switch(a->type){
+        case NODE_OPERATOR:
+            return a->val.op == b->val.op;
+        case NODE_VALUE:
+            return a->val.value == b->val.value;
+        case NODE_FLOAT:
+            return memcmp(&a->val.number, &b->val.number, sizeof(double)) == 0;
+        case NODE_VARIABLE:
+            return (a->slot >= 0) == (b->slot >= 0) && strcmp(a->val.strValue, b->val.strValue) == 0;
+        case NODE_LOCAL:
+        case NODE_CAPTURED:
+            return a->slot == b->slot && strcmp(a->val.strValue, b->val.strValue) == 0;
+        case NODE_STRING_LITERAL:
+            return stringEqual(a->val.string, b->val.string);
+        case NODE_BIGINT:
+            return bigCompare(a->val.big, b->val.big) == 0;
+        default:
+            return 0;
+    }
+}
+
+static void setGrow(NodeSet *set, uint64_t (*hash)(const Node*)){
+    size_t capacity = set->capacity == 0 ? 64 : set->capacity * 2;
+    Node **slots = (Node**)memCalloc(capacity, sizeof(Node*));
+    for(size_t i = 0; i < set->capacity; i++){
+        if(set->slots[i] != NULL){
+            size_t slot = (size_t)hash(set->slots[i]) & (capacity - 1);
+            while(slots[slot] != NULL){
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = set->slots[i];
+        }
+    }
+    memFree(set->slots);
+    set->slots = slots;
+    set->capacity = capacity;
+}
+
+/**
+ * @brief Find a node equal to `node` in the set, adding `node` if there is none
+ * @return The node to use from now on
+ */
+static Node* setIntern(NodeSet *set, Node *node, uint64_t (*hash)(const Node*),
+                       int (*same)(const Node*, const Node*)){
+    if((set->count + 1) * 2 > set->capacity){
+        setGrow(set, hash);
+    }
+    size_t slot = (size_t)hash(node) & (set->capacity - 1);
+    for(; set->slots[slot] != NULL; slot = (slot + 1) & (set->capacity - 1)){
+        if(same(set->slots[slot], node)){
+            return set->slots[slot];
+        }
+    }
+    set->slots[slot] = node;
+    set->count++;
+    return node;
+}
+
+typedef struct {
+    NodeSet nodes;
+    unsigned long parsed;
+    unsigned long dropped;
+} Sharing;
+
+/**
+ * @brief Free a node that an equal one has replaced, but not what it points to
+ */
+static void dropDuplicate(Node *node){
+    // The node it was replaced by holds its own reference to these
+    if(node->childNode != NULL){
+        node->childNode->refs--;
+    }
+    if(node->nextNode != NULL){
+        node->nextNode->refs--;
+    }
+    node->childNode = NULL;
+    node->nextNode = NULL;
+    freeTree(node);
+}
+
+/**
+ * @brief Share a sibling list and everything below it, from the last sibling back
+ * @return The list's first node, possibly one shared with another list
+ */
+static Node* shareList(Node *head, Sharing *sharing){
+    int count = 0;
+    for(Node *node = head; node != NULL; node = node->nextNode){
+        count++;
+    }
+    Node *local[16];
+    Node **items = count <= 16 ? local : (Node**)memAlloc(sizeof(Node*) * count);
+    count = 0;
+    for(Node *node = head; node != NULL; node = node->nextNode){
+        items[count++] = node;
+    }
+    sharing->parsed += count;
+
+    Node *next = NULL;
+    for(int i = count - 1; i >= 0; i--){
+        Node *node = items[i];
+        node->nextNode = next;
+        if(node->type == NODE_OPERATOR || node->type == NODE_LAMBDA){
+            node->childNode = shareList(node->childNode, sharing);
+        }
+        if(node->type == NODE_LAMBDA){
+            next = node;
+            continue;
+        }
+        Node *shared = setIntern(&sharing->nodes, node, hashNode, sameNode);
+        if(shared != node){
+            shared->refs++;
+            dropDuplicate(node);
+            sharing->dropped++;
+        }
+        next = shared;
+    }
+
+    if(items != local){
+        memFree(items);
+    }
+    return next;
+}
+
+// Operator nodes are the same expression when operator and argument list match
+static uint64_t hashExpression(const Node *node){
+    return mix(mix(14695981039346656037ULL, node->val.op), (uintptr_t)node->childNode);
+}
+
+static int sameExpression(const Node *a, const Node *b){
+    return a->val.op == b->val.op && a->childNode == b->childNode;
+}
+
+static int cacheable(enum operators op){
+    switch(op){
+        case ADD: case SUB: case MUL: case DIV:
+        case GT: case LT: case EQ: case GTE: case LTE:
+        case AND: case OR: case NOT:
+        case IF: case SEQ:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int addInputs(Node *node, Node **inputs, int count){
+    for(; node != NULL; node = node->nextNode){
+        switch(node->type){
+            case NODE_VALUE:
+            case NODE_BIGINT:
+            case NODE_FLOAT:
+            case NODE_STRING_LITERAL:
+                break;
+            case NODE_VARIABLE:
+            case NODE_LOCAL:
+            case NODE_CAPTURED: {
+                if(node->type == NODE_VARIABLE && node->slot < 0){
+                    return -1;
+                }
+                int seen = 0;
+                for(int i = 0; i < count && !seen; i++){
+                    seen = inputs[i] == node ||
+                           (inputs[i]->type == node->type && (node->type == NODE_VARIABLE
+                               ? strcmp(inputs[i]->val.strValue, node->val.strValue) == 0
+                               : inputs[i]->slot == node->slot));
+                }
+                if(!seen){
+                    if(count == CSE_MAX_INPUTS){
+                        return -1;
+                    }
+                    inputs[count++] = node;
+                }
+                break;
+            }
+            case NODE_OPERATOR:
+                if(!cacheable(node->val.op)){
+                    return -1;
+                }
+                count = addInputs(node->childNode, inputs, count);
+                if(count < 0){
+                    return -1;
+                }
+                break;
+            default:
+                return -1;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief List the variables an expression reads
+ * @param node An operator node
+ * @param inputs Room for CSE_MAX_INPUTS nodes, one per variable
+ * @return How many there are, or -1 if the expression cannot be numbered
+ */
+int cseInputs(Node *node, Node **inputs){
+    if(node->type != NODE_OPERATOR || !cacheable(node->val.op)){
+        return -1;
+    }
+    return addInputs(node->childNode, inputs, 0);
+}
+
+// Call with numberLock held; the tables outlive any allocation arena
+static void growTable(int** table, int* capacity, int needed){
+    if(needed <= *capacity){
+        return;
+    }
+    int grown = *capacity == 0 ? 64 : *capacity;
+    while(grown < needed){
+        grown *= 2;
+    }
+    AllocArena *arena = allocArenaUse(NULL);
+    *table = (int*)memRealloc(*table, sizeof(int) * grown);
+    allocArenaUse(arena);
+    memset(*table + *capacity, 0, sizeof(int) * (grown - *capacity));
+    *capacity = grown;
+}
+
+// A number for a new expression, counting from 1 like Occurrences.number
+static int takeNumber(void){
+    pthread_mutex_lock(&numberLock);
+    int number = freeNumberCount > 0 ? freeNumbers[--freeNumberCount] : atomic_fetch_add(&expressionCount, 1) + 1;
+    pthread_mutex_unlock(&numberLock);
+    return number;
+}
+
+static void addUser(int index){
+    pthread_mutex_lock(&numberLock);
+    growTable(&users, &userCapacity, index + 1);
+    users[index]++;
+    pthread_mutex_unlock(&numberLock);
+}
+
+/**
+ * @brief Let go of a node's expression number, for freeTree
+ * @param index The node's `cse`
+ */
+void cseRelease(int index){
+    pthread_mutex_lock(&numberLock);
+    if(--users[index] == 0){
+        growTable(&freeNumbers, &freeNumberCapacity, freeNumberCount + 1);
+        freeNumbers[freeNumberCount++] = index + 1;
+    }
+    pthread_mutex_unlock(&numberLock);
+}
+
+/*
+ * Per expression while numbering: how often it occurs, and its number once
+ * it has one. Indexed like the set of first nodes.
+ */
+typedef struct {
+    unsigned int occurrences;
+    int number;
+} Occurrences;
+
+static Occurrences* findOccurrences(NodeSet *expressions, Occurrences *counts, Node *node){
+    size_t slot = (size_t)hashExpression(node) & (expressions->capacity - 1);
+    while(!sameExpression(expressions->slots[slot], node)){
+        slot = (slot + 1) & (expressions->capacity - 1);
+    }
+    return &counts[slot];
+}
+
+/**
+ * @brief Collect an operator node's expression (pass 0), count where it
+ * occurs (pass 1), or give it its expression's number (pass 2)
+ */
+static void numberNode(Node *node, NodeSet *expressions, Occurrences *counts, int pass){
+    if(node->type != NODE_OPERATOR){
+        return;
+    }
+    if(pass == 0){
+        setIntern(expressions, node, hashExpression, sameExpression);
+        return;
+    }
+    Occurrences *expression = findOccurrences(expressions, counts, node);
+    if(pass == 1){
+        // A shared node stands for every place that refers to it
+        expression->occurrences += node->refs;
+        return;
+    }
+    if(expression->number == 0){
+        Node *inputs[CSE_MAX_INPUTS];
+        if(expression->occurrences > 1 && cseInputs(node, inputs) >= 0){
+            expression->number = takeNumber();
+            __atomic_add_fetch(&expressionsNumbered, 1, __ATOMIC_RELAXED);
+        }else{
+            expression->number = -1;
+        }
+    }
+    node->cse = expression->number > 0 ? expression->number - 1 : -1;
+    if(node->cse >= 0){
+        addUser(node->cse);
+    }
+}
+
+/**
+ * @brief Share identical subtrees and number the common subexpressions
+ * @param root A resolved, analysed tree; its top-level forms are left unshared
+ */
+void cseShare(Node *root){
+    Sharing sharing = {{NULL, 0, 0}, 1, 0};
+    for(Node *form = root->childNode; form != NULL; form = form->nextNode){
+        sharing.parsed++;
+        form->childNode = shareList(form->childNode, &sharing);
+    }
+
+    // Each physical node is now in the set once, apart from the top-level forms
+    NodeSet expressions = {NULL, 0, 0};
+    Occurrences *counts = NULL;
+    for(int pass = 0; pass < 3; pass++){
+        if(pass == 1){
+            if(expressions.count == 0){
+                break;
+            }
+            counts = (Occurrences*)memCalloc(expressions.capacity, sizeof(Occurrences));
+        }
+        for(size_t i = 0; i < sharing.nodes.capacity; i++){
+            if(sharing.nodes.slots[i] != NULL){
+                numberNode(sharing.nodes.slots[i], &expressions, counts, pass);
+            }
+        }
+        for(Node *form = root->childNode; form != NULL; form = form->nextNode){
+            numberNode(form, &expressions, counts, pass);
+        }
+    }
+
+    __atomic_add_fetch(&nodesParsed, sharing.parsed, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&nodesKept, sharing.parsed - sharing.dropped, __ATOMIC_RELAXED);
+    memFree(counts);
+    memFree(sharing.nodes.slots);
+    memFree(expressions.slots);
+}
+
+/**
+ * @brief How many expressions have been numbered so far, over every tree
+ */
+int cseExpressionCount(void){
+    return atomic_load(&expressionCount);
+}
+
+void cseCountSaved(void){
+    __atomic_add_fetch(&evaluationsSaved, 1, __ATOMIC_RELAXED);
+}
+
+static void reportAtExit(void){
+    cseReport();
+}
+
+void cseStatsEnable(void){
+    if(!cseStats){
+        cseStats = 1;
+        atexit(reportAtExit);
+    }
+}
+
+/**
+ * @brief Print how much sharing saved, on stderr
+ */
+void cseReport(void){
+    unsigned long parsed = __atomic_load_n(&nodesParsed, __ATOMIC_RELAXED);
+    unsigned long kept = __atomic_load_n(&nodesKept, __ATOMIC_RELAXED);
+    fprintf(stderr, "cse: %lu nodes parsed, %lu after sharing (%.1f%% shared), "
+            "%lu common subexpressions, %lu evaluations saved\n",
+            parsed, kept, parsed > 0 ? 100.0 * (double)(parsed - kept) / (double)parsed : 0.0,
+            __atomic_load_n(&expressionsNumbered, __ATOMIC_RELAXED),
+            __atomic_load_n(&evaluationsSaved, __ATOMIC_RELAXED));
+}
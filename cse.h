@@ -0,0 +1,54 @@
+#ifndef LISP_LITE_CSE_H
+#define LISP_LITE_CSE_H
+#include "library.h"
+
+/*
+ * Hash-consing and common subexpression elimination, run once after effect
+ * analysis.
+ *
+ * cseShare makes structurally identical subtrees share their nodes: below
+ * the top level, a node whose type, value, children and following siblings
+ * all match one seen before is replaced by that one, so an expression that
+ * is written many times, and any argument list it ends, is stored once.
+ * Shared nodes are reference counted and freeTree frees each on its last
+ * reference. Lambdas are never shared, since resolving gives each its own
+ * captures.
+ *
+ * Operator nodes with the same operator and, after sharing, the same
+ * argument list are then the same expression. Every expression that occurs
+ * more than once, is built only from arithmetic, comparisons, and, or, not,
+ * if, seq, literals and variable reads, and reads at most CSE_MAX_INPUTS
+ * different variables gets a number in `cse` on all its nodes. Per thread,
+ * the evaluator keeps the last result of each number with the values the
+ * variables had, and an occurrence whose variables hold the same values
+ * again takes that result instead of being evaluated: once per stretch in
+ * which none of its variables is redefined. Strings and bignums are
+ * compared by identity, which is sound only while none is freed, so
+ * resetEvaluator and forgetSharedResults() drop every remembered result;
+ * code that frees values between evaluations (--each-line records,
+ * --serve requests, embedding calls) goes through one of them.
+ */
+
+#define CSE_MAX_INPUTS 4
+
+// Cleared by --no-cse before anything is evaluated; sharing still happens
+extern int cseEnabled;
+
+// Set by --cse-stats: count evaluations saved, and report at exit
+extern int cseStats;
+
+void cseShare(Node* root);
+
+int cseInputs(Node* node, Node** inputs);
+
+int cseExpressionCount(void);
+
+void cseRelease(int index);
+
+void cseCountSaved(void);
+
+void cseStatsEnable(void);
+
+void cseReport(void);
+
+#endif //LISP_LITE_CSE_H
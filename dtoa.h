@@ -0,0 +1,25 @@
+#ifndef LISP_LITE_DTOA_H
+#define LISP_LITE_DTOA_H
+#include <stdint.h>
+
+/*
+ * Shortest decimal digits of a double, with Ulf Adams' Ryu ("Ryū: fast
+ * float-to-string conversion", PLDI 2018). Of all the decimals that read
+ * back to the same double, Ryu picks one with the fewest digits, and of
+ * those the one nearest the double (ties to an even last digit), which is
+ * exactly what correctly rounding with %.17g and trimming would give. It
+ * works in 64x128-bit multiplications against a table of powers of five,
+ * with no loop over candidate precisions and no strtod.
+ */
+
+/**
+ * @brief Split a finite double into |value| = digits * 10^exponent with the
+ *        fewest possible digits
+ * @param value A finite double; 0 and -0 give 0 * 10^0
+ * @param digits Receives the decimal significand, at most 17 digits, which
+ *        may still end in zeros after rounding up
+ * @param exponent Receives the power of ten
+ */
+void shortestDecimal(double value, uint64_t* digits, int* exponent);
+
+#endif //LISP_LITE_DTOA_H
@@ -0,0 +1,350 @@
+#include "effects.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Everything the program binds with DEF under one global name. The name
+ * is only a known function if every binding is a lambda.
+ */
+typedef struct {
+    const char *name;
+    Node **definitions;
+    int count;
+    int allLambdas;
+    int pure;
+    int costState;  // 0 not computed, 1 in progress, 2 done
+    unsigned int cost;
+} Function;
+
+struct EffectsTable {
+    Function *items;
+    int count;
+    int capacity;
+    // Open-addressed index into items by name: item + 1, or 0 when empty
+    int *slots;
+    int slotCount;
+};
+
+static unsigned int hashName(const char *name){
+    unsigned int hash = 2166136261u;
+    for(; *name != '\0'; name++){
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+static Function* findFunction(EffectsTable *table, const char *name){
+    if(table->slotCount == 0){
+        return NULL;
+    }
+    for(unsigned int i = hashName(name) & (table->slotCount - 1); table->slots[i] != 0;
+        i = (i + 1) & (table->slotCount - 1)){
+        Function *function = &table->items[table->slots[i] - 1];
+        if(strcmp(function->name, name) == 0){
+            return function;
+        }
+    }
+    return NULL;
+}
+
+static Function* addFunction(EffectsTable *table, const char *name){
+    if(table->count == table->capacity){
+        table->capacity = table->capacity == 0 ? 16 : table->capacity * 2;
+        table->items = (Function*)memRealloc(table->items, sizeof(Function) * table->capacity);
+        // Keep the index at most half full
+        memFree(table->slots);
+        table->slotCount = table->capacity * 2;
+        table->slots = (int*)memCalloc(table->slotCount, sizeof(int));
+        for(int i = 0; i < table->count; i++){
+            unsigned int slot = hashName(table->items[i].name) & (table->slotCount - 1);
+            while(table->slots[slot] != 0){
+                slot = (slot + 1) & (table->slotCount - 1);
+            }
+            table->slots[slot] = i + 1;
+        }
+    }
+    unsigned int slot = hashName(name) & (table->slotCount - 1);
+    while(table->slots[slot] != 0){
+        slot = (slot + 1) & (table->slotCount - 1);
+    }
+    table->slots[slot] = table->count + 1;
+    Function *function = &table->items[table->count++];
+    *function = (Function){name, NULL, 0, 1, 0, 0, 0};
+    return function;
+}
+
+static void collectDefinitions(Node *node, EffectsTable *table){
+    for(; node != NULL; node = node->nextNode){
+        if(node->type == NODE_OPERATOR && node->val.op == DEF
+           && node->childNode != NULL && node->childNode->type == NODE_VARIABLE
+           && node->childNode->nextNode != NULL){
+            const char *name = node->childNode->val.strValue;
+            Function *function = findFunction(table, name);
+            if(function == NULL){
+                function = addFunction(table, name);
+            }
+            Node *value = node->childNode->nextNode;
+            function->definitions = (Node**)memRealloc(function->definitions, sizeof(Node*) * (function->count + 1));
+            function->definitions[function->count++] = value;
+            if(value->type != NODE_LAMBDA){
+                function->allLambdas = 0;
+            }
+        }
+        if(node->type == NODE_OPERATOR || node->type == NODE_LAMBDA){
+            collectDefinitions(node->childNode, table);
+        }
+    }
+}
+
+static int hasEffects(enum operators op){
+    switch(op){
+        case PRINT:
+        case INPUT:
+        case DEF:
+        case READ_ALL:
+        case READ_LINES:
+        case READ_N:
+        case MAP_PUT:
+        case MAP_DEL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int formsPure(Node *forms, EffectsTable *table);
+
+/**
+ * @brief Whether calling what `callee` evaluates to is known to be pure
+ */
+static int calleePure(Node *callee, EffectsTable *table){
+    if(callee == NULL){
+        return 0;
+    }
+    if(callee->type == NODE_VARIABLE){
+        Function *function = findFunction(table, callee->val.strValue);
+        return function != NULL && function->pure;
+    }
+    if(callee->type == NODE_LAMBDA){
+        return formsPure(callee->childNode, table);
+    }
+    // A parameter or captured variable could hold any function
+    return 0;
+}
+
+static int formsPure(Node *forms, EffectsTable *table){
+    for(Node *node = forms; node != NULL; node = node->nextNode){
+        if(node->type != NODE_OPERATOR){
+            // Variables and constants read, and a lambda only builds a closure
+            continue;
+        }
+        if(hasEffects(node->val.op)){
+            return 0;
+        }
+        if(node->val.op == CALL && !calleePure(node->childNode, table)){
+            return 0;
+        }
+        if(!formsPure(node->childNode, table)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Find which known functions are pure
+ *
+ * Starts from "every all-lambda name is pure" and knocks out functions until
+ * nothing changes, so recursive functions can come out pure.
+ */
+static void solvePurity(EffectsTable *table){
+    for(int i = 0; i < table->count; i++){
+        table->items[i].pure = table->items[i].allLambdas;
+    }
+    int changed = 1;
+    while(changed){
+        changed = 0;
+        for(int i = 0; i < table->count; i++){
+            Function *function = &table->items[i];
+            if(!function->pure){
+                continue;
+            }
+            for(int d = 0; d < function->count; d++){
+                if(!formsPure(function->definitions[d]->childNode, table)){
+                    function->pure = 0;
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static unsigned int addCost(unsigned int a, unsigned int b){
+    return a > COST_UNBOUNDED - b ? COST_UNBOUNDED : a + b;
+}
+
+static void annotate(Node *node, EffectsTable *table);
+
+static unsigned int bodyCost(Node *lambdaNode, EffectsTable *table){
+    unsigned int cost = 0;
+    for(Node *form = lambdaNode->childNode; form != NULL; form = form->nextNode){
+        annotate(form, table);
+        cost = addCost(cost, form->cost);
+    }
+    return cost;
+}
+
+/**
+ * @brief Cost of one call to a known function, the most expensive definition
+ */
+static unsigned int functionCost(Function *function, EffectsTable *table){
+    if(function->costState == 1){
+        // Reached itself again: recursion, so no static bound
+        return COST_UNBOUNDED;
+    }
+    if(function->costState == 0){
+        function->costState = 1;
+        unsigned int cost = 0;
+        for(int d = 0; d < function->count; d++){
+            unsigned int definitionCost = bodyCost(function->definitions[d], table);
+            if(definitionCost > cost){
+                cost = definitionCost;
+            }
+        }
+        function->cost = cost;
+        function->costState = 2;
+    }
+    return function->cost;
+}
+
+static int forkable(enum operators op){
+    switch(op){
+        case ADD: case SUB: case MUL: case DIV:
+        case GT: case LT: case EQ: case GTE: case LTE:
+        case AND: case OR:
+        case CALL:
+        case VEC: case MAKE_VEC: case VEC_RANGE: case VEC_REF: case VEC_LEN:
+        case VEC_ADD: case VEC_SUB: case VEC_MUL: case VEC_DIV:
+        case VEC_SUM: case VEC_MIN: case VEC_MAX: case VEC_DOT:
+        case VEC_LT: case VEC_GT: case VEC_EQ:
+        case MAP: case MAP_GET: case MAP_PUT: case MAP_DEL: case MAP_HAS: case MAP_SIZE:
+        case LENGTH: case SUBSTRING: case INDEX_OF: case CONTAINS: case STARTS_WITH:
+        case SPLIT: case JOIN: case REPLACE: case UPPER: case LOWER:
+        case RE_MATCH: case RE_FIND: case RE_REPLACE:
+        case LIST: case CONS: case CAR: case CDR: case NTH: case APPEND: case REVERSE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Set pure, cost and fork on a node and everything below it
+ */
+static void annotate(Node *node, EffectsTable *table){
+    node->pure = 1;
+    node->cost = 1;
+    node->fork = 0;
+
+    if(node->type == NODE_LAMBDA){
+        // Building the closure is all that happens here; the body is
+        // annotated for when it is called
+        bodyCost(node, table);
+        return;
+    }
+    if(node->type != NODE_OPERATOR){
+        return;
+    }
+
+    for(Node *child = node->childNode; child != NULL; child = child->nextNode){
+        annotate(child, table);
+        node->pure &= child->pure;
+        node->cost = addCost(node->cost, child->cost);
+    }
+
+    enum operators op = node->val.op;
+    Node *arguments = node->childNode;
+    if(hasEffects(op)){
+        node->pure = 0;
+    }else if(op == CALL && arguments != NULL){
+        Node *callee = arguments;
+        arguments = callee->nextNode;
+        node->pure &= calleePure(callee, table);
+        if(callee->type == NODE_VARIABLE){
+            Function *function = findFunction(table, callee->val.strValue);
+            if(function != NULL && function->allLambdas){
+                node->cost = addCost(node->cost, functionCost(function, table));
+            }
+        }else if(callee->type == NODE_LAMBDA){
+            node->cost = addCost(node->cost, bodyCost(callee, table));
+        }
+    }
+
+    if(forkable(op)){
+        int allPure = 1;
+        int heavy = 0;
+        for(Node *argument = arguments; argument != NULL; argument = argument->nextNode){
+            allPure &= argument->pure;
+            heavy += argument->cost >= FORK_COST_THRESHOLD;
+        }
+        node->fork = allPure && heavy >= 2;
+    }
+}
+
+static int countForks(Node *node){
+    int count = 0;
+    for(; node != NULL; node = node->nextNode){
+        count += node->fork;
+        if(node->type == NODE_OPERATOR || node->type == NODE_LAMBDA){
+            count += countForks(node->childNode);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Collect a program's global definitions and work out which are pure functions
+ * @param program The resolved tree; the table points into it
+ */
+EffectsTable* effectsTableCreate(Node* program){
+    EffectsTable *table = (EffectsTable*)memCalloc(1, sizeof(EffectsTable));
+    collectDefinitions(program, table);
+    solvePurity(table);
+    return table;
+}
+
+/**
+ * @brief Mark pure subtrees, estimate costs and pick fork points
+ * @param table The definitions calls are resolved against
+ * @param root A resolved tree from the same program
+ * @return The number of operators marked for parallel argument evaluation
+ */
+int effectsAnnotate(EffectsTable* table, Node* root){
+    for(Node *node = root; node != NULL; node = node->nextNode){
+        annotate(node, table);
+    }
+    return countForks(root);
+}
+
+void effectsTableFree(EffectsTable* table){
+    for(int i = 0; i < table->count; i++){
+        memFree(table->items[i].definitions);
+    }
+    memFree(table->items);
+    memFree(table->slots);
+    memFree(table);
+}
+
+/**
+ * @brief Analyse a whole program on its own
+ * @param root The resolved tree
+ * @return The number of operators marked for parallel argument evaluation
+ */
+int analyzeEffects(Node* root){
+    EffectsTable *table = effectsTableCreate(root);
+    int forks = effectsAnnotate(table, root);
+    effectsTableFree(table);
+    return forks;
+}
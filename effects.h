@@ -0,0 +1,43 @@
+#ifndef LISP_LITE_EFFECTS_H
+#define LISP_LITE_EFFECTS_H
+#include "library.h"
+
+/*
+ * Static effect and cost analysis, run once after a tree is resolved.
+ *
+ * A subtree is pure when evaluating it can neither be observed nor change
+ * what other code sees: no PRINT, INPUT, DEF, stdin reads or map mutation,
+ * and calls only to global functions whose every definition is a lambda
+ * with a pure body. Its cost is the number of nodes evaluated, with calls
+ * to known functions expanded and recursion counted as unbounded.
+ *
+ * Only the program's own definitions are seen. A name bound before the
+ * program starts, by a host or an earlier program, is assumed not to be
+ * called before the program's DEF rebinds it; that cannot be checked here,
+ * so parallel evaluation only runs when asked for with --threads.
+ *
+ * Operators whose arguments are all pure, with at least two of them costing
+ * FORK_COST_THRESHOLD or more, are marked for parallel argument evaluation.
+ */
+
+#define COST_UNBOUNDED 0xffffffffu
+
+// Below this many nodes an argument is cheaper to evaluate than to hand off
+#define FORK_COST_THRESHOLD 1000
+
+int analyzeEffects(Node* root);
+
+/*
+ * The same in two steps, for a program that changes a piece at a time:
+ * the table of its definitions can be kept and used to annotate new pieces
+ * for as long as no definition of a function changes.
+ */
+typedef struct EffectsTable EffectsTable;
+
+EffectsTable* effectsTableCreate(Node* program);
+
+int effectsAnnotate(EffectsTable* table, Node* root);
+
+void effectsTableFree(EffectsTable* table);
+
+#endif //LISP_LITE_EFFECTS_H
@@ -0,0 +1,65 @@
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+static _Thread_local ErrorTrap* trapTop = NULL;
+
+void errorTrapPush(ErrorTrap* trap){
+    trap->code = ERROR_NONE;
+    trap->message[0] = '\0';
+    trap->previous = trapTop;
+    trapTop = trap;
+}
+
+void errorTrapPop(ErrorTrap* trap){
+    trapTop = trap->previous;
+}
+
+/**
+ * @brief Short lowercase name of an error code, e.g. "type"
+ */
+const char* errorName(ErrorCode code){
+    switch(code){
+        case ERROR_NONE: return "none";
+        case ERROR_SYNTAX: return "syntax";
+        case ERROR_UNBOUND: return "unbound";
+        case ERROR_TYPE: return "type";
+        case ERROR_ARITY: return "arity";
+        case ERROR_RANGE: return "range";
+        case ERROR_IO: return "io";
+        case ERROR_RESOURCE: return "resource";
+        case ERROR_UNSUPPORTED: return "unsupported";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Report an error and leave the current evaluation
+ * @param code What kind of error it is; never ERROR_NONE
+ * @param format printf-style message, conventionally "Error: ...\n"
+ *
+ * Unwinds to the innermost trap on this thread, or exits when there is none.
+ */
+_Noreturn void fatalError(ErrorCode code, const char* format, ...){
+    va_list args;
+    va_start(args, format);
+
+    ErrorTrap* trap = trapTop;
+    if(trap == NULL){
+        vfprintf(stderr, format, args);
+        va_end(args);
+        exit(1);
+    }
+
+    vsnprintf(trap->message, sizeof(trap->message), format, args);
+    va_end(args);
+    size_t length = strlen(trap->message);
+    if(length > 0 && trap->message[length - 1] == '\n'){
+        trap->message[length - 1] = '\0';
+    }
+    trap->code = code;
+    trapTop = trap->previous;
+    longjmp(trap->jump, (int)code);
+}
@@ -0,0 +1,53 @@
+#ifndef LISP_LITE_ERROR_H
+#define LISP_LITE_ERROR_H
+#include <setjmp.h>
+
+/*
+ * Every error the interpreter can hit goes through fatalError(), with a code
+ * saying what kind of error it is. With no trap set it prints the message
+ * to stderr and exits, as a script run from the command line expects. An
+ * embedder sets a trap around each call into the interpreter, and the error
+ * then unwinds to it instead:
+ *
+ *     ErrorTrap trap;
+ *     errorTrapPush(&trap);
+ *     if(setjmp(trap.jump) == 0){
+ *         ...
+ *         errorTrapPop(&trap);
+ *     }else{
+ *         // trap.code and trap.message hold the error; the trap is already popped
+ *     }
+ *
+ * setjmp also returns the code. Traps are per thread and nest.
+ */
+
+#define ERROR_MESSAGE_SIZE 256
+
+typedef enum {
+    ERROR_NONE,
+    ERROR_SYNTAX,       // the program text does not parse
+    ERROR_UNBOUND,      // a variable that was never defined
+    ERROR_TYPE,         // a value of the wrong type, or a call of a non-function
+    ERROR_ARITY,        // the wrong number of arguments
+    ERROR_RANGE,        // division by zero, a missing key, an index out of bounds
+    ERROR_IO,           // input or a connection that could not be read
+    ERROR_RESOURCE,     // out of memory, value stack or threads
+    ERROR_UNSUPPORTED   // something the operator or backend does not handle
+} ErrorCode;
+
+typedef struct ErrorTrap {
+    jmp_buf jump;
+    ErrorCode code;
+    char message[ERROR_MESSAGE_SIZE];
+    struct ErrorTrap* previous;
+} ErrorTrap;
+
+void errorTrapPush(ErrorTrap* trap);
+
+void errorTrapPop(ErrorTrap* trap);
+
+const char* errorName(ErrorCode code);
+
+_Noreturn void fatalError(ErrorCode code, const char* format, ...);
+
+#endif //LISP_LITE_ERROR_H
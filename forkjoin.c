@@ -0,0 +1,208 @@
+#include "forkjoin.h"
+#include "error.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * Tasks live in items[top, bottom). The owner pushes and pops at the bottom
+ * and thieves take from the top; both ends move under the lock, which is
+ * uncontended unless someone is stealing.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int top;
+    int bottom;
+    ForkTask* items[FORK_DEQUE_CAPACITY];
+} Deque;
+
+static Deque* deques = NULL;
+static int participants = 0;
+static int started = 0;
+
+// Workers not running a task; forks are only worth making while one exists
+static atomic_int idle = 0;
+// Tasks sitting in some deque
+static atomic_int pending = 0;
+static atomic_int sleepers = 0;
+static pthread_mutex_t sleepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+// This thread's deque, or -1 for threads outside the pool
+static _Thread_local int self = -1;
+static _Thread_local uint32_t victimSeed = 1;
+
+static void runTask(ForkTask* task){
+    task->run(task);
+    atomic_store_explicit(&task->done, 1, memory_order_release);
+}
+
+static ForkTask* stealFrom(Deque* deque){
+    ForkTask* task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->top < deque->bottom){
+        task = deque->items[deque->top++];
+        if(deque->top == deque->bottom){
+            deque->top = deque->bottom = 0;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    if(task != NULL){
+        atomic_fetch_sub(&pending, 1);
+    }
+    return task;
+}
+
+/**
+ * @brief Take the oldest task from any other deque, starting at a random one
+ */
+static ForkTask* stealAny(void){
+    if(atomic_load_explicit(&pending, memory_order_relaxed) == 0){
+        return NULL;
+    }
+    victimSeed ^= victimSeed << 13;
+    victimSeed ^= victimSeed >> 17;
+    victimSeed ^= victimSeed << 5;
+    int start = (int)(victimSeed % (uint32_t)participants);
+    for(int i = 0; i < participants; i++){
+        int victim = (start + i) % participants;
+        if(victim == self){
+            continue;
+        }
+        ForkTask* task = stealFrom(&deques[victim]);
+        if(task != NULL){
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void* workerMain(void* arg){
+    self = (int)(intptr_t)arg;
+    victimSeed = (uint32_t)self * 2654435761u + 1;
+    atomic_fetch_add(&idle, 1);
+
+    for(;;){
+        ForkTask* task = stealAny();
+        if(task != NULL){
+            atomic_fetch_sub(&idle, 1);
+            runTask(task);
+            atomic_fetch_add(&idle, 1);
+            continue;
+        }
+
+        // Sleep until something is spawned. Spawners check `sleepers` after
+        // publishing a task and sleepers check `pending` after announcing
+        // themselves, so one of the two always sees the other.
+        pthread_mutex_lock(&sleepLock);
+        atomic_fetch_add(&sleepers, 1);
+        while(atomic_load(&pending) == 0){
+            pthread_cond_wait(&wake, &sleepLock);
+        }
+        atomic_fetch_sub(&sleepers, 1);
+        pthread_mutex_unlock(&sleepLock);
+    }
+    return NULL;
+}
+
+static void startWorkers(void){
+    started = 1;
+    for(int i = 1; i < participants; i++){
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, workerMain, (void*)(intptr_t)i) != 0){
+            fatalError(ERROR_RESOURCE, "Error: Could not start worker thread\n");
+        }
+        pthread_detach(thread);
+    }
+}
+
+/**
+ * @brief Make the calling thread the root of a pool of `threads` threads
+ * @param threads Total threads including the caller; 1 or less disables forking
+ *
+ * Workers are only started on the first spawn, so programs that never fork
+ * never pay for them.
+ */
+void forkJoinInit(int threads){
+    if(threads <= 1 || deques != NULL){
+        return;
+    }
+    participants = threads;
+    deques = (Deque*)memCalloc((size_t)threads, sizeof(Deque));
+    for(int i = 0; i < threads; i++){
+        pthread_mutex_init(&deques[i].lock, NULL);
+    }
+    self = 0;
+}
+
+/**
+ * @brief Whether spawning from this thread could run anything in parallel
+ *
+ * False outside the pool, and while every worker is busy: then the caller
+ * is better off evaluating the work itself.
+ */
+int forkJoinActive(void){
+    return self >= 0 && (!started || atomic_load_explicit(&idle, memory_order_relaxed) > 0);
+}
+
+/**
+ * @brief Offer a task to the pool
+ * @return 0 if the deque is full, in which case the caller runs the task
+ */
+int forkJoinSpawn(ForkTask* task){
+    if(!started){
+        startWorkers();
+    }
+    atomic_store_explicit(&task->done, 0, memory_order_relaxed);
+
+    Deque* deque = &deques[self];
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom == FORK_DEQUE_CAPACITY){
+        pthread_mutex_unlock(&deque->lock);
+        return 0;
+    }
+    deque->items[deque->bottom++] = task;
+    pthread_mutex_unlock(&deque->lock);
+
+    atomic_fetch_add(&pending, 1);
+    if(atomic_load(&sleepers) > 0){
+        pthread_mutex_lock(&sleepLock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&sleepLock);
+    }
+    return 1;
+}
+
+/**
+ * @brief Wait for a spawned task, running it here if nobody has taken it
+ *
+ * Tasks must be waited for in the reverse order they were spawned. While a
+ * stolen task is still running, this thread steals other work meanwhile.
+ */
+void forkJoinWait(ForkTask* task){
+    Deque* deque = &deques[self];
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom > deque->top && deque->items[deque->bottom - 1] == task){
+        deque->bottom--;
+        if(deque->top == deque->bottom){
+            deque->top = deque->bottom = 0;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        atomic_fetch_sub(&pending, 1);
+        runTask(task);
+        return;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    while(!atomic_load_explicit(&task->done, memory_order_acquire)){
+        ForkTask* other = stealAny();
+        if(other != NULL){
+            runTask(other);
+        }else{
+            sched_yield();
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef LISP_LITE_FORKJOIN_H
+#define LISP_LITE_FORKJOIN_H
+#include <stdatomic.h>
+
+/*
+ * Work-stealing fork-join pool. The thread that calls forkJoinInit() and
+ * the pool's workers each own a deque: a thread spawns onto the bottom of
+ * its own deque and takes work back from there, while idle threads steal
+ * the oldest task from the top of someone else's.
+ *
+ * Tasks are owned by the spawner, which must forkJoinWait() on every task
+ * it spawned before the task goes out of scope.
+ */
+
+#define FORK_DEQUE_CAPACITY 256
+
+typedef struct ForkTask ForkTask;
+struct ForkTask {
+    void (*run)(ForkTask* task);
+    atomic_int done;
+};
+
+void forkJoinInit(int threads);
+
+int forkJoinActive(void);
+
+int forkJoinSpawn(ForkTask* task);
+
+void forkJoinWait(ForkTask* task);
+
+#endif //LISP_LITE_FORKJOIN_H
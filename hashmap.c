@@ -0,0 +1,310 @@
+#include "hashmap.h"
+#include "output.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOT_EMPTY   0
+#define SLOT_DELETED 1
+
+#define INITIAL_CAPACITY 8
+
+// Buckets of the old table moved per operation while a resize is in flight.
+// Draining C buckets must finish before the new 2C table fills up, which
+// takes at least 0.75C inserts, so anything above 1.34 per insert is enough.
+#define MIGRATE_STEP 4
+
+static uint64_t mix64(uint64_t x){
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t hashString(const String *string){
+    const char *s = string->bytes;
+    size_t length = string->length;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ length;
+    while(length >= 8){
+        uint64_t chunk;
+        memcpy(&chunk, s, 8);
+        h = mix64(h ^ chunk);
+        s += 8;
+        length -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, s, length);
+    return mix64(h ^ tail);
+}
+
+/**
+ * @brief Hash a key, keeping clear of the empty and deleted markers
+ */
+static uint64_t hashKey(Value key){
+    uint64_t h;
+    if(key.type == VAL_INT){
+        h = mix64((uint64_t)key.intValue);
+    }else if(key.type == VAL_STRING){
+        h = hashString(key.string) ^ 0x5bd1e995ULL; // keep 1 and "1" apart
+    }else{
+        fatalError(ERROR_TYPE, "Error: Map keys must be INT or STRING\n");
+    }
+    return h < 2 ? h + 2 : h;
+}
+
+static int keysEqual(Value a, Value b){
+    if(a.type != b.type){
+        return 0;
+    }
+    if(a.type == VAL_INT){
+        return a.intValue == b.intValue;
+    }
+    return stringEqual(a.string, b.string);
+}
+
+static void tableInit(MapTable *table, size_t capacity){
+    table->slots = (MapSlot*)memCalloc(capacity, sizeof(MapSlot));
+    if(table->slots == NULL){
+        fatalError(ERROR_RESOURCE, "Error: Out of memory growing a map to %zu slots\n", capacity);
+    }
+    table->capacity = capacity;
+    table->live = 0;
+    table->used = 0;
+}
+
+/**
+ * @brief Linear probe for a key
+ * @return The slot holding the key, or NULL
+ */
+static MapSlot* tableFind(const MapTable *table, Value key, uint64_t hash){
+    if(table->live == 0){
+        return NULL;
+    }
+    size_t mask = table->capacity - 1;
+    for(size_t i = hash & mask;; i = (i + 1) & mask){
+        MapSlot *slot = &table->slots[i];
+        if(slot->hash == SLOT_EMPTY){
+            return NULL;
+        }
+        if(slot->hash == hash && keysEqual(slot->key, key)){
+            return slot;
+        }
+    }
+}
+
+/**
+ * @brief Place a key that is known not to be in the table
+ */
+static void tableInsertNew(MapTable *table, uint64_t hash, Value key, Value value){
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    while(table->slots[i].hash > SLOT_DELETED){
+        i = (i + 1) & mask;
+    }
+    if(table->slots[i].hash == SLOT_EMPTY){
+        table->used++;
+    }
+    table->slots[i] = (MapSlot){hash, key, value};
+    table->live++;
+}
+
+/**
+ * @brief Move a few buckets of the old table into the current one
+ * @param budget How many old buckets to visit
+ */
+static void migrate(HashMap *map, size_t budget){
+    MapTable *old = &map->old;
+    if(old->slots == NULL){
+        return;
+    }
+    size_t end = map->migrated + budget;
+    if(end > old->capacity) end = old->capacity;
+    for(; map->migrated < end; map->migrated++){
+        MapSlot *slot = &old->slots[map->migrated];
+        if(slot->hash > SLOT_DELETED){
+            tableInsertNew(&map->current, slot->hash, slot->key, slot->value);
+            // Leave a deletion marker so probes past this bucket still work
+            slot->hash = SLOT_DELETED;
+            old->live--;
+        }
+    }
+    if(map->migrated == old->capacity){
+        memFree(old->slots);
+        *old = (MapTable){NULL, 0, 0, 0};
+        map->migrated = 0;
+    }
+}
+
+/**
+ * @brief Make room for one more entry in the current table
+ *
+ * Past 3/4 full (deleted slots included) a new table is started and the
+ * current one becomes `old`, to be drained by later operations.
+ */
+static void reserveOne(HashMap *map){
+    MapTable *current = &map->current;
+    if((current->used + 1) * 4 <= current->capacity * 3){
+        return;
+    }
+
+    // A previous resize is somehow still draining: finish it first
+    migrate(map, map->old.capacity);
+
+    // Grow by live entries; a table full of deletions just gets rebuilt
+    size_t capacity = current->capacity;
+    while((current->live + 1) * 2 > capacity){
+        capacity *= 2;
+    }
+    map->old = *current;
+    map->migrated = 0;
+    tableInit(current, capacity);
+}
+
+HashMap* createHashMap(void){
+    HashMap *map = (HashMap*)memAlloc(sizeof(HashMap));
+    tableInit(&map->current, INITIAL_CAPACITY);
+    map->old = (MapTable){NULL, 0, 0, 0};
+    map->migrated = 0;
+    return map;
+}
+
+static MapSlot* mapFind(const HashMap *map, Value key, uint64_t hash){
+    MapSlot *slot = tableFind(&map->current, key, hash);
+    if(slot == NULL && map->old.slots != NULL){
+        slot = tableFind(&map->old, key, hash);
+    }
+    return slot;
+}
+
+static void mapPut(HashMap *map, Value key, Value value){
+    uint64_t hash = hashKey(key);
+    migrate(map, MIGRATE_STEP);
+
+    MapSlot *slot = mapFind(map, key, hash);
+    if(slot != NULL){
+        // Still in the old table is fine; it moves across with its bucket
+        slot->value = value;
+        return;
+    }
+    reserveOne(map);
+    tableInsertNew(&map->current, hash, key, value);
+}
+
+static int mapDelete(HashMap *map, Value key){
+    uint64_t hash = hashKey(key);
+    migrate(map, MIGRATE_STEP);
+
+    MapTable *tables[2] = {&map->current, &map->old};
+    for(int t = 0; t < 2; t++){
+        if(tables[t]->slots == NULL) continue;
+        MapSlot *slot = tableFind(tables[t], key, hash);
+        if(slot != NULL){
+            slot->hash = SLOT_DELETED;
+            tables[t]->live--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static HashMap* expectMap(enum operators op, Value value){
+    if(value.type != VAL_MAP){
+        fatalError(ERROR_TYPE, "Error: Expected map in %s\n", getOperatorSymbol(op));
+    }
+    return value.map;
+}
+
+static void expectArgs(enum operators op, int argc, int min, int max){
+    if(argc < min || argc > max){
+        fatalError(ERROR_ARITY, "Error: Wrong number of arguments for %s\n", getOperatorSymbol(op));
+    }
+}
+
+/**
+ * @brief Evaluate a map builtin on already-evaluated arguments
+ * @param op One of the MAP_* operators
+ * @param args The argument values
+ * @param argc The number of arguments
+ * @return The result
+ */
+Value evaluateMapOp(enum operators op, Value* args, int argc){
+    switch(op){
+        case MAP: {
+            if(argc % 2 != 0){
+                fatalError(ERROR_ARITY, "Error: MAP expects key value pairs\n");
+            }
+            HashMap *map = createHashMap();
+            for(int i = 0; i < argc; i += 2){
+                mapPut(map, args[i], args[i + 1]);
+            }
+            return (Value){.type = VAL_MAP, .map = map};
+        }
+        case MAP_GET: {
+            // (map-get m key) or (map-get m key default)
+            expectArgs(op, argc, 2, 3);
+            HashMap *map = expectMap(op, args[0]);
+            MapSlot *slot = mapFind(map, args[1], hashKey(args[1]));
+            if(slot != NULL){
+                return slot->value;
+            }
+            if(argc == 3){
+                return args[2];
+            }
+            if(args[1].type == VAL_INT){
+                fatalError(ERROR_RANGE, "Error: Key %lld not found\n", args[1].intValue);
+            }
+            fatalError(ERROR_RANGE, "Error: Key \"%.*s\" not found\n", (int)args[1].string->length, args[1].string->bytes);
+        }
+        case MAP_PUT:
+            expectArgs(op, argc, 3, 3);
+            mapPut(expectMap(op, args[0]), args[1], args[2]);
+            return args[0];
+        case MAP_DEL:
+            expectArgs(op, argc, 2, 2);
+            return makeIntValue(mapDelete(expectMap(op, args[0]), args[1]));
+        case MAP_HAS: {
+            expectArgs(op, argc, 2, 2);
+            HashMap *map = expectMap(op, args[0]);
+            return makeIntValue(mapFind(map, args[1], hashKey(args[1])) != NULL);
+        }
+        case MAP_SIZE: {
+            expectArgs(op, argc, 1, 1);
+            HashMap *map = expectMap(op, args[0]);
+            return makeIntValue((long long)(map->current.live + map->old.live));
+        }
+        default:
+            fatalError(ERROR_UNSUPPORTED, "Error: Unknown map operator %s\n", getOperatorSymbol(op));
+    }
+}
+
+/**
+ * @brief Print a map as {key value, key value}, with string keys quoted
+ * @param map The map
+ */
+void printHashMap(const HashMap* map){
+    const MapTable *tables[2] = {&map->old, &map->current};
+    int first = 1;
+    outputChar('{');
+    for(int t = 0; t < 2; t++){
+        for(size_t i = 0; i < tables[t]->capacity; i++){
+            const MapSlot *slot = &tables[t]->slots[i];
+            if(slot->hash <= SLOT_DELETED) continue;
+            if(!first) outputString(", ");
+            if(slot->key.type == VAL_STRING){
+                outputChar('"');
+                outputWrite(slot->key.string->bytes, slot->key.string->length);
+                outputChar('"');
+            }else{
+                outputInt(slot->key.intValue);
+            }
+            outputChar(' ');
+            printValue(slot->value);
+            first = 0;
+        }
+    }
+    outputChar('}');
+}
@@ -0,0 +1,42 @@
+#ifndef LISP_LITE_HASHMAP_H
+#define LISP_LITE_HASHMAP_H
+#include "library.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Slot in an open-addressing table. The key's hash is cached so probing
+ * only compares keys whose full hash matches; hash 0 marks an empty slot
+ * and hash 1 a deleted one.
+ */
+typedef struct {
+    uint64_t hash;
+    Value key;
+    Value value;
+} MapSlot;
+
+typedef struct {
+    MapSlot *slots;
+    size_t capacity;   // power of two
+    size_t live;
+    size_t used;       // live + deleted
+} MapTable;
+
+/*
+ * Hash map with int and string keys. Growing allocates a bigger table but
+ * leaves the entries where they are; every later operation moves a few
+ * buckets across, so no single insert pays for a full rehash.
+ */
+struct HashMap {
+    MapTable current;
+    MapTable old;      // being drained into `current`, or empty
+    size_t migrated;   // next bucket of `old` to move
+};
+
+HashMap* createHashMap(void);
+
+Value evaluateMapOp(enum operators op, Value* args, int argc);
+
+void printHashMap(const HashMap* map);
+
+#endif //LISP_LITE_HASHMAP_H
@@ -0,0 +1,214 @@
+#include "input.h"
+#include "error.h"
+#include "utf8.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#else
+#include <unistd.h>
+#endif
+
+struct InputSource {
+    InputReader read;  // NULL reads file descriptor 0
+    void *user;
+    char *chunk;
+    size_t start;  // first unread byte
+    size_t end;    // one past the last buffered byte
+    int atEof;
+};
+
+static InputSource standardInput = {NULL, NULL, NULL, 0, 0, 0};
+
+// What this thread's reads come from
+static _Thread_local InputSource *source = &standardInput;
+
+// Set on threads that must leave stdin to someone else
+static _Thread_local int denied = 0;
+
+/**
+ * @brief Make stdin reads an error on the calling thread
+ */
+void inputDeny(void){
+    denied = 1;
+}
+
+static void checkAllowed(void){
+    if(denied && source == &standardInput){
+        fatalError(ERROR_IO, "Error: Stdin is not readable from this thread\n");
+    }
+}
+
+/**
+ * @brief Create a source that pulls its bytes from a callback
+ * @param read Fills a buffer and returns the byte count, 0 at end of input
+ * @param user Passed through to the callback
+ */
+InputSource* inputSourceCreate(InputReader read, void* user){
+    InputSource *in = (InputSource*)memCalloc(1, sizeof(InputSource));
+    in->read = read;
+    in->user = user;
+    return in;
+}
+
+void inputSourceFree(InputSource* in){
+    if(in != NULL){
+        memFree(in->chunk);
+        memFree(in);
+    }
+}
+
+/**
+ * @brief Read from `in` on this thread from now on
+ * @param in The source, or NULL for stdin
+ */
+void inputUse(InputSource* in){
+    source = in != NULL ? in : &standardInput;
+}
+
+/**
+ * @brief Refill the chunk with the next block of input
+ * @return 0 once the input is exhausted
+ */
+static int fill(void){
+    InputSource *in = source;
+    if(in->chunk == NULL){
+        // Standard input outlives any embedding context that reads it
+        AllocArena *arena = allocArenaUse(NULL);
+        in->chunk = (char*)memAlloc(INPUT_CHUNK_SIZE);
+        allocArenaUse(arena);
+    }
+    in->start = in->end = 0;
+    if(in->read != NULL){
+        if(!in->atEof){
+            in->end = in->read(in->user, in->chunk, INPUT_CHUNK_SIZE);
+            in->atEof = in->end == 0;
+        }
+        return in->end > 0;
+    }
+    while(!in->atEof){
+        ssize_t got = read(0, in->chunk, INPUT_CHUNK_SIZE);
+        if(got > 0){
+            in->end = (size_t)got;
+            return 1;
+        }
+        if(got == 0){
+            in->atEof = 1;
+        }else if(errno != EINTR){
+            in->atEof = 1; // a caller that recovers reads no further
+            fatalError(ERROR_IO, "Error: Could not read input\n");
+        }
+    }
+    return 0;
+}
+
+/*
+ * Growable result string, allocated as a string value from the start so
+ * finish() only has to seal it; most reads fit in one chunk and need a
+ * single allocation.
+ */
+typedef struct {
+    String *data;
+    size_t length;
+    size_t capacity;
+} Collected;
+
+static void collect(Collected *out, const char *data, size_t length){
+    if(out->length + length + 1 > out->capacity){
+        size_t capacity = out->capacity ? out->capacity : 64;
+        while(out->length + length + 1 > capacity){
+            capacity *= 2;
+        }
+        out->data = stringResize(out->data, capacity);
+        out->capacity = capacity;
+    }
+    memcpy(out->data->data + out->length, data, length);
+    out->length += length;
+}
+
+static String* finish(Collected *out){
+    if(out->data == NULL){
+        collect(out, "", 0);
+    }
+    size_t bad = stringSeal(out->data, out->length);
+    if(bad != out->length){
+        stringFree(out->data);
+        fatalError(ERROR_IO, "Error: Input is not valid UTF-8 at byte %zu\n", bad);
+    }
+    return out->data;
+}
+
+/**
+ * @brief Read the next line, without its newline
+ * @return The line, or NULL at end of input
+ */
+String* inputReadLine(void){
+    checkAllowed();
+    InputSource *in = source;
+    Collected line = {NULL, 0, 0};
+    int sawAny = 0;
+
+    for(;;){
+        if(in->start == in->end && !fill()){
+            if(!sawAny){
+                return NULL;
+            }
+            break; // last line had no trailing newline
+        }
+        sawAny = 1;
+
+        char *newline = (char*)memchr(in->chunk + in->start, '\n', in->end - in->start);
+        if(newline != NULL){
+            collect(&line, in->chunk + in->start, (size_t)(newline - (in->chunk + in->start)));
+            in->start = (size_t)(newline - in->chunk) + 1;
+            break;
+        }
+        // The line runs past this chunk
+        collect(&line, in->chunk + in->start, in->end - in->start);
+        in->start = in->end;
+    }
+    return finish(&line);
+}
+
+/**
+ * @brief Read everything left on the input
+ */
+String* inputReadAll(void){
+    checkAllowed();
+    InputSource *in = source;
+    Collected all = {NULL, 0, 0};
+    while(in->start < in->end || fill()){
+        collect(&all, in->chunk + in->start, in->end - in->start);
+        in->start = in->end;
+    }
+    return finish(&all);
+}
+
+/**
+ * @brief Read up to `count` bytes; fewer only at end of input
+ *
+ * A code point cut off by the count is read to its end, so the result may
+ * run up to three bytes over.
+ */
+String* inputReadN(size_t count){
+    checkAllowed();
+    InputSource *in = source;
+    Collected part = {NULL, 0, 0};
+    while(part.length < count && (in->start < in->end || fill())){
+        size_t take = in->end - in->start;
+        if(take > count - part.length){
+            take = count - part.length;
+        }
+        collect(&part, in->chunk + in->start, take);
+        in->start += take;
+        if(part.length == count){
+            count += utf8Missing(part.data->data, part.length);
+        }
+    }
+    return finish(&part);
+}
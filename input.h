@@ -0,0 +1,38 @@
+#ifndef LISP_LITE_INPUT_H
+#define LISP_LITE_INPUT_H
+#include "utf8.h"
+#include <stddef.h>
+
+/*
+ * Buffered stdin reader. Input is pulled in with read(2) a large block at a
+ * time and lines are cut out of the block with memchr, so a line costs no
+ * syscall of its own and may be any length.
+ *
+ * Every function returns a new string (see utf8.h); input that is not valid
+ * UTF-8 is an error.
+ * Stdin is shared by the whole process; threads that must not touch it
+ * call inputDeny(). A thread can instead read from its own InputSource,
+ * which pulls blocks from a callback.
+ */
+
+#define INPUT_CHUNK_SIZE (256 * 1024)
+
+typedef size_t (*InputReader)(void* user, char* buffer, size_t capacity);
+
+typedef struct InputSource InputSource;
+
+String* inputReadLine(void);
+
+String* inputReadAll(void);
+
+String* inputReadN(size_t count);
+
+void inputDeny(void);
+
+InputSource* inputSourceCreate(InputReader read, void* user);
+
+void inputSourceFree(InputSource* source);
+
+void inputUse(InputSource* source);
+
+#endif //LISP_LITE_INPUT_H
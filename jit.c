@@ -0,0 +1,434 @@
+#include "jit.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+int jitEnabled = 1;
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @brief Whether every operator in an int-only subtree has an arity the code handles
+ */
+static int supportedArity(enum operators op, int argc){
+    switch(op){
+        case ADD: case MUL:
+            return 1;
+        case SUB: case DIV: case SEQ:
+            return argc >= 1;
+        case GT: case LT: case EQ: case GTE: case LTE:
+        case AND: case OR:
+            return argc == 2;
+        case NOT:
+            return argc == 1;
+        case IF:
+            return argc == 3;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Flag the int-only operators below a node, keeping only the outermost
+ * @return Whether the node itself can be compiled
+ */
+static int markNode(Node* node){
+    switch(node->type){
+        case NODE_VALUE:
+        case NODE_LOCAL:
+        case NODE_CAPTURED:
+            return 1;
+        case NODE_VARIABLE:
+            return node->slot >= 0;
+        case NODE_OPERATOR:
+            break;
+        case NODE_LAMBDA:
+            for(Node* body = node->childNode; body != NULL; body = body->nextNode){
+                markNode(body);
+            }
+            return 0;
+        default:
+            return 0;
+    }
+
+    int compiles = 1;
+    int argc = 0;
+    for(Node* child = node->childNode; child != NULL; child = child->nextNode){
+        compiles &= markNode(child);
+        argc++;
+    }
+    compiles &= supportedArity(node->val.op, argc);
+    if(compiles){
+        // Compiled as part of this node, not on their own
+        for(Node* child = node->childNode; child != NULL; child = child->nextNode){
+            child->jit = 0;
+        }
+    }
+    node->jit = (unsigned char)compiles;
+    return compiles;
+}
+
+/**
+ * @brief Flag the subtrees worth compiling once they get hot
+ * @param root The resolved tree
+ */
+void jitMark(Node* root){
+    for(Node* node = root; node != NULL; node = node->nextNode){
+        markNode(node);
+    }
+}
+
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+    size_t* bails;      // rel32 fields that jump to the failure exit
+    int bailCount;
+    int cacheSlots;
+} Code;
+
+static void emit(Code* code, const unsigned char* bytes, size_t count){
+    if(code->length + count > code->capacity){
+        code->capacity = code->capacity ? code->capacity * 2 : 256;
+        while(code->capacity < code->length + count){
+            code->capacity *= 2;
+        }
+        code->data = (unsigned char*)memRealloc(code->data, code->capacity);
+    }
+    memcpy(code->data + code->length, bytes, count);
+    code->length += count;
+}
+
+#define EMIT(code, ...) do { \
+        static const unsigned char bytes_[] = {__VA_ARGS__}; \
+        emit(code, bytes_, sizeof(bytes_)); \
+    } while(0)
+
+static void emit32(Code* code, int value){
+    unsigned char bytes[4];
+    memcpy(bytes, &value, 4);
+    emit(code, bytes, 4);
+}
+
+static void emit64(Code* code, long long value){
+    unsigned char bytes[8];
+    memcpy(bytes, &value, 8);
+    emit(code, bytes, 8);
+}
+
+/**
+ * @brief Emit the rel32 of a jump whose target comes later
+ * @return Where to patch it with patchJump
+ */
+static size_t jumpForward(Code* code){
+    size_t at = code->length;
+    emit32(code, 0);
+    return at;
+}
+
+static void patchJump(Code* code, size_t at){
+    int offset = (int)(code->length - (at + 4));
+    memcpy(code->data + at, &offset, 4);
+}
+
+// jne/jo/je to the failure exit, given the second opcode byte of the jcc
+static void bailIf(Code* code, unsigned char condition){
+    unsigned char bytes[2] = {0x0f, condition};
+    emit(code, bytes, 2);
+    code->bails = (size_t*)memRealloc(code->bails, sizeof(size_t) * (code->bailCount + 1));
+    code->bails[code->bailCount++] = jumpForward(code);
+}
+
+#define JO 0x80
+#define JE 0x84
+#define JNE 0x85
+
+/*
+ * Register use: rdi = frame, rsi = captured, r11 = inline caches,
+ * rcx = environment version, r8 = result pointer, r9 = stack pointer on
+ * entry. Expressions leave their value in rax; the right operand of a binary
+ * operator is in r10. Nothing is called, so no other register is touched.
+ */
+enum { RAX, R10 };
+
+static int isLeaf(Node* node){
+    return node->type != NODE_OPERATOR;
+}
+
+/**
+ * @brief Load a literal or variable into rax or r10, failing unless it is an INT
+ */
+static void emitLeaf(Code* code, Node* node, int target){
+    int typeOffset = (int)offsetof(Value, type);
+    int intOffset = (int)offsetof(Value, intValue);
+    switch(node->type){
+        case NODE_VALUE:
+            if(node->val.value >= INT32_MIN && node->val.value <= INT32_MAX){
+                // mov rax/r10, imm32 (sign-extended)
+                if(target == RAX) EMIT(code, 0x48, 0xc7, 0xc0); else EMIT(code, 0x49, 0xc7, 0xc2);
+                emit32(code, (int)node->val.value);
+            }else{
+                // movabs rax/r10, imm64
+                if(target == RAX) EMIT(code, 0x48, 0xb8); else EMIT(code, 0x49, 0xba);
+                emit64(code, node->val.value);
+            }
+            return;
+        case NODE_LOCAL:
+        case NODE_CAPTURED: {
+            int local = node->type == NODE_LOCAL;
+            int slot = node->slot * (int)sizeof(Value);
+            // cmp dword [rdi/rsi + slot], VAL_INT
+            if(local) EMIT(code, 0x83, 0xbf); else EMIT(code, 0x83, 0xbe);
+            emit32(code, slot + typeOffset);
+            EMIT(code, VAL_INT);
+            bailIf(code, JNE);
+            // mov rax/r10, [rdi/rsi + slot]
+            if(target == RAX){
+                if(local) EMIT(code, 0x48, 0x8b, 0x87); else EMIT(code, 0x48, 0x8b, 0x86);
+            }else{
+                if(local) EMIT(code, 0x4c, 0x8b, 0x97); else EMIT(code, 0x4c, 0x8b, 0x96);
+            }
+            emit32(code, slot + intOffset);
+            return;
+        }
+        default: {
+            // A global: its inline cache must be current for this environment
+            int cache = node->slot * (int)sizeof(InlineCache);
+            int value = (int)offsetof(EnvEntry, value);
+            if(node->slot + 1 > code->cacheSlots){
+                code->cacheSlots = node->slot + 1;
+            }
+            // cmp [r11 + cache.version], rcx
+            EMIT(code, 0x49, 0x39, 0x8b);
+            emit32(code, cache + (int)offsetof(InlineCache, version));
+            bailIf(code, JNE);
+            if(target == RAX){
+                // mov rax, [r11 + cache.entry]; cmp dword [rax + type], VAL_INT; mov rax, [rax + int]
+                EMIT(code, 0x49, 0x8b, 0x83);
+                emit32(code, cache + (int)offsetof(InlineCache, entry));
+                EMIT(code, 0x83, 0xb8);
+                emit32(code, value + typeOffset);
+                EMIT(code, VAL_INT);
+                bailIf(code, JNE);
+                EMIT(code, 0x48, 0x8b, 0x80);
+                emit32(code, value + intOffset);
+            }else{
+                // The same through r10
+                EMIT(code, 0x4d, 0x8b, 0x93);
+                emit32(code, cache + (int)offsetof(InlineCache, entry));
+                EMIT(code, 0x41, 0x83, 0xba);
+                emit32(code, value + typeOffset);
+                EMIT(code, VAL_INT);
+                bailIf(code, JNE);
+                EMIT(code, 0x4d, 0x8b, 0x92);
+                emit32(code, value + intOffset);
+            }
+            return;
+        }
+    }
+}
+
+static void emitExpression(Code* code, Node* node);
+
+/**
+ * @brief Evaluate a right operand into r10, keeping rax
+ */
+static void emitOperand(Code* code, Node* node){
+    if(isLeaf(node)){
+        emitLeaf(code, node, R10);
+        return;
+    }
+    EMIT(code, 0x50);               // push rax
+    emitExpression(code, node);
+    EMIT(code, 0x49, 0x89, 0xc2);   // mov r10, rax
+    EMIT(code, 0x58);               // pop rax
+}
+
+/**
+ * @brief rax = rax op r10 for + - * /, failing where the interpreter would
+ *        overflow into a bignum or report division by zero
+ */
+static void emitArithmetic(Code* code, enum operators op){
+    switch(op){
+        case ADD:
+            EMIT(code, 0x4c, 0x01, 0xd0);           // add rax, r10
+            bailIf(code, JO);
+            return;
+        case SUB:
+            EMIT(code, 0x4c, 0x29, 0xd0);           // sub rax, r10
+            bailIf(code, JO);
+            return;
+        case MUL:
+            EMIT(code, 0x49, 0x0f, 0xaf, 0xc2);     // imul rax, r10
+            bailIf(code, JO);
+            return;
+        default: {
+            EMIT(code, 0x4d, 0x85, 0xd2);           // test r10, r10
+            bailIf(code, JE);
+            EMIT(code, 0x49, 0x83, 0xfa, 0xff);     // cmp r10, -1
+            EMIT(code, 0x0f, JNE);
+            size_t divide = jumpForward(code);
+            EMIT(code, 0x48, 0xba);                 // mov rdx, LLONG_MIN
+            emit64(code, LLONG_MIN);
+            EMIT(code, 0x48, 0x39, 0xd0);           // cmp rax, rdx
+            bailIf(code, JE);
+            patchJump(code, divide);
+            EMIT(code, 0x48, 0x99);                 // cqo
+            EMIT(code, 0x49, 0xf7, 0xfa);           // idiv r10
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Evaluate an int-only subtree into rax
+ */
+static void emitExpression(Code* code, Node* node){
+    if(isLeaf(node)){
+        emitLeaf(code, node, RAX);
+        return;
+    }
+
+    Node* first = node->childNode;
+    enum operators op = node->val.op;
+    switch(op){
+        case ADD:
+        case MUL:
+        case SUB:
+        case DIV:
+            if(first == NULL){
+                // (+) is 0 and (*) is 1
+                if(op == ADD) EMIT(code, 0x31, 0xc0); else EMIT(code, 0xb8, 0x01, 0x00, 0x00, 0x00);
+                return;
+            }
+            // Folding from 0 or 1 as the interpreter does cannot overflow, so
+            // start from the first operand
+            emitExpression(code, first);
+            for(Node* operand = first->nextNode; operand != NULL; operand = operand->nextNode){
+                emitOperand(code, operand);
+                emitArithmetic(code, op);
+            }
+            return;
+        case GT:
+        case LT:
+        case EQ:
+        case GTE:
+        case LTE: {
+            emitExpression(code, first);
+            emitOperand(code, first->nextNode);
+            EMIT(code, 0x4c, 0x39, 0xd0);           // cmp rax, r10
+            unsigned char set = op == GT ? 0x9f : op == LT ? 0x9c : op == GTE ? 0x9d : op == LTE ? 0x9e : 0x94;
+            unsigned char bytes[3] = {0x0f, set, 0xc0};
+            emit(code, bytes, 3);                   // setcc al
+            EMIT(code, 0x0f, 0xb6, 0xc0);           // movzx eax, al
+            return;
+        }
+        case AND:
+        case OR:
+            // Both sides are evaluated, as in the interpreter
+            emitExpression(code, first);
+            emitOperand(code, first->nextNode);
+            EMIT(code, 0x48, 0x85, 0xc0);           // test rax, rax
+            EMIT(code, 0x0f, 0x95, 0xc0);           // setne al
+            EMIT(code, 0x4d, 0x85, 0xd2);           // test r10, r10
+            EMIT(code, 0x0f, 0x95, 0xc2);           // setne dl
+            if(op == AND) EMIT(code, 0x20, 0xd0); else EMIT(code, 0x08, 0xd0);
+            EMIT(code, 0x0f, 0xb6, 0xc0);           // movzx eax, al
+            return;
+        case NOT:
+            emitExpression(code, first);
+            EMIT(code, 0x48, 0x85, 0xc0);           // test rax, rax
+            EMIT(code, 0x0f, 0x94, 0xc0);           // sete al
+            EMIT(code, 0x0f, 0xb6, 0xc0);           // movzx eax, al
+            return;
+        case IF: {
+            emitExpression(code, first);
+            EMIT(code, 0x48, 0x85, 0xc0);           // test rax, rax
+            EMIT(code, 0x0f, JE);
+            size_t otherwise = jumpForward(code);
+            emitExpression(code, first->nextNode);
+            EMIT(code, 0xe9);                       // jmp
+            size_t done = jumpForward(code);
+            patchJump(code, otherwise);
+            emitExpression(code, first->nextNode->nextNode);
+            patchJump(code, done);
+            return;
+        }
+        default:
+            // SEQ
+            for(; first != NULL; first = first->nextNode){
+                emitExpression(code, first);
+            }
+            return;
+    }
+}
+
+/**
+ * @brief Compile a subtree flagged by jitMark
+ * @param node The subtree's root
+ * @return Its code, also stored in node->jitCode, or NULL if executable
+ *         memory could not be had (the node is then unflagged)
+ */
+JitCode* jitCompile(Node* node){
+    Code code = {0};
+    EMIT(&code, 0x49, 0x89, 0xd3);              // mov r11, rdx
+    EMIT(&code, 0x49, 0x89, 0xe1);              // mov r9, rsp
+    emitExpression(&code, node);
+    EMIT(&code, 0x49, 0x89, 0x00);              // mov [r8], rax
+    EMIT(&code, 0x31, 0xc0, 0xc3);              // xor eax, eax; ret
+    for(int i = 0; i < code.bailCount; i++){
+        patchJump(&code, code.bails[i]);
+    }
+    EMIT(&code, 0x4c, 0x89, 0xcc);              // mov rsp, r9
+    EMIT(&code, 0xb8, 0x01, 0x00, 0x00, 0x00);  // mov eax, 1
+    EMIT(&code, 0xc3);                          // ret
+    memFree(code.bails);
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (code.length + page - 1) / page * page;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED){
+        memFree(code.data);
+        __atomic_store_n(&node->jit, 0, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    memcpy(memory, code.data, code.length);
+    memFree(code.data);
+    if(mprotect(memory, size, PROT_READ | PROT_EXEC) != 0){
+        munmap(memory, size);
+        __atomic_store_n(&node->jit, 0, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    JitCode* compiled = (JitCode*)memAlloc(sizeof(JitCode));
+    compiled->entry = (JitEntry)memory;
+    compiled->size = size;
+    compiled->cacheSlots = code.cacheSlots;
+    compiled->bails = 0;
+    __atomic_store_n(&node->jitCode, compiled, __ATOMIC_RELEASE);
+    return compiled;
+}
+
+void jitRelease(JitCode* code){
+    munmap((void*)code->entry, code->size);
+    memFree(code);
+}
+
+#else
+
+void jitMark(Node* root){
+}
+
+JitCode* jitCompile(Node* node){
+    return NULL;
+}
+
+void jitRelease(JitCode* code){
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef LISP_LITE_JIT_H
+#define LISP_LITE_JIT_H
+#include "library.h"
+#include <stddef.h>
+
+/*
+ * Native code for int-only subtrees, on x86-64.
+ *
+ * jitMark flags the largest subtrees built only from integer literals,
+ * variable reads, + - * /, comparisons, and, or, not, if and seq. Once one
+ * of them has been evaluated JIT_THRESHOLD times it is compiled into mmap'd
+ * executable memory and called instead of walking the tree.
+ *
+ * The literals and operators are known to give ints, so the only checks the
+ * code makes are that every variable it reads holds an INT (globals are read
+ * straight from the thread's inline cache slots) and that nothing overflows
+ * or divides by zero. When a check fails the code returns without a result
+ * and the subtree is evaluated as usual; it has no side effects, so running
+ * it again is safe. A subtree that fails its checks JIT_BAIL_LIMIT times is
+ * left to the interpreter from then on.
+ *
+ * On other targets jitMark flags nothing and the interpreter runs as before.
+ */
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 100
+#endif
+
+#define JIT_BAIL_LIMIT 1000
+
+/*
+ * Returns 0 with the value in *result, or nonzero if a check failed.
+ * `captured` may be NULL outside a lambda.
+ */
+typedef int (*JitEntry)(const Value* frame, const Value* captured, const InlineCache* caches,
+                        unsigned long version, long long* result);
+
+struct JitCode {
+    JitEntry entry;
+    size_t size;
+    // The inline cache table must have this many slots before the code runs
+    int cacheSlots;
+    unsigned int bails;
+};
+
+// Cleared by --no-jit before anything is evaluated
+extern int jitEnabled;
+
+void jitMark(Node* root);
+
+JitCode* jitCompile(Node* node);
+
+void jitRelease(JitCode* code);
+
+#endif //LISP_LITE_JIT_H
@@ -0,0 +1,69 @@
+#include "latency.h"
+#include <time.h>
+
+/**
+ * @brief Monotonic clock reading in seconds
+ */
+double nowSeconds(void){
+    struct timespec ts;
+#ifdef _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int latencyBucket(unsigned long long ns){
+    if(ns < 4){
+        return (int)ns;
+    }
+    int log2 = 63 - __builtin_clzll(ns);
+    return log2 * 4 + (int)((ns >> (log2 - 2)) & 3);
+}
+
+// Smallest latency that lands in a bucket, used when reporting percentiles
+static unsigned long long bucketFloor(int bucket){
+    if(bucket < 4){
+        return (unsigned long long)bucket;
+    }
+    int log2 = bucket / 4;
+    return (1ULL << log2) + (unsigned long long)(bucket % 4) * (1ULL << (log2 - 2));
+}
+
+void recordLatency(LatencyStats* stats, double seconds){
+    unsigned long long ns = (unsigned long long)(seconds * 1e9);
+    if(stats->count == 0 || ns < stats->minNs) stats->minNs = ns;
+    if(ns > stats->maxNs) stats->maxNs = ns;
+    stats->buckets[latencyBucket(ns)]++;
+    stats->totalSeconds += seconds;
+    stats->count++;
+}
+
+void mergeStats(LatencyStats* into, const LatencyStats* from){
+    if(from->count == 0){
+        return;
+    }
+    if(into->count == 0 || from->minNs < into->minNs) into->minNs = from->minNs;
+    if(from->maxNs > into->maxNs) into->maxNs = from->maxNs;
+    for(int i = 0; i < LATENCY_BUCKETS; i++){
+        into->buckets[i] += from->buckets[i];
+    }
+    into->totalSeconds += from->totalSeconds;
+    into->count += from->count;
+}
+
+/**
+ * @brief Approximate latency below which `fraction` of the samples fall, in ns
+ */
+unsigned long long latencyPercentile(const LatencyStats* stats, double fraction){
+    unsigned long long rank = (unsigned long long)(fraction * (double)stats->count);
+    unsigned long long seen = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; i++){
+        seen += stats->buckets[i];
+        if(seen > rank){
+            return bucketFloor(i);
+        }
+    }
+    return stats->maxNs;
+}
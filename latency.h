@@ -0,0 +1,27 @@
+#ifndef LISP_LITE_LATENCY_H
+#define LISP_LITE_LATENCY_H
+
+/*
+ * Latency histogram: four buckets per power of two nanoseconds, so memory
+ * stays constant however many samples stream by. Used for --stats, the
+ * --serve stats endpoint and the load generator.
+ */
+#define LATENCY_BUCKETS (64 * 4)
+
+typedef struct {
+    unsigned long long count;
+    double totalSeconds;
+    unsigned long long minNs;
+    unsigned long long maxNs;
+    unsigned long long buckets[LATENCY_BUCKETS];
+} LatencyStats;
+
+double nowSeconds(void);
+
+void recordLatency(LatencyStats* stats, double seconds);
+
+void mergeStats(LatencyStats* into, const LatencyStats* from);
+
+unsigned long long latencyPercentile(const LatencyStats* stats, double fraction);
+
+#endif //LISP_LITE_LATENCY_H
@@ -1,18 +1,111 @@
 #include "lexer.h"
 #include "library.h"
+#include "effects.h"
+#include "jit.h"
+#include "cse.h"
+#include "regexp.h"
+#include "alloc.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+
+
+/**
+ * Decide whether a bare token is an integer (123), a float (1.5, .5, 2e10,
+ * 1.5e-3) or an identifier.
+ */
+static TokenType classifyNumber(const char* value) {
+    const char* p = value;
+    int digits = 0;
+    int isFloat = 0;
+
+    while (isdigit((unsigned char)*p)) { p++; digits++; }
+    if (*p == '.') {
+        isFloat = 1;
+        p++;
+        while (isdigit((unsigned char)*p)) { p++; digits++; }
+    }
+    if (digits == 0) {
+        return TOKEN_IDENTIFIER;
+    }
+    if (*p == 'e' || *p == 'E') {
+        isFloat = 1;
+        p++;
+        if (*p == '+' || *p == '-') p++;
+        if (!isdigit((unsigned char)*p)) {
+            return TOKEN_IDENTIFIER;
+        }
+        while (isdigit((unsigned char)*p)) p++;
+    }
+    if (*p != '\0') {
+        return TOKEN_IDENTIFIER;
+    }
+    return isFloat ? TOKEN_FLOAT : TOKEN_NUMBER;
+}
+
+/**
+ * @brief Turn line breaks and other control characters into spaces
+ * @param buffer The source text, changed in place
+ * @param length Its length in bytes
+ *
+ * The lexer only treats ' ' as whitespace. Bytes above 0x7F are left alone:
+ * they are UTF-8, which lex() checks.
+ */
+void normalizeSource(char* buffer, size_t length){
+    for (char* p = buffer; *p; ++p) {
+        if (*p == '\r') *p = ' ';
+        if (*p == '\n') *p = ' ';
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        if ((unsigned char)buffer[i] < 32 || (unsigned char)buffer[i] == 127) {
+            // Replace control chars with space
+            buffer[i] = ' ';
+        }
+    }
+}
+
+/**
+ * @brief Append a token that takes ownership of `value`
+ */
+static Token* linkToken(Token** head, Token* current, TokenType type, char* value){
+    Token* newToken = (Token*)memAlloc(sizeof(Token));
+    newToken->type = type;
+    newToken->value = value;
+    newToken->next = NULL;
 
+    if(*head == NULL){
+        *head = newToken;
+    }else{
+        current->next = newToken;
+    }
+    return newToken;
+}
+
+/**
+ * @brief Copy `length` bytes of the source into a token's text
+ */
+static char* tokenText(const char* start, size_t length){
+    char* value = (char*)memAlloc(length + 1);
+    memcpy(value, start, length);
+    value[length] = '\0';
+    return value;
+}
 
 Token* lex(char* input) {
+    size_t inputLength = strlen(input);
+    size_t bad = utf8Check(input, inputLength);
+    if (bad != inputLength) {
+        fatalError(ERROR_SYNTAX, "Error: Invalid UTF-8 at byte %zu\n", bad);
+    }
+
+    AllocPhase phase = allocPhase(ALLOC_LEX);
     Token* head = NULL;
     Token* current = NULL;
     char* currentChar = input;
-
-    unsigned long long inputLength = strlen(input);
-    int index = 0;
+    size_t index = 0;
 
     while (index < inputLength) {
         char currentCharValue = *currentChar;
@@ -29,47 +122,21 @@ Token* lex(char* input) {
                 index++;
                 break;
             case '"': {
-                char value[256]; // Use stack buffer
-                int valueIndex = 0;
-                index++;
-                currentChar = input + index;
-                currentCharValue = *currentChar;
-                while (currentCharValue != '"' && index < inputLength) {
-                    value[valueIndex++] = currentCharValue;
+                size_t start = ++index;
+                while (index < inputLength && input[index] != '"') {
                     index++;
-                    currentChar = input + index;
-                    currentCharValue = *currentChar;
                 }
-                value[valueIndex] = '\0';
-                current = addToken(&head, current, TOKEN_STRING, value);
+                current = linkToken(&head, current, TOKEN_STRING, tokenText(input + start, index - start));
                 index++;
                 break;
             }
             default: {
-                char value[256]; // Use stack buffer
-                int valueIndex = 0;
-                while (currentCharValue != ' ' && currentCharValue != '(' && currentCharValue != ')' &&
-                       index < inputLength) {
-                    value[valueIndex++] = currentCharValue;
+                size_t start = index;
+                while (index < inputLength && input[index] != ' ' && input[index] != '(' && input[index] != ')') {
                     index++;
-                    currentChar = input + index;
-                    currentCharValue = *currentChar;
-                }
-                value[valueIndex] = '\0';
-
-                int isNumber = 1;
-                for (int i = 0; i < strlen(value); i++) {
-                    if (!isdigit(value[i])) {
-                        isNumber = 0;
-                        break;
-                    }
-                }
-
-                if (isNumber) {
-                    current = addToken(&head, current, TOKEN_NUMBER, value);
-                } else {
-                    current = addToken(&head, current, TOKEN_IDENTIFIER, value);
                 }
+                char* value = tokenText(input + start, index - start);
+                current = linkToken(&head, current, classifyNumber(value), value);
                 break;
             }
         }
@@ -77,33 +144,21 @@ Token* lex(char* input) {
         currentChar = input + index;
     }
 
+    allocPhase(phase);
     return head;  // <-- THIS is why it was crashing.
 }
 
 
 Token* addToken(Token** head, Token* current, TokenType type, char* value){
-    Token* newToken = (Token*)malloc(sizeof(Token));
-    newToken->type = type;
-    newToken->value = strdup(value);
-    newToken->next = NULL;
-
-    if(*head == NULL){
-        *head = newToken;
-        current = newToken;
-    }else{
-        current->next = newToken;
-        current = newToken;
-    }
-
-    return current;
+    return linkToken(head, current, type, memStrdup(value));
 }
 
 void freeTokens(Token* head){
     Token* current = head;
     while(current != NULL){
         Token* next = current->next;
-        free(current->value);
-        free(current);
+        memFree(current->value);
+        memFree(current);
         current = next;
     }
 }
@@ -134,39 +189,119 @@ int getOperatorCode(const char* ident) {
     if (strcmp(ident, "not") == 0) return NOT;
     if (strcmp(ident, "print") == 0) return PRINT;
     if (strcmp(ident, "input") == 0) return INPUT;
-    fprintf(stderr, "Unknown operator '%s'\n", ident);
-    exit(1);
+    if (strcmp(ident, "lambda") == 0) return LAMBDA;
+    if (strcmp(ident, "vec") == 0) return VEC;
+    if (strcmp(ident, "make-vec") == 0) return MAKE_VEC;
+    if (strcmp(ident, "vec-range") == 0) return VEC_RANGE;
+    if (strcmp(ident, "vec-ref") == 0) return VEC_REF;
+    if (strcmp(ident, "vec-len") == 0) return VEC_LEN;
+    if (strcmp(ident, "vec+") == 0) return VEC_ADD;
+    if (strcmp(ident, "vec-") == 0) return VEC_SUB;
+    if (strcmp(ident, "vec*") == 0) return VEC_MUL;
+    if (strcmp(ident, "vec/") == 0) return VEC_DIV;
+    if (strcmp(ident, "vec-sum") == 0) return VEC_SUM;
+    if (strcmp(ident, "vec-min") == 0) return VEC_MIN;
+    if (strcmp(ident, "vec-max") == 0) return VEC_MAX;
+    if (strcmp(ident, "vec-dot") == 0) return VEC_DOT;
+    if (strcmp(ident, "vec<") == 0) return VEC_LT;
+    if (strcmp(ident, "vec>") == 0) return VEC_GT;
+    if (strcmp(ident, "vec=") == 0) return VEC_EQ;
+    if (strcmp(ident, "map") == 0) return MAP;
+    if (strcmp(ident, "map-get") == 0) return MAP_GET;
+    if (strcmp(ident, "map-put") == 0) return MAP_PUT;
+    if (strcmp(ident, "map-del") == 0) return MAP_DEL;
+    if (strcmp(ident, "map-has") == 0) return MAP_HAS;
+    if (strcmp(ident, "map-size") == 0) return MAP_SIZE;
+    if (strcmp(ident, "read-all") == 0) return READ_ALL;
+    if (strcmp(ident, "read-lines") == 0) return READ_LINES;
+    if (strcmp(ident, "read-n") == 0) return READ_N;
+    if (strcmp(ident, "length") == 0) return LENGTH;
+    if (strcmp(ident, "substring") == 0) return SUBSTRING;
+    if (strcmp(ident, "index-of") == 0) return INDEX_OF;
+    if (strcmp(ident, "contains") == 0) return CONTAINS;
+    if (strcmp(ident, "starts-with") == 0) return STARTS_WITH;
+    if (strcmp(ident, "split") == 0) return SPLIT;
+    if (strcmp(ident, "join") == 0) return JOIN;
+    if (strcmp(ident, "replace") == 0) return REPLACE;
+    if (strcmp(ident, "upper") == 0) return UPPER;
+    if (strcmp(ident, "lower") == 0) return LOWER;
+    if (strcmp(ident, "re-match") == 0) return RE_MATCH;
+    if (strcmp(ident, "re-find") == 0) return RE_FIND;
+    if (strcmp(ident, "re-replace") == 0) return RE_REPLACE;
+    if (strcmp(ident, "list") == 0) return LIST;
+    if (strcmp(ident, "cons") == 0) return CONS;
+    if (strcmp(ident, "car") == 0) return CAR;
+    if (strcmp(ident, "cdr") == 0) return CDR;
+    if (strcmp(ident, "nth") == 0) return NTH;
+    if (strcmp(ident, "append") == 0) return APPEND;
+    if (strcmp(ident, "reverse") == 0) return REVERSE;
+    // Anything else names a function to call
+    return -1;
+}
+
+/**
+ * Parse a lambda parameter list such as (x y), leaving *current after the ')'.
+ */
+static Node* parseLambda(Token** current) {
+    Token* token = *current;
+    if (token == NULL || token->type != TOKEN_LPAREN) {
+        fatalError(ERROR_SYNTAX, "Expected parameter list after 'lambda', got '%s'\n", token ? token->value : "NULL");
+    }
+
+    char** params = NULL;
+    int paramCount = 0;
+    for (token = token->next; token != NULL && token->type == TOKEN_IDENTIFIER; token = token->next) {
+        params = (char**)memRealloc(params, sizeof(char*) * (paramCount + 1));
+        params[paramCount++] = memStrdup(token->value);
+    }
+
+    if (token == NULL || token->type != TOKEN_RPAREN) {
+        fatalError(ERROR_SYNTAX, "Expected ')' after lambda parameters, got '%s'\n", token ? token->value : "NULL");
+    }
+
+    *current = token->next;
+    return createLambdaNode(params, paramCount);
 }
 
 
 Node* parseExpr(Token** current) {
     if (*current == NULL) {
-        fprintf(stderr, "Unexpected end of tokens.\n");
-        exit(1);
+        fatalError(ERROR_SYNTAX, "Unexpected end of tokens.\n");
     }
 
     Token* token = *current;
 
     if (token->type != TOKEN_LPAREN) {
-        fprintf(stderr, "Expected '(', got '%s'\n", token->value);
-        exit(1);
+        fatalError(ERROR_SYNTAX, "Expected '(', got '%s'\n", token->value);
     }
 
     // Advance to next token after '('
     *current = token->next;
     token = *current;
 
-    if (token == NULL || token->type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "Expected operator after '(', got '%s'\n", token ? token->value : "NULL");
-        exit(1);
+    Node* node;
+    if (token != NULL && token->type == TOKEN_LPAREN) {
+        // ((lambda (x) ...) 1): the function is itself an expression
+        node = createOperatorNode(CALL);
+        addNode(node, parseExpr(current));
+    } else if (token != NULL && token->type == TOKEN_IDENTIFIER) {
+        // Create the operator node (like ADD, DEF, etc.)
+        int op = getOperatorCode(token->value);
+
+        // Advance to the first argument
+        *current = token->next;
+
+        if (op == LAMBDA) {
+            node = parseLambda(current);
+        } else if (op < 0) {
+            node = createOperatorNode(CALL);
+            addNode(node, createVariableNode(token->value));
+        } else {
+            node = createOperatorNode(op);
+        }
+    } else {
+        fatalError(ERROR_SYNTAX, "Expected operator after '(', got '%s'\n", token ? token->value : "NULL");
     }
-
-    // Create the operator node (like ADD, DEF, etc.)
-    int op = getOperatorCode(token->value);  // You'll need this function
-    Node* node = createOperatorNode(op);
-
-    // Advance to the first argument
-    *current = token->next;
     token = *current;
 
     // Loop over arguments until we hit ')'
@@ -178,7 +313,13 @@ Node* parseExpr(Token** current) {
             // Recursively parse the nested expression
             child = parseExpr(current);
         } else if (token->type == TOKEN_NUMBER) {
-            child = createValueNode(strtol(token->value, NULL, 10));
+            errno = 0;
+            long long value = strtoll(token->value, NULL, 10);
+            // Literals past 64 bits start out as bignums
+            child = errno == ERANGE ? createBigIntNode(token->value) : createValueNode(value);
+            *current = token->next;
+        } else if (token->type == TOKEN_FLOAT) {
+            child = createFloatNode(strtod(token->value, NULL));
             *current = token->next;
         } else if (token->type == TOKEN_IDENTIFIER) {
             child = createVariableNode(token->value);
@@ -187,8 +328,7 @@ Node* parseExpr(Token** current) {
             child = createStringLiteralNode(token->value);
             *current = token->next;
         } else {
-            fprintf(stderr, "Unexpected token '%s'\n", token->value);
-            exit(1);
+            fatalError(ERROR_SYNTAX, "Unexpected token '%s'\n", token->value);
         }
 
         addNode(node, child);
@@ -196,17 +336,25 @@ Node* parseExpr(Token** current) {
     }
 
     if (token == NULL || token->type != TOKEN_RPAREN) {
-        fprintf(stderr, "Expected ')', got '%s'\n", token ? token->value : "NULL");
-        exit(1);
+        fatalError(ERROR_SYNTAX, "Expected ')', got '%s'\n", token ? token->value : "NULL");
     }
 
     // Advance past ')'
     *current = token->next;
 
+    // A literal pattern is compiled here, once, instead of on every evaluation
+    if (node->type == NODE_OPERATOR && (node->val.op == RE_MATCH || node->val.op == RE_FIND || node->val.op == RE_REPLACE)) {
+        Node* pattern = node->childNode != NULL ? node->childNode->nextNode : NULL;
+        if (pattern != NULL && pattern->type == NODE_STRING_LITERAL) {
+            node->regex = regexCompile(pattern->val.string);
+        }
+    }
+
     return node;
 }
 
 Node* parse(Token* tokens) {
+    AllocPhase phase = allocPhase(ALLOC_PARSE);
     Node* root = createOperatorNode(SEQ);
 
     Token* current = tokens;
@@ -216,11 +364,16 @@ Node* parse(Token* tokens) {
             Node* expr = parseExpr(&current);
             addNode(root, expr);
         } else {
-            fprintf(stderr, "Unexpected token '%s'\n", current->value);
-            exit(1);
+            fatalError(ERROR_SYNTAX, "Unexpected token '%s'\n", current->value);
         }
     }
 
+    allocPhase(ALLOC_ANALYZE);
+    resolveTree(root);
+    analyzeEffects(root);
+    cseShare(root);
+    jitMark(root);
+    allocPhase(phase);
     return root;
 }
 
@@ -1,11 +1,13 @@
 #ifndef LISP_LITE_LEXER_H
 #define LISP_LITE_LEXER_H
 #include "library.h"
+#include <stddef.h>
 
 typedef enum {
     TOKEN_LPAREN,
     TOKEN_RPAREN,
     TOKEN_NUMBER,
+    TOKEN_FLOAT,
     TOKEN_IDENTIFIER,
     TOKEN_STRING
 } TokenType;
@@ -16,6 +18,8 @@ typedef struct Token {
     struct Token* next;
 } Token;
 
+void normalizeSource(char* buffer, size_t length);
+
 Token* lex(char* input);
 
 Token* addToken(Token** head, Token* current, TokenType type, char* value);
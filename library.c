@@ -1,7 +1,24 @@
 #include "library.h"
+#include "vector.h"
+#include "hashmap.h"
+#include "strlib.h"
+#include "regexp.h"
+#include "list.h"
+#include "output.h"
+#include "input.h"
+#include "effects.h"
+#include "forkjoin.h"
+#include "jit.h"
+#include "cse.h"
+#include "alloc.h"
+#include "dtoa.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #define COLOR_RESET   "\033[0m"
 #define COLOR_RED     "\033[31m"
@@ -12,6 +29,78 @@
 #define COLOR_CYAN    "\033[36m"
 #define COLOR_WHITE   "\033[37m"
 
+/*
+ * Bumped whenever a name is added to (or removed from) an environment.
+ * Existing entries never move, so an inline cache stamped with the current
+ * version still points at the right EnvEntry.
+ *
+ * The tree is shared between threads, so the caches are not kept in the
+ * nodes: each global reference gets a slot at resolve time and every thread
+ * has its own table of entries, indexed by that slot.
+ *
+ * freeTree hands a tree's slots back for the next trees resolved, so a
+ * process that parses programs as it goes (--serve, embedding) keeps its
+ * tables the size of the programs alive at once. A thread may still hold
+ * an entry for a reused slot stamped with its current version, so every
+ * entry point that can run a tree resolved after another was freed calls
+ * resetEvaluator first.
+ */
+
+static atomic_int inlineCacheSlots = 0;
+static _Thread_local InlineCache *inlineCaches = NULL;
+static _Thread_local int inlineCacheCount = 0;
+static _Thread_local unsigned long envVersion = 1;
+
+static pthread_mutex_t freeSlotLock = PTHREAD_MUTEX_INITIALIZER;
+static int *freeSlots = NULL;
+static int freeSlotCount = 0;
+static int freeSlotCapacity = 0;
+
+/*
+ * Each thread's last result for every common subexpression (see cse.h),
+ * indexed by its number, with the values of the variables it read.
+ */
+typedef struct {
+    unsigned long generation;   // the resetEvaluator stretch it belongs to
+    int inputCount;     // -1 until this thread first evaluates it
+    int filled;         // result and values are from a finished evaluation
+    Node *inputs[CSE_MAX_INPUTS];
+    Value values[CSE_MAX_INPUTS];
+    Value result;
+} SharedResult;
+
+static _Thread_local SharedResult *sharedResults = NULL;
+static _Thread_local int sharedResultCount = 0;
+static _Thread_local unsigned long sharedGeneration = 1;
+
+/*
+ * Argument frames live on one value stack instead of in EnvEntry lists.
+ * `frame` points at the parameters of the function being evaluated and
+ * `currentClosure` at its captured variables.
+ */
+#define VALUE_STACK_SIZE (1 << 20)
+
+static _Thread_local Value *stackBase = NULL;
+static _Thread_local Value *stackTop = NULL;
+static _Thread_local Value *stackLimit = NULL;
+static _Thread_local Value *frame = NULL;
+static _Thread_local Closure *currentClosure = NULL;
+
+/*
+ * Every evaluateTree that reaches evaluateActivation nests C frames, and
+ * only tail calls avoid it, so deep ordinary recursion runs out of C stack
+ * unless it is stopped first. A thread's C stack is 8 MB by default, which
+ * holds about 14000 levels in an unoptimised build and 37000 optimised;
+ * AddressSanitizer's frames are several times larger.
+ */
+#if defined(__SANITIZE_ADDRESS__)
+#define DEFAULT_MAX_DEPTH 2500
+#else
+#define DEFAULT_MAX_DEPTH 10000
+#endif
+
+int maxDepth = DEFAULT_MAX_DEPTH;
+static _Thread_local int depth = 0;
 
 
 /**
@@ -29,11 +118,22 @@ Node* createOperatorNode(int value){
  * @param value The value of the node
  * @return The new value node
  */
-Node* createValueNode(int value){
+Node* createValueNode(long long value){
     Node *node =  createNode(NODE_VALUE, value);
     return node;
 }
 
+/**
+ * @brief Generate a node for an integer literal that does not fit in a fixnum
+ * @param digits The literal's decimal digits
+ * @return The new node
+ */
+Node* createBigIntNode(const char* digits){
+    Node *node = createNode(NODE_BIGINT, 0);
+    node->val.big = bigFromString(digits);
+    return node;
+}
+
 /**
  * @brief create a variable node
  * @param name
@@ -41,15 +141,42 @@ Node* createValueNode(int value){
  */
 Node* createVariableNode(char* name){
     Node *node = createNode(NODE_VARIABLE, 0);
-    node->val.strValue = (char*)malloc(strlen(name) + 1);
+    node->val.strValue = (char*)memAlloc(strlen(name) + 1);
     strcpy(node->val.strValue, name);
     return node;
 }
 
 Node* createStringLiteralNode(char* value){
     Node *node = createNode(NODE_STRING_LITERAL, 0);
-    node->val.strValue = (char*)malloc(strlen(value) + 1);
-    strcpy(node->val.strValue, value);
+    node->val.string = stringCopy(value, strlen(value));
+    return node;
+}
+
+/**
+ * @brief Create a lambda node; its children are the body expressions
+ * @param params The parameter names (ownership is taken)
+ * @param paramCount The number of parameters
+ * @return The new lambda node
+ */
+Node* createLambdaNode(char** params, int paramCount){
+    Node *node = createNode(NODE_LAMBDA, 0);
+    Lambda *lambda = (Lambda*)memAlloc(sizeof(Lambda));
+    lambda->paramCount = paramCount;
+    lambda->params = params;
+    lambda->captureCount = 0;
+    lambda->captures = NULL;
+    node->val.lambda = lambda;
+    return node;
+}
+
+/**
+ * @brief Generate a float literal node
+ * @param value The value of the node
+ * @return The new node
+ */
+Node* createFloatNode(double value){
+    Node *node = createNode(NODE_FLOAT, 0);
+    node->val.number = value;
     return node;
 }
 
@@ -59,8 +186,8 @@ Node* createStringLiteralNode(char* value){
  * @param value The value of the node
  * @return The new node
  */
-Node *createNode(NodeType type, int value){
-    Node *node = (Node *)malloc(sizeof(Node));
+Node *createNode(NodeType type, long long value){
+    Node *node = (Node *)memAlloc(sizeof(Node));
     node->type = type;
     switch(type){
         case NODE_OPERATOR:
@@ -77,6 +204,17 @@ Node *createNode(NodeType type, int value){
     }
     node->childNode = NULL;
     node->nextNode = NULL;
+    // Variables only get an inline cache slot once resolved as globals
+    node->slot = type == NODE_VARIABLE ? -1 : 0;
+    node->cost = 1;
+    node->pure = 0;
+    node->fork = 0;
+    node->jit = 0;
+    node->jitCount = 0;
+    node->jitCode = NULL;
+    node->refs = 1;
+    node->cse = -1;
+    node->regex = NULL;
     return node;
 }
 
@@ -97,6 +235,113 @@ void addNode(Node *parent, Node *child){
     }
 }
 
+typedef struct Scope {
+    Node *lambdaNode;
+    struct Scope *parent;
+} Scope;
+
+/**
+ * @brief Find where a name lives as seen from a lambda scope
+ * @param scope The innermost enclosing lambda, or NULL at top level
+ * @param name The variable name
+ * @param slot Set to the frame or closure slot
+ * @return NODE_LOCAL, NODE_CAPTURED, or NODE_VARIABLE for globals
+ *
+ * Names found in an outer lambda are added to the capture list of every
+ * lambda in between, so each closure only copies what its body uses.
+ */
+static NodeType resolveName(Scope *scope, const char *name, int *slot){
+    if(scope == NULL){
+        return NODE_VARIABLE;
+    }
+
+    Lambda *lambda = scope->lambdaNode->val.lambda;
+    for(int i = 0; i < lambda->paramCount; i++){
+        if(strcmp(lambda->params[i], name) == 0){
+            *slot = i;
+            return NODE_LOCAL;
+        }
+    }
+    for(int i = 0; i < lambda->captureCount; i++){
+        if(strcmp(lambda->captures[i].name, name) == 0){
+            *slot = i;
+            return NODE_CAPTURED;
+        }
+    }
+
+    int outerSlot;
+    NodeType outer = resolveName(scope->parent, name, &outerSlot);
+    if(outer == NODE_VARIABLE){
+        return NODE_VARIABLE;
+    }
+
+    lambda->captures = (Capture*)memRealloc(lambda->captures, sizeof(Capture) * (lambda->captureCount + 1));
+    lambda->captures[lambda->captureCount].name = memStrdup(name);
+    lambda->captures[lambda->captureCount].fromClosure = outer == NODE_CAPTURED;
+    lambda->captures[lambda->captureCount].slot = outerSlot;
+    *slot = lambda->captureCount++;
+    return NODE_CAPTURED;
+}
+
+/**
+ * @brief An inline cache slot for a global reference, one a freed tree gave
+ *        back if there is one
+ */
+static int takeInlineCacheSlot(void){
+    pthread_mutex_lock(&freeSlotLock);
+    int slot = freeSlotCount > 0 ? freeSlots[--freeSlotCount] : atomic_fetch_add(&inlineCacheSlots, 1);
+    pthread_mutex_unlock(&freeSlotLock);
+    return slot;
+}
+
+static void releaseInlineCacheSlot(int slot){
+    pthread_mutex_lock(&freeSlotLock);
+    if(freeSlotCount == freeSlotCapacity){
+        freeSlotCapacity = freeSlotCapacity == 0 ? 64 : freeSlotCapacity * 2;
+        AllocArena *arena = allocArenaUse(NULL);
+        freeSlots = (int*)memRealloc(freeSlots, sizeof(int) * freeSlotCapacity);
+        allocArenaUse(arena);
+    }
+    freeSlots[freeSlotCount++] = slot;
+    pthread_mutex_unlock(&freeSlotLock);
+}
+
+static void resolveNode(Node *node, Scope *scope){
+    for(; node != NULL; node = node->nextNode){
+        switch(node->type){
+            case NODE_VARIABLE:
+                node->type = resolveName(scope, node->val.strValue, &node->slot);
+                if(node->type == NODE_VARIABLE){
+                    node->slot = takeInlineCacheSlot();
+                }
+                break;
+            case NODE_LAMBDA: {
+                Scope inner = {node, scope};
+                resolveNode(node->childNode, &inner);
+                break;
+            }
+            case NODE_OPERATOR:
+                // The name being defined is always global
+                if(node->val.op == DEF && node->childNode != NULL){
+                    resolveNode(node->childNode->nextNode, scope);
+                }else{
+                    resolveNode(node->childNode, scope);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Bind every variable reference to a frame slot, a closure slot or a global
+ * @param root The root node of the tree
+ */
+void resolveTree(Node *root){
+    resolveNode(root, NULL);
+}
+
 /**
  * @brief Print a tree
  * @param node The root node of the tree
@@ -113,7 +358,13 @@ void printHelper(Node *node, char* prefix, int isLastChild){
 
     if(node->type == NODE_OPERATOR){
         printf("|--+ " COLOR_BLUE "%s\n" COLOR_RESET, getOperatorSymbol(node->val.op));
-    }else if (node->type == NODE_VARIABLE){
+    }else if(node->type == NODE_LAMBDA){
+        printf("|--+ " COLOR_BLUE "LAMBDA (");
+        for(int i = 0; i < node->val.lambda->paramCount; i++){
+            printf(i == 0 ? "%s" : " %s", node->val.lambda->params[i]);
+        }
+        printf(")\n" COLOR_RESET);
+    }else if (node->type == NODE_VARIABLE || node->type == NODE_LOCAL || node->type == NODE_CAPTURED){
         if(!isLastChild) {
             printf("|-- " COLOR_YELLOW "%s\n" COLOR_RESET, node->val.strValue);
         } else {
@@ -121,15 +372,23 @@ void printHelper(Node *node, char* prefix, int isLastChild){
         }
     }else if(node->type == NODE_STRING_LITERAL){
         if(!isLastChild){
-            printf("|-- " COLOR_MAGENTA "\"%s\"\n" COLOR_RESET, node->val.strValue);
+            printf("|-- " COLOR_MAGENTA "\"%s\"\n" COLOR_RESET, node->val.string->data);
         } else {
-            printf("\\-- " COLOR_MAGENTA "\"%s\"\n" COLOR_RESET, node->val.strValue);
+            printf("\\-- " COLOR_MAGENTA "\"%s\"\n" COLOR_RESET, node->val.string->data);
         }
+    }else if(node->type == NODE_FLOAT){
+        char digits[32];
+        formatFloat(node->val.number, digits);
+        printf("%s " COLOR_GREEN "%s\n" COLOR_RESET, isLastChild ? "\\--" : "|--", digits);
+    }else if(node->type == NODE_BIGINT){
+        char *digits = bigToString(node->val.big);
+        printf("%s " COLOR_GREEN "%s\n" COLOR_RESET, isLastChild ? "\\--" : "|--", digits);
+        memFree(digits);
     }else{
         if(!isLastChild){
-            printf("|-- " COLOR_GREEN "%d\n" COLOR_RESET, node->val.value);
+            printf("|-- " COLOR_GREEN "%lld\n" COLOR_RESET, node->val.value);
         }else{
-            printf("\\-- " COLOR_GREEN "%d\n" COLOR_RESET, node->val.value);
+            printf("\\-- " COLOR_GREEN "%lld\n" COLOR_RESET, node->val.value);
         }
     }
     char newPrefix[255];
@@ -161,11 +420,44 @@ void printTree(Node *node){
  */
 void freeTree(Node *node){
     if(node == NULL) return;
+    // Shared by cseShare: the last one to let go frees it
+    if(node->refs > 1){
+        node->refs--;
+        return;
+    }
 
     freeTree(node->childNode);
     freeTree(node->nextNode);
 
-    free(node);
+    if(node->type == NODE_LAMBDA){
+        Lambda *lambda = node->val.lambda;
+        for(int i = 0; i < lambda->paramCount; i++){
+            memFree(lambda->params[i]);
+        }
+        for(int i = 0; i < lambda->captureCount; i++){
+            memFree(lambda->captures[i].name);
+        }
+        memFree(lambda->params);
+        memFree(lambda->captures);
+        memFree(lambda);
+    }else if(node->type == NODE_VARIABLE || node->type == NODE_LOCAL || node->type == NODE_CAPTURED){
+        if(node->type == NODE_VARIABLE && node->slot >= 0){
+            releaseInlineCacheSlot(node->slot);
+        }
+        memFree(node->val.strValue);
+    }else if(node->type == NODE_STRING_LITERAL){
+        stringFree(node->val.string);
+    }else if(node->type == NODE_BIGINT){
+        memFree(node->val.big);
+    }
+    if(node->cse >= 0){
+        cseRelease(node->cse);
+    }
+    if(node->jitCode != NULL){
+        jitRelease(node->jitCode);
+    }
+    regexFree(node->regex);
+    memFree(node);
 }
 
 /**
@@ -209,8 +501,102 @@ char* getOperatorSymbol(int operator){
             return "PRINT";
         case INPUT:
             return "INPUT";
+        case LAMBDA:
+            return "LAMBDA";
+        case CALL:
+            return "CALL";
+        case VEC:
+            return "VEC";
+        case MAKE_VEC:
+            return "MAKE_VEC";
+        case VEC_RANGE:
+            return "VEC_RANGE";
+        case VEC_REF:
+            return "VEC_REF";
+        case VEC_LEN:
+            return "VEC_LEN";
+        case VEC_ADD:
+            return "VEC_ADD";
+        case VEC_SUB:
+            return "VEC_SUB";
+        case VEC_MUL:
+            return "VEC_MUL";
+        case VEC_DIV:
+            return "VEC_DIV";
+        case VEC_SUM:
+            return "VEC_SUM";
+        case VEC_MIN:
+            return "VEC_MIN";
+        case VEC_MAX:
+            return "VEC_MAX";
+        case VEC_DOT:
+            return "VEC_DOT";
+        case VEC_LT:
+            return "VEC_LT";
+        case VEC_GT:
+            return "VEC_GT";
+        case VEC_EQ:
+            return "VEC_EQ";
+        case MAP:
+            return "MAP";
+        case MAP_GET:
+            return "MAP_GET";
+        case MAP_PUT:
+            return "MAP_PUT";
+        case MAP_DEL:
+            return "MAP_DEL";
+        case MAP_HAS:
+            return "MAP_HAS";
+        case MAP_SIZE:
+            return "MAP_SIZE";
+        case READ_ALL:
+            return "READ_ALL";
+        case READ_LINES:
+            return "READ_LINES";
+        case READ_N:
+            return "READ_N";
+        case LENGTH:
+            return "LENGTH";
+        case SUBSTRING:
+            return "SUBSTRING";
+        case INDEX_OF:
+            return "INDEX_OF";
+        case CONTAINS:
+            return "CONTAINS";
+        case STARTS_WITH:
+            return "STARTS_WITH";
+        case SPLIT:
+            return "SPLIT";
+        case JOIN:
+            return "JOIN";
+        case REPLACE:
+            return "REPLACE";
+        case UPPER:
+            return "UPPER";
+        case LOWER:
+            return "LOWER";
+        case RE_MATCH:
+            return "RE_MATCH";
+        case RE_FIND:
+            return "RE_FIND";
+        case RE_REPLACE:
+            return "RE_REPLACE";
+        case LIST:
+            return "LIST";
+        case CONS:
+            return "CONS";
+        case CAR:
+            return "CAR";
+        case CDR:
+            return "CDR";
+        case NTH:
+            return "NTH";
+        case APPEND:
+            return "APPEND";
+        case REVERSE:
+            return "REVERSE";
         default: {
-            static char buf[16];
+            static _Thread_local char buf[16];
             snprintf(buf, sizeof(buf), "OP_%d", operator);
             return buf;
         }
@@ -219,319 +605,1083 @@ char* getOperatorSymbol(int operator){
 }
 
 /**
- * @brief Evaluate a tree
- * @param node The root node of the tree
- * @param globalEnv The global environment
- * @return The result of the evaluation
+ * @brief Build a closure for a lambda, copying its captured variables
+ * @param lambdaNode The NODE_LAMBDA being evaluated
+ * @return The closure value
  */
-Value evaluateTree(Node *node, EnvEntry **globalEnv){
-    if(node == NULL){
-        return (Value){.type = VAL_INT, .intValue = 0};
+static Value makeClosure(Node *lambdaNode){
+    Lambda *lambda = lambdaNode->val.lambda;
+    Closure *closure = (Closure*)memAlloc(sizeof(Closure) + sizeof(Value) * lambda->captureCount);
+    closure->lambdaNode = lambdaNode;
+    for(int i = 0; i < lambda->captureCount; i++){
+        Capture *capture = &lambda->captures[i];
+        closure->captured[i] = capture->fromClosure ? currentClosure->captured[capture->slot] : frame[capture->slot];
     }
+    return (Value){.type = VAL_CLOSURE, .closure = closure};
+}
+
+static void allocateStack(void){
+    // The thread keeps its stack from one embedding context to the next
+    AllocArena *arena = allocArenaUse(NULL);
+    stackBase = (Value*)memAlloc(sizeof(Value) * VALUE_STACK_SIZE);
+    allocArenaUse(arena);
+    stackTop = stackBase;
+    stackLimit = stackBase + VALUE_STACK_SIZE;
+}
 
-    if(node->type == NODE_VALUE){
-        return (Value){.type = VAL_INT, .intValue = node->val.value};
+/**
+ * @brief Push a value onto the value stack
+ * @param value The value to push
+ */
+static void stackPush(Value value){
+    if(stackTop == stackLimit){
+        fatalError(ERROR_RESOURCE, "Error: Value stack overflow\n");
     }
+    *stackTop++ = value;
+}
+
+/**
+ * @brief Drop whatever evaluation state this thread has left over
+ *
+ * For entry points that may be switching to a different environment, or
+ * that are starting again after an error unwound out of an evaluation.
+ */
+void resetEvaluator(void){
+    stackTop = stackBase;
+    frame = NULL;
+    currentClosure = NULL;
+    depth = 0;
+    // Cached entries may belong to another environment, and remembered
+    // results to values since freed
+    envVersion++;
+    sharedGeneration++;
+    // An error may have left lexing or parsing before it restored the phase
+    allocPhase(ALLOC_EVAL);
+}
+
+/**
+ * @brief Forget this thread's remembered common subexpression results
+ *
+ * They are matched by the identity of the values they were computed from,
+ * and hold values themselves, so call this after freeing values that a
+ * later evaluation could meet again at the same address, without a
+ * resetEvaluator in between.
+ */
+void forgetSharedResults(void){
+    sharedGeneration++;
+}
+
+static int isNumeric(Value value){
+    return value.type == VAL_INT || value.type == VAL_BIGINT || value.type == VAL_FLOAT;
+}
 
-    if(node->type == NODE_VARIABLE){
-        return env_get(*globalEnv, node->val.strValue);
+/**
+ * @brief Convert any number to a double (ints and bignums round to nearest)
+ */
+static double toDouble(Value value){
+    switch(value.type){
+        case VAL_FLOAT: return value.floatValue;
+        case VAL_BIGINT: return bigToDouble(value.bigValue);
+        default: return (double)value.intValue;
     }
+}
 
-    if(node->type == NODE_STRING_LITERAL){
-        return (Value){.type = VAL_STRING, .strValue = node->val.strValue};
+/**
+ * @brief Wrap a bignum result, demoting it to a fixnum when it fits
+ */
+static Value makeBigValue(BigInt *big){
+    long long fixnum;
+    if(bigToInt(big, &fixnum)){
+        memFree(big);
+        return makeIntValue(fixnum);
     }
+    return (Value){.type = VAL_BIGINT, .bigValue = big};
+}
 
-    Value result = (Value){.type = VAL_INT, .intValue = 0};
-    Node *current = node->childNode;
-    switch(node->val.op){
-        case ADD: {
-            Node* current = node->childNode;
-            int isStringConcat = 0;
-
-            // Peek ahead to check if any operand is a string
-            for (Node* n = current; n != NULL; n = n->nextNode) {
-                Value val = evaluateTree(n, globalEnv);
-                if (val.type == VAL_STRING) {
-                    isStringConcat = 1;
-                    break;
-                }
-            }
+/**
+ * @brief Arithmetic on doubles; division by zero gives inf or nan as in IEEE 754
+ */
+static inline Value floatArithmetic(enum operators op, double x, double y){
+    switch(op){
+        case ADD: return makeFloatValue(x + y);
+        case SUB: return makeFloatValue(x - y);
+        case MUL: return makeFloatValue(x * y);
+        default: return makeFloatValue(x / y);
+    }
+}
 
-            if (isStringConcat) {
-                // String concatenation path
-                char buffer[2048] = {0};
-                for (Node* n = current; n != NULL; n = n->nextNode) {
-                    Value val = evaluateTree(n, globalEnv);
-                    if (val.type == VAL_STRING) {
-                        strcat(buffer, val.strValue);
-                    } else if (val.type == VAL_INT) {
-                        char tmp[32];
-                        sprintf(tmp, "%d", val.intValue);
-                        strcat(buffer, tmp);
-                    } else {
-                        fprintf(stderr, "Error: Expected string or int in +\n");
-                        exit(1);
-                    }
-                }
-                return makeStringValue(buffer);
-            } else {
-                // Pure numeric add
-                int sum = 0;
-                for (; current != NULL; current = current->nextNode) {
-                    Value val = evaluateTree(current, globalEnv);
-                    if (val.type != VAL_INT) {
-                        fprintf(stderr, "Error: Expected INT in +\n");
-                        exit(1);
-                    }
-                    sum += val.intValue;
-                }
-                return makeIntValue(sum);
-            }
-        }
-        case SUB:
-        {
-            result.intValue = evaluateTree(current, globalEnv).intValue;
-            current = current->nextNode;
-            while (current != NULL) {
-                if (current->type == NODE_OPERATOR) {
-                    result.intValue -= evaluateTree(current, globalEnv).intValue;
-                    current = current->nextNode;
-                    continue;
-                }
+/**
+ * @brief Arithmetic once a fixnum operation overflowed or the operands are mixed
+ *
+ * Promotion: if either operand is a float the other is converted to double;
+ * otherwise both are widened to bignums.
+ */
+static Value slowArithmetic(enum operators op, Value a, Value b){
+    if(!isNumeric(a) || !isNumeric(b)){
+        fatalError(ERROR_TYPE, "Error: Expected number in %s\n", getOperatorSymbol(op));
+    }
 
-                result.intValue -= evaluateTree(current, globalEnv).intValue;
-                current = current->nextNode;
-            }
-            break;
-        }
-        case MUL:{
-            result = (Value){.type=VAL_INT, .intValue=1};
-            while (current != NULL) {
-                if (current->type == NODE_OPERATOR) {
-                    result.intValue *= evaluateTree(current, globalEnv).intValue;
-                    current = current->nextNode;
-                    continue;
-                }
+    if(a.type == VAL_FLOAT || b.type == VAL_FLOAT){
+        return floatArithmetic(op, toDouble(a), toDouble(b));
+    }
 
-                result.intValue *= evaluateTree(current, globalEnv).intValue;
-                current = current->nextNode;
+    BigInt *x = a.type == VAL_BIGINT ? a.bigValue : bigFromInt(a.intValue);
+    BigInt *y = b.type == VAL_BIGINT ? b.bigValue : bigFromInt(b.intValue);
+    BigInt *r;
+    switch(op){
+        case ADD: r = bigAdd(x, y); break;
+        case SUB: r = bigSub(x, y); break;
+        case MUL: r = bigMul(x, y); break;
+        default:
+            if(y->sign == 0){
+                fatalError(ERROR_RANGE, "Error: Division by zero\n");
             }
+            r = bigDiv(x, y);
             break;
-        }
-        case DIV: {
-            result.intValue = evaluateTree(current, globalEnv).intValue;
-            current = current->nextNode;
-            while (current != NULL) {
-                if (current->type == NODE_OPERATOR) {
-                    result.intValue /= evaluateTree(current, globalEnv).intValue;
-                    current = current->nextNode;
-                    continue;
-                }
+    }
 
-                result.intValue /= evaluateTree(current, globalEnv).intValue;
-                current = current->nextNode;
-            }
-            break;
+    if(a.type != VAL_BIGINT) memFree(x);
+    if(b.type != VAL_BIGINT) memFree(y);
+    return makeBigValue(r);
+}
+
+/**
+ * @brief Apply + - * or / to two numbers
+ *
+ * Fixnums and pairs of floats take the inline path, which only costs an
+ * overflow check over plain C arithmetic; anything else goes to
+ * slowArithmetic.
+ */
+static inline Value arithmetic(enum operators op, Value a, Value b){
+    if(a.type == VAL_INT && b.type == VAL_INT){
+        long long r;
+        switch(op){
+            case ADD:
+                if(!__builtin_add_overflow(a.intValue, b.intValue, &r)) return makeIntValue(r);
+                break;
+            case SUB:
+                if(!__builtin_sub_overflow(a.intValue, b.intValue, &r)) return makeIntValue(r);
+                break;
+            case MUL:
+                if(!__builtin_mul_overflow(a.intValue, b.intValue, &r)) return makeIntValue(r);
+                break;
+            default:
+                if(b.intValue == 0){
+                    fatalError(ERROR_RANGE, "Error: Division by zero\n");
+                }
+                // LLONG_MIN / -1 is the one quotient that overflows
+                if(b.intValue != -1 || a.intValue != LLONG_MIN) return makeIntValue(a.intValue / b.intValue);
+                break;
         }
-        case DEF: {
-            Node* varNode = node->childNode;
-            Node* exprNode = varNode->nextNode;
+    }else if(a.type == VAL_FLOAT && b.type == VAL_FLOAT){
+        return floatArithmetic(op, a.floatValue, b.floatValue);
+    }
+    return slowArithmetic(op, a, b);
+}
 
-            if(varNode == NULL || varNode->type != NODE_VARIABLE){
-                fprintf(stderr, "Error: Expected variable name\n");
-                exit(1);
-            }
+/**
+ * @brief Compare two numbers with GT, LT, EQ, GTE or LTE
+ *
+ * Floats compare as doubles, so any comparison with nan is false.
+ */
+static int compareNumbers(enum operators op, Value a, Value b){
+    int cmp;
+    if(a.type == VAL_FLOAT || b.type == VAL_FLOAT){
+        double x = toDouble(a), y = toDouble(b);
+        switch(op){
+            case GT: return x > y;
+            case LT: return x < y;
+            case GTE: return x >= y;
+            case LTE: return x <= y;
+            default: return x == y;
+        }
+    }else if(a.type == VAL_INT && b.type == VAL_INT){
+        cmp = (a.intValue > b.intValue) - (a.intValue < b.intValue);
+    }else{
+        BigInt *x = a.type == VAL_BIGINT ? a.bigValue : bigFromInt(a.intValue);
+        BigInt *y = b.type == VAL_BIGINT ? b.bigValue : bigFromInt(b.intValue);
+        cmp = bigCompare(x, y);
+        if(a.type != VAL_BIGINT) memFree(x);
+        if(b.type != VAL_BIGINT) memFree(y);
+    }
 
-            if(exprNode == NULL){
-                fprintf(stderr, "Error: Expected expression\n");
-                exit(1);
-            }
+    switch(op){
+        case GT: return cmp > 0;
+        case LT: return cmp < 0;
+        case GTE: return cmp >= 0;
+        case LTE: return cmp <= 0;
+        default: return cmp == 0;
+    }
+}
 
-            Value value = evaluateTree(exprNode, globalEnv);
-            env_set(globalEnv, varNode->val.strValue, value);
-            return value;
-        }
-        case SEQ: {
-            while (current != NULL) {
-                result = evaluateTree(current, globalEnv);
-                current = current->nextNode;
-            }
-            break;
-        }
-        case IF: {
-            if(current == NULL || current->nextNode == NULL || current->nextNode->nextNode == NULL){
-                fprintf(stderr, "Error: Expected three arguments for IF\n");
-                exit(1);
-            }
+static Value evaluateActivation(Node *node, EnvEntry **globalEnv, Value *base);
 
-            Node* condition = current;
-            Node* trueBranch = current->nextNode;
-            Node* falseBranch = trueBranch->nextNode;
+static Value evaluateShared(Node *node, EnvEntry **globalEnv, Value *base);
 
-            if(evaluateTree(condition, globalEnv).intValue){
-                result = evaluateTree(trueBranch, globalEnv);
-            break;
+/**
+ * @brief Add numbers, or concatenate when any operand is a string
+ */
+static Value addValues(Value *operands, int count){
+    int isStringConcat = 0;
+    for (int i = 0; i < count; i++) {
+        if (operands[i].type == VAL_STRING) {
+            isStringConcat = 1;
         }
-        case GT: {
-            if(current == NULL || current->nextNode == NULL){
-                fprintf(stderr, "Error: Expected two arguments for GT\n");
-                exit(1);
-            }
-
-            Value left = evaluateTree(current, globalEnv);
-            Value right = evaluateTree(current->nextNode, globalEnv);
+    }
 
-            if(left.type == VAL_INT && right.type == VAL_INT){
-                result.intValue = left.intValue > right.intValue;
-            } else {
-                fprintf(stderr, "Error: Expected two INTs\n");
-                exit(1);
+    if (isStringConcat) {
+        // Format the numbers first so the result can be sized exactly; the
+        // strings' cached lengths and code point counts carry over as is
+        char **text = NULL;
+        size_t length = 0, codePoints = 0;
+        int ascii = 1;
+        for (int i = 0; i < count; i++) {
+            Value val = operands[i];
+            if (val.type == VAL_STRING) {
+                length += val.string->length;
+                codePoints += val.string->codePoints;
+                ascii &= val.string->ascii;
+                continue;
             }
-            break;
-        }
-        }
-        case LT: {
-            if(current == NULL || current->nextNode == NULL){
-                fprintf(stderr, "Error: Expected two arguments for LT\n");
-                exit(1);
+            if (text == NULL) {
+                text = (char**)memCalloc((size_t)count, sizeof(char*));
             }
-
-            Value left = evaluateTree(current, globalEnv);
-            Value right = evaluateTree(current->nextNode, globalEnv);
-            if(left.type == VAL_INT && right.type == VAL_INT){
-                result.intValue = left.intValue < right.intValue;
+            char tmp[32];
+            if (val.type == VAL_INT) {
+                sprintf(tmp, "%lld", val.intValue);
+                text[i] = memStrdup(tmp);
+            } else if (val.type == VAL_FLOAT) {
+                formatFloat(val.floatValue, tmp);
+                text[i] = memStrdup(tmp);
+            } else if (val.type == VAL_BIGINT) {
+                text[i] = bigToString(val.bigValue);
             } else {
-                fprintf(stderr, "Error: Expected two INTs\n");
-                exit(1);
+                for (int j = 0; j < i; j++) {
+                    memFree(text[j]);
+                }
+                memFree(text);
+                fatalError(ERROR_TYPE, "Error: Expected string or int in +\n");
             }
-
-            break;
+            size_t n = strlen(text[i]);
+            length += n;
+            codePoints += n;
         }
-        case EQ: {
-            if(current == NULL || current->nextNode == NULL){
-                fprintf(stderr, "Error: Expected two arguments for EQ\n");
-                exit(1);
-            }
 
-            Value left = evaluateTree(current, globalEnv);
-            Value right = evaluateTree(current->nextNode, globalEnv);
-            if(left.type == VAL_INT && right.type == VAL_INT){
-                result.intValue = left.intValue == right.intValue;
-            } else if (left.type == VAL_STRING && right.type == VAL_STRING){
-                result.intValue = strcmp(left.strValue, right.strValue) == 0;
+        String *result = stringAlloc(length);
+        char *end = result->data;
+        for (int i = 0; i < count; i++) {
+            if (operands[i].type == VAL_STRING) {
+                memcpy(end, operands[i].string->bytes, operands[i].string->length);
+                end += operands[i].string->length;
             } else {
-                fprintf(stderr, "Error: Cannot compare different types\n");
-                exit(1);
+                size_t n = strlen(text[i]);
+                memcpy(end, text[i], n);
+                end += n;
+                memFree(text[i]);
             }
-            break;
         }
-        case GTE: {
-            if(current == NULL || current->nextNode == NULL){
-                fprintf(stderr, "Error: Expected two arguments for GTE\n");
-                exit(1);
-            }
+        memFree(text);
+        *end = '\0';
+        result->length = length;
+        result->codePoints = codePoints;
+        result->ascii = ascii;
+        return (Value){.type = VAL_STRING, .string = result};
+    }
 
-            Value left = evaluateTree(current, globalEnv);
-            Value right = evaluateTree(current->nextNode, globalEnv);
-            if(left.type == VAL_INT && right.type == VAL_INT){
-                result.intValue = left.intValue >= right.intValue;
-            } else {
-                fprintf(stderr, "Error: Expected two INTs\n");
-                exit(1);
+    // Pure numeric add
+    Value sum = makeIntValue(0);
+    for (int i = 0; i < count; i++) {
+        sum = arithmetic(ADD, sum, operands[i]);
+    }
+    return sum;
+}
+
+/**
+ * @brief Apply an arithmetic, comparison or logical operator to evaluated arguments
+ * @param op The operator
+ * @param args The argument values, in order
+ * @param argc The number of arguments
+ * @return The result
+ */
+static inline Value applyOperator(enum operators op, Value *args, int argc){
+    Value result = (Value){.type = VAL_INT, .intValue = 0};
+    switch(op){
+        case ADD:
+            return addValues(args, argc);
+        case SUB:
+        case DIV: {
+            if (argc == 0) {
+                fatalError(ERROR_ARITY, "Error: Expected at least one argument for %s\n", getOperatorSymbol(op));
             }
-            break;
-        }
-        case LTE: {
-            if(current == NULL || current->nextNode == NULL){
-                fprintf(stderr, "Error: Expected two arguments for LTE\n");
-                exit(1);
+            result = args[0];
+            for (int i = 1; i < argc; i++) {
+                result = arithmetic(op, result, args[i]);
             }
-
-            Value left = evaluateTree(current, globalEnv);
-            Value right = evaluateTree(current->nextNode, globalEnv);
-            if(left.type == VAL_INT && right.type == VAL_INT){
-                result.intValue = left.intValue <= right.intValue;
-            } else {
-                fprintf(stderr, "Error: Expected two INTs\n");
-                exit(1);
+            return result;
+        }
+        case MUL: {
+            result = makeIntValue(1);
+            for (int i = 0; i < argc; i++) {
+                result = arithmetic(MUL, result, args[i]);
             }
-            break;
+            return result;
         }
-        case AND: {
-            if(current == NULL || current->nextNode == NULL){
-                fprintf(stderr, "Error: Expected two arguments for AND\n");
-                exit(1);
+        case GT:
+        case LT:
+        case GTE:
+        case LTE:
+        case EQ: {
+            if(argc < 2){
+                fatalError(ERROR_ARITY, "Error: Expected two arguments for %s\n", getOperatorSymbol(op));
             }
 
-            Value left = evaluateTree(current, globalEnv);
-            Value right = evaluateTree(current->nextNode, globalEnv);
+            Value left = args[0];
+            Value right = args[1];
             if(left.type == VAL_INT && right.type == VAL_INT){
-                result.intValue = left.intValue && right.intValue;
+                switch(op){
+                    case GT: result.intValue = left.intValue > right.intValue; break;
+                    case LT: result.intValue = left.intValue < right.intValue; break;
+                    case GTE: result.intValue = left.intValue >= right.intValue; break;
+                    case LTE: result.intValue = left.intValue <= right.intValue; break;
+                    default: result.intValue = left.intValue == right.intValue; break;
+                }
+            } else if(isNumeric(left) && isNumeric(right)){
+                result.intValue = compareNumbers(op, left, right);
+            } else if(op == EQ && left.type == VAL_STRING && right.type == VAL_STRING){
+                result.intValue = stringEqual(left.string, right.string);
+            } else if(op == EQ){
+                fatalError(ERROR_TYPE, "Error: Cannot compare different types\n");
             } else {
-                fprintf(stderr, "Error: Expected two INTs\n");
-                exit(1);
+                fatalError(ERROR_TYPE, "Error: Expected two INTs\n");
             }
-            break;
+            return result;
         }
+        case AND:
         case OR: {
-            if(current == NULL || current->nextNode == NULL){
-                fprintf(stderr, "Error: Expected two arguments for OR\n");
-                exit(1);
+            if(argc < 2){
+                fatalError(ERROR_ARITY, "Error: Expected two arguments for %s\n", getOperatorSymbol(op));
             }
 
-            Value left = evaluateTree(current, globalEnv);
-            Value right = evaluateTree(current->nextNode, globalEnv);
+            Value left = args[0];
+            Value right = args[1];
             if(left.type == VAL_INT && right.type == VAL_INT){
-                result.intValue = left.intValue || right.intValue;
+                result.intValue = op == AND ? (left.intValue && right.intValue) : (left.intValue || right.intValue);
             } else {
-                fprintf(stderr, "Error: Expected two INTs\n");
-                exit(1);
+                fatalError(ERROR_TYPE, "Error: Expected two INTs\n");
             }
-            break;
+            return result;
         }
-        case NOT: {
-            if(current == NULL){
-                fprintf(stderr, "Error: Expected one argument for NOT\n");
-                exit(1);
-            }
+        default:
+            fatalError(ERROR_UNSUPPORTED, "Error: Unknown operator %s\n", getOperatorSymbol(op));
+    }
+}
 
-            Value val = evaluateTree(current, globalEnv);
-            if(val.type == VAL_INT){
-                result.intValue = !val.intValue;
-            } else {
-                fprintf(stderr, "Error: Expected INT\n");
-                exit(1);
-            }
-            break;
-        }
-        case PRINT :{
-            while (current != NULL) {
-                Value val = evaluateTree(current, globalEnv);
-                if(val.type == VAL_INT){
-                    printf("%d\n", val.intValue);
-                }else{
-                    printf("%s\n", val.strValue);
-                }
-                current = current->nextNode;
-            }
-            return (Value){.type = VAL_INT, .intValue = 0};
-            break;
-        }
-        case INPUT :{
-            char buffer[1024];
-            if(fgets(buffer, sizeof(buffer), stdin) == NULL){
-                fprintf(stderr, "Error: Could not read input\n");
-                exit(1);
-            }
+/*
+ * One argument handed to the fork-join pool. The frame and closure are the
+ * spawner's; nothing writes to them until every task has been waited for.
+ * An error is kept in the task, for the spawner to raise once it has waited.
+ */
+typedef struct {
+    ForkTask task;
+    Node *node;
+    EnvEntry **globalEnv;
+    Value *frame;
+    Closure *closure;
+    Value *result;
+    ErrorCode error;
+    char *message;
+} ArgumentTask;
 
-            // Remove newline
-            size_t len = strlen(buffer);
-            if (len > 0 && buffer[len - 1] == '\n') {
-                buffer[len - 1] = '\0';
-            }
+static void runArgumentTask(ForkTask *task){
+    ArgumentTask *argument = (ArgumentTask*)task;
+    Value *savedFrame = frame;
+    Closure *savedClosure = currentClosure;
+    Value *savedTop = stackTop;
+    int savedDepth = depth;
+    frame = argument->frame;
+    currentClosure = argument->closure;
+    // This thread's inline caches may point into an environment that has
+    // changed since they were filled; pure code cannot change it under us
+    envVersion++;
 
-            return makeStringValue(buffer);
-        }
+    // Unwinding past here would leave the spawner waiting forever, or on a
+    // worker, reach no trap at all
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if (setjmp(trap.jump) == 0) {
+        *argument->result = evaluateTree(argument->node, argument->globalEnv);
+        errorTrapPop(&trap);
+    } else {
+        argument->error = trap.code;
+        argument->message = memStrdup(trap.message);
+        stackTop = savedTop;
+        depth = savedDepth;
+    }
+
+    frame = savedFrame;
+    currentClosure = savedClosure;
+}
+
+/**
+ * @brief Evaluate arguments with the expensive ones spread over the pool
+ * @return The number of arguments, whose values end up on the stack in order
+ *
+ * The first expensive argument and all the cheap ones are evaluated on this
+ * thread while the other expensive ones are offered to idle workers.
+ */
+static int evaluateArgumentsInParallel(Node *first, EnvEntry **globalEnv){
+    // Read again after the error trap below, so it must survive a longjmp
+    volatile int argc = 0;
+    for (Node *n = first; n != NULL; n = n->nextNode) {
+        argc++;
+    }
+    if (stackLimit - stackTop < argc) {
+        fatalError(ERROR_RESOURCE, "Error: Value stack overflow\n");
+    }
+    Value *args = stackTop;
+    stackTop += argc;
+
+    ArgumentTask local[8];
+    ArgumentTask *tasks = argc <= 8 ? local : (ArgumentTask*)memAlloc(sizeof(ArgumentTask) * argc);
+    int keptOne = 0;
+    int i = 0;
+    for (Node *n = first; n != NULL; n = n->nextNode, i++) {
+        tasks[i].node = NULL;
+        if (n->cost < FORK_COST_THRESHOLD) {
+            continue;
+        }
+        if (!keptOne) {
+            keptOne = 1;
+            continue;
+        }
+        tasks[i] = (ArgumentTask){.node = n, .globalEnv = globalEnv, .frame = frame,
+                                  .closure = currentClosure, .result = &args[i]};
+        tasks[i].task.run = runArgumentTask;
+        if (!forkJoinSpawn(&tasks[i].task)) {
+            tasks[i].node = NULL;
+        }
+    }
+
+    // The spawned tasks point into this frame, so an error in the arguments
+    // evaluated here waits for them before it goes any further
+    Value *savedFrame = frame;
+    Closure *savedClosure = currentClosure;
+    int savedDepth = depth;
+    volatile int failedAt = argc;
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if (setjmp(trap.jump) == 0) {
+        int at = 0;
+        for (Node *n = first; n != NULL; n = n->nextNode, at++) {
+            if (tasks[at].node == NULL) {
+                failedAt = at;
+                args[at] = evaluateTree(n, globalEnv);
+            }
+        }
+        failedAt = argc;
+        errorTrapPop(&trap);
+    } else {
+        stackTop = args + argc;
+        frame = savedFrame;
+        currentClosure = savedClosure;
+        depth = savedDepth;
+    }
+    for (i = argc - 1; i >= 0; i--) {
+        if (tasks[i].node != NULL) {
+            forkJoinWait(&tasks[i].task);
+        }
+    }
+
+    // Report the leftmost error, as evaluating in order would have
+    ErrorCode error = failedAt < argc ? trap.code : ERROR_NONE;
+    char message[ERROR_MESSAGE_SIZE];
+    strcpy(message, trap.message);
+    for (i = argc - 1; i >= 0; i--) {
+        if (tasks[i].node != NULL && tasks[i].error != ERROR_NONE) {
+            if (i < failedAt) {
+                error = tasks[i].error;
+                strcpy(message, tasks[i].message);
+            }
+            memFree(tasks[i].message);
+        }
+    }
+
+    if (tasks != local) {
+        memFree(tasks);
+    }
+    if (error != ERROR_NONE) {
+        fatalError(error, "%s\n", message);
+    }
+    return argc;
+}
+
+/**
+ * @brief Evaluate an operator's arguments onto the value stack, in order
+ * @param node The operator node
+ * @param first Its first argument
+ * @param globalEnv The global environment
+ * @return The number of values pushed
+ */
+static int evaluateArguments(Node *node, Node *first, EnvEntry **globalEnv){
+    if (node->fork && forkJoinActive()) {
+        return evaluateArgumentsInParallel(first, globalEnv);
+    }
+    int argc = 0;
+    for (; first != NULL; first = first->nextNode) {
+        stackPush(evaluateTree(first, globalEnv));
+        argc++;
+    }
+    return argc;
+}
+
+
+/**
+ * @brief Evaluate a tree
+ * @param node The root node of the tree
+ * @param globalEnv The global environment
+ * @return The result of the evaluation
+ */
+Value evaluateTree(Node *node, EnvEntry **globalEnv){
+    if(node == NULL){
+        return (Value){.type = VAL_INT, .intValue = 0};
+    }
+
+    switch(node->type){
+        case NODE_VALUE:
+            return (Value){.type = VAL_INT, .intValue = node->val.value};
+        case NODE_BIGINT:
+            return (Value){.type = VAL_BIGINT, .bigValue = node->val.big};
+        case NODE_FLOAT:
+            return (Value){.type = VAL_FLOAT, .floatValue = node->val.number};
+        case NODE_VARIABLE:
+            return env_get_cached(node, *globalEnv);
+        case NODE_LOCAL:
+            return frame[node->slot];
+        case NODE_CAPTURED:
+            return currentClosure->captured[node->slot];
+        case NODE_STRING_LITERAL:
+            return (Value){.type = VAL_STRING, .string = node->val.string};
+        case NODE_LAMBDA:
+            return makeClosure(node);
+        default:
+            break;
+    }
+
+    if(stackBase == NULL){
+        allocateStack();
+    }
+
+    if(depth >= maxDepth){
+        fatalError(ERROR_RESOURCE, "Error: Evaluation nested deeper than %d levels\n", maxDepth);
+    }
+
+    // Calls made while evaluating this node reuse one frame above the caller's
+    Value *savedTop = stackTop;
+    Value *savedFrame = frame;
+    Closure *savedClosure = currentClosure;
+    int savedDepth = depth++;
+
+    Value result = node->cse >= 0 && cseEnabled ? evaluateShared(node, globalEnv, savedTop)
+                                                : evaluateActivation(node, globalEnv, savedTop);
+
+    stackTop = savedTop;
+    frame = savedFrame;
+    currentClosure = savedClosure;
+    depth = savedDepth;
+    return result;
+}
+
+/**
+ * @brief Apply a strict builtin (arithmetic, comparison, logic, vector or map
+ *        operator) to arguments that are already evaluated
+ */
+Value applyBuiltin(enum operators op, Value* args, int argc){
+    switch(op){
+        case VEC:
+        case MAKE_VEC:
+        case VEC_RANGE:
+        case VEC_REF:
+        case VEC_LEN:
+        case VEC_ADD:
+        case VEC_SUB:
+        case VEC_MUL:
+        case VEC_DIV:
+        case VEC_SUM:
+        case VEC_MIN:
+        case VEC_MAX:
+        case VEC_DOT:
+        case VEC_LT:
+        case VEC_GT:
+        case VEC_EQ:
+            return evaluateVectorOp(op, args, argc);
+        case MAP:
+        case MAP_GET:
+        case MAP_PUT:
+        case MAP_DEL:
+        case MAP_HAS:
+        case MAP_SIZE:
+            return evaluateMapOp(op, args, argc);
+        case LENGTH:
+        case SUBSTRING:
+        case INDEX_OF:
+        case CONTAINS:
+        case STARTS_WITH:
+        case SPLIT:
+        case JOIN:
+        case REPLACE:
+        case UPPER:
+        case LOWER:
+            return evaluateStringOp(op, args, argc);
+        case RE_MATCH:
+        case RE_FIND:
+        case RE_REPLACE:
+            return evaluateRegexOp(op, NULL, args, argc);
+        case LIST:
+        case CONS:
+        case CAR:
+        case CDR:
+        case NTH:
+        case APPEND:
+        case REVERSE:
+            return evaluateListOp(op, args, argc);
+        default:
+            return applyOperator(op, args, argc);
+    }
+}
+
+/**
+ * @brief Call a function value from C
+ * @param fn The closure to call
+ * @param args The argument values
+ * @param argc The number of arguments
+ * @param globalEnv The global environment
+ * @return The function's result
+ */
+Value applyFunction(Value fn, Value* args, int argc, EnvEntry **globalEnv){
+    if(fn.type != VAL_CLOSURE){
+        fatalError(ERROR_TYPE, "Error: Attempt to call a non-function\n");
+    }
+    Lambda *lambda = fn.closure->lambdaNode->val.lambda;
+    if(argc != lambda->paramCount){
+        fatalError(ERROR_ARITY, "Error: Expected %d arguments, got %d\n", lambda->paramCount, argc);
+    }
+    if(stackBase == NULL){
+        allocateStack();
+    }
+
+    Value *savedTop = stackTop;
+    Value *savedFrame = frame;
+    Closure *savedClosure = currentClosure;
+
+    frame = stackTop;
+    for(int i = 0; i < argc; i++){
+        stackPush(args[i]);
+    }
+    currentClosure = fn.closure;
+
+    Value result = (Value){.type = VAL_INT, .intValue = 0};
+    for(Node *body = fn.closure->lambdaNode->childNode; body != NULL; body = body->nextNode){
+        result = evaluateTree(body, globalEnv);
+    }
+
+    stackTop = savedTop;
+    frame = savedFrame;
+    currentClosure = savedClosure;
+    return result;
+}
+
+static void growInlineCaches(void);
+
+/**
+ * @brief Run a jitMark'd subtree's machine code, compiling it once it is hot
+ * @param node The subtree's root
+ * @param value Set to the result
+ * @return Whether the code produced the result; if not, the tree is walked
+ */
+static int runJit(Node *node, long long *value){
+    JitCode *code = __atomic_load_n(&node->jitCode, __ATOMIC_ACQUIRE);
+    if(code == NULL){
+        if(__atomic_add_fetch(&node->jitCount, 1, __ATOMIC_RELAXED) != JIT_THRESHOLD){
+            return 0;
+        }
+        // The code belongs to the tree, which may outlive the arena in use
+        AllocArena *arena = allocArenaUse(NULL);
+        code = jitCompile(node);
+        allocArenaUse(arena);
+        if(code == NULL){
+            return 0;
+        }
+    }
+    if(code->cacheSlots > inlineCacheCount){
+        growInlineCaches();
+    }
+    if(code->entry(frame, currentClosure != NULL ? currentClosure->captured : NULL,
+                   inlineCaches, envVersion, value) == 0){
+        return 1;
+    }
+    // A variable held something other than an INT, a global was not cached
+    // yet, or the result needs a bignum or an error message
+    if(__atomic_add_fetch(&code->bails, 1, __ATOMIC_RELAXED) == JIT_BAIL_LIMIT){
+        __atomic_store_n(&node->jit, 0, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+static EnvEntry* cachedEntry(Node *node, EnvEntry* env);
+
+/**
+ * @brief Read what a variable node refers to, without failing
+ * @return 0 for a global that is not bound
+ */
+static int readInput(Node *node, EnvEntry *env, Value *value){
+    if(node->type == NODE_LOCAL){
+        *value = frame[node->slot];
+        return 1;
+    }
+    if(node->type == NODE_CAPTURED){
+        *value = currentClosure->captured[node->slot];
+        return 1;
+    }
+    EnvEntry *entry = cachedEntry(node, env);
+    if(entry == NULL){
+        return 0;
+    }
+    *value = entry->value;
+    return 1;
+}
+
+// Strings and bignums are immutable, so while nothing is freed the same
+// pointer is the same value; see forgetSharedResults
+static int sameValue(Value a, Value b){
+    return a.type == b.type && a.intValue == b.intValue;
+}
+
+static void growSharedResults(void){
+    int count = cseExpressionCount();
+    AllocArena *arena = allocArenaUse(NULL);
+    sharedResults = (SharedResult*)memRealloc(sharedResults, sizeof(SharedResult) * count);
+    allocArenaUse(arena);
+    for(int i = sharedResultCount; i < count; i++){
+        sharedResults[i].generation = 0;
+    }
+    sharedResultCount = count;
+}
+
+/**
+ * @brief Evaluate an occurrence of a common subexpression
+ * @param node A node numbered by cseShare
+ * @return This thread's last result for it if the variables it reads hold
+ *         the same values as then, or else a new one
+ */
+static Value evaluateShared(Node *node, EnvEntry **globalEnv, Value *base){
+    if(node->cse >= sharedResultCount){
+        growSharedResults();
+    }
+    SharedResult *shared = &sharedResults[node->cse];
+    if(shared->generation != sharedGeneration){
+        // From before resetEvaluator, and maybe for an expression since
+        // freed whose number this one reuses
+        shared->generation = sharedGeneration;
+        shared->inputCount = -1;
+        shared->filled = 0;
+    }
+    if(shared->filled){
+        int same = 1;
+        for(int i = 0; i < shared->inputCount && same; i++){
+            Value value;
+            same = readInput(shared->inputs[i], *globalEnv, &value) && sameValue(value, shared->values[i]);
+        }
+        if(same){
+            if(cseStats){
+                cseCountSaved();
+            }
+            return shared->result;
+        }
+    }
+
+    Value result = evaluateActivation(node, globalEnv, base);
+
+    // Evaluating it may have grown the table
+    shared = &sharedResults[node->cse];
+    if(shared->inputCount < 0){
+        shared->inputCount = cseInputs(node, shared->inputs);
+    }
+    // A global on a branch not taken may be unbound; nothing to compare against then
+    shared->filled = 1;
+    for(int i = 0; i < shared->inputCount && shared->filled; i++){
+        shared->filled = readInput(shared->inputs[i], *globalEnv, &shared->values[i]);
+    }
+    shared->result = result;
+    return result;
+}
+
+/**
+ * @brief Evaluate an operator node, looping instead of recursing on tail positions
+ * @param node The operator node
+ * @param globalEnv The global environment
+ * @param base Where this activation may place its argument frame
+ * @return The result of the evaluation
+ *
+ * The branches of IF, the last expression of SEQ and the body of a called
+ * lambda are evaluated by replacing `node` and going round again. A call in
+ * one of those positions overwrites the frame at `base`, so tail-recursive
+ * loops run in constant C stack and constant value stack.
+ */
+static Value evaluateActivation(Node *node, EnvEntry **globalEnv, Value *base){
+    Node *entered = node;
+  tailCall:
+    if(node->type != NODE_OPERATOR){
+        return evaluateTree(node, globalEnv);
+    }
+    if(node->cse >= 0 && node != entered && cseEnabled){
+        return evaluateShared(node, globalEnv, base);
+    }
+
+    if(__atomic_load_n(&node->jit, __ATOMIC_RELAXED) && jitEnabled){
+        long long value;
+        if(runJit(node, &value)){
+            return makeIntValue(value);
+        }
+    }
+
+    Value result = (Value){.type = VAL_INT, .intValue = 0};
+    Node *current = node->childNode;
+    switch(node->val.op){
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case GT:
+        case LT:
+        case EQ:
+        case GTE:
+        case LTE:
+        case AND:
+        case OR: {
+            if (!node->fork && current != NULL && current->nextNode != NULL && current->nextNode->nextNode == NULL) {
+                // Two operands, by far the common case, need not touch the value stack
+                Value pair[2];
+                pair[0] = evaluateTree(current, globalEnv);
+                pair[1] = evaluateTree(current->nextNode, globalEnv);
+                if (pair[0].type == VAL_INT && pair[1].type == VAL_INT) {
+                    long long x = pair[0].intValue;
+                    long long y = pair[1].intValue;
+                    switch (node->val.op) {
+                        case GT: result.intValue = x > y; return result;
+                        case LT: result.intValue = x < y; return result;
+                        case EQ: result.intValue = x == y; return result;
+                        case GTE: result.intValue = x >= y; return result;
+                        case LTE: result.intValue = x <= y; return result;
+                        case AND: case OR: break;
+                        default: return arithmetic(node->val.op, pair[0], pair[1]);
+                    }
+                }
+                result = applyOperator(node->val.op, pair, 2);
+                break;
+            }
+            Value *args = stackTop;
+            int argc = evaluateArguments(node, current, globalEnv);
+            result = applyOperator(node->val.op, args, argc);
+            stackTop = args;
+            break;
+        }
+        case DEF: {
+            Node* varNode = node->childNode;
+            if(varNode == NULL || varNode->type != NODE_VARIABLE){
+                fatalError(ERROR_SYNTAX, "Error: Expected variable name\n");
+            }
+            Node* exprNode = varNode->nextNode;
+
+            if(exprNode == NULL){
+                fatalError(ERROR_SYNTAX, "Error: Expected expression\n");
+            }
+
+            Value value = evaluateTree(exprNode, globalEnv);
+            env_set(globalEnv, varNode->val.strValue, value);
+            return value;
+        }
+        case SEQ: {
+            if (current == NULL) {
+                break;
+            }
+            while (current->nextNode != NULL) {
+                evaluateTree(current, globalEnv);
+                current = current->nextNode;
+            }
+            node = current;
+            goto tailCall;
+        }
+        case IF: {
+            if(current == NULL || current->nextNode == NULL || current->nextNode->nextNode == NULL){
+                fatalError(ERROR_ARITY, "Error: Expected three arguments for IF\n");
+            }
+
+            Node* condition = current;
+            Node* trueBranch = current->nextNode;
+            Node* falseBranch = trueBranch->nextNode;
+
+            node = evaluateTree(condition, globalEnv).intValue ? trueBranch : falseBranch;
+            goto tailCall;
+        }
+        case NOT: {
+            if(current == NULL){
+                fatalError(ERROR_ARITY, "Error: Expected one argument for NOT\n");
+            }
+
+            Value val = evaluateTree(current, globalEnv);
+            if(val.type == VAL_INT){
+                result.intValue = !val.intValue;
+            } else {
+                fatalError(ERROR_TYPE, "Error: Expected INT\n");
+            }
+            break;
+        }
+        case PRINT :{
+            while (current != NULL) {
+                printValue(evaluateTree(current, globalEnv));
+                outputChar('\n');
+                current = current->nextNode;
+            }
+            return (Value){.type = VAL_INT, .intValue = 0};
+            break;
+        }
+        case INPUT :{
+            // Whatever was printed (a prompt, usually) has to be visible first
+            outputFlush();
+            String *line = inputReadLine();
+            if(line == NULL){
+                fatalError(ERROR_IO, "Error: Could not read input\n");
+            }
+            return (Value){.type = VAL_STRING, .string = line};
+        }
+        case READ_ALL: {
+            outputFlush();
+            return (Value){.type = VAL_STRING, .string = inputReadAll()};
+        }
+        case READ_N: {
+            Value count = evaluateTree(current, globalEnv);
+            if(count.type != VAL_INT || count.intValue < 0){
+                fatalError(ERROR_RANGE, "Error: Expected a non-negative INT for READ_N\n");
+            }
+            outputFlush();
+            return (Value){.type = VAL_STRING, .string = inputReadN((size_t)count.intValue)};
+        }
+        case READ_LINES: {
+            // (read-lines f) calls f on every remaining line and returns the count
+            Value fn = evaluateTree(current, globalEnv);
+            outputFlush();
+            long long count = 0;
+            String *line;
+            while((line = inputReadLine()) != NULL){
+                Value arg = (Value){.type = VAL_STRING, .string = line};
+                applyFunction(fn, &arg, 1, globalEnv);
+                count++;
+            }
+            return makeIntValue(count);
+        }
+        case VEC:
+        case MAKE_VEC:
+        case VEC_RANGE:
+        case VEC_REF:
+        case VEC_LEN:
+        case VEC_ADD:
+        case VEC_SUB:
+        case VEC_MUL:
+        case VEC_DIV:
+        case VEC_SUM:
+        case VEC_MIN:
+        case VEC_MAX:
+        case VEC_DOT:
+        case VEC_LT:
+        case VEC_GT:
+        case VEC_EQ: {
+            Value *args = stackTop;
+            int argc = evaluateArguments(node, current, globalEnv);
+            result = evaluateVectorOp(node->val.op, args, argc);
+            stackTop = args;
+            break;
+        }
+        case MAP:
+        case MAP_GET:
+        case MAP_PUT:
+        case MAP_DEL:
+        case MAP_HAS:
+        case MAP_SIZE: {
+            Value *args = stackTop;
+            int argc = evaluateArguments(node, current, globalEnv);
+            result = evaluateMapOp(node->val.op, args, argc);
+            stackTop = args;
+            break;
+        }
+        case LENGTH:
+        case SUBSTRING:
+        case INDEX_OF:
+        case CONTAINS:
+        case STARTS_WITH:
+        case SPLIT:
+        case JOIN:
+        case REPLACE:
+        case UPPER:
+        case LOWER: {
+            Value *args = stackTop;
+            int argc = evaluateArguments(node, current, globalEnv);
+            result = evaluateStringOp(node->val.op, args, argc);
+            stackTop = args;
+            break;
+        }
+        case RE_MATCH:
+        case RE_FIND:
+        case RE_REPLACE: {
+            Value *args = stackTop;
+            int argc = evaluateArguments(node, current, globalEnv);
+            result = evaluateRegexOp(node->val.op, node->regex, args, argc);
+            stackTop = args;
+            break;
+        }
+        case LIST:
+        case CONS:
+        case CAR:
+        case CDR:
+        case NTH:
+        case APPEND:
+        case REVERSE: {
+            Value *args = stackTop;
+            int argc = evaluateArguments(node, current, globalEnv);
+            result = evaluateListOp(node->val.op, args, argc);
+            stackTop = args;
+            break;
+        }
+        case CALL: {
+            Value fn = evaluateTree(current, globalEnv);
+            if(fn.type != VAL_CLOSURE){
+                fatalError(ERROR_TYPE, "Error: Attempt to call a non-function\n");
+            }
+
+            Lambda *lambda = fn.closure->lambdaNode->val.lambda;
+            Value *args = stackTop;
+            int argc = evaluateArguments(node, current->nextNode, globalEnv);
+
+            if(argc != lambda->paramCount){
+                fatalError(ERROR_ARITY, "Error: Expected %d arguments, got %d\n", lambda->paramCount, argc);
+            }
+
+            // The caller's frame is dead from here on, so the callee takes its place
+            memmove(base, args, sizeof(Value) * argc);
+            frame = base;
+            stackTop = base + argc;
+            currentClosure = fn.closure;
+
+            Node *body = fn.closure->lambdaNode->childNode;
+            if(body == NULL){
+                break;
+            }
+            while(body->nextNode != NULL){
+                evaluateTree(body, globalEnv);
+                body = body->nextNode;
+            }
+            node = body;
+            goto tailCall;
+        }
         default:
             return (Value){.type = VAL_INT, .intValue = 0};
     }
@@ -546,16 +1696,83 @@ Value evaluateTree(Node *node, EnvEntry **globalEnv){
  * @return
  */
 Value env_get(EnvEntry* env, const char* name) {
+    EnvEntry* entry = env_lookup(env, name);
+    if (entry != NULL) {
+        return entry->value;
+    }
+
+    fatalError(ERROR_UNBOUND, "Error: Variable %s not found\n", name);
+}
+
+/**
+ * @brief Find the entry for a variable
+ * @param env
+ * @param name
+ * @return The entry, or NULL if the name is not bound
+ */
+EnvEntry* env_lookup(EnvEntry* env, const char* name) {
     EnvEntry* current = env;
     while (current != NULL) {
         if (strcmp(current->name, name) == 0) {
-            return current->value;
+            return current;
         }
         current = current->next;
     }
+    return NULL;
+}
+
+/**
+ * @brief Extend this thread's inline cache table to every slot handed out so far
+ */
+static void growInlineCaches(void){
+    int slots = atomic_load(&inlineCacheSlots);
+    AllocArena *arena = allocArenaUse(NULL);
+    inlineCaches = (InlineCache*)memRealloc(inlineCaches, sizeof(InlineCache) * slots);
+    allocArenaUse(arena);
+    memset(inlineCaches + inlineCacheCount, 0, sizeof(InlineCache) * (slots - inlineCacheCount));
+    inlineCacheCount = slots;
+}
+
+/**
+ * @brief Find a global's entry through the node's inline cache
+ * @return The entry, or NULL if the name is not bound
+ */
+static EnvEntry* cachedEntry(Node *node, EnvEntry* env) {
+    InlineCache *cache = NULL;
+    if (node->slot >= 0) {
+        if (node->slot >= inlineCacheCount) {
+            // First lookup on this thread, or a tree resolved since
+            growInlineCaches();
+        }
+        cache = &inlineCaches[node->slot];
+        if (cache->version == envVersion) {
+            return cache->entry;
+        }
+    }
 
-    fprintf(stderr, "Error: Variable %s not found\n", name);
-    exit(1);
+    EnvEntry* entry = env_lookup(env, node->val.strValue);
+    if (entry != NULL && cache != NULL) {
+        cache->entry = entry;
+        cache->version = envVersion;
+    }
+    return entry;
+}
+
+/**
+ * @brief Read a variable through the node's inline cache
+ * @param node A NODE_VARIABLE node
+ * @param env
+ * @return The variable's value
+ *
+ * A hit costs one compare and one load. On a miss (first read, or a name was
+ * added since the cache was filled) the list is scanned and the cache refilled.
+ */
+Value env_get_cached(Node *node, EnvEntry* env) {
+    EnvEntry* entry = cachedEntry(node, env);
+    if (entry == NULL) {
+        fatalError(ERROR_UNBOUND, "Error: Variable %s not found\n", node->val.strValue);
+    }
+    return entry->value;
 }
 
 
@@ -576,32 +1793,342 @@ void env_set(EnvEntry** env, const char* name, Value value) {
         current = current->next;
     }
 
-    EnvEntry* newEntry = (EnvEntry*)malloc(sizeof(EnvEntry));
-    newEntry->name = strdup(name); // malloc + strcpy in one
+    EnvEntry* newEntry = (EnvEntry*)memAlloc(sizeof(EnvEntry));
+    newEntry->name = memStrdup(name); // malloc + strcpy in one
     newEntry->value = value;
 
     newEntry->next = *env;  // Add to front
     *env = newEntry;
+    envVersion++;
+}
+
+/**
+ * @brief Remove a variable from the environment, if it is there
+ * @param env
+ * @param name
+ */
+void env_remove(EnvEntry** env, const char* name){
+    for(EnvEntry** link = env; *link != NULL; link = &(*link)->next){
+        EnvEntry* entry = *link;
+        if(strcmp(entry->name, name) == 0){
+            *link = entry->next;
+            memFree(entry->name);
+            memFree(entry);
+            envVersion++;
+            return;
+        }
+    }
 }
 
 void env_free(EnvEntry* env){
+    envVersion++;
+
     EnvEntry* current = env;
     while(current != NULL){
         EnvEntry* next = current->next;
-        free(current->name);
-        free(current);
+        memFree(current->name);
+        memFree(current);
         current = next;
     }
 }
 
-Value makeIntValue(int x){
+/*
+ * What env_keep has been through that it could not simply take, keyed by
+ * the original: slices and lists, which it copies, and containers in no
+ * arena, which it fixes in place and maps to themselves. Each is done once,
+ * so values shared before are shared after, and a map holding itself still
+ * does.
+ */
+typedef struct {
+    const void *from;
+    void *to;
+} KeptValue;
+
+typedef struct {
+    KeptValue *slots;
+    size_t capacity;    // power of two
+    size_t count;
+} KeptValues;
+
+static size_t keptSlot(const KeptValues *kept, const void *from){
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)from * 0x9E3779B97F4A7C15ULL) >> 32) & (kept->capacity - 1);
+    while(kept->slots[slot].from != NULL && kept->slots[slot].from != from){
+        slot = (slot + 1) & (kept->capacity - 1);
+    }
+    return slot;
+}
+
+static void *findKept(const KeptValues *kept, const void *from){
+    return kept->capacity > 0 ? kept->slots[keptSlot(kept, from)].to : NULL;
+}
+
+static void addKept(KeptValues *kept, const void *from, void *to){
+    if((kept->count + 1) * 2 > kept->capacity){
+        KeptValues grown = {NULL, kept->capacity > 0 ? kept->capacity * 2 : 64, kept->count};
+        grown.slots = (KeptValue*)memCalloc(grown.capacity, sizeof(KeptValue));
+        for(size_t i = 0; i < kept->capacity; i++){
+            if(kept->slots[i].from != NULL){
+                grown.slots[keptSlot(&grown, kept->slots[i].from)] = kept->slots[i];
+            }
+        }
+        memFree(kept->slots);
+        *kept = grown;
+    }
+    kept->slots[keptSlot(kept, from)] = (KeptValue){from, to};
+    kept->count++;
+}
+
+/**
+ * @brief Whether a container's contents still need keeping: the first
+ *        time it is met, whichever arena it is in
+ */
+static int firstVisit(void *container, KeptValues *kept){
+    switch(allocArenaTake(container)){
+        case 1:
+            return 1;
+        case 0:
+            return 0;
+        default:
+            if(findKept(kept, container) != NULL){
+                return 0;
+            }
+            addKept(kept, container, container);
+            return 1;
+    }
+}
+
+static Value keepValue(Value value, KeptValues *kept);
+
+static Value keepElement(Value value, void *kept){
+    return keepValue(value, (KeptValues*)kept);
+}
+
+static String *keepString(String *string, KeptValues *kept){
+    if(string->bytes == string->data){
+        allocArenaTake(string);
+        return string;
+    }
+    // A slice cannot outlive its parent's arena, so becomes a string of its own
+    String *copy = (String*)findKept(kept, string);
+    if(copy == NULL){
+        copy = stringCopy(string->bytes, string->length);
+        addKept(kept, string, copy);
+    }
+    return copy;
+}
+
+static void keepTable(MapTable *table, KeptValues *kept){
+    if(table->slots == NULL){
+        return;
+    }
+    allocArenaTake(table->slots);
+    for(size_t i = 0; i < table->capacity; i++){
+        // 0 is an empty slot and 1 a deleted one
+        if(table->slots[i].hash > 1){
+            table->slots[i].key = keepValue(table->slots[i].key, kept);
+            table->slots[i].value = keepValue(table->slots[i].value, kept);
+        }
+    }
+}
+
+static Value keepValue(Value value, KeptValues *kept){
+    switch(value.type){
+        case VAL_INT:
+        case VAL_FLOAT:
+            return value;
+        case VAL_STRING:
+            value.string = keepString(value.string, kept);
+            return value;
+        case VAL_BIGINT:
+            allocArenaTake(value.bigValue);
+            return value;
+        case VAL_CLOSURE:
+            if(firstVisit(value.closure, kept)){
+                int count = value.closure->lambdaNode->val.lambda->captureCount;
+                for(int i = 0; i < count; i++){
+                    value.closure->captured[i] = keepValue(value.closure->captured[i], kept);
+                }
+            }
+            return value;
+        case VAL_VECTOR:
+            if(firstVisit(value.vector, kept) && value.vector->type == VEC_OF_STRING){
+                for(size_t i = 0; i < value.vector->length; i++){
+                    value.vector->strings[i] = keepString(value.vector->strings[i], kept);
+                }
+            }
+            return value;
+        case VAL_MAP:
+            if(firstVisit(value.map, kept)){
+                keepTable(&value.map->current, kept);
+                keepTable(&value.map->old, kept);
+            }
+            return value;
+        case VAL_LIST: {
+            if(value.list == NULL){
+                return value;
+            }
+            // Chunks are carved out of blocks shared with other lists
+            List *copy = (List*)findKept(kept, value.list);
+            if(copy == NULL){
+                copy = copyList(value.list, keepElement, kept);
+                addKept(kept, value.list, copy);
+            }
+            value.list = copy;
+            return value;
+        }
+    }
+    return value;
+}
+
+/**
+ * @brief Move an environment, and every value it can reach, into the
+ *        current allocation arena
+ *
+ * For --each-line, which keeps only what the globals hold when it frees
+ * the arenas its records ran in. Lists and slices are copied, as they share
+ * their blocks; everything else stays where it is, so values shared before
+ * are shared after.
+ */
+void env_keep(EnvEntry* env){
+    KeptValues kept = {NULL, 0, 0};
+    for(; env != NULL; env = env->next){
+        allocArenaTake(env);
+        allocArenaTake(env->name);
+        env->value = keepValue(env->value, &kept);
+    }
+    memFree(kept.slots);
+}
+
+Value makeIntValue(long long x){
     return (Value){.type = VAL_INT, .intValue = x};
 }
 
 Value makeStringValue(const char* s){
     Value v;
     v.type = VAL_STRING;
-    v.strValue = strdup(s);
+    v.string = stringCopy(s, strlen(s));
     return v;
 }
 
+Value makeFloatValue(double x){
+    return (Value){.type = VAL_FLOAT, .floatValue = x};
+}
+
+/**
+ * @brief Format a double with the fewest digits that read back to the same value
+ * @param value The number
+ * @param buffer At least 32 bytes
+ * @return The length written
+ *
+ * The digits come from shortestDecimal (dtoa.h) and are laid out as %.Pg
+ * would, P being the digit count but at least 15: plain notation unless the
+ * decimal exponent is below -4 or at least P. Integral values keep a ".0"
+ * so they still read back as floats.
+ */
+int formatFloat(double value, char* buffer){
+    if(isnan(value)){
+        return sprintf(buffer, "nan");
+    }
+    if(isinf(value)){
+        return sprintf(buffer, value < 0 ? "-inf" : "inf");
+    }
+
+    uint64_t significand;
+    int exponent;
+    shortestDecimal(value, &significand, &exponent);
+    char digits[24];
+    int count = 0;
+    do{
+        digits[count++] = (char)('0' + significand % 10);
+        significand /= 10;
+    }while(significand != 0);
+    // Most significant first, without the zeros rounding may have left at the end
+    int skip = 0;
+    while(skip < count - 1 && digits[skip] == '0'){
+        skip++;
+    }
+    exponent += skip;
+    count -= skip;
+    for(int i = 0; i < count / 2; i++){
+        char digit = digits[skip + i];
+        digits[skip + i] = digits[skip + count - 1 - i];
+        digits[skip + count - 1 - i] = digit;
+    }
+    const char* d = digits + skip;
+    int scientific = exponent + count - 1;  // the exponent of the first digit
+
+    int length = 0;
+    if(signbit(value)){
+        buffer[length++] = '-';
+    }
+    if(scientific < -4 || scientific >= (count > 15 ? count : 15)){
+        buffer[length++] = d[0];
+        if(count > 1){
+            buffer[length++] = '.';
+            memcpy(buffer + length, d + 1, (size_t)count - 1);
+            length += count - 1;
+        }
+        length += sprintf(buffer + length, "e%c%02d", scientific < 0 ? '-' : '+', abs(scientific));
+        return length;
+    }
+    if(scientific < 0){
+        buffer[length++] = '0';
+        buffer[length++] = '.';
+        for(int i = -1; i > scientific; i--){
+            buffer[length++] = '0';
+        }
+        memcpy(buffer + length, d, (size_t)count);
+        length += count;
+    }else{
+        for(int i = 0; i <= scientific; i++){
+            buffer[length++] = i < count ? d[i] : '0';
+        }
+        buffer[length++] = '.';
+        if(count > scientific + 1){
+            memcpy(buffer + length, d + scientific + 1, (size_t)(count - scientific - 1));
+            length += count - scientific - 1;
+        }else{
+            buffer[length++] = '0';
+        }
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+/**
+ * @brief Write a value to the output buffer the way PRINT shows it
+ * @param value The value
+ */
+void printValue(Value value){
+    switch(value.type){
+        case VAL_INT:
+            outputInt(value.intValue);
+            break;
+        case VAL_FLOAT: {
+            char digits[32];
+            outputWrite(digits, (size_t)formatFloat(value.floatValue, digits));
+            break;
+        }
+        case VAL_BIGINT: {
+            char *digits = bigToString(value.bigValue);
+            outputString(digits);
+            memFree(digits);
+            break;
+        }
+        case VAL_VECTOR:
+            printVector(value.vector);
+            break;
+        case VAL_MAP:
+            printHashMap(value.map);
+            break;
+        case VAL_LIST:
+            printList(value.list);
+            break;
+        case VAL_CLOSURE:
+            outputString("<lambda>");
+            break;
+        default:
+            outputWrite(value.string->bytes, value.string->length);
+            break;
+    }
+}
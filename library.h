@@ -1,5 +1,8 @@
 #ifndef LISP_LITE_LIBRARY_H
 #define LISP_LITE_LIBRARY_H
+#include "error.h"
+#include "bigint.h"
+#include "utf8.h"
 
 enum operators {
     ADD,
@@ -18,19 +21,83 @@ enum operators {
     OR,
     NOT,
     PRINT,
-    INPUT
+    INPUT,
+    LAMBDA,
+    CALL,
+    VEC,
+    MAKE_VEC,
+    VEC_RANGE,
+    VEC_REF,
+    VEC_LEN,
+    VEC_ADD,
+    VEC_SUB,
+    VEC_MUL,
+    VEC_DIV,
+    VEC_SUM,
+    VEC_MIN,
+    VEC_MAX,
+    VEC_DOT,
+    VEC_LT,
+    VEC_GT,
+    VEC_EQ,
+    MAP,
+    MAP_GET,
+    MAP_PUT,
+    MAP_DEL,
+    MAP_HAS,
+    MAP_SIZE,
+    READ_ALL,
+    READ_LINES,
+    READ_N,
+    LENGTH,
+    SUBSTRING,
+    INDEX_OF,
+    CONTAINS,
+    STARTS_WITH,
+    SPLIT,
+    JOIN,
+    REPLACE,
+    UPPER,
+    LOWER,
+    RE_MATCH,
+    RE_FIND,
+    RE_REPLACE,
+    LIST,
+    CONS,
+    CAR,
+    CDR,
+    NTH,
+    APPEND,
+    REVERSE
 };
 
 typedef enum {
     VAL_INT,
-    VAL_STRING
+    VAL_STRING,
+    VAL_CLOSURE,
+    VAL_BIGINT,
+    VAL_FLOAT,
+    VAL_VECTOR,
+    VAL_MAP,
+    VAL_LIST
 }ValueType;
 
+typedef struct Closure Closure;
+typedef struct Vector Vector;
+typedef struct HashMap HashMap;
+typedef struct List List;   // a tagged chunk address, see list.h
+
 typedef struct {
     ValueType type;
     union {
-        int intValue;
-        char *strValue;
+        long long intValue;
+        String *string;
+        Closure *closure;
+        BigInt *bigValue;
+        double floatValue;
+        Vector *vector;
+        HashMap *map;
+        List *list;
     };
 }Value;
 
@@ -40,13 +107,44 @@ typedef struct EnvEntry {
     struct EnvEntry* next;
 }EnvEntry;
 
+/*
+ * A thread's cached binding for one global reference (see env_get_cached):
+ * valid while `version` matches the thread's environment version.
+ */
+typedef struct {
+    EnvEntry *entry;
+    unsigned long version;
+} InlineCache;
+
 typedef enum{
     NODE_OPERATOR,
     NODE_VALUE,
     NODE_VARIABLE,
-    NODE_STRING_LITERAL
+    NODE_STRING_LITERAL,
+    NODE_BIGINT,    // integer literal too large for a fixnum
+    NODE_FLOAT,
+    NODE_LAMBDA,
+    NODE_LOCAL,     // parameter of the innermost lambda, read from its frame
+    NODE_CAPTURED   // free variable of the innermost lambda, read from its closure
 } NodeType;
 
+/*
+ * A captured variable is copied into the closure when the lambda is
+ * evaluated, from either the enclosing frame or the enclosing closure.
+ */
+typedef struct {
+    char *name;
+    int fromClosure;
+    int slot;
+} Capture;
+
+typedef struct {
+    int paramCount;
+    char **params;
+    int captureCount;
+    Capture *captures;
+} Lambda;
+
 
 /*
  * Trees kinda look like:
@@ -58,27 +156,81 @@ typedef enum{
  *
  */
 typedef struct Node Node;
+typedef struct JitCode JitCode;
+typedef struct Regex Regex;
 struct Node{
     NodeType type;
     union {
-        int value;
+        long long value;
         enum operators op;
-        char* strValue;
+        char* strValue;     // a variable's name
+        String* string;     // a string literal
+        Lambda* lambda;
+        BigInt* big;
+        double number;
     } val;
     Node *childNode;
     Node *nextNode;
+    /*
+     * Frame or closure slot for NODE_LOCAL / NODE_CAPTURED; for a global
+     * NODE_VARIABLE, its slot in the per-thread inline cache tables.
+     */
+    int slot;
+    /*
+     * Set by analyzeEffects: a static estimate of what evaluating the subtree
+     * costs, whether it is free of side effects, and whether this operator's
+     * arguments are worth evaluating in parallel.
+     */
+    unsigned int cost;
+    unsigned char pure;
+    unsigned char fork;
+    /*
+     * Set by jitMark on the root of an int-only subtree: how many times it
+     * has been evaluated, and its machine code once it has been compiled.
+     */
+    unsigned char jit;
+    unsigned int jitCount;
+    JitCode *jitCode;
+    /*
+     * Set by cseShare: how many nodes point at this one, and the number of
+     * the common subexpression it is an occurrence of, or -1.
+     */
+    unsigned int refs;
+    int cse;
+    /*
+     * Set by the parser on a regex operator whose pattern is a string
+     * literal: the pattern, compiled once for every evaluation.
+     */
+    Regex *regex;
+};
+
+/*
+ * Flat closure: the lambda plus a copy of exactly the free variables its
+ * body uses, so reading one is a single indexed load.
+ */
+struct Closure {
+    Node *lambdaNode;
+    Value captured[];
 };
 
-Node *createNode(NodeType type, int value);
+Node *createNode(NodeType type, long long value);
 
 Node *createOperatorNode(int value);
 
-Node *createValueNode(int value);
+Node *createValueNode(long long value);
+
+Node *createBigIntNode(const char* digits);
+
+Node *createFloatNode(double value);
 
 Node *createVariableNode(char* name);
 
 Node *createStringLiteralNode(char* value);
 
+Node *createLambdaNode(char** params, int paramCount);
+
+void resolveTree(Node *root);
+
 void addNode(Node *parent, Node *child);
 
 void printHelper(Node *node, char* prefix, int isLastChild);
@@ -89,16 +241,42 @@ void freeTree(Node *node);
 
 char* getOperatorSymbol(int operator);
 
+// How deeply evaluateTree may nest before it fails with ERROR_RESOURCE;
+// set by --max-depth before anything is evaluated
+extern int maxDepth;
+
 Value evaluateTree(Node *node, EnvEntry **globalEnv);
 
+Value applyFunction(Value fn, Value* args, int argc, EnvEntry **globalEnv);
+
+Value applyBuiltin(enum operators op, Value* args, int argc);
+
+void resetEvaluator(void);
+
+void forgetSharedResults(void);
+
 Value env_get(EnvEntry* env, const char* name);
 
+EnvEntry* env_lookup(EnvEntry* env, const char* name);
+
+Value env_get_cached(Node *node, EnvEntry* env);
+
 void env_set(EnvEntry** env, const char* name, Value value);
 
+void env_remove(EnvEntry** env, const char* name);
+
 void env_free(EnvEntry* env);
 
-Value makeIntValue(int value);
+void env_keep(EnvEntry* env);
+
+Value makeIntValue(long long value);
 
 Value makeStringValue(const char* value);
 
+Value makeFloatValue(double value);
+
+int formatFloat(double value, char* buffer);
+
+void printValue(Value value);
+
 #endif //LISP_LITE_LIBRARY_H
@@ -0,0 +1,276 @@
+#include "lisp.h"
+#include "library.h"
+#include "lexer.h"
+#include "output.h"
+#include "input.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct lisp_program {
+    char* source;
+    Token* tokens;
+    Node* tree;
+    lisp_program* next;
+};
+
+struct lisp_ctx {
+    AllocArena* arena;      // everything the context allocates
+    EnvEntry* globals;
+    lisp_program* programs;
+    lisp_write_fn write;
+    InputSource* input;
+    void* user;
+    ErrorCode code;
+    char error[ERROR_MESSAGE_SIZE];
+};
+
+// lisp_status lists the same codes in the same order
+_Static_assert((int)LISP_ERROR_UNSUPPORTED == (int)ERROR_UNSUPPORTED, "lisp_status out of step with ErrorCode");
+
+static lisp_value toPublic(Value value){
+    lisp_value v;
+    switch(value.type){
+        case VAL_INT:
+            v.type = LISP_INT;
+            v.as.int_value = value.intValue;
+            break;
+        case VAL_FLOAT:
+            v.type = LISP_FLOAT;
+            v.as.float_value = value.floatValue;
+            break;
+        case VAL_STRING:
+            v.type = LISP_STRING;
+            v.as.string_value = stringCString(value.string);
+            break;
+        case VAL_BIGINT:
+            v.type = LISP_BIGINT;
+            v.as.object = value.bigValue;
+            break;
+        case VAL_CLOSURE:
+            v.type = LISP_FUNCTION;
+            v.as.object = value.closure;
+            break;
+        case VAL_VECTOR:
+            v.type = LISP_VECTOR;
+            v.as.object = value.vector;
+            break;
+        case VAL_MAP:
+            v.type = LISP_MAP;
+            v.as.object = value.map;
+            break;
+        case VAL_LIST:
+            v.type = LISP_LIST;
+            v.as.object = value.list;
+            break;
+    }
+    return v;
+}
+
+static Value fromPublic(lisp_value v){
+    switch(v.type){
+        case LISP_INT:
+            return makeIntValue(v.as.int_value);
+        case LISP_FLOAT:
+            return makeFloatValue(v.as.float_value);
+        case LISP_STRING:
+            return makeStringValue(v.as.string_value);
+        case LISP_BIGINT:
+            return (Value){.type = VAL_BIGINT, .bigValue = (BigInt*)v.as.object};
+        case LISP_FUNCTION:
+            return (Value){.type = VAL_CLOSURE, .closure = (Closure*)v.as.object};
+        case LISP_VECTOR:
+            return (Value){.type = VAL_VECTOR, .vector = (Vector*)v.as.object};
+        case LISP_MAP:
+            return (Value){.type = VAL_MAP, .map = (HashMap*)v.as.object};
+        case LISP_LIST:
+            return (Value){.type = VAL_LIST, .list = (List*)v.as.object};
+    }
+    return makeIntValue(0);
+}
+
+/**
+ * @brief Point this thread's interpreter state at a context
+ */
+static void enter(lisp_ctx* ctx){
+    resetEvaluator();
+    allocArenaUse(ctx->arena);
+    outputRedirect(ctx->write, ctx->user);
+    inputUse(ctx->input);
+}
+
+static void leave(void){
+    allocArenaUse(NULL);
+    outputRedirect(NULL, NULL);
+    inputUse(NULL);
+}
+
+/**
+ * @brief Create an interpreter with no globals, writing to stdout and reading stdin
+ * @return The context, or NULL when out of memory
+ */
+lisp_ctx* lisp_create(void){
+    AllocArena* arena = allocArenaCreate();
+    if(arena == NULL){
+        return NULL;
+    }
+    lisp_ctx* ctx = (lisp_ctx*)memCalloc(1, sizeof(lisp_ctx));
+    if(ctx == NULL){
+        allocArenaFree(arena);
+        return NULL;
+    }
+    ctx->arena = arena;
+    return ctx;
+}
+
+/**
+ * @brief Free a context, its globals, every program loaded into it and
+ *        every value it made
+ */
+void lisp_destroy(lisp_ctx* ctx){
+    if(ctx == NULL){
+        return;
+    }
+    env_free(ctx->globals);
+    lisp_program* program = ctx->programs;
+    while(program != NULL){
+        lisp_program* next = program->next;
+        freeTree(program->tree);
+        freeTokens(program->tokens);
+        memFree(program->source);
+        memFree(program);
+        program = next;
+    }
+    inputSourceFree(ctx->input);
+    allocArenaFree(ctx->arena);
+    memFree(ctx);
+}
+
+/**
+ * @brief Route program output and input through callbacks
+ * @param write Receives output; NULL for stdout
+ * @param read Supplies input for input, read-line and friends; NULL for stdin
+ * @param user Passed to both callbacks
+ */
+void lisp_set_io(lisp_ctx* ctx, lisp_write_fn write, lisp_read_fn read, void* user){
+    inputSourceFree(ctx->input);
+    ctx->input = read != NULL ? inputSourceCreate(read, user) : NULL;
+    ctx->write = write;
+    ctx->user = user;
+}
+
+/**
+ * @brief Parse a program held in memory
+ * @param source The program text; it need not be NUL-terminated
+ * @param length Its length in bytes
+ * @return The program, owned by the context, or NULL on a syntax error
+ */
+lisp_program* lisp_load(lisp_ctx* ctx, const char* source, size_t length){
+    allocArenaUse(ctx->arena);
+    lisp_program* program = (lisp_program*)memCalloc(1, sizeof(lisp_program));
+    program->source = (char*)memAlloc(length + 1);
+    memcpy(program->source, source, length);
+    program->source[length] = '\0';
+    normalizeSource(program->source, length);
+
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) != 0){
+        ctx->code = trap.code;
+        strcpy(ctx->error, trap.message);
+        memFree(program->source);
+        memFree(program);
+        allocArenaUse(NULL);
+        return NULL;
+    }
+    program->tokens = lex(program->source);
+    program->tree = parse(program->tokens);
+    errorTrapPop(&trap);
+    allocArenaUse(NULL);
+
+    program->next = ctx->programs;
+    ctx->programs = program;
+    ctx->code = ERROR_NONE;
+    ctx->error[0] = '\0';
+    return program;
+}
+
+/**
+ * @brief Run a loaded program against the context's globals
+ * @param result Set to the value of the last top-level form; may be NULL
+ * @return 0 on success, -1 on a runtime error
+ */
+int lisp_eval(lisp_ctx* ctx, lisp_program* program, lisp_value* result){
+    enter(ctx);
+
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) != 0){
+        ctx->code = trap.code;
+        strcpy(ctx->error, trap.message);
+        resetEvaluator();
+        leave();
+        return -1;
+    }
+    Value value = evaluateTree(program->tree, &ctx->globals);
+    errorTrapPop(&trap);
+
+    if(result != NULL){
+        *result = toPublic(value);
+    }
+    leave();
+    ctx->code = ERROR_NONE;
+    ctx->error[0] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Read a global variable
+ * @return 0, or -1 if the name is not bound
+ */
+int lisp_get_global(lisp_ctx* ctx, const char* name, lisp_value* value){
+    EnvEntry* entry = env_lookup(ctx->globals, name);
+    if(entry == NULL){
+        ctx->code = ERROR_UNBOUND;
+        strcpy(ctx->error, "Error: Variable not found");
+        return -1;
+    }
+    // A string slice is copied out, and the copy lives as long as the context
+    allocArenaUse(ctx->arena);
+    *value = toPublic(entry->value);
+    allocArenaUse(NULL);
+    return 0;
+}
+
+/**
+ * @brief Bind a global variable, as `def` would; strings are copied
+ * @return 0, or -1 if a string is not valid UTF-8
+ */
+int lisp_set_global(lisp_ctx* ctx, const char* name, lisp_value value){
+    if(value.type == LISP_STRING){
+        size_t length = strlen(value.as.string_value);
+        if(utf8Check(value.as.string_value, length) != length){
+            ctx->code = ERROR_TYPE;
+            strcpy(ctx->error, "Error: String is not valid UTF-8");
+            return -1;
+        }
+    }
+    allocArenaUse(ctx->arena);
+    env_set(&ctx->globals, name, fromPublic(value));
+    allocArenaUse(NULL);
+    return 0;
+}
+
+/**
+ * @brief The message for the last failed call, or "" after a success
+ */
+const char* lisp_error(const lisp_ctx* ctx){
+    return ctx->error;
+}
+
+/**
+ * @brief What kind of error the last failed call hit, or LISP_OK after a success
+ */
+lisp_status lisp_error_code(const lisp_ctx* ctx){
+    return (lisp_status)ctx->code;
+}
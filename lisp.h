@@ -0,0 +1,125 @@
+#ifndef LISP_LITE_LISP_H
+#define LISP_LITE_LISP_H
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Embedding API for LISP_LITE.
+ *
+ * A lisp_ctx is one interpreter: its global variables, the programs loaded
+ * into it and where its output and input go. Programs are parsed once with
+ * lisp_load() and can then be evaluated any number of times.
+ *
+ * Errors never exit the process: the call returns -1 (or NULL),
+ * lisp_error() describes what went wrong and lisp_error_code() says what
+ * kind of error it was. A context must only be used by
+ * one thread at a time, and not from inside its own I/O callbacks; separate
+ * contexts can be used on separate threads at once.
+ *
+ *     lisp_ctx* ctx = lisp_create();
+ *     lisp_program* program = lisp_load(ctx, "(+ x 1)", 7);
+ *     lisp_set_global(ctx, "x", lisp_int(41));
+ *     lisp_value result;
+ *     if(lisp_eval(ctx, program, &result) == 0) ... result.as.int_value ...
+ *     lisp_destroy(ctx);
+ */
+
+typedef struct lisp_ctx lisp_ctx;
+typedef struct lisp_program lisp_program;
+
+typedef enum {
+    LISP_INT,
+    LISP_FLOAT,
+    LISP_STRING,
+    LISP_BIGINT,
+    LISP_FUNCTION,
+    LISP_VECTOR,
+    LISP_MAP,
+    LISP_LIST
+} lisp_type;
+
+typedef enum {
+    LISP_OK,
+    LISP_ERROR_SYNTAX,      // the program text does not parse
+    LISP_ERROR_UNBOUND,     // a variable that was never defined
+    LISP_ERROR_TYPE,        // a value of the wrong type, or a call of a non-function
+    LISP_ERROR_ARITY,       // the wrong number of arguments
+    LISP_ERROR_RANGE,       // division by zero, a missing key, an index out of bounds
+    LISP_ERROR_IO,          // input that could not be read
+    LISP_ERROR_RESOURCE,    // out of memory or value stack
+    LISP_ERROR_UNSUPPORTED  // something the operator does not handle
+} lisp_status;
+
+/*
+ * Strings and objects returned by the interpreter stay valid until the
+ * context is destroyed. Objects (bigints, functions, vectors, maps and
+ * lists) can only be passed back to the context they came from.
+ *
+ * A context allocates from its own arena, and lisp_destroy frees every
+ * value it made. Nothing is reclaimed before then: a long-lived context
+ * grows with every evaluation, so hosts running many unrelated programs
+ * should give each batch of them a fresh context.
+ */
+typedef struct {
+    lisp_type type;
+    union {
+        long long int_value;
+        double float_value;
+        const char* string_value;
+        void* object;
+    } as;
+} lisp_value;
+
+// Receives program output in blocks
+typedef void (*lisp_write_fn)(void* user, const char* data, size_t length);
+
+// Fills `buffer` with up to `capacity` bytes of input; returns 0 at the end
+typedef size_t (*lisp_read_fn)(void* user, char* buffer, size_t capacity);
+
+lisp_ctx* lisp_create(void);
+
+void lisp_destroy(lisp_ctx* ctx);
+
+void lisp_set_io(lisp_ctx* ctx, lisp_write_fn write, lisp_read_fn read, void* user);
+
+lisp_program* lisp_load(lisp_ctx* ctx, const char* source, size_t length);
+
+int lisp_eval(lisp_ctx* ctx, lisp_program* program, lisp_value* result);
+
+int lisp_get_global(lisp_ctx* ctx, const char* name, lisp_value* value);
+
+int lisp_set_global(lisp_ctx* ctx, const char* name, lisp_value value);
+
+const char* lisp_error(const lisp_ctx* ctx);
+
+lisp_status lisp_error_code(const lisp_ctx* ctx);
+
+static inline lisp_value lisp_int(long long value){
+    lisp_value v;
+    v.type = LISP_INT;
+    v.as.int_value = value;
+    return v;
+}
+
+static inline lisp_value lisp_float(double value){
+    lisp_value v;
+    v.type = LISP_FLOAT;
+    v.as.float_value = value;
+    return v;
+}
+
+static inline lisp_value lisp_string(const char* value){
+    lisp_value v;
+    v.type = LISP_STRING;
+    v.as.string_value = value;
+    return v;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LISP_LITE_LISP_H
@@ -0,0 +1,302 @@
+#include "list.h"
+#include "output.h"
+#include "alloc.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// The largest chunk holds fewer than CHUNK_ALIGN elements, so the index of
+// a list's first element fits in the low bits of its chunk's address
+#define CHUNK_ALIGN 256
+#define MIN_CHUNK_BYTES 256
+#define MAX_CHUNK_BYTES 4096
+#define SLAB_BYTES (64 * 1024)
+
+/*
+ * A run of list elements in items[first..capacity-1], followed by the list
+ * `next`. Slots below `first` are free for `cons` to claim.
+ */
+typedef struct {
+    List *next;
+    size_t restLength;       // the length of `next`
+    unsigned int capacity;
+    unsigned int first;      // only changed with a compare-and-swap
+    _Alignas(16) Value items[];
+} ListChunk;
+
+// Chunks of the current slab not handed out yet, and the allocation arena
+// (alloc.h) the slab belongs to
+static _Thread_local char *slabNext = NULL;
+static _Thread_local char *slabEnd = NULL;
+static _Thread_local uint64_t slabArena = 0;
+
+static inline ListChunk* chunkOf(const List* list){
+    return (ListChunk*)((uintptr_t)list & ~(uintptr_t)(CHUNK_ALIGN - 1));
+}
+
+static inline unsigned int startOf(const List* list){
+    return (unsigned int)((uintptr_t)list & (CHUNK_ALIGN - 1));
+}
+
+static inline List* makeList(ListChunk* chunk, unsigned int start){
+    return (List*)((uintptr_t)chunk | start);
+}
+
+static size_t chunkBytes(const ListChunk* chunk){
+    return offsetof(ListChunk, items) + chunk->capacity * sizeof(Value);
+}
+
+/**
+ * @brief The number of elements in a list, read from its first chunk
+ */
+size_t listLength(const List* list){
+    if(list == NULL){
+        return 0;
+    }
+    ListChunk *chunk = chunkOf(list);
+    return chunk->capacity - startOf(list) + chunk->restLength;
+}
+
+/**
+ * @brief Carve a chunk out of this thread's slab, starting a new slab when
+ *        the rest of the current one is too small or in another arena
+ * @param bytes A multiple of CHUNK_ALIGN, at most MAX_CHUNK_BYTES
+ */
+static ListChunk* allocateChunk(size_t bytes){
+    if((size_t)(slabEnd - slabNext) < bytes || slabArena != allocArenaId()){
+        char *block = (char*)memAlloc(SLAB_BYTES + CHUNK_ALIGN);
+        if(block == NULL){
+            fatalError(ERROR_RESOURCE, "Error: Out of memory allocating a list\n");
+        }
+        slabNext = (char*)(((uintptr_t)block + CHUNK_ALIGN - 1) & ~(uintptr_t)(CHUNK_ALIGN - 1));
+        slabEnd = slabNext + SLAB_BYTES;
+        slabArena = allocArenaId();
+    }
+    ListChunk *chunk = (ListChunk*)slabNext;
+    slabNext += bytes;
+    chunk->capacity = (unsigned int)((bytes - offsetof(ListChunk, items)) / sizeof(Value));
+    return chunk;
+}
+
+/**
+ * @brief Prepend an element, in the free slot in front of the list if
+ *        nothing has claimed it yet, otherwise in a new chunk
+ */
+static List* cons(Value head, List* tail){
+    size_t bytes = MIN_CHUNK_BYTES;
+    if(tail != NULL){
+        ListChunk *chunk = chunkOf(tail);
+        unsigned int start = startOf(tail);
+        unsigned int expected = start;
+        // Another thread may be consing onto the same list at the same time
+        if(start > 0 && __atomic_compare_exchange_n(&chunk->first, &expected, start - 1, 0,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+            chunk->items[start - 1] = head;
+            return makeList(chunk, start - 1);
+        }
+        if(start == 0){
+            // The list is growing at the front: give it more room each time
+            bytes = chunkBytes(chunk) < MAX_CHUNK_BYTES ? chunkBytes(chunk) * 2 : MAX_CHUNK_BYTES;
+        }
+    }
+    ListChunk *chunk = allocateChunk(bytes);
+    chunk->next = tail;
+    chunk->restLength = listLength(tail);
+    chunk->first = chunk->capacity - 1;
+    chunk->items[chunk->first] = head;
+    return makeList(chunk, chunk->first);
+}
+
+/**
+ * @brief Copy a list's elements, in order, into `items`, which has room
+ *        for listLength(list) of them
+ * @return How many there were
+ */
+size_t listItems(const List* list, Value* items){
+    size_t n = 0;
+    for(; list != NULL; list = chunkOf(list)->next){
+        ListChunk *chunk = chunkOf(list);
+        for(unsigned int i = startOf(list); i < chunk->capacity; i++){
+            items[n++] = chunk->items[i];
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Copy a list into chunks of this thread's own, the same shape as
+ *        the original's
+ * @param copy Makes the copy of each element, called with `user`
+ */
+List* copyList(const List* list, Value (*copy)(Value value, void* user), void* user){
+    List *head = NULL;
+    List **link = &head;
+    while(list != NULL){
+        ListChunk *from = chunkOf(list);
+        unsigned int start = startOf(list);
+        ListChunk *to = allocateChunk(chunkBytes(from));
+        to->next = NULL;
+        to->restLength = from->restLength;
+        to->first = start;
+        for(unsigned int i = start; i < from->capacity; i++){
+            to->items[i] = copy(from->items[i], user);
+        }
+        *link = makeList(to, start);
+        link = &to->next;
+        list = from->next;
+    }
+    return head;
+}
+
+static void expectArgs(enum operators op, int argc, int min, int max){
+    if(argc < min || argc > max){
+        fatalError(ERROR_ARITY, "Error: Wrong number of arguments for %s\n", getOperatorSymbol(op));
+    }
+}
+
+static List* expectList(enum operators op, Value value){
+    if(value.type != VAL_LIST){
+        fatalError(ERROR_TYPE, "Error: Expected list in %s\n", getOperatorSymbol(op));
+    }
+    return value.list;
+}
+
+static List* expectNonEmpty(enum operators op, Value value){
+    List *list = expectList(op, value);
+    if(list == NULL){
+        fatalError(ERROR_RANGE, "Error: %s of an empty list\n", getOperatorSymbol(op));
+    }
+    return list;
+}
+
+static Value listValue(List* list){
+    return (Value){.type = VAL_LIST, .list = list};
+}
+
+/**
+ * @brief Copy every list but the last in front of the last one
+ */
+static List* append(enum operators op, Value* args, int argc){
+    if(argc == 0){
+        return NULL;
+    }
+    List *result = expectList(op, args[argc - 1]);
+    size_t count = 0;
+    for(int i = 0; i < argc - 1; i++){
+        count += listLength(expectList(op, args[i]));
+    }
+    if(count == 0){
+        return result;
+    }
+    // Lists only link forwards, so line the elements up to cons them back to front
+    Value *items = (Value*)memAlloc(count * sizeof(Value));
+    if(items == NULL){
+        fatalError(ERROR_RESOURCE, "Error: Out of memory appending %zu elements\n", count);
+    }
+    size_t n = 0;
+    for(int i = 0; i < argc - 1; i++){
+        n += listItems(args[i].list, items + n);
+    }
+    while(n > 0){
+        result = cons(items[--n], result);
+    }
+    memFree(items);
+    return result;
+}
+
+/**
+ * @brief Evaluate a list builtin on already-evaluated arguments
+ * @param op One of LIST, CONS, CAR, CDR, NTH, APPEND and REVERSE
+ * @param args The argument values
+ * @param argc The number of arguments
+ * @return The result
+ */
+Value evaluateListOp(enum operators op, Value* args, int argc){
+    switch(op){
+        case LIST: {
+            List *list = NULL;
+            for(int i = argc - 1; i >= 0; i--){
+                list = cons(args[i], list);
+            }
+            return listValue(list);
+        }
+        case CONS:
+            expectArgs(op, argc, 2, 2);
+            return listValue(cons(args[0], expectList(op, args[1])));
+        case CAR: {
+            expectArgs(op, argc, 1, 1);
+            List *list = expectNonEmpty(op, args[0]);
+            return chunkOf(list)->items[startOf(list)];
+        }
+        case CDR: {
+            expectArgs(op, argc, 1, 1);
+            List *list = expectNonEmpty(op, args[0]);
+            ListChunk *chunk = chunkOf(list);
+            unsigned int start = startOf(list);
+            return listValue(start + 1 < chunk->capacity ? makeList(chunk, start + 1) : chunk->next);
+        }
+        case NTH: {
+            // (nth l i), counting from 0 like vec-ref
+            expectArgs(op, argc, 2, 2);
+            List *list = expectList(op, args[0]);
+            if(args[1].type != VAL_INT){
+                fatalError(ERROR_TYPE, "Error: Expected INT in %s\n", getOperatorSymbol(op));
+            }
+            long long index = args[1].intValue;
+            size_t length = listLength(list);
+            if(index < 0 || (unsigned long long)index >= length){
+                fatalError(ERROR_RANGE, "Error: Index %lld out of range for list of length %zu\n", index, length);
+            }
+            // Skip whole chunks, reading only their capacity and start
+            size_t rest = (size_t)index;
+            ListChunk *chunk = chunkOf(list);
+            unsigned int start = startOf(list);
+            while(rest >= chunk->capacity - start){
+                rest -= chunk->capacity - start;
+                list = chunk->next;
+                chunk = chunkOf(list);
+                start = startOf(list);
+            }
+            return chunk->items[start + rest];
+        }
+        case APPEND:
+            return listValue(append(op, args, argc));
+        case REVERSE: {
+            expectArgs(op, argc, 1, 1);
+            List *result = NULL;
+            for(List *list = expectList(op, args[0]); list != NULL; list = chunkOf(list)->next){
+                ListChunk *chunk = chunkOf(list);
+                for(unsigned int i = startOf(list); i < chunk->capacity; i++){
+                    result = cons(chunk->items[i], result);
+                }
+            }
+            return listValue(result);
+        }
+        default:
+            fatalError(ERROR_UNSUPPORTED, "Error: Unknown list operator %s\n", getOperatorSymbol(op));
+    }
+}
+
+/**
+ * @brief Print a list as (1 2 3), with strings quoted
+ * @param list The list
+ */
+void printList(const List* list){
+    int first = 1;
+    outputChar('(');
+    for(; list != NULL; list = chunkOf(list)->next){
+        const ListChunk *chunk = chunkOf(list);
+        for(unsigned int i = startOf(list); i < chunk->capacity; i++){
+            if(!first) outputChar(' ');
+            Value item = chunk->items[i];
+            if(item.type == VAL_STRING){
+                outputChar('"');
+                outputWrite(item.string->bytes, item.string->length);
+                outputChar('"');
+            }else{
+                printValue(item);
+            }
+            first = 0;
+        }
+    }
+    outputChar(')');
+}
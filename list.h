@@ -0,0 +1,37 @@
+#ifndef LISP_LITE_LIST_H
+#define LISP_LITE_LIST_H
+#include "library.h"
+#include <stddef.h>
+
+/*
+ * Immutable lists, stored unrolled: each chunk holds a run of elements side
+ * by side, from 14 in a 256-byte chunk up to 254 in a 4 KB one, and points
+ * to the chunk holding the rest. Walking a list reads memory in order, one
+ * chunk header per run, and each chunk records how long the rest of the
+ * list is, so `length` takes constant time and `nth` skips a whole chunk at
+ * a time.
+ *
+ * A chunk fills from its end towards its start. `cons` puts the new
+ * element in the free slot just before the list's first one, if no other
+ * `cons` has claimed it yet, so building a list with `cons` in a loop
+ * fills chunks in place. Otherwise it starts a new chunk, twice the size
+ * of the one it is in front of when that one is full. Lists share their
+ * tails: `cdr` and `cons` never copy, and `append` copies all but its last
+ * argument.
+ *
+ * Chunks are carved out of per-thread slabs on 256-byte boundaries, and a
+ * List pointer is the address of its first chunk with the index of its
+ * first element in the low byte. The empty list is NULL.
+ */
+
+Value evaluateListOp(enum operators op, Value* args, int argc);
+
+size_t listLength(const List* list);
+
+size_t listItems(const List* list, Value* items);
+
+List* copyList(const List* list, Value (*copy)(Value value, void* user), void* user);
+
+void printList(const List* list);
+
+#endif //LISP_LITE_LIST_H
@@ -0,0 +1,1060 @@
+#include "lks8.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/*
+ * The backend works in three steps. Each function is lowered to code over
+ * an unbounded set of virtual registers; live intervals are computed from
+ * that code and registers assigned by linear scan, spilling to the frame
+ * when r0-r3 run out; and the resulting machine code for the whole program
+ * goes through a peephole pass before it is encoded.
+ */
+
+#define ALLOCATABLE 4
+#define SCRATCH_A 4     // also the return value
+#define SCRATCH_B 5
+
+// Operations that only exist before register allocation
+enum {
+    IR_LABEL = 64,
+    IR_PARAM,       // dst = parameter `imm`
+    IR_BEGIN_CALL,  // registers live across the call are saved here
+    IR_ARG,         // push src[0] as the next argument
+    IR_CALL,        // call function `target`, dst = its result
+    IR_RETURN       // return src[0]
+};
+
+// Only in the machine code list, before encoding
+#define MACHINE_LABEL 64
+
+typedef struct {
+    int op;
+    int dst;        // virtual register written, or -1
+    int src[2];     // virtual registers read, or -1
+    long long imm;
+    int target;     // label for branches and IR_LABEL, function for IR_CALL
+} Ir;
+
+typedef struct {
+    char* name;         // NULL for the top level
+    int index;
+    Node* lambda;
+    int paramCount;
+    int* params;        // the virtual register of each parameter
+    int entry;          // label of the first instruction
+    int body;           // label self tail calls jump to
+    Ir* code;
+    int length;
+    int capacity;
+    int vregs;
+} Function;
+
+typedef struct {
+    int op;
+    int rd, ra, rb;
+    long long imm;
+    int label;          // branch target, or the label a MACHINE_LABEL defines
+} Instr;
+
+typedef struct {
+    Function** functions;
+    int functionCount;
+    char** globals;
+    int globalCount;
+    int labels;
+    Instr* machine;
+    int machineLength;
+    int machineCapacity;
+    int spills;
+} Compiler;
+
+static _Noreturn void unsupported(const char* what){
+    fatalError(ERROR_UNSUPPORTED, "Error: LKS-8 backend does not support %s\n", what);
+}
+
+static int globalAddress(Compiler* c, const char* name){
+    for(int i = 0; i < c->globalCount; i++){
+        if(strcmp(c->globals[i], name) == 0) return i;
+    }
+    c->globals = (char**)memRealloc(c->globals, sizeof(char*) * (c->globalCount + 1));
+    c->globals[c->globalCount] = memStrdup(name);
+    return c->globalCount++;
+}
+
+static Function* findFunction(Compiler* c, const char* name){
+    for(int i = 0; i < c->functionCount; i++){
+        if(c->functions[i]->name != NULL && strcmp(c->functions[i]->name, name) == 0) return c->functions[i];
+    }
+    return NULL;
+}
+
+static Function* addFunction(Compiler* c, char* name, Node* lambda){
+    Function* f = (Function*)memCalloc(1, sizeof(Function));
+    f->name = name;
+    f->lambda = lambda;
+    f->index = c->functionCount;
+    f->entry = c->labels++;
+    f->body = c->labels++;
+    c->functions = (Function**)memRealloc(c->functions, sizeof(Function*) * (c->functionCount + 1));
+    c->functions[c->functionCount++] = f;
+    return f;
+}
+
+static void countDefinitions(Node* node, const char* name, int* lambdas, int* others){
+    for(; node != NULL; node = node->nextNode){
+        if(node->type == NODE_OPERATOR && node->val.op == DEF && node->childNode != NULL
+           && node->childNode->type == NODE_VARIABLE && strcmp(node->childNode->val.strValue, name) == 0){
+            Node* value = node->childNode->nextNode;
+            if(value != NULL && value->type == NODE_LAMBDA) (*lambdas)++; else (*others)++;
+        }
+        if(node->type == NODE_OPERATOR || node->type == NODE_LAMBDA){
+            countDefinitions(node->childNode, name, lambdas, others);
+        }
+    }
+}
+
+/**
+ * @brief Make a function of every global bound exactly once, at the top level, to a lambda
+ */
+static void collectFunctions(Compiler* c, Node* root){
+    for(Node* form = root->childNode; form != NULL; form = form->nextNode){
+        if(form->type != NODE_OPERATOR || form->val.op != DEF || form->childNode == NULL) continue;
+        Node* target = form->childNode;
+        Node* value = target->nextNode;
+        if(target->type != NODE_VARIABLE || value == NULL || value->type != NODE_LAMBDA) continue;
+        int lambdas = 0, others = 0;
+        countDefinitions(root, target->val.strValue, &lambdas, &others);
+        if(lambdas == 1 && others == 0){
+            Function* f = addFunction(c, target->val.strValue, value);
+            f->paramCount = value->val.lambda->paramCount;
+        }
+    }
+}
+
+static Ir* emitIr(Function* f, int op){
+    if(f->length == f->capacity){
+        f->capacity = f->capacity ? f->capacity * 2 : 64;
+        f->code = (Ir*)memRealloc(f->code, sizeof(Ir) * f->capacity);
+    }
+    Ir* ir = &f->code[f->length++];
+    *ir = (Ir){.op = op, .dst = -1, .src = {-1, -1}, .imm = 0, .target = -1};
+    return ir;
+}
+
+static int newVreg(Function* f){
+    return f->vregs++;
+}
+
+static int constant(Function* f, long long value){
+    Ir* ir = emitIr(f, LKS_LI);
+    ir->dst = newVreg(f);
+    ir->imm = value;
+    return ir->dst;
+}
+
+static int binary(Function* f, int op, int a, int b){
+    Ir* ir = emitIr(f, op);
+    ir->dst = newVreg(f);
+    ir->src[0] = a;
+    ir->src[1] = b;
+    return ir->dst;
+}
+
+static int unary(Function* f, int op, int a, long long imm){
+    Ir* ir = emitIr(f, op);
+    ir->dst = newVreg(f);
+    ir->src[0] = a;
+    ir->imm = imm;
+    return ir->dst;
+}
+
+static void label(Function* f, int id){
+    emitIr(f, IR_LABEL)->target = id;
+}
+
+static void branch(Function* f, int op, int condition, int target){
+    Ir* ir = emitIr(f, op);
+    ir->src[0] = condition;
+    ir->target = target;
+}
+
+static int fitsImmediate(long long value){
+    return value >= -32768 && value <= 32767;
+}
+
+static int lower(Compiler* c, Function* f, Node* node, int tail);
+
+static int argumentCount(Node* node){
+    int count = 0;
+    for(; node != NULL; node = node->nextNode) count++;
+    return count;
+}
+
+/**
+ * @brief + - * / folded left to right, with small literal addends as ADDI
+ */
+static int lowerArithmetic(Compiler* c, Function* f, enum operators op, Node* first){
+    static const int ops[] = {LKS_ADD, LKS_SUB, LKS_MUL, LKS_DIV};
+    if(first == NULL){
+        if(op == SUB || op == DIV){
+            fatalError(ERROR_ARITY, "Error: Expected at least one argument for %s\n", getOperatorSymbol(op));
+        }
+        return constant(f, op == ADD ? 0 : 1);
+    }
+    int acc = lower(c, f, first, 0);
+    for(Node* operand = first->nextNode; operand != NULL; operand = operand->nextNode){
+        if(operand->type == NODE_VALUE && (op == ADD || op == SUB)){
+            long long addend = op == ADD ? operand->val.value : -operand->val.value;
+            if(operand->val.value != LLONG_MIN && fitsImmediate(addend)){
+                acc = unary(f, LKS_ADDI, acc, addend);
+                continue;
+            }
+        }
+        acc = binary(f, ops[op], acc, lower(c, f, operand, 0));
+    }
+    return acc;
+}
+
+static int lowerCall(Compiler* c, Function* f, Node* node, int tail){
+    Node* head = node->childNode;
+    if(head == NULL || head->type != NODE_VARIABLE){
+        unsupported("calls to anything but a named function");
+    }
+    Function* callee = findFunction(c, head->val.strValue);
+    if(callee == NULL){
+        unsupported("calls to anything but a named function");
+    }
+    int argc = argumentCount(head->nextNode);
+    if(argc != callee->paramCount){
+        fatalError(ERROR_ARITY, "Error: Expected %d arguments, got %d\n", callee->paramCount, argc);
+    }
+
+    int* args = (int*)memAlloc(sizeof(int) * (argc + 1));
+    int i = 0;
+    for(Node* arg = head->nextNode; arg != NULL; arg = arg->nextNode, i++){
+        args[i] = lower(c, f, arg, 0);
+    }
+
+    if(tail && callee == f){
+        // Copy first: an argument may be a parameter about to be overwritten
+        for(i = 0; i < argc; i++){
+            Ir* copy = emitIr(f, LKS_MOV);
+            copy->dst = newVreg(f);
+            copy->src[0] = args[i];
+            args[i] = copy->dst;
+        }
+        for(i = 0; i < argc; i++){
+            Ir* move = emitIr(f, LKS_MOV);
+            move->dst = f->params[i];
+            move->src[0] = args[i];
+        }
+        emitIr(f, LKS_JMP)->target = f->body;
+        memFree(args);
+        return -1;
+    }
+
+    emitIr(f, IR_BEGIN_CALL);
+    for(i = 0; i < argc; i++){
+        emitIr(f, IR_ARG)->src[0] = args[i];
+    }
+    Ir* call = emitIr(f, IR_CALL);
+    call->dst = newVreg(f);
+    call->target = callee->index;
+    call->imm = argc;
+    memFree(args);
+    return call->dst;
+}
+
+/**
+ * @brief Lower an expression
+ * @param tail Whether it is in tail position in its function
+ * @return The virtual register holding its value, or -1 if it ended in a
+ *         self tail call and so never produces one
+ */
+static int lower(Compiler* c, Function* f, Node* node, int tail){
+    switch(node->type){
+        case NODE_VALUE:
+            return constant(f, node->val.value);
+        case NODE_LOCAL:
+            return f->params[node->slot];
+        case NODE_VARIABLE: {
+            if(findFunction(c, node->val.strValue) != NULL){
+                unsupported("functions as values");
+            }
+            Ir* ir = emitIr(f, LKS_LDG);
+            ir->dst = newVreg(f);
+            ir->imm = globalAddress(c, node->val.strValue);
+            return ir->dst;
+        }
+        case NODE_CAPTURED:
+        case NODE_LAMBDA:
+            unsupported("closures");
+        case NODE_STRING_LITERAL:
+            unsupported("strings");
+        case NODE_FLOAT:
+            unsupported("floats");
+        case NODE_BIGINT:
+            unsupported("bignums");
+        default:
+            break;
+    }
+
+    Node* first = node->childNode;
+    enum operators op = node->val.op;
+    switch(op){
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+            return lowerArithmetic(c, f, op, first);
+        case GT:
+        case LT:
+        case EQ:
+        case GTE:
+        case LTE:
+        case AND:
+        case OR: {
+            if(argumentCount(first) < 2){
+                fatalError(ERROR_ARITY, "Error: Expected two arguments for %s\n", getOperatorSymbol(op));
+            }
+            int a = lower(c, f, first, 0);
+            int b = lower(c, f, first->nextNode, 0);
+            for(Node* extra = first->nextNode->nextNode; extra != NULL; extra = extra->nextNode){
+                lower(c, f, extra, 0);
+            }
+            switch(op){
+                case GT: return binary(f, LKS_SLT, b, a);
+                case LT: return binary(f, LKS_SLT, a, b);
+                case GTE: return binary(f, LKS_SLE, b, a);
+                case LTE: return binary(f, LKS_SLE, a, b);
+                case EQ: return binary(f, LKS_SEQ, a, b);
+                case AND:
+                    return binary(f, LKS_AND, unary(f, LKS_SNEZ, a, 0), unary(f, LKS_SNEZ, b, 0));
+                default:
+                    return unary(f, LKS_SNEZ, binary(f, LKS_OR, a, b), 0);
+            }
+        }
+        case NOT:
+            if(first == NULL){
+                fatalError(ERROR_ARITY, "Error: Expected one argument for NOT\n");
+            }
+            return unary(f, LKS_SEQZ, lower(c, f, first, 0), 0);
+        case IF: {
+            if(argumentCount(first) < 3){
+                fatalError(ERROR_ARITY, "Error: Expected three arguments for IF\n");
+            }
+            int result = newVreg(f);
+            int otherwise = c->labels++;
+            int done = c->labels++;
+            branch(f, LKS_BEQZ, lower(c, f, first, 0), otherwise);
+            int value = lower(c, f, first->nextNode, tail);
+            if(value >= 0){
+                Ir* move = emitIr(f, LKS_MOV);
+                move->dst = result;
+                move->src[0] = value;
+                emitIr(f, LKS_JMP)->target = done;
+            }
+            label(f, otherwise);
+            value = lower(c, f, first->nextNode->nextNode, tail);
+            if(value >= 0){
+                Ir* move = emitIr(f, LKS_MOV);
+                move->dst = result;
+                move->src[0] = value;
+            }
+            label(f, done);
+            return result;
+        }
+        case SEQ: {
+            if(first == NULL){
+                return constant(f, 0);
+            }
+            for(; first->nextNode != NULL; first = first->nextNode){
+                lower(c, f, first, 0);
+            }
+            return lower(c, f, first, tail);
+        }
+        case DEF: {
+            if(first == NULL || first->type != NODE_VARIABLE){
+                fatalError(ERROR_SYNTAX, "Error: Expected variable name\n");
+            }
+            if(first->nextNode == NULL){
+                fatalError(ERROR_SYNTAX, "Error: Expected expression\n");
+            }
+            if(first->nextNode->type == NODE_LAMBDA && findFunction(c, first->val.strValue) != NULL){
+                if(f->name != NULL){
+                    unsupported("functions defined inside functions");
+                }
+                // Compiled on its own; there is no closure value to return
+                return constant(f, 0);
+            }
+            int value = lower(c, f, first->nextNode, 0);
+            Ir* store = emitIr(f, LKS_STG);
+            store->src[0] = value;
+            store->imm = globalAddress(c, first->val.strValue);
+            return value;
+        }
+        case PRINT:
+            for(; first != NULL; first = first->nextNode){
+                int value = lower(c, f, first, 0);
+                emitIr(f, LKS_OUT)->src[0] = value;
+            }
+            return constant(f, 0);
+        case CALL:
+            return lowerCall(c, f, node, tail);
+        default:
+            unsupported(getOperatorSymbol(op));
+    }
+}
+
+static void lowerFunction(Compiler* c, Function* f, Node* root){
+    int value;
+    if(f->lambda == NULL){
+        value = lower(c, f, root, 0);
+    }else{
+        f->params = (int*)memAlloc(sizeof(int) * (f->paramCount + 1));
+        for(int i = 0; i < f->paramCount; i++){
+            Ir* param = emitIr(f, IR_PARAM);
+            param->dst = f->params[i] = newVreg(f);
+            param->imm = i;
+        }
+        label(f, f->body);
+        Node* body = f->lambda->childNode;
+        if(body == NULL){
+            value = constant(f, 0);
+        }else{
+            for(; body->nextNode != NULL; body = body->nextNode){
+                lower(c, f, body, 0);
+            }
+            value = lower(c, f, body, 1);
+        }
+    }
+    if(value >= 0){
+        emitIr(f, IR_RETURN)->src[0] = value;
+    }
+}
+
+/* ---- Live intervals and linear scan ---- */
+
+typedef struct {
+    int start, end;     // first and last instruction the value is live at
+    int reg;            // physical register, or -1 if spilled
+    int slot;           // frame offset from fp when spilled
+    int uses;
+} Interval;
+
+typedef unsigned long long Bits;
+
+static int isJump(int op){
+    return op == LKS_JMP || op == LKS_BEQZ || op == LKS_BNEZ;
+}
+
+static void setBit(Bits* set, int bit){
+    set[bit / 64] |= 1ull << (bit % 64);
+}
+
+static int hasBit(const Bits* set, int bit){
+    return (int)((set[bit / 64] >> (bit % 64)) & 1);
+}
+
+static void extend(Interval* interval, int position){
+    if(position < interval->start) interval->start = position;
+    if(position > interval->end) interval->end = position;
+}
+
+/**
+ * @brief Work out where every virtual register is live, with loops taken into account
+ * @param liveAfter Set, for each IR_CALL, to the values still needed after it returns
+ */
+static Interval* liveIntervals(Function* f, Bits** liveAfter){
+    int n = f->length;
+    int words = (f->vregs + 63) / 64 + 1;
+
+    // Basic blocks: a label starts one, a jump or return ends one
+    int* blockOf = (int*)memAlloc(sizeof(int) * (n + 1));
+    int* starts = (int*)memAlloc(sizeof(int) * (n + 1));
+    int blocks = 0;
+    for(int i = 0; i < n; i++){
+        if(i == 0 || f->code[i].op == IR_LABEL || isJump(f->code[i - 1].op) || f->code[i - 1].op == IR_RETURN){
+            starts[blocks++] = i;
+        }
+        blockOf[i] = blocks - 1;
+    }
+    starts[blocks] = n;
+
+    Bits* use = (Bits*)memCalloc((size_t)blocks * words, sizeof(Bits));
+    Bits* def = (Bits*)memCalloc((size_t)blocks * words, sizeof(Bits));
+    Bits* in = (Bits*)memCalloc((size_t)blocks * words, sizeof(Bits));
+    Bits* out = (Bits*)memCalloc((size_t)blocks * words, sizeof(Bits));
+    for(int b = 0; b < blocks; b++){
+        for(int i = starts[b]; i < starts[b + 1]; i++){
+            Ir* ir = &f->code[i];
+            for(int s = 0; s < 2; s++){
+                if(ir->src[s] >= 0 && !hasBit(def + b * words, ir->src[s])) setBit(use + b * words, ir->src[s]);
+            }
+            if(ir->dst >= 0) setBit(def + b * words, ir->dst);
+        }
+    }
+
+    int* labelBlock = NULL;
+    int labelLimit = 0;
+    for(int i = 0; i < n; i++){
+        if(f->code[i].op == IR_LABEL){
+            if(f->code[i].target >= labelLimit){
+                int limit = f->code[i].target + 1;
+                labelBlock = (int*)memRealloc(labelBlock, sizeof(int) * limit);
+                for(int l = labelLimit; l < limit; l++) labelBlock[l] = -1;
+                labelLimit = limit;
+            }
+            labelBlock[f->code[i].target] = blockOf[i];
+        }
+    }
+
+    for(int changed = 1; changed;){
+        changed = 0;
+        for(int b = blocks - 1; b >= 0; b--){
+            Bits* o = out + b * words;
+            Ir* last = &f->code[starts[b + 1] - 1];
+            int successors[2] = {-1, -1};
+            if(last->op != LKS_JMP && last->op != IR_RETURN && b + 1 < blocks) successors[0] = b + 1;
+            if(isJump(last->op)) successors[1] = labelBlock[last->target];
+            for(int s = 0; s < 2; s++){
+                if(successors[s] < 0) continue;
+                Bits* successor = in + successors[s] * words;
+                for(int w = 0; w < words; w++) o[w] |= successor[w];
+            }
+            Bits* i = in + b * words;
+            for(int w = 0; w < words; w++){
+                Bits value = use[b * words + w] | (o[w] & ~def[b * words + w]);
+                if(value != i[w]){
+                    i[w] = value;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    Interval* intervals = (Interval*)memAlloc(sizeof(Interval) * (f->vregs + 1));
+    for(int v = 0; v < f->vregs; v++){
+        intervals[v] = (Interval){INT_MAX, -1, -1, 0, 0};
+    }
+    for(int i = 0; i < n; i++){
+        Ir* ir = &f->code[i];
+        if(ir->dst >= 0) extend(&intervals[ir->dst], i);
+        for(int s = 0; s < 2; s++){
+            if(ir->src[s] >= 0){
+                extend(&intervals[ir->src[s]], i);
+                intervals[ir->src[s]].uses++;
+            }
+        }
+    }
+    for(int b = 0; b < blocks; b++){
+        for(int v = 0; v < f->vregs; v++){
+            if(hasBit(in + b * words, v)) extend(&intervals[v], starts[b]);
+            if(hasBit(out + b * words, v)) extend(&intervals[v], starts[b + 1] - 1);
+        }
+    }
+
+    Bits* live = (Bits*)memAlloc(sizeof(Bits) * words);
+    for(int b = 0; b < blocks; b++){
+        memcpy(live, out + b * words, sizeof(Bits) * words);
+        for(int i = starts[b + 1] - 1; i >= starts[b]; i--){
+            Ir* ir = &f->code[i];
+            if(ir->dst >= 0) live[ir->dst / 64] &= ~(1ull << (ir->dst % 64));
+            if(ir->op == IR_CALL){
+                liveAfter[i] = (Bits*)memAlloc(sizeof(Bits) * words);
+                memcpy(liveAfter[i], live, sizeof(Bits) * words);
+            }
+            for(int s = 0; s < 2; s++){
+                if(ir->src[s] >= 0) setBit(live, ir->src[s]);
+            }
+        }
+    }
+    memFree(live);
+
+    memFree(blockOf);
+    memFree(starts);
+    memFree(use);
+    memFree(def);
+    memFree(in);
+    memFree(out);
+    memFree(labelBlock);
+    return intervals;
+}
+
+static Interval* sortIntervals;
+
+static int byStart(const void* a, const void* b){
+    const Interval* x = &sortIntervals[*(const int*)a];
+    const Interval* y = &sortIntervals[*(const int*)b];
+    if(x->start != y->start) return x->start < y->start ? -1 : 1;
+    return *(const int*)a - *(const int*)b;
+}
+
+/**
+ * @brief Assign r0-r3 by linear scan (Poletto and Sarkar)
+ * @return The number of frame slots the spilled values need
+ *
+ * When all four are taken, whichever of the new interval and the active
+ * ones ends last goes to the stack for its whole life. A parameter spills
+ * to the argument slot it arrived in. A MOV's destination takes its
+ * source's register when that is free, so the peephole pass can drop it.
+ */
+static int allocateRegisters(Compiler* c, Function* f, Interval* intervals){
+    int* order = (int*)memAlloc(sizeof(int) * (f->vregs + 1));
+    int count = 0;
+    for(int v = 0; v < f->vregs; v++){
+        if(intervals[v].end >= 0) order[count++] = v;
+    }
+    sortIntervals = intervals;
+    qsort(order, (size_t)count, sizeof(int), byStart);
+
+    int active[ALLOCATABLE];
+    int activeCount = 0;
+    int slots = 0;
+    for(int k = 0; k < count; k++){
+        int v = order[k];
+        Interval* current = &intervals[v];
+
+        // A value whose last use is this instruction has been read by the time it writes
+        int kept = 0;
+        for(int a = 0; a < activeCount; a++){
+            if(intervals[active[a]].end > current->start) active[kept++] = active[a];
+        }
+        activeCount = kept;
+
+        int used = 0;
+        for(int a = 0; a < activeCount; a++) used |= 1 << intervals[active[a]].reg;
+
+        Ir* definition = &f->code[current->start];
+        int hint = -1;
+        if(definition->op == LKS_MOV && definition->dst == v && intervals[definition->src[0]].reg >= 0){
+            hint = intervals[definition->src[0]].reg;
+        }
+
+        int spilled = -1;
+        if(activeCount < ALLOCATABLE){
+            current->reg = hint >= 0 && !(used & (1 << hint)) ? hint : 0;
+            while(used & (1 << current->reg)) current->reg++;
+        }else{
+            int last = 0;
+            for(int a = 1; a < activeCount; a++){
+                if(intervals[active[a]].end > intervals[active[last]].end) last = a;
+            }
+            if(intervals[active[last]].end > current->end){
+                current->reg = intervals[active[last]].reg;
+                spilled = active[last];
+                active[last] = active[--activeCount];
+            }else{
+                spilled = v;
+            }
+        }
+        if(spilled >= 0){
+            Interval* spill = &intervals[spilled];
+            spill->reg = -1;
+            c->spills++;
+            int param = -1;
+            for(int p = 0; p < f->paramCount; p++){
+                if(f->params[p] == spilled) param = p;
+            }
+            // [fp] is the caller's fp, [fp + 1] the return address, then the arguments, last one first
+            spill->slot = param >= 0 ? 1 + f->paramCount - param : -1 - slots++;
+        }
+        if(current->reg >= 0){
+            active[activeCount++] = v;
+        }
+    }
+    memFree(order);
+    return slots;
+}
+
+/* ---- Machine code ---- */
+
+static Instr* emitMachine(Compiler* c, int op, int rd, int ra, int rb, long long imm){
+    if(c->machineLength == c->machineCapacity){
+        c->machineCapacity = c->machineCapacity ? c->machineCapacity * 2 : 256;
+        c->machine = (Instr*)memRealloc(c->machine, sizeof(Instr) * c->machineCapacity);
+    }
+    Instr* instr = &c->machine[c->machineLength++];
+    *instr = (Instr){op, rd, ra, rb, imm, -1};
+    return instr;
+}
+
+static void emitLabel(Compiler* c, int id){
+    emitMachine(c, MACHINE_LABEL, 0, 0, 0, 0)->label = id;
+}
+
+// The register a use reads: its own, or `scratch` after loading it from the frame
+static int useRegister(Compiler* c, Interval* intervals, int v, int scratch){
+    if(intervals[v].reg >= 0) return intervals[v].reg;
+    emitMachine(c, LKS_LD, scratch, LKS8_FP, 0, intervals[v].slot);
+    return scratch;
+}
+
+static int defineRegister(Interval* intervals, int v){
+    return intervals[v].reg >= 0 ? intervals[v].reg : SCRATCH_A;
+}
+
+static void finishDefine(Compiler* c, Interval* intervals, int v, int reg){
+    if(intervals[v].reg < 0){
+        emitMachine(c, LKS_ST, reg, LKS8_FP, 0, intervals[v].slot);
+    }
+}
+
+// Registers holding values the caller still needs once the call returns
+static int savedAcross(Interval* intervals, int vregs, const Bits* live){
+    int saved = 0;
+    for(int v = 0; v < vregs; v++){
+        if(intervals[v].reg >= 0 && hasBit(live, v)){
+            saved |= 1 << intervals[v].reg;
+        }
+    }
+    return saved;
+}
+
+static void generateFunction(Compiler* c, Function* f){
+    Bits** liveAfter = (Bits**)memCalloc((size_t)f->length + 1, sizeof(Bits*));
+    Interval* intervals = liveIntervals(f, liveAfter);
+    int slots = allocateRegisters(c, f, intervals);
+
+    emitLabel(c, f->entry);
+    emitMachine(c, LKS_PUSH, 0, LKS8_FP, 0, 0);
+    emitMachine(c, LKS_MOV, LKS8_FP, LKS8_SP, 0, 0);
+    if(slots > 0){
+        emitMachine(c, LKS_ADDI, LKS8_SP, LKS8_SP, 0, -slots);
+    }
+
+    int saved = 0;
+    for(int i = 0; i < f->length; i++){
+        Ir* ir = &f->code[i];
+        if(ir->dst >= 0 && intervals[ir->dst].uses == 0 && ir->op != IR_CALL && ir->op != LKS_DIV){
+            // Nothing reads it, and computing it cannot fail
+            continue;
+        }
+        switch(ir->op){
+            case IR_LABEL:
+                emitLabel(c, ir->target);
+                break;
+            case IR_PARAM:
+                if(intervals[ir->dst].reg >= 0){
+                    emitMachine(c, LKS_LD, intervals[ir->dst].reg, LKS8_FP, 0, 1 + f->paramCount - ir->imm);
+                }
+                break;
+            case LKS_LI:
+            case LKS_LDG: {
+                int d = defineRegister(intervals, ir->dst);
+                if(ir->op == LKS_LI && !fitsImmediate(ir->imm)){
+                    emitMachine(c, LKS_LIW, d, 0, 0, ir->imm);
+                }else{
+                    emitMachine(c, ir->op, d, 0, 0, ir->imm);
+                }
+                finishDefine(c, intervals, ir->dst, d);
+                break;
+            }
+            case LKS_MOV:
+            case LKS_ADDI:
+            case LKS_SNEZ:
+            case LKS_SEQZ: {
+                int a = useRegister(c, intervals, ir->src[0], SCRATCH_A);
+                int d = defineRegister(intervals, ir->dst);
+                emitMachine(c, ir->op, d, a, 0, ir->imm);
+                finishDefine(c, intervals, ir->dst, d);
+                break;
+            }
+            case LKS_STG:
+            case LKS_OUT:
+            case IR_ARG: {
+                int a = useRegister(c, intervals, ir->src[0], SCRATCH_A);
+                if(ir->op == IR_ARG){
+                    emitMachine(c, LKS_PUSH, 0, a, 0, 0);
+                }else{
+                    emitMachine(c, ir->op, ir->op == LKS_STG ? a : 0, a, 0, ir->imm);
+                }
+                break;
+            }
+            case LKS_BEQZ:
+            case LKS_BNEZ: {
+                int a = useRegister(c, intervals, ir->src[0], SCRATCH_A);
+                emitMachine(c, ir->op, 0, a, 0, 0)->label = ir->target;
+                break;
+            }
+            case LKS_JMP:
+                emitMachine(c, LKS_JMP, 0, 0, 0, 0)->label = ir->target;
+                break;
+            case IR_BEGIN_CALL: {
+                int call = i + 1;
+                while(f->code[call].op != IR_CALL) call++;
+                saved = savedAcross(intervals, f->vregs, liveAfter[call]);
+                for(int r = 0; r < ALLOCATABLE; r++){
+                    if(saved & (1 << r)) emitMachine(c, LKS_PUSH, 0, r, 0, 0);
+                }
+                break;
+            }
+            case IR_CALL: {
+                emitMachine(c, LKS_CALL, 0, 0, 0, 0)->label = c->functions[ir->target]->entry;
+                if(ir->imm > 0){
+                    emitMachine(c, LKS_ADDI, LKS8_SP, LKS8_SP, 0, ir->imm);
+                }
+                if(intervals[ir->dst].uses > 0){
+                    int d = defineRegister(intervals, ir->dst);
+                    emitMachine(c, LKS_MOV, d, SCRATCH_A, 0, 0);
+                    finishDefine(c, intervals, ir->dst, d);
+                }
+                for(int r = ALLOCATABLE - 1; r >= 0; r--){
+                    if(saved & (1 << r)) emitMachine(c, LKS_POP, r, 0, 0, 0);
+                }
+                break;
+            }
+            case IR_RETURN: {
+                int a = useRegister(c, intervals, ir->src[0], SCRATCH_A);
+                emitMachine(c, LKS_MOV, SCRATCH_A, a, 0, 0);
+                if(f->name == NULL){
+                    emitMachine(c, LKS_HALT, 0, 0, 0, 0);
+                }else{
+                    emitMachine(c, LKS_MOV, LKS8_SP, LKS8_FP, 0, 0);
+                    emitMachine(c, LKS_POP, LKS8_FP, 0, 0, 0);
+                    emitMachine(c, LKS_RET, 0, 0, 0, 0);
+                }
+                break;
+            }
+            default: {
+                // Two-operand arithmetic, logic and comparisons
+                int a = useRegister(c, intervals, ir->src[0], SCRATCH_A);
+                int b = useRegister(c, intervals, ir->src[1], SCRATCH_B);
+                int d = defineRegister(intervals, ir->dst);
+                emitMachine(c, ir->op, d, a, b, 0);
+                finishDefine(c, intervals, ir->dst, d);
+                break;
+            }
+        }
+    }
+    for(int i = 0; i < f->length; i++){
+        memFree(liveAfter[i]);
+    }
+    memFree(liveAfter);
+    memFree(intervals);
+}
+
+/* ---- Peephole ---- */
+
+static int nextReal(Compiler* c, int i){
+    for(i++; i < c->machineLength; i++){
+        if(c->machine[i].op != LKS_NOP) return i;
+    }
+    return -1;
+}
+
+static int nextInstruction(Compiler* c, int i){
+    for(i = nextReal(c, i); i >= 0 && c->machine[i].op == MACHINE_LABEL; i = nextReal(c, i));
+    return i;
+}
+
+// Whether label `id` is among the labels directly after i, before any instruction
+static int labelFollows(Compiler* c, int i, int id){
+    for(i = nextReal(c, i); i >= 0 && c->machine[i].op == MACHINE_LABEL; i = nextReal(c, i)){
+        if(c->machine[i].label == id) return 1;
+    }
+    return 0;
+}
+
+static int findLabel(Compiler* c, int id){
+    for(int i = 0; i < c->machineLength; i++){
+        if(c->machine[i].op == MACHINE_LABEL && c->machine[i].label == id) return i;
+    }
+    return -1;
+}
+
+static int isBranch(int op){
+    return op == LKS_BEQZ || op == LKS_BNEZ || op == LKS_JMP;
+}
+
+/**
+ * @brief One pass of local rewrites over the whole program
+ * @return How many instructions it removed or simplified
+ */
+static int peepholePass(Compiler* c){
+    int rewrites = 0;
+    for(int i = 0; i < c->machineLength; i++){
+        Instr* x = &c->machine[i];
+        if(x->op == LKS_NOP || x->op == MACHINE_LABEL) continue;
+        int j = nextReal(c, i);
+        Instr* y = j >= 0 ? &c->machine[j] : NULL;
+
+        // mov r, r and addi r, r, 0 do nothing
+        if((x->op == LKS_MOV && x->rd == x->ra) || (x->op == LKS_ADDI && x->rd == x->ra && x->imm == 0)){
+            x->op = LKS_NOP;
+            rewrites++;
+            continue;
+        }
+        // Nothing after an unconditional transfer runs until the next label
+        if((x->op == LKS_JMP || x->op == LKS_RET || x->op == LKS_HALT) && y != NULL && y->op != MACHINE_LABEL){
+            y->op = LKS_NOP;
+            rewrites++;
+            continue;
+        }
+        if(isBranch(x->op)){
+            // A jump to the next instruction
+            if(labelFollows(c, i, x->label)){
+                x->op = LKS_NOP;
+                rewrites++;
+                continue;
+            }
+            // Jump threading: a jump to a jump goes straight to the final target
+            int target = nextInstruction(c, findLabel(c, x->label));
+            if(target >= 0 && target != i && c->machine[target].op == LKS_JMP && c->machine[target].label != x->label){
+                x->label = c->machine[target].label;
+                rewrites++;
+                continue;
+            }
+        }
+        if(y == NULL) continue;
+        // beqz a, L1; jmp L2; L1:  becomes  bnez a, L2; L1:
+        if((x->op == LKS_BEQZ || x->op == LKS_BNEZ) && y->op == LKS_JMP && labelFollows(c, j, x->label)){
+            x->op = x->op == LKS_BEQZ ? LKS_BNEZ : LKS_BEQZ;
+            x->label = y->label;
+            y->op = LKS_NOP;
+            rewrites++;
+            continue;
+        }
+        // A reload straight after the store
+        if(x->op == LKS_ST && y->op == LKS_LD && x->ra == y->ra && x->imm == y->imm){
+            y->op = LKS_MOV;
+            y->ra = x->rd;
+            y->imm = 0;
+            rewrites++;
+            continue;
+        }
+        // Storing back what was just loaded
+        if(x->op == LKS_LD && y->op == LKS_ST && x->rd == y->rd && x->ra == y->ra && x->imm == y->imm
+           && x->rd != x->ra){
+            y->op = LKS_NOP;
+            rewrites++;
+            continue;
+        }
+        // push a; pop b
+        if(x->op == LKS_PUSH && y->op == LKS_POP){
+            x->op = LKS_MOV;
+            x->rd = y->rd;
+            y->op = LKS_NOP;
+            rewrites++;
+            continue;
+        }
+        // mov a, b; mov b, a
+        if(x->op == LKS_MOV && y->op == LKS_MOV && x->rd == y->ra && x->ra == y->rd){
+            y->op = LKS_NOP;
+            rewrites++;
+            continue;
+        }
+    }
+
+    int kept = 0;
+    for(int i = 0; i < c->machineLength; i++){
+        if(c->machine[i].op != LKS_NOP) c->machine[kept++] = c->machine[i];
+    }
+    c->machineLength = kept;
+    return rewrites;
+}
+
+/* ---- Encoding ---- */
+
+static unsigned int encode(int op, int rd, int ra, int field){
+    return (unsigned int)op << 24 | (unsigned int)rd << 20 | (unsigned int)ra << 16 | ((unsigned int)field & 0xffff);
+}
+
+static int immediate(long long value){
+    if(!fitsImmediate(value)){
+        fatalError(ERROR_RESOURCE, "Error: LKS-8 program too large\n");
+    }
+    return (int)value;
+}
+
+static void assemble(Compiler* c, Lks8Program* program){
+    int* address = (int*)memAlloc(sizeof(int) * (c->labels + 1));
+    int length = 0;
+    for(int i = 0; i < c->machineLength; i++){
+        Instr* x = &c->machine[i];
+        if(x->op == MACHINE_LABEL){
+            address[x->label] = length;
+        }else{
+            length += x->op == LKS_LIW ? 3 : 1;
+        }
+    }
+
+    program->code = (unsigned int*)memAlloc(sizeof(unsigned int) * (length + 1));
+    program->length = length;
+    int at = 0;
+    for(int i = 0; i < c->machineLength; i++){
+        Instr* x = &c->machine[i];
+        switch(x->op){
+            case MACHINE_LABEL:
+                continue;
+            case LKS_LIW: {
+                unsigned long long bits = (unsigned long long)x->imm;
+                program->code[at++] = encode(x->op, x->rd, 0, 0);
+                program->code[at++] = (unsigned int)bits;
+                program->code[at++] = (unsigned int)(bits >> 32);
+                continue;
+            }
+            case LKS_ADD: case LKS_SUB: case LKS_MUL: case LKS_DIV:
+            case LKS_AND: case LKS_OR: case LKS_SLT: case LKS_SLE: case LKS_SEQ:
+                program->code[at++] = encode(x->op, x->rd, x->ra, x->rb);
+                continue;
+            case LKS_BEQZ: case LKS_BNEZ: case LKS_JMP: case LKS_CALL:
+                program->code[at] = encode(x->op, x->rd, x->ra, immediate(address[x->label] - at));
+                at++;
+                continue;
+            default:
+                program->code[at++] = encode(x->op, x->rd, x->ra, immediate(x->imm));
+                continue;
+        }
+    }
+    memFree(address);
+}
+
+/**
+ * @brief Compile a resolved tree to LKS-8 code
+ * @param root The tree from parse()
+ * @return The encoded program
+ *
+ * Constructs the backend cannot handle are reported through fatalError.
+ */
+Lks8Program* lks8Compile(Node* root){
+    Compiler c = {0};
+    // The top level comes first, so the program starts at address 0
+    addFunction(&c, NULL, NULL);
+    collectFunctions(&c, root);
+    for(int i = 0; i < c.functionCount; i++){
+        Function* f = c.functions[i];
+        lowerFunction(&c, f, root);
+        generateFunction(&c, f);
+    }
+
+    Lks8Program* program = (Lks8Program*)memCalloc(1, sizeof(Lks8Program));
+    int rewrites;
+    while((rewrites = peepholePass(&c)) > 0){
+        program->rewrites += rewrites;
+    }
+    assemble(&c, program);
+    program->globalCount = c.globalCount;
+    program->globals = c.globals;
+    program->spills = c.spills;
+
+    for(int i = 0; i < c.functionCount; i++){
+        memFree(c.functions[i]->params);
+        memFree(c.functions[i]->code);
+        memFree(c.functions[i]);
+    }
+    memFree(c.functions);
+    memFree(c.machine);
+    return program;
+}
+
+void lks8Free(Lks8Program* program){
+    for(int i = 0; i < program->globalCount; i++){
+        memFree(program->globals[i]);
+    }
+    memFree(program->globals);
+    memFree(program->code);
+    memFree(program);
+}
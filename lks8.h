@@ -0,0 +1,95 @@
+#ifndef LISP_LITE_LKS8_H
+#define LISP_LITE_LKS8_H
+#include "library.h"
+#include <stdio.h>
+
+/*
+ * LKS-8: a small load/store machine with eight 64-bit registers, and a
+ * backend and simulator for it, so generated code can be measured before
+ * there is hardware.
+ *
+ * r0-r3 hold values and are handed out by a linear-scan allocator. r4 and
+ * r5 are scratch for spill code, with r4 also carrying return values. r6 is
+ * the frame pointer and r7 the stack pointer. Memory is addressed in 64-bit
+ * words: globals start at address 0 and the stack grows down from the top.
+ * All registers are caller-saved.
+ *
+ * Every instruction is one 32-bit word: the opcode in bits 31-24, rd in
+ * 23-20, ra in 19-16, and in 15-0 either rb or a signed immediate. LIW
+ * takes its 64-bit immediate from the next two words. Branches, JMP and
+ * CALL jump relative to their own address.
+ *
+ * The backend takes int-only programs: integer literals, + - * /,
+ * comparisons, and/or/not, if, seq, print, globals, and functions defined
+ * once at the top level with (def name (lambda ...)) and called by name.
+ * Arithmetic wraps instead of growing into bignums. Self tail calls are
+ * compiled to jumps.
+ */
+
+typedef enum {
+    LKS_NOP,
+    LKS_LI,     // rd = imm
+    LKS_LIW,    // rd = next two words
+    LKS_MOV,    // rd = ra
+    LKS_ADD,    // rd = ra op rb
+    LKS_SUB,
+    LKS_MUL,
+    LKS_DIV,
+    LKS_AND,
+    LKS_OR,
+    LKS_SLT,
+    LKS_SLE,
+    LKS_SEQ,
+    LKS_ADDI,   // rd = ra + imm
+    LKS_SNEZ,   // rd = ra != 0
+    LKS_SEQZ,   // rd = ra == 0
+    LKS_LD,     // rd = mem[ra + imm]
+    LKS_ST,     // mem[ra + imm] = rd
+    LKS_LDG,    // rd = mem[imm]
+    LKS_STG,    // mem[imm] = rd
+    LKS_PUSH,   // mem[--sp] = ra
+    LKS_POP,    // rd = mem[sp++]
+    LKS_BEQZ,   // if ra == 0, pc += imm
+    LKS_BNEZ,
+    LKS_JMP,
+    LKS_CALL,   // mem[--sp] = pc + 1, pc += imm
+    LKS_RET,    // pc = mem[sp++]
+    LKS_OUT,    // print ra and a newline
+    LKS_HALT    // stop with the result in r4
+} Lks8Op;
+
+#define LKS8_REGISTERS 8
+#define LKS8_FP 6
+#define LKS8_SP 7
+
+// Words of data memory in the simulator: 8 MiB
+#define LKS8_MEMORY_WORDS (1 << 20)
+
+typedef struct {
+    unsigned int* code;
+    int length;         // in words
+    int globalCount;
+    char** globals;     // names, by address
+    int spills;         // values the allocator kept on the stack
+    int rewrites;       // instructions removed or simplified by the peephole pass
+} Lks8Program;
+
+typedef struct {
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long loads;
+    unsigned long long stores;
+    unsigned long long fetches;     // instruction words read
+} Lks8Stats;
+
+Lks8Program* lks8Compile(Node* root);
+
+void lks8Disassemble(Lks8Program* program, FILE* out);
+
+long long lks8Run(Lks8Program* program, Lks8Stats* stats);
+
+void lks8PrintStats(Lks8Program* program, Lks8Stats* stats);
+
+void lks8Free(Lks8Program* program);
+
+#endif //LISP_LITE_LKS8_H
@@ -0,0 +1,266 @@
+#include "lks8.h"
+#include "output.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Cycle costs of the simulated machine: a simple in-order core where ALU
+ * operations take one cycle, multiplies three and divides twenty, memory
+ * accesses three (two for stores, which retire through a write buffer),
+ * and taken branches pay one extra cycle for the refetch.
+ */
+#define CYCLES_ALU 1
+#define CYCLES_MUL 3
+#define CYCLES_DIV 20
+#define CYCLES_LOAD 3
+#define CYCLES_STORE 2
+#define CYCLES_TAKEN 2
+
+static const char* mnemonics[] = {
+    "nop", "li", "liw", "mov", "add", "sub", "mul", "div", "and", "or",
+    "slt", "sle", "seq", "addi", "snez", "seqz", "ld", "st", "ldg", "stg",
+    "push", "pop", "beqz", "bnez", "jmp", "call", "ret", "out", "halt"
+};
+
+static void decode(unsigned int word, int* op, int* rd, int* ra, int* rb, int* imm){
+    *op = (int)(word >> 24);
+    *rd = (int)(word >> 20) & 0xf;
+    *ra = (int)(word >> 16) & 0xf;
+    *rb = (int)word & 0xf;
+    *imm = (int)(short)(word & 0xffff);
+}
+
+static const char* registerName(int reg){
+    static const char* names[] = {"r0", "r1", "r2", "r3", "r4", "r5", "fp", "sp"};
+    return names[reg & 7];
+}
+
+/**
+ * @brief Print the program as assembly, one instruction per line with its address
+ */
+void lks8Disassemble(Lks8Program* program, FILE* out){
+    fprintf(out, "; %d words, %d globals, %d spilled values, %d peephole rewrites\n",
+            program->length, program->globalCount, program->spills, program->rewrites);
+    for(int g = 0; g < program->globalCount; g++){
+        fprintf(out, "; global %d: %s\n", g, program->globals[g]);
+    }
+    for(int pc = 0; pc < program->length; pc++){
+        int op, rd, ra, rb, imm;
+        decode(program->code[pc], &op, &rd, &ra, &rb, &imm);
+        fprintf(out, "%5d  %-5s", pc, op <= LKS_HALT ? mnemonics[op] : "???");
+        switch(op){
+            case LKS_LI:
+            case LKS_LDG:
+            case LKS_STG:
+                fprintf(out, " %s, %d", registerName(rd), imm);
+                break;
+            case LKS_LIW: {
+                unsigned long long bits = program->code[pc + 1] | (unsigned long long)program->code[pc + 2] << 32;
+                fprintf(out, " %s, %lld", registerName(rd), (long long)bits);
+                pc += 2;
+                break;
+            }
+            case LKS_MOV:
+            case LKS_SNEZ:
+            case LKS_SEQZ:
+                fprintf(out, " %s, %s", registerName(rd), registerName(ra));
+                break;
+            case LKS_ADDI:
+                fprintf(out, " %s, %s, %d", registerName(rd), registerName(ra), imm);
+                break;
+            case LKS_LD:
+            case LKS_ST:
+                fprintf(out, " %s, [%s%+d]", registerName(rd), registerName(ra), imm);
+                break;
+            case LKS_PUSH:
+            case LKS_OUT:
+                fprintf(out, " %s", registerName(ra));
+                break;
+            case LKS_POP:
+                fprintf(out, " %s", registerName(rd));
+                break;
+            case LKS_BEQZ:
+            case LKS_BNEZ:
+                fprintf(out, " %s, %d", registerName(ra), pc + imm);
+                break;
+            case LKS_JMP:
+            case LKS_CALL:
+                fprintf(out, " %d", pc + imm);
+                break;
+            case LKS_NOP:
+            case LKS_RET:
+            case LKS_HALT:
+                break;
+            default:
+                fprintf(out, " %s, %s, %s", registerName(rd), registerName(ra), registerName(rb));
+                break;
+        }
+        fputc('\n', out);
+    }
+}
+
+static long long* memoryAt(long long* memory, long long address){
+    if(address < 0 || address >= LKS8_MEMORY_WORDS){
+        fatalError(ERROR_RANGE, "Error: LKS-8 memory access out of range (%lld)\n", address);
+    }
+    return &memory[address];
+}
+
+static void push(long long* memory, long long* regs, int globals, long long value){
+    if(regs[LKS8_SP] <= globals){
+        fatalError(ERROR_RESOURCE, "Error: LKS-8 stack overflow\n");
+    }
+    *memoryAt(memory, --regs[LKS8_SP]) = value;
+}
+
+static long long pop(long long* memory, long long* regs){
+    return *memoryAt(memory, regs[LKS8_SP]++);
+}
+
+// Wrapping arithmetic, as the hardware does it
+static long long wrap(unsigned long long value){
+    return (long long)value;
+}
+
+/**
+ * @brief Run a program on the simulator
+ * @param program The compiled program
+ * @param stats Filled in with what the run cost
+ * @return The value the program halted with
+ *
+ * `out` goes through the interpreter's output buffer, like print.
+ */
+long long lks8Run(Lks8Program* program, Lks8Stats* stats){
+    long long* memory = (long long*)memCalloc(LKS8_MEMORY_WORDS, sizeof(long long));
+    long long regs[LKS8_REGISTERS] = {0};
+    regs[LKS8_SP] = LKS8_MEMORY_WORDS;
+    regs[LKS8_FP] = LKS8_MEMORY_WORDS;
+    memset(stats, 0, sizeof(Lks8Stats));
+
+    long long pc = 0;
+    for(;;){
+        if(pc < 0 || pc >= program->length){
+            fatalError(ERROR_RANGE, "Error: LKS-8 jump out of the program (%lld)\n", pc);
+        }
+        int op, rd, ra, rb, imm;
+        decode(program->code[pc], &op, &rd, &ra, &rb, &imm);
+        stats->instructions++;
+        stats->fetches++;
+        long long next = pc + 1;
+        unsigned long long a = (unsigned long long)regs[ra];
+        unsigned long long b = (unsigned long long)regs[rb];
+        int cycles = CYCLES_ALU;
+        switch(op){
+            case LKS_NOP: break;
+            case LKS_LI: regs[rd] = imm; break;
+            case LKS_LIW:
+                regs[rd] = wrap(program->code[pc + 1] | (unsigned long long)program->code[pc + 2] << 32);
+                stats->fetches += 2;
+                cycles = 2;
+                next = pc + 3;
+                break;
+            case LKS_MOV: regs[rd] = regs[ra]; break;
+            case LKS_ADD: regs[rd] = wrap(a + b); break;
+            case LKS_SUB: regs[rd] = wrap(a - b); break;
+            case LKS_MUL: regs[rd] = wrap(a * b); cycles = CYCLES_MUL; break;
+            case LKS_DIV:
+                if(regs[rb] == 0){
+                    fatalError(ERROR_RANGE, "Error: Division by zero\n");
+                }
+                // The one overflowing quotient wraps like everything else
+                regs[rd] = regs[rb] == -1 ? wrap(0 - a) : regs[ra] / regs[rb];
+                cycles = CYCLES_DIV;
+                break;
+            case LKS_AND: regs[rd] = regs[ra] & regs[rb]; break;
+            case LKS_OR: regs[rd] = regs[ra] | regs[rb]; break;
+            case LKS_SLT: regs[rd] = regs[ra] < regs[rb]; break;
+            case LKS_SLE: regs[rd] = regs[ra] <= regs[rb]; break;
+            case LKS_SEQ: regs[rd] = regs[ra] == regs[rb]; break;
+            case LKS_ADDI: regs[rd] = wrap(a + (unsigned long long)(long long)imm); break;
+            case LKS_SNEZ: regs[rd] = regs[ra] != 0; break;
+            case LKS_SEQZ: regs[rd] = regs[ra] == 0; break;
+            case LKS_LD:
+                regs[rd] = *memoryAt(memory, regs[ra] + imm);
+                stats->loads++;
+                cycles = CYCLES_LOAD;
+                break;
+            case LKS_ST:
+                *memoryAt(memory, regs[ra] + imm) = regs[rd];
+                stats->stores++;
+                cycles = CYCLES_STORE;
+                break;
+            case LKS_LDG:
+                regs[rd] = *memoryAt(memory, imm);
+                stats->loads++;
+                cycles = CYCLES_LOAD;
+                break;
+            case LKS_STG:
+                *memoryAt(memory, imm) = regs[rd];
+                stats->stores++;
+                cycles = CYCLES_STORE;
+                break;
+            case LKS_PUSH:
+                push(memory, regs, program->globalCount, regs[ra]);
+                stats->stores++;
+                cycles = CYCLES_STORE;
+                break;
+            case LKS_POP:
+                regs[rd] = pop(memory, regs);
+                stats->loads++;
+                cycles = CYCLES_LOAD;
+                break;
+            case LKS_BEQZ:
+            case LKS_BNEZ:
+                if((regs[ra] == 0) == (op == LKS_BEQZ)){
+                    next = pc + imm;
+                    cycles = CYCLES_TAKEN;
+                }
+                break;
+            case LKS_JMP:
+                next = pc + imm;
+                cycles = CYCLES_TAKEN;
+                break;
+            case LKS_CALL:
+                push(memory, regs, program->globalCount, pc + 1);
+                stats->stores++;
+                next = pc + imm;
+                cycles = CYCLES_TAKEN;
+                break;
+            case LKS_RET:
+                next = pop(memory, regs);
+                stats->loads++;
+                cycles = CYCLES_LOAD;
+                break;
+            case LKS_OUT:
+                printValue(makeIntValue(regs[ra]));
+                outputChar('\n');
+                break;
+            case LKS_HALT:
+                stats->cycles += CYCLES_ALU;
+                memFree(memory);
+                return regs[4];
+            default:
+                fatalError(ERROR_UNSUPPORTED, "Error: LKS-8 illegal instruction %#x at %lld\n", program->code[pc], pc);
+        }
+        stats->cycles += cycles;
+        pc = next;
+    }
+}
+
+/**
+ * @brief Report a run's cost on stderr
+ */
+void lks8PrintStats(Lks8Program* program, Lks8Stats* stats){
+    fprintf(stderr, "code size:    %d words (%d bytes)\n", program->length, program->length * 4);
+    fprintf(stderr, "spills:       %d\n", program->spills);
+    fprintf(stderr, "peephole:     %d rewrites\n", program->rewrites);
+    fprintf(stderr, "instructions: %llu\n", stats->instructions);
+    fprintf(stderr, "cycles:       %llu\n", stats->cycles);
+    if(stats->instructions > 0){
+        fprintf(stderr, "CPI:          %.2f\n", (double)stats->cycles / (double)stats->instructions);
+    }
+    fprintf(stderr, "loads:        %llu (%llu bytes)\n", stats->loads, stats->loads * 8);
+    fprintf(stderr, "stores:       %llu (%llu bytes)\n", stats->stores, stats->stores * 8);
+    fprintf(stderr, "fetched:      %llu bytes\n", stats->fetches * 4);
+}
@@ -1,17 +1,126 @@
 #include "library.h"
 #include "lexer.h"
+#include "output.h"
+#include "batch.h"
+#include "serve.h"
+#include "aot.h"
+#include "lks8.h"
+#include "forkjoin.h"
+#include "jit.h"
+#include "cse.h"
+#include "watch.h"
+#include "alloc.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 
 int main(int argc, char** argv){
 
-    if(argc != 2){
-        fprintf(stderr, "Usage: %s <input>\n", argv[0]);
+    char* input = NULL;
+    char* socketPath = NULL;
+    size_t outputBuffer = 0;
+    int eachLine = 0;
+    int emit = 0;
+    int lks8 = 0;
+    int watchFile = 0;
+    int cpus = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    int threads = 0;    // 0 until --threads is given
+    EachLineOptions options = {1, 0, 0, 0};
+    int jobsGiven = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--output-buffer") == 0 && i + 1 < argc){
+            outputBuffer = strtoull(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--emit-c") == 0){
+            emit = 1;
+        }else if(strcmp(argv[i], "--lks8") == 0){
+            lks8 = 1;
+        }else if(strcmp(argv[i], "--lks8-asm") == 0){
+            lks8 = 2;
+        }else if(strcmp(argv[i], "--watch") == 0){
+            watchFile = 1;
+        }else if(strcmp(argv[i], "--each-line") == 0){
+            eachLine = 1;
+        }else if(strcmp(argv[i], "--jobs") == 0 && i + 1 < argc){
+            options.jobs = atoi(argv[++i]);
+            if(options.jobs < 1){
+                fprintf(stderr, "Error: --jobs needs a positive count\n");
+                return 1;
+            }
+            jobsGiven = 1;
+        }else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc){
+            socketPath = argv[++i];
+        }else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            threads = atoi(argv[++i]);
+            if(threads < 1){
+                fprintf(stderr, "Error: --threads needs a positive count\n");
+                return 1;
+            }
+        }else if(strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc){
+            maxDepth = atoi(argv[++i]);
+            if(maxDepth < 1){
+                fprintf(stderr, "Error: --max-depth needs a positive count\n");
+                return 1;
+            }
+        }else if(strcmp(argv[i], "--no-jit") == 0){
+            jitEnabled = 0;
+        }else if(strcmp(argv[i], "--no-cse") == 0){
+            cseEnabled = 0;
+        }else if(strcmp(argv[i], "--cse-stats") == 0){
+            cseStatsEnable();
+        }else if(strcmp(argv[i], "--alloc-stats") == 0){
+            // Nothing has been allocated yet
+            allocTrackingEnable();
+        }else if(strcmp(argv[i], "--ordered") == 0){
+            options.ordered = 1;
+        }else if(strcmp(argv[i], "--reset-env") == 0){
+            options.resetEnv = 1;
+        }else if(strcmp(argv[i], "--stats") == 0){
+            options.showStats = 1;
+        }else if(input == NULL){
+            input = argv[i];
+        }else{
+            input = NULL;
+            break;
+        }
+    }
+
+    allocPhase(ALLOC_STARTUP);
+    if(eachLine){
+        // Records run in arenas (batch.c), and nothing is allocated yet
+        allocHeadersEnable();
+    }
+
+    if(socketPath != NULL && input == NULL){
+        // Requests run side by side instead of forking within one
+        ServeOptions serveOptions = {jobsGiven ? options.jobs : threads > 0 ? threads : cpus};
+        return runServer(socketPath, &serveOptions);
+    }
+
+    if(input == NULL || socketPath != NULL){
+        fprintf(stderr, "Usage: %s [--output-buffer BYTES] [--threads N] [--max-depth N] [--no-jit] [--no-cse] [--cse-stats] [--alloc-stats] [--each-line [--jobs N [--ordered]] [--reset-env] [--stats]] <input>\n", argv[0]);
+        fprintf(stderr, "       %s --emit-c <input> > program.c\n", argv[0]);
+        fprintf(stderr, "       %s --lks8 | --lks8-asm <input>\n", argv[0]);
+        fprintf(stderr, "       %s --watch <input>\n", argv[0]);
+        fprintf(stderr, "       %s --serve SOCKET [--jobs N]\n", argv[0]);
         return 1;
     }
 
-    char* input = argv[1];
+    outputInit(outputBuffer);
+    // Pure arguments may be evaluated in parallel on this many threads. Purity
+    // is only proven against the program's own definitions (effects.h), so
+    // this stays off unless asked for
+    forkJoinInit(threads > 0 ? threads : 1);
+    if(watchFile){
+        return runWatch(input);
+    }
     FILE *file = fopen(input, "r");
     if(file == NULL){
         fprintf(stderr, "Error: Could not open file %s\n", input);
@@ -22,24 +131,62 @@ int main(int argc, char** argv){
     long length = ftell(file);
     fseek(file, 0, SEEK_SET);
 
-    char* buffer = (char*)malloc(length + 1);
+    char* buffer = (char*)memAlloc(length + 1);
     fread(buffer, 1, length, file);
 
     buffer[length] = '\0';
 
-    for (char* p = buffer; *p; ++p) {
-        if (*p == '\r') *p = ' ';
-        if (*p == '\n') *p = ' ';
+    normalizeSource(buffer, (size_t)length);
+
+    if(emit){
+        fclose(file);
+        Token* tokens = lex(buffer);
+        Node* AST = parse(tokens);
+        allocPhase(ALLOC_CODEGEN);
+        emitC(AST, stdout);
+        freeTokens(tokens);
+        freeTree(AST);
+        memFree(buffer);
+        return 0;
     }
 
-    for (int i = 0; i < length; ++i) {
-        if ((unsigned char)buffer[i] < 32 || (unsigned char)buffer[i] > 126) {
-            // Replace non-printable ASCII chars with space or null
-            buffer[i] = ' ';
+    if(lks8){
+        fclose(file);
+        Token* tokens = lex(buffer);
+        Node* AST = parse(tokens);
+        allocPhase(ALLOC_CODEGEN);
+        Lks8Program* program = lks8Compile(AST);
+        allocPhase(ALLOC_EVAL);
+        if(lks8 == 2){
+            lks8Disassemble(program, stdout);
+        }else{
+            // Runs on the simulator, which reports what it cost on stderr
+            Lks8Stats stats;
+            long long result = lks8Run(program, &stats);
+            outputString("Result: ");
+            printValue(makeIntValue(result));
+            outputChar('\n');
+            outputFlush();
+            lks8PrintStats(program, &stats);
         }
+        lks8Free(program);
+        freeTokens(tokens);
+        freeTree(AST);
+        memFree(buffer);
+        return 0;
     }
 
-
+    if(eachLine){
+        fclose(file);
+        Token* tokens = lex(buffer);
+        Node* AST = parse(tokens);
+        allocPhase(ALLOC_EVAL);
+        int status = runEachLine(AST, &options);
+        freeTokens(tokens);
+        freeTree(AST);
+        memFree(buffer);
+        return status;
+    }
 
     printf("Buffer: [%s]\n", buffer);
 
@@ -59,16 +206,20 @@ int main(int argc, char** argv){
 
     EnvEntry* env = NULL;
 
+    // The tree went out through stdio; program output uses the output buffer
+    fflush(stdout);
+
+    allocPhase(ALLOC_EVAL);
     Value result = evaluateTree(AST, &env);
-    if(result.type == VAL_INT){
-        printf("Result: %d\n", result.intValue);
-    }else{
-        printf("Result: %s\n", result.strValue);
-    }
+    outputString("Result: ");
+    printValue(result);
+    outputChar('\n');
+    outputFlush();
 
     freeTokens(tokens);
     freeTree(AST);
     env_free(env);
+    memFree(buffer);
 
     return 0;
 }
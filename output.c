@@ -0,0 +1,237 @@
+#include "output.h"
+#include "alloc.h"
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+// Per thread, so worker threads can each capture their own output
+static _Thread_local char *buffer = NULL;
+static _Thread_local size_t capacity = 0;
+static _Thread_local size_t used = 0;
+static _Thread_local int capturing = 0;
+// Where flushed output goes instead of file descriptor 1, when set
+static _Thread_local OutputSink sink = NULL;
+static _Thread_local void *sinkUser = NULL;
+
+// Strings at least this long skip the copy and go out with writev
+#define DIRECT_WRITE_THRESHOLD (capacity / 2)
+
+/**
+ * @brief Give up on stdout after a write to it failed
+ *
+ * What is still buffered is dropped first, or the flush at exit would fail
+ * the same way again.
+ */
+static _Noreturn void writeFailed(void){
+    int error = errno;
+    used = 0;
+    fatalError(ERROR_IO, "Error: Could not write output: %s\n", strerror(error));
+}
+
+static void writeAll(const char *data, size_t length){
+    if(sink != NULL){
+        if(length > 0){
+            sink(sinkUser, data, length);
+        }
+        return;
+    }
+    while(length > 0){
+        ssize_t written = write(1, data, length);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            writeFailed();
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+static void registerFlush(void){
+    // exit(1) on error paths still gets whatever was printed out
+    atexit(outputFlush);
+}
+
+/**
+ * @brief Set up the buffer; safe to call again to resize
+ * @param size Buffer size in bytes (0 for the default)
+ */
+void outputInit(size_t size){
+    // Handler threads may write for the first time at once
+    static pthread_once_t registered = PTHREAD_ONCE_INIT;
+    if(size == 0){
+        size = OUTPUT_DEFAULT_CAPACITY;
+    }
+    outputFlush();
+    memFree(buffer);
+    // The buffer is the thread's, whichever embedding context first writes
+    AllocArena *arena = allocArenaUse(NULL);
+    buffer = (char*)memAlloc(size);
+    allocArenaUse(arena);
+    capacity = size;
+    used = 0;
+    pthread_once(&registered, registerFlush);
+}
+
+void outputFlush(void){
+    if(used > 0 && !capturing){
+        writeAll(buffer, used);
+        used = 0;
+    }
+}
+
+/**
+ * @brief Append bytes, flushing as needed
+ */
+void outputWrite(const char* data, size_t length){
+    if(buffer == NULL){
+        outputInit(0);
+    }
+    if(length <= capacity - used){
+        memcpy(buffer + used, data, length);
+        used += length;
+        return;
+    }
+
+    if(capturing){
+        while(length > capacity - used){
+            capacity *= 2;
+        }
+        buffer = (char*)memRealloc(buffer, capacity);
+        memcpy(buffer + used, data, length);
+        used += length;
+        return;
+    }
+
+    if(length >= DIRECT_WRITE_THRESHOLD && sink != NULL){
+        outputFlush();
+        writeAll(data, length);
+        return;
+    }
+
+    if(length >= DIRECT_WRITE_THRESHOLD){
+#ifdef _WIN32
+        outputFlush();
+        writeAll(data, length);
+#else
+        // Buffered bytes and the big string in one syscall, no copy
+        struct iovec parts[2] = {{buffer, used}, {(void*)data, length}};
+        ssize_t written;
+        do{
+            written = writev(1, parts, 2);
+        }while(written < 0 && errno == EINTR);
+        if(written < 0){
+            writeFailed();
+        }
+        size_t done = (size_t)written;
+        if(done < used){
+            writeAll(buffer + done, used - done);
+            done = used;
+        }
+        writeAll(data + (done - used), length - (done - used));
+        used = 0;
+#endif
+        return;
+    }
+
+    outputFlush();
+    memcpy(buffer, data, length);
+    used = length;
+}
+
+/**
+ * @brief Send this thread's output to a callback instead of stdout
+ * @param write Called with each flushed block; NULL goes back to stdout
+ * @param user Passed through to the callback
+ *
+ * Anything still buffered goes to the previous destination first.
+ */
+void outputRedirect(OutputSink write, void* user){
+    outputFlush();
+    sink = write;
+    sinkUser = user;
+}
+
+/**
+ * @brief Keep this thread's output in memory instead of writing it
+ *
+ * Used by worker threads, whose output is handed to the main thread with
+ * outputTakeCaptured() and written from there.
+ */
+void outputCapture(void){
+    if(buffer == NULL){
+        outputInit(0);
+    }
+    capturing = 1;
+}
+
+/**
+ * @brief Take everything captured since the last call
+ * @param length Set to the number of bytes
+ * @return The bytes, malloc'd; NULL when there were none
+ */
+char* outputTakeCaptured(size_t* length){
+    *length = used;
+    if(used == 0){
+        return NULL;
+    }
+    char *data = (char*)memAlloc(used);
+    memcpy(data, buffer, used);
+    used = 0;
+    return data;
+}
+
+void outputString(const char* s){
+    outputWrite(s, strlen(s));
+}
+
+void outputChar(char c){
+    if(buffer == NULL || used == capacity){
+        outputWrite(&c, 1);
+        return;
+    }
+    buffer[used++] = c;
+}
+
+static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * @brief Format a fixnum without printf, two digits per step
+ */
+void outputInt(long long value){
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+
+    while(magnitude >= 100){
+        unsigned pair = (unsigned)(magnitude % 100) * 2;
+        magnitude /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+    if(magnitude >= 10){
+        unsigned pair = (unsigned)magnitude * 2;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }else{
+        *--p = (char)('0' + magnitude);
+    }
+    if(value < 0){
+        *--p = '-';
+    }
+    outputWrite(p, (size_t)(end - p));
+}
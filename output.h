@@ -0,0 +1,38 @@
+#ifndef LISP_LITE_OUTPUT_H
+#define LISP_LITE_OUTPUT_H
+#include <stddef.h>
+
+/*
+ * Interpreter-owned stdout buffer. Program output is formatted straight into
+ * it and handed to write(2) in large blocks, independent of whether stdout
+ * is a tty. Anything else that writes to stdout through stdio must call
+ * outputFlush() first to keep the two in order.
+ *
+ * The buffer is per thread. A thread that calls outputCapture() keeps its
+ * output in memory until it is taken, rather than writing it to stdout, and
+ * outputRedirect() sends it to a callback instead.
+ */
+
+#define OUTPUT_DEFAULT_CAPACITY (256 * 1024)
+
+typedef void (*OutputSink)(void* user, const char* data, size_t length);
+
+void outputInit(size_t capacity);
+
+void outputWrite(const char* data, size_t length);
+
+void outputString(const char* s);
+
+void outputChar(char c);
+
+void outputInt(long long value);
+
+void outputFlush(void);
+
+void outputRedirect(OutputSink write, void* user);
+
+void outputCapture(void);
+
+char* outputTakeCaptured(size_t* length);
+
+#endif //LISP_LITE_OUTPUT_H
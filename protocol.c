@@ -0,0 +1,118 @@
+#include "protocol.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int writeFully(int fd, const char* data, size_t length){
+    while(length > 0){
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if(sent < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+static int readFully(int fd, char* data, size_t length){
+    while(length > 0){
+        ssize_t got = recv(fd, data, length, 0);
+        if(got == 0){
+            return -1;
+        }
+        if(got < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        data += got;
+        length -= (size_t)got;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send one frame
+ * @return 0, or -1 if the peer has gone away
+ */
+int writeFrame(int fd, char kind, const void* payload, uint32_t length){
+    char header[5];
+    header[0] = kind;
+    header[1] = (char)(length >> 24);
+    header[2] = (char)(length >> 16);
+    header[3] = (char)(length >> 8);
+    header[4] = (char)length;
+    if(length <= 4096){
+        // Small frames go out in a single send
+        char packet[5 + 4096];
+        memcpy(packet, header, 5);
+        memcpy(packet + 5, payload, length);
+        return writeFully(fd, packet, 5 + (size_t)length);
+    }
+    if(writeFully(fd, header, 5) != 0){
+        return -1;
+    }
+    return writeFully(fd, (const char*)payload, length);
+}
+
+/**
+ * @brief Receive one frame; the caller frees frame->payload
+ * @return 0, or -1 at end of stream, on an error or on an oversized frame
+ */
+int readFrame(int fd, Frame* frame){
+    unsigned char header[5];
+    frame->payload = NULL;
+    if(readFully(fd, (char*)header, 5) != 0){
+        return -1;
+    }
+    frame->kind = (char)header[0];
+    frame->length = ((uint32_t)header[1] << 24) | ((uint32_t)header[2] << 16)
+                  | ((uint32_t)header[3] << 8) | (uint32_t)header[4];
+    if(frame->length > FRAME_MAX_PAYLOAD){
+        return -1;
+    }
+    if(frame->length == 0){
+        return 0;
+    }
+    frame->payload = (char*)malloc((size_t)frame->length + 1);
+    if(readFully(fd, frame->payload, frame->length) != 0){
+        free(frame->payload);
+        frame->payload = NULL;
+        return -1;
+    }
+    frame->payload[frame->length] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Connect to a server's socket
+ * @return The connected descriptor, or -1
+ */
+int connectSocket(const char* path){
+    struct sockaddr_un address;
+    if(strlen(path) >= sizeof(address.sun_path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,42 @@
+#ifndef LISP_LITE_PROTOCOL_H
+#define LISP_LITE_PROTOCOL_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Wire format between `LISP_LITE --serve` and its clients, over a Unix
+ * stream socket. Every message is a frame: one kind byte, a 4-byte
+ * big-endian payload length, then the payload.
+ *
+ * A client sends FRAME_RUN with the program text (or FRAME_STATS). While the
+ * program runs the server streams FRAME_OUTPUT blocks, and when the program
+ * wants input it sends FRAME_READ with the most bytes it can take; the
+ * client answers with one FRAME_INPUT, empty at end of input. The request
+ * ends with FRAME_ERROR (if it failed) and then FRAME_EXIT carrying the
+ * status byte. A connection can carry any number of requests in turn.
+ */
+
+#define FRAME_RUN    'r'
+#define FRAME_STATS  's'
+#define FRAME_INPUT  'i'
+#define FRAME_OUTPUT 'o'
+#define FRAME_READ   'n'
+#define FRAME_ERROR  'e'
+#define FRAME_EXIT   'x'
+
+// Largest payload either side accepts
+#define FRAME_MAX_PAYLOAD (64u * 1024 * 1024)
+
+typedef struct {
+    char kind;
+    uint32_t length;
+    char* payload;  // malloc'd and NUL-terminated; NULL when empty
+} Frame;
+
+int writeFrame(int fd, char kind, const void* payload, uint32_t length);
+
+int readFrame(int fd, Frame* frame);
+
+int connectSocket(const char* path);
+
+#endif //LISP_LITE_PROTOCOL_H
@@ -0,0 +1,1386 @@
+#include "regexp.h"
+#include "strlib.h"
+#include "alloc.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#define MAX_CODE_POINT 0x10FFFFu
+
+// Largest count allowed in {n,m}
+#define MAX_REPEAT 1000
+
+// Instructions a pattern may compile to once counted repeats are expanded
+#define MAX_PROGRAM 65536
+
+// Groups and stacked repeats nested deeper than this are refused, since
+// parsing and compiling them recurses
+#define MAX_DEPTH 256
+
+// Bytes of cached states per DFA; past this, searches work out the states
+// they need without keeping them
+#define CACHE_BYTES (4u << 20)
+
+// Slots for patterns that are not literals, remembered across calls
+#define PATTERN_CACHE 64
+
+// Longest literal prefix searched for ahead of running the DFA
+#define MAX_PREFIX 64
+
+/* ---------------------------------------------------------------- parsing */
+
+typedef struct {
+    uint32_t lo, hi;
+} Range;
+
+typedef struct {
+    Range* ranges;      // sorted and disjoint once the set is complete
+    int count;
+    int capacity;
+} CharSet;
+
+typedef enum {
+    AST_SET,
+    AST_CONCAT,     // no children for the empty pattern
+    AST_ALT,
+    AST_REPEAT,
+    AST_BEGIN,
+    AST_END
+} AstKind;
+
+/*
+ * Pattern syntax tree, kept in one array and linked by index: a node's
+ * children start at `child` and carry on through their `next`, the way
+ * evaluation trees are linked.
+ */
+typedef struct {
+    AstKind kind;
+    int child;
+    int next;
+    int set;        // AST_SET
+    int min, max;   // AST_REPEAT; max is -1 for no limit
+    int greedy;
+} Ast;
+
+typedef struct {
+    const unsigned char* start;
+    const unsigned char* at;
+    const unsigned char* end;
+    Ast* nodes;
+    int nodeCount, nodeCapacity;
+    CharSet* sets;
+    int setCount, setCapacity;
+    int depth;
+} Parser;
+
+static _Noreturn void syntaxError(const Parser* p, const char* what){
+    fatalError(ERROR_SYNTAX, "Error: %s at offset %zu in regular expression\n", what, (size_t)(p->at - p->start));
+}
+
+static int newNode(Parser* p, AstKind kind){
+    if(p->nodeCount == p->nodeCapacity){
+        p->nodeCapacity = p->nodeCapacity ? p->nodeCapacity * 2 : 32;
+        p->nodes = (Ast*)memRealloc(p->nodes, p->nodeCapacity * sizeof(Ast));
+    }
+    p->nodes[p->nodeCount] = (Ast){kind, -1, -1, -1, 0, 0, 1};
+    return p->nodeCount++;
+}
+
+static int newSet(Parser* p){
+    if(p->setCount == p->setCapacity){
+        p->setCapacity = p->setCapacity ? p->setCapacity * 2 : 16;
+        p->sets = (CharSet*)memRealloc(p->sets, p->setCapacity * sizeof(CharSet));
+    }
+    p->sets[p->setCount] = (CharSet){NULL, 0, 0};
+    return p->setCount++;
+}
+
+static void addRange(CharSet* set, uint32_t lo, uint32_t hi){
+    if(set->count == set->capacity){
+        set->capacity = set->capacity ? set->capacity * 2 : 4;
+        set->ranges = (Range*)memRealloc(set->ranges, set->capacity * sizeof(Range));
+    }
+    set->ranges[set->count++] = (Range){lo, hi};
+}
+
+static int compareRanges(const void* a, const void* b){
+    const Range* x = (const Range*)a;
+    const Range* y = (const Range*)b;
+    return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+/**
+ * @brief Sort a set's ranges and merge the ones that overlap or touch
+ */
+static void normalizeSet(CharSet* set){
+    if(set->count < 2){
+        return;
+    }
+    qsort(set->ranges, (size_t)set->count, sizeof(Range), compareRanges);
+    int kept = 0;
+    for(int i = 1; i < set->count; i++){
+        Range* last = &set->ranges[kept];
+        if(set->ranges[i].lo <= last->hi + 1){
+            if(set->ranges[i].hi > last->hi) last->hi = set->ranges[i].hi;
+        }else{
+            set->ranges[++kept] = set->ranges[i];
+        }
+    }
+    set->count = kept + 1;
+}
+
+static void negateSet(CharSet* set){
+    normalizeSet(set);
+    CharSet result = {NULL, 0, 0};
+    uint32_t next = 0;
+    for(int i = 0; i < set->count; i++){
+        if(set->ranges[i].lo > next){
+            addRange(&result, next, set->ranges[i].lo - 1);
+        }
+        next = set->ranges[i].hi + 1;
+    }
+    if(next <= MAX_CODE_POINT){
+        addRange(&result, next, MAX_CODE_POINT);
+    }
+    memFree(set->ranges);
+    *set = result;
+}
+
+static int setContains(const CharSet* set, uint32_t c){
+    int lo = 0, hi = set->count - 1;
+    while(lo <= hi){
+        int mid = (lo + hi) / 2;
+        if(c < set->ranges[mid].lo){
+            hi = mid - 1;
+        }else if(c > set->ranges[mid].hi){
+            lo = mid + 1;
+        }else{
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Read one code point of valid UTF-8 and move past it
+ */
+static inline uint32_t decode(const unsigned char** at){
+    const unsigned char* s = *at;
+    if(s[0] < 0x80){
+        *at = s + 1;
+        return s[0];
+    }
+    if(s[0] < 0xE0){
+        *at = s + 2;
+        return ((s[0] & 0x1Fu) << 6) | (s[1] & 0x3Fu);
+    }
+    if(s[0] < 0xF0){
+        *at = s + 3;
+        return ((s[0] & 0x0Fu) << 12) | ((s[1] & 0x3Fu) << 6) | (s[2] & 0x3Fu);
+    }
+    *at = s + 4;
+    return ((s[0] & 0x07u) << 18) | ((s[1] & 0x3Fu) << 12) | ((s[2] & 0x3Fu) << 6) | (s[3] & 0x3Fu);
+}
+
+static int isClassEscape(unsigned char c){
+    return c == 'd' || c == 'w' || c == 's' || c == 'D' || c == 'W' || c == 'S';
+}
+
+/**
+ * @brief Add \d, \w, \s or one of their negations to a set
+ */
+static void addClassEscape(CharSet* set, unsigned char name){
+    CharSet named = {NULL, 0, 0};
+    switch(tolower(name)){
+        case 'd':
+            addRange(&named, '0', '9');
+            break;
+        case 'w':
+            addRange(&named, '0', '9');
+            addRange(&named, 'A', 'Z');
+            addRange(&named, 'a', 'z');
+            addRange(&named, '_', '_');
+            break;
+        default:
+            addRange(&named, '\t', '\r');
+            addRange(&named, ' ', ' ');
+            break;
+    }
+    if(isupper(name)){
+        negateSet(&named);
+    }
+    for(int i = 0; i < named.count; i++){
+        addRange(set, named.ranges[i].lo, named.ranges[i].hi);
+    }
+    memFree(named.ranges);
+}
+
+static int hexDigit(unsigned char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief The code point an escape stands for, with p->at just past the backslash
+ */
+static uint32_t parseEscape(Parser* p){
+    if(p->at == p->end){
+        syntaxError(p, "Trailing backslash");
+    }
+    unsigned char c = *p->at;
+    switch(c){
+        case 'n': p->at++; return '\n';
+        case 't': p->at++; return '\t';
+        case 'r': p->at++; return '\r';
+        case 'f': p->at++; return '\f';
+        case 'v': p->at++; return '\v';
+        case 'x': {
+            int high = p->end - p->at > 2 ? hexDigit(p->at[1]) : -1;
+            int low = high >= 0 ? hexDigit(p->at[2]) : -1;
+            if(low < 0){
+                syntaxError(p, "Expected two hex digits after \\x");
+            }
+            p->at += 3;
+            return (uint32_t)(high * 16 + low);
+        }
+        default:
+            break;
+    }
+    if(c >= 0x80 || isalnum(c)){
+        syntaxError(p, "Unknown escape");
+    }
+    p->at++;
+    return c;
+}
+
+static int setNode(Parser* p, int set){
+    normalizeSet(&p->sets[set]);
+    int node = newNode(p, AST_SET);
+    p->nodes[node].set = set;
+    return node;
+}
+
+static int literalNode(Parser* p, uint32_t c){
+    int set = newSet(p);
+    addRange(&p->sets[set], c, c);
+    return setNode(p, set);
+}
+
+/**
+ * @brief A bracketed class, with p->at just past the [
+ */
+static int parseClass(Parser* p){
+    int set = newSet(p);
+    int negate = 0;
+    if(p->at < p->end && *p->at == '^'){
+        negate = 1;
+        p->at++;
+    }
+    // A ] straight after the [ or [^ is a literal
+    int first = 1;
+    for(;;){
+        if(p->at == p->end){
+            syntaxError(p, "Missing ]");
+        }
+        if(*p->at == ']' && !first){
+            p->at++;
+            break;
+        }
+        first = 0;
+
+        uint32_t lo;
+        if(*p->at == '\\'){
+            p->at++;
+            if(p->at < p->end && isClassEscape(*p->at)){
+                addClassEscape(&p->sets[set], *p->at++);
+                continue;
+            }
+            lo = parseEscape(p);
+        }else{
+            lo = decode(&p->at);
+        }
+
+        uint32_t hi = lo;
+        if(p->end - p->at >= 2 && p->at[0] == '-' && p->at[1] != ']'){
+            p->at++;
+            if(*p->at == '\\'){
+                p->at++;
+                if(p->at < p->end && isClassEscape(*p->at)){
+                    syntaxError(p, "Class escape used as a range bound");
+                }
+                hi = parseEscape(p);
+            }else{
+                hi = decode(&p->at);
+            }
+            if(hi < lo){
+                syntaxError(p, "Range out of order");
+            }
+        }
+        addRange(&p->sets[set], lo, hi);
+    }
+    if(negate){
+        negateSet(&p->sets[set]);
+    }
+    return setNode(p, set);
+}
+
+static int parseAlternation(Parser* p);
+
+static int parseAtom(Parser* p){
+    switch(*p->at){
+        case '(': {
+            p->at++;
+            if(p->end - p->at >= 2 && p->at[0] == '?' && p->at[1] == ':'){
+                p->at += 2;
+            }
+            if(++p->depth > MAX_DEPTH){
+                syntaxError(p, "Groups nested too deeply");
+            }
+            int inner = parseAlternation(p);
+            p->depth--;
+            if(p->at == p->end || *p->at != ')'){
+                syntaxError(p, "Missing )");
+            }
+            p->at++;
+            return inner;
+        }
+        case '[':
+            p->at++;
+            return parseClass(p);
+        case '.': {
+            p->at++;
+            int set = newSet(p);
+            addRange(&p->sets[set], 0, '\n' - 1);
+            addRange(&p->sets[set], '\n' + 1, MAX_CODE_POINT);
+            return setNode(p, set);
+        }
+        case '^':
+            p->at++;
+            return newNode(p, AST_BEGIN);
+        case '$':
+            p->at++;
+            return newNode(p, AST_END);
+        case '\\':
+            p->at++;
+            if(p->at < p->end && isClassEscape(*p->at)){
+                int set = newSet(p);
+                addClassEscape(&p->sets[set], *p->at++);
+                return setNode(p, set);
+            }
+            return literalNode(p, parseEscape(p));
+        case '*':
+        case '+':
+        case '?':
+            syntaxError(p, "Nothing to repeat");
+        default:
+            return literalNode(p, decode(&p->at));
+    }
+}
+
+static int parseNumber(const unsigned char** at, const unsigned char* end, int* value){
+    const unsigned char* s = *at;
+    long n = 0;
+    while(s < end && *s >= '0' && *s <= '9'){
+        if(n <= MAX_REPEAT) n = n * 10 + (*s - '0');
+        s++;
+    }
+    if(s == *at){
+        return 0;
+    }
+    *at = s;
+    *value = n > MAX_REPEAT ? MAX_REPEAT + 1 : (int)n;
+    return 1;
+}
+
+/**
+ * @brief Read {n}, {n,} or {n,m} at p->at
+ * @return 0, leaving p->at alone, if it is not one (the { is then a literal)
+ */
+static int parseCount(Parser* p, int* min, int* max){
+    const unsigned char* s = p->at + 1;
+    if(!parseNumber(&s, p->end, min)){
+        return 0;
+    }
+    *max = *min;
+    if(s < p->end && *s == ','){
+        s++;
+        *max = -1;
+        parseNumber(&s, p->end, max);
+    }
+    if(s == p->end || *s != '}'){
+        return 0;
+    }
+    if(*min > MAX_REPEAT || *max > MAX_REPEAT){
+        syntaxError(p, "Repeat count too large");
+    }
+    if(*max >= 0 && *max < *min){
+        syntaxError(p, "Repeat counts out of order");
+    }
+    p->at = s + 1;
+    return 1;
+}
+
+static int parseRepeat(Parser* p){
+    int atom = parseAtom(p);
+    int stacked = 0;
+    while(p->at < p->end){
+        int min, max;
+        if(*p->at == '*'){
+            min = 0;
+            max = -1;
+            p->at++;
+        }else if(*p->at == '+'){
+            min = 1;
+            max = -1;
+            p->at++;
+        }else if(*p->at == '?'){
+            min = 0;
+            max = 1;
+            p->at++;
+        }else if(*p->at != '{' || !parseCount(p, &min, &max)){
+            break;
+        }
+        if(++stacked > MAX_DEPTH){
+            syntaxError(p, "Too many repeats in a row");
+        }
+        int greedy = 1;
+        if(p->at < p->end && *p->at == '?'){
+            greedy = 0;
+            p->at++;
+        }
+        int node = newNode(p, AST_REPEAT);
+        Ast* repeat = &p->nodes[node];
+        repeat->child = atom;
+        repeat->min = min;
+        repeat->max = max;
+        repeat->greedy = greedy;
+        atom = node;
+    }
+    return atom;
+}
+
+static int parseConcat(Parser* p){
+    int node = newNode(p, AST_CONCAT);
+    int last = -1;
+    while(p->at < p->end && *p->at != '|' && *p->at != ')'){
+        int item = parseRepeat(p);
+        if(last < 0){
+            p->nodes[node].child = item;
+        }else{
+            p->nodes[last].next = item;
+        }
+        last = item;
+    }
+    return node;
+}
+
+static int parseAlternation(Parser* p){
+    int first = parseConcat(p);
+    if(p->at == p->end || *p->at != '|'){
+        return first;
+    }
+    int node = newNode(p, AST_ALT);
+    p->nodes[node].child = first;
+    int last = first;
+    while(p->at < p->end && *p->at == '|'){
+        p->at++;
+        int item = parseConcat(p);
+        p->nodes[last].next = item;
+        last = item;
+    }
+    return node;
+}
+
+/* -------------------------------------------------------------- programs */
+
+typedef enum {
+    INST_SET,       // read a code point in `set`
+    INST_SPLIT,     // go to both `out` and `out1`, preferring `out`
+    INST_JMP,
+    INST_MATCH,
+    INST_BEGIN,     // only at the start of the text (the end, for the reversed program)
+    INST_END
+} InstOp;
+
+typedef struct {
+    InstOp op;
+    int set;
+    int out;
+    int out1;
+} Inst;
+
+typedef struct {
+    Inst* insts;
+    int count;
+    int capacity;
+} Program;
+
+static int emit(Program* program, InstOp op, int set){
+    if(program->count == MAX_PROGRAM){
+        fatalError(ERROR_SYNTAX, "Error: Regular expression too large\n");
+    }
+    if(program->count == program->capacity){
+        program->capacity = program->capacity ? program->capacity * 2 : 32;
+        program->insts = (Inst*)memRealloc(program->insts, program->capacity * sizeof(Inst));
+    }
+    program->insts[program->count] = (Inst){op, set, program->count + 1, -1};
+    return program->count++;
+}
+
+static void branch(Program* program, int split, int take, int skip, int greedy){
+    program->insts[split].out = greedy ? take : skip;
+    program->insts[split].out1 = greedy ? skip : take;
+}
+
+/**
+ * @brief Compile a syntax tree node, reversing concatenation and swapping
+ *        the anchors if `reversed`
+ */
+static void emitNode(const Parser* p, Program* program, int index, int reversed){
+    const Ast* node = &p->nodes[index];
+    switch(node->kind){
+        case AST_SET:
+            emit(program, INST_SET, node->set);
+            break;
+        case AST_BEGIN:
+            emit(program, reversed ? INST_END : INST_BEGIN, -1);
+            break;
+        case AST_END:
+            emit(program, reversed ? INST_BEGIN : INST_END, -1);
+            break;
+        case AST_CONCAT:
+            if(!reversed){
+                for(int c = node->child; c >= 0; c = p->nodes[c].next){
+                    emitNode(p, program, c, reversed);
+                }
+            }else{
+                int count = 0;
+                for(int c = node->child; c >= 0; c = p->nodes[c].next) count++;
+                int* children = (int*)memAlloc(sizeof(int) * (count ? count : 1));
+                count = 0;
+                for(int c = node->child; c >= 0; c = p->nodes[c].next) children[count++] = c;
+                while(count > 0){
+                    emitNode(p, program, children[--count], reversed);
+                }
+                memFree(children);
+            }
+            break;
+        case AST_ALT: {
+            // split L1 L2; L1: a; jmp end; L2: split ... ; last; end:
+            int count = 0;
+            for(int c = node->child; c >= 0; c = p->nodes[c].next) count++;
+            int* jumps = (int*)memAlloc(sizeof(int) * count);
+            int jumpCount = 0;
+            for(int c = node->child; c >= 0; c = p->nodes[c].next){
+                if(p->nodes[c].next < 0){
+                    emitNode(p, program, c, reversed);
+                    break;
+                }
+                int split = emit(program, INST_SPLIT, -1);
+                emitNode(p, program, c, reversed);
+                jumps[jumpCount++] = emit(program, INST_JMP, -1);
+                branch(program, split, split + 1, program->count, 1);
+            }
+            for(int i = 0; i < jumpCount; i++){
+                program->insts[jumps[i]].out = program->count;
+            }
+            memFree(jumps);
+            break;
+        }
+        case AST_REPEAT: {
+            int min = node->min, max = node->max;
+            int copies = max < 0 && min > 0 ? min - 1 : min;
+            for(int i = 0; i < copies; i++){
+                emitNode(p, program, node->child, reversed);
+            }
+            if(max < 0 && min > 0){
+                // The last required copy loops back on itself
+                int loop = program->count;
+                emitNode(p, program, node->child, reversed);
+                int split = emit(program, INST_SPLIT, -1);
+                branch(program, split, loop, split + 1, node->greedy);
+            }else if(max < 0){
+                int split = emit(program, INST_SPLIT, -1);
+                emitNode(p, program, node->child, reversed);
+                int jump = emit(program, INST_JMP, -1);
+                program->insts[jump].out = split;
+                branch(program, split, split + 1, program->count, node->greedy);
+            }else if(max > min){
+                // x{0,3} is (x(x(x)?)?)?: every optional copy can skip to the end
+                int* splits = (int*)memAlloc(sizeof(int) * (max - min));
+                for(int i = 0; i < max - min; i++){
+                    splits[i] = emit(program, INST_SPLIT, -1);
+                    emitNode(p, program, node->child, reversed);
+                }
+                for(int i = 0; i < max - min; i++){
+                    branch(program, splits[i], splits[i] + 1, program->count, node->greedy);
+                }
+                memFree(splits);
+            }
+            break;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------- DFA */
+
+/*
+ * A DFA state is the list of NFA instructions the search could be at, in
+ * priority order: those that read a code point, MATCH, and END waiting to
+ * see whether the text ends. Its transitions are filled in per code point
+ * class as they are first taken, and published with release stores so
+ * searches can follow them without the lock.
+ */
+typedef struct DState DState;
+struct DState {
+    DState* chain;          // next state in the same hash bucket
+    uint64_t hash;
+    int* insts;
+    int count;
+    unsigned char cached;
+    unsigned char match;    // a match ends here
+    unsigned char stop;     // a match ends here or nothing is left to match
+    signed char endMatch;   // -1 until known: a match ends here if the text does
+    DState* next[];         // per class; never filled in on a state that is not cached
+};
+
+typedef struct {
+    Program program;
+    // Carry on after a match in case a longer one follows, rather than
+    // dropping everything of lower priority than the match
+    int longest;
+    pthread_mutex_t lock;
+    DState** buckets;
+    size_t bucketCount;
+    size_t stateCount;
+    size_t bytes;
+    DState* start[2];       // away from and at the start of the text
+    // Working space for computing a state, used with the lock held
+    int* list;
+    int* stack;
+    unsigned* seen;
+    unsigned generation;
+} Dfa;
+
+/*
+ * States a single search made without caching them. Only the current one
+ * and the one being computed from it are live, so two are reused in turn.
+ */
+typedef struct {
+    DState* spare[2];
+    int turn;
+} Search;
+
+struct Regex {
+    String* pattern;
+    CharSet* sets;
+    int setCount;
+    // Code points split into classes that every set either fully contains
+    // or misses: class k is [bounds[k], bounds[k + 1])
+    uint32_t* bounds;
+    int classCount;
+    int asciiClass[128];
+    Dfa forward;    // leftmost-first, with a lazy loop in front so a match can start anywhere
+    Dfa reverse;    // the reversed pattern, anchored and longest-match
+    // Bytes every match starts with: a search still at the start state can
+    // skip straight to where they next occur
+    char prefix[MAX_PREFIX];
+    size_t prefixLength;
+};
+
+static int compareBounds(const void* a, const void* b){
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int classOf(const Regex* regex, uint32_t c){
+    int lo = 0, hi = regex->classCount - 1;
+    while(lo < hi){
+        int mid = (lo + hi + 1) / 2;
+        if(regex->bounds[mid] <= c){
+            lo = mid;
+        }else{
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static void buildClasses(Regex* regex){
+    size_t edges = 1;
+    for(int s = 0; s < regex->setCount; s++){
+        edges += 2 * (size_t)regex->sets[s].count;
+    }
+    uint32_t* bounds = (uint32_t*)memAlloc(edges * sizeof(uint32_t));
+    size_t n = 0;
+    bounds[n++] = 0;
+    for(int s = 0; s < regex->setCount; s++){
+        for(int i = 0; i < regex->sets[s].count; i++){
+            bounds[n++] = regex->sets[s].ranges[i].lo;
+            if(regex->sets[s].ranges[i].hi < MAX_CODE_POINT){
+                bounds[n++] = regex->sets[s].ranges[i].hi + 1;
+            }
+        }
+    }
+    qsort(bounds, n, sizeof(uint32_t), compareBounds);
+    size_t unique = 1;
+    for(size_t i = 1; i < n; i++){
+        if(bounds[i] != bounds[unique - 1]){
+            bounds[unique++] = bounds[i];
+        }
+    }
+    regex->bounds = bounds;
+    regex->classCount = (int)unique;
+    for(uint32_t c = 0; c < 128; c++){
+        regex->asciiClass[c] = classOf(regex, c);
+    }
+}
+
+static void dfaInit(Dfa* dfa, int longest){
+    int size = dfa->program.count;
+    dfa->longest = longest;
+    pthread_mutex_init(&dfa->lock, NULL);
+    dfa->bucketCount = 64;
+    dfa->buckets = (DState**)memCalloc(dfa->bucketCount, sizeof(DState*));
+    dfa->list = (int*)memAlloc(sizeof(int) * size);
+    dfa->stack = (int*)memAlloc(sizeof(int) * (2 * size + 1));
+    dfa->seen = (unsigned*)memCalloc(size, sizeof(unsigned));
+    dfa->generation = 0;
+}
+
+static void dfaFree(Dfa* dfa){
+    for(size_t b = 0; b < dfa->bucketCount; b++){
+        DState* state = dfa->buckets[b];
+        while(state != NULL){
+            DState* chain = state->chain;
+            memFree(state);
+            state = chain;
+        }
+    }
+    memFree(dfa->buckets);
+    memFree(dfa->list);
+    memFree(dfa->stack);
+    memFree(dfa->seen);
+    memFree(dfa->program.insts);
+    pthread_mutex_destroy(&dfa->lock);
+}
+
+static void newGeneration(Dfa* dfa){
+    if(++dfa->generation == 0){
+        memset(dfa->seen, 0, sizeof(unsigned) * dfa->program.count);
+        dfa->generation = 1;
+    }
+}
+
+/**
+ * @brief Append the threads reachable from `pc` without reading a code
+ *        point to the working list, in priority order
+ * @return 0 if a match cut off everything of lower priority
+ */
+static int addThreads(Dfa* dfa, int pc, int atBegin, int atEnd, int* count){
+    const Inst* insts = dfa->program.insts;
+    int top = 0;
+    dfa->stack[top++] = pc;
+    while(top > 0){
+        pc = dfa->stack[--top];
+        if(dfa->seen[pc] == dfa->generation){
+            continue;
+        }
+        dfa->seen[pc] = dfa->generation;
+        const Inst* inst = &insts[pc];
+        switch(inst->op){
+            case INST_JMP:
+                dfa->stack[top++] = inst->out;
+                break;
+            case INST_SPLIT:
+                dfa->stack[top++] = inst->out1;
+                dfa->stack[top++] = inst->out;
+                break;
+            case INST_BEGIN:
+                if(atBegin) dfa->stack[top++] = inst->out;
+                break;
+            case INST_END:
+                if(atEnd){
+                    dfa->stack[top++] = inst->out;
+                }else{
+                    dfa->list[(*count)++] = pc;
+                }
+                break;
+            case INST_SET:
+                dfa->list[(*count)++] = pc;
+                break;
+            case INST_MATCH:
+                dfa->list[(*count)++] = pc;
+                if(!dfa->longest){
+                    return 0;
+                }
+                break;
+        }
+    }
+    return 1;
+}
+
+static uint64_t hashList(const int* list, int count){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < count; i++){
+        h = (h ^ (uint32_t)list[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void fillState(Dfa* dfa, DState* state, int count, uint64_t hash){
+    state->chain = NULL;
+    state->hash = hash;
+    state->count = count;
+    state->match = 0;
+    state->endMatch = -1;
+    memcpy(state->insts, dfa->list, sizeof(int) * count);
+    for(int i = 0; i < count; i++){
+        if(dfa->program.insts[dfa->list[i]].op == INST_MATCH){
+            state->match = 1;
+        }
+    }
+    state->stop = state->match || count == 0;
+}
+
+static void growBuckets(Dfa* dfa){
+    size_t bucketCount = dfa->bucketCount * 2;
+    DState** buckets = (DState**)memCalloc(bucketCount, sizeof(DState*));
+    for(size_t b = 0; b < dfa->bucketCount; b++){
+        DState* state = dfa->buckets[b];
+        while(state != NULL){
+            DState* chain = state->chain;
+            state->chain = buckets[state->hash & (bucketCount - 1)];
+            buckets[state->hash & (bucketCount - 1)] = state;
+            state = chain;
+        }
+    }
+    memFree(dfa->buckets);
+    dfa->buckets = buckets;
+    dfa->bucketCount = bucketCount;
+}
+
+/**
+ * @brief The state for the working list: an existing one, a new cached
+ *        one, or while the cache is full, one of the search's spares
+ */
+static DState* intern(Dfa* dfa, int count, int classCount, Search* search){
+    uint64_t hash = hashList(dfa->list, count);
+    DState** bucket = &dfa->buckets[hash & (dfa->bucketCount - 1)];
+    for(DState* state = *bucket; state != NULL; state = state->chain){
+        if(state->hash == hash && state->count == count && memcmp(state->insts, dfa->list, sizeof(int) * count) == 0){
+            return state;
+        }
+    }
+
+    size_t size = sizeof(DState) + sizeof(DState*) * classCount + sizeof(int) * count;
+    if(dfa->bytes + size > CACHE_BYTES){
+        DState** spare = &search->spare[search->turn];
+        search->turn ^= 1;
+        if(*spare == NULL){
+            *spare = (DState*)memCalloc(1, sizeof(DState) + sizeof(DState*) * classCount + sizeof(int) * dfa->program.count);
+            if(*spare == NULL){
+                return NULL;
+            }
+            (*spare)->insts = (int*)((*spare)->next + classCount);
+        }
+        fillState(dfa, *spare, count, hash);
+        return *spare;
+    }
+
+    // Cached states belong to the regex, which outlives the arena in use
+    AllocArena* arena = allocArenaUse(NULL);
+    DState* state = (DState*)memCalloc(1, size);
+    if(state == NULL){
+        allocArenaUse(arena);
+        return NULL;
+    }
+    state->cached = 1;
+    state->insts = (int*)(state->next + classCount);
+    fillState(dfa, state, count, hash);
+    state->chain = *bucket;
+    *bucket = state;
+    dfa->bytes += size;
+    if(++dfa->stateCount > dfa->bucketCount){
+        growBuckets(dfa);
+    }
+    allocArenaUse(arena);
+    return state;
+}
+
+static void outOfMemory(Dfa* dfa){
+    pthread_mutex_unlock(&dfa->lock);
+    fatalError(ERROR_RESOURCE, "Error: Out of memory matching a regular expression\n");
+}
+
+static DState* startState(Dfa* dfa, int classCount, int atBegin, Search* search){
+    DState* state = __atomic_load_n(&dfa->start[atBegin], __ATOMIC_ACQUIRE);
+    if(state != NULL){
+        return state;
+    }
+    pthread_mutex_lock(&dfa->lock);
+    newGeneration(dfa);
+    int count = 0;
+    addThreads(dfa, 0, atBegin, 0, &count);
+    state = intern(dfa, count, classCount, search);
+    if(state == NULL){
+        outOfMemory(dfa);
+    }
+    if(state->cached){
+        __atomic_store_n(&dfa->start[atBegin], state, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&dfa->lock);
+    return state;
+}
+
+static DState* computeStep(const Regex* regex, Dfa* dfa, DState* from, int cls, Search* search){
+    pthread_mutex_lock(&dfa->lock);
+    newGeneration(dfa);
+    uint32_t c = regex->bounds[cls];
+    int count = 0;
+    for(int i = 0; i < from->count; i++){
+        const Inst* inst = &dfa->program.insts[from->insts[i]];
+        if(inst->op == INST_SET && setContains(&regex->sets[inst->set], c)){
+            if(!addThreads(dfa, inst->out, 0, 0, &count)){
+                break;
+            }
+        }
+    }
+    DState* next = intern(dfa, count, regex->classCount, search);
+    if(next == NULL){
+        outOfMemory(dfa);
+    }
+    if(from->cached && next->cached){
+        __atomic_store_n(&from->next[cls], next, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&dfa->lock);
+    return next;
+}
+
+static inline DState* step(const Regex* regex, Dfa* dfa, DState* from, int cls, Search* search){
+    DState* next = __atomic_load_n(&from->next[cls], __ATOMIC_ACQUIRE);
+    return next != NULL ? next : computeStep(regex, dfa, from, cls, search);
+}
+
+/**
+ * @brief Whether a match ends at a state if the text ends there too
+ */
+static int matchesAtEnd(Dfa* dfa, DState* state){
+    signed char known = __atomic_load_n(&state->endMatch, __ATOMIC_RELAXED);
+    if(known >= 0){
+        return known;
+    }
+    pthread_mutex_lock(&dfa->lock);
+    newGeneration(dfa);
+    int found = state->match;
+    for(int i = 0; i < state->count && !found; i++){
+        const Inst* inst = &dfa->program.insts[state->insts[i]];
+        if(inst->op != INST_END){
+            continue;
+        }
+        int count = 0;
+        addThreads(dfa, inst->out, 0, 1, &count);
+        for(int j = 0; j < count; j++){
+            if(dfa->program.insts[dfa->list[j]].op == INST_MATCH){
+                found = 1;
+            }
+        }
+    }
+    __atomic_store_n(&state->endMatch, (signed char)found, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&dfa->lock);
+    return found;
+}
+
+static void searchDone(Search* search){
+    memFree(search->spare[0]);
+    memFree(search->spare[1]);
+}
+
+/**
+ * @brief The class of the code point at `p`, and its width in bytes
+ */
+static inline int classAt(const Regex* regex, const unsigned char* p, size_t* width){
+    if(*p < 0x80){
+        *width = 1;
+        return regex->asciiClass[*p];
+    }
+    const unsigned char* next = p;
+    uint32_t c = decode(&next);
+    *width = (size_t)(next - p);
+    return classOf(regex, c);
+}
+
+/**
+ * @brief The class of the code point ending at `p`, and its width in bytes
+ */
+static inline int classBefore(const Regex* regex, const unsigned char* p, size_t* width){
+    if(p[-1] < 0x80){
+        *width = 1;
+        return regex->asciiClass[p[-1]];
+    }
+    const unsigned char* lead = p - 1;
+    while((*lead & 0xC0) == 0x80){
+        lead--;
+    }
+    *width = (size_t)(p - lead);
+    return classOf(regex, decode(&lead));
+}
+
+/**
+ * @brief Run the forward DFA from byte `from`
+ * @param first Stop as soon as any match is known to end, instead of
+ *        finding where the preferred one does
+ * @return Whether there is a match, with its end in *end
+ */
+static int scanForward(Regex* regex, const String* s, size_t from, int first, size_t* end){
+    Dfa* dfa = &regex->forward;
+    const unsigned char* bytes = (const unsigned char*)s->bytes;
+    Search search = {{NULL, NULL}, 0};
+    DState* state = startState(dfa, regex->classCount, from == 0, &search);
+    DState* restart = NULL;
+    if(regex->prefixLength > 0){
+        restart = startState(dfa, regex->classCount, 0, &search);
+        if(!restart->cached) restart = NULL;
+    }
+    int found = 0;
+    size_t i = from;
+    for(;;){
+        if(state->stop){
+            if(state->match){
+                found = 1;
+                *end = i;
+                if(first) break;
+            }
+            if(state->count == 0){
+                break;
+            }
+        }
+        if(i == s->length){
+            if(matchesAtEnd(dfa, state)){
+                found = 1;
+                *end = i;
+            }
+            break;
+        }
+        if(state == restart){
+            // Nothing is under way, and no match can start before the prefix
+            const char* next = stringSearch(s->bytes + i, s->length - i, regex->prefix, regex->prefixLength);
+            if(next == NULL){
+                break;
+            }
+            i = (size_t)(next - s->bytes);
+        }
+        size_t width;
+        int cls = classAt(regex, bytes + i, &width);
+        state = step(regex, dfa, state, cls, &search);
+        i += width;
+    }
+    searchDone(&search);
+    return found;
+}
+
+/**
+ * @brief Read back from the end of a match to where it starts, no earlier
+ *        than byte `from`
+ */
+static size_t scanBack(Regex* regex, const String* s, size_t from, size_t end){
+    Dfa* dfa = &regex->reverse;
+    const unsigned char* bytes = (const unsigned char*)s->bytes;
+    Search search = {{NULL, NULL}, 0};
+    DState* state = startState(dfa, regex->classCount, end == s->length, &search);
+    size_t start = end;
+    size_t i = end;
+    for(;;){
+        if(state->match){
+            start = i;
+        }
+        if(state->count == 0){
+            break;
+        }
+        if(i == from){
+            if(from == 0 && matchesAtEnd(dfa, state)){
+                start = i;
+            }
+            break;
+        }
+        size_t width;
+        int cls = classBefore(regex, bytes + i, &width);
+        state = step(regex, dfa, state, cls, &search);
+        i -= width;
+    }
+    searchDone(&search);
+    return start;
+}
+
+/**
+ * @brief The leftmost-first match at or after byte `from`
+ */
+static int regexSearch(Regex* regex, const String* s, size_t from, size_t* start, size_t* end){
+    if(!scanForward(regex, s, from, 0, end)){
+        return 0;
+    }
+    *start = scanBack(regex, s, from, *end);
+    return 1;
+}
+
+/* ------------------------------------------------------------- compiling */
+
+/**
+ * @brief Collect the single code points the forward program must read, in
+ *        order, from `pc` before it reaches anything else
+ */
+static void findPrefix(Regex* regex, int pc){
+    const Program* program = &regex->forward.program;
+    size_t length = 0;
+    for(;;){
+        const Inst* inst = &program->insts[pc];
+        if(inst->op == INST_JMP){
+            pc = inst->out;
+            continue;
+        }
+        if(inst->op != INST_SET){
+            break;
+        }
+        const CharSet* set = &regex->sets[inst->set];
+        if(set->count != 1 || set->ranges[0].lo != set->ranges[0].hi){
+            break;
+        }
+        uint32_t c = set->ranges[0].lo;
+        char bytes[4];
+        size_t width;
+        if(c < 0x80){
+            bytes[0] = (char)c;
+            width = 1;
+        }else if(c < 0x800){
+            bytes[0] = (char)(0xC0 | (c >> 6));
+            bytes[1] = (char)(0x80 | (c & 0x3F));
+            width = 2;
+        }else if(c < 0x10000){
+            bytes[0] = (char)(0xE0 | (c >> 12));
+            bytes[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+            bytes[2] = (char)(0x80 | (c & 0x3F));
+            width = 3;
+        }else{
+            bytes[0] = (char)(0xF0 | (c >> 18));
+            bytes[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+            bytes[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+            bytes[3] = (char)(0x80 | (c & 0x3F));
+            width = 4;
+        }
+        if(length + width > MAX_PREFIX){
+            break;
+        }
+        memcpy(regex->prefix + length, bytes, width);
+        length += width;
+        pc = inst->out;
+    }
+    regex->prefixLength = length;
+}
+
+/**
+ * @brief Compile a pattern; a malformed one is an ERROR_SYNTAX
+ */
+Regex* regexCompile(const String* pattern){
+    Parser p = {0};
+    p.start = p.at = (const unsigned char*)pattern->bytes;
+    p.end = p.start + pattern->length;
+    int root = parseAlternation(&p);
+    if(p.at != p.end){
+        syntaxError(&p, "Unmatched )");
+    }
+    int any = newSet(&p);
+    addRange(&p.sets[any], 0, MAX_CODE_POINT);
+
+    Regex* regex = (Regex*)memCalloc(1, sizeof(Regex));
+    regex->pattern = stringCopy(pattern->bytes, pattern->length);
+    regex->sets = p.sets;
+    regex->setCount = p.setCount;
+    buildClasses(regex);
+
+    // 0: split 2 1; 1: any, jmp 0; 2: the pattern, tried first at every position
+    Program* forward = &regex->forward.program;
+    int loop = emit(forward, INST_SPLIT, -1);
+    int skip = emit(forward, INST_SET, any);
+    forward->insts[skip].out = loop;
+    branch(forward, loop, forward->count, skip, 1);
+    emitNode(&p, forward, root, 0);
+    emit(forward, INST_MATCH, -1);
+
+    Program* reverse = &regex->reverse.program;
+    emitNode(&p, reverse, root, 1);
+    emit(reverse, INST_MATCH, -1);
+
+    dfaInit(&regex->forward, 0);
+    dfaInit(&regex->reverse, 1);
+    findPrefix(regex, loop + 2);
+    memFree(p.nodes);
+    return regex;
+}
+
+void regexFree(Regex* regex){
+    if(regex == NULL){
+        return;
+    }
+    dfaFree(&regex->forward);
+    dfaFree(&regex->reverse);
+    for(int s = 0; s < regex->setCount; s++){
+        memFree(regex->sets[s].ranges);
+    }
+    memFree(regex->sets);
+    memFree(regex->bounds);
+    stringFree(regex->pattern);
+    memFree(regex);
+}
+
+static pthread_mutex_t patternLock = PTHREAD_MUTEX_INITIALIZER;
+static Regex* patterns[PATTERN_CACHE];
+
+/**
+ * @brief The compiled form of a pattern that is not a literal
+ *
+ * Patterns are kept by content in a small table, first come first served.
+ * One whose slot is taken by another pattern is compiled for this call
+ * alone, and *temporary tells the caller to free it.
+ */
+static Regex* lookupPattern(const String* pattern, int* temporary){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < pattern->length; i++){
+        hash = (hash ^ (unsigned char)pattern->bytes[i]) * 0x100000001b3ULL;
+    }
+    Regex** slot = &patterns[hash % PATTERN_CACHE];
+
+    pthread_mutex_lock(&patternLock);
+    Regex* regex = *slot;
+    pthread_mutex_unlock(&patternLock);
+    if(regex != NULL && stringEqual(regex->pattern, pattern)){
+        return regex;
+    }
+
+    // The table is shared by every embedding context
+    AllocArena* arena = allocArenaUse(NULL);
+    regex = regexCompile(pattern);
+    allocArenaUse(arena);
+    pthread_mutex_lock(&patternLock);
+    if(*slot == NULL){
+        *slot = regex;
+    }else{
+        *temporary = 1;
+    }
+    pthread_mutex_unlock(&patternLock);
+    return regex;
+}
+
+/* -------------------------------------------------------------- builtins */
+
+static void expectArgs(enum operators op, int argc, int min, int max){
+    if(argc < min || argc > max){
+        fatalError(ERROR_ARITY, "Error: Wrong number of arguments for %s\n", getOperatorSymbol(op));
+    }
+}
+
+static String* expectString(enum operators op, Value value){
+    if(value.type != VAL_STRING){
+        fatalError(ERROR_TYPE, "Error: Expected STRING in %s\n", getOperatorSymbol(op));
+    }
+    return value.string;
+}
+
+/**
+ * @brief Replace every match, left to right; an empty match also moves the
+ *        search on by a code point
+ */
+static Value replaceAll(Regex* regex, String* s, const String* with){
+    size_t* spans = NULL;
+    size_t count = 0, capacity = 0;
+    size_t from = 0, start, end;
+    while(regexSearch(regex, s, from, &start, &end)){
+        if(count == capacity){
+            capacity = capacity ? capacity * 2 : 16;
+            spans = (size_t*)memRealloc(spans, capacity * 2 * sizeof(size_t));
+        }
+        spans[2 * count] = start;
+        spans[2 * count + 1] = end;
+        count++;
+        if(end > start){
+            from = end;
+        }else if(end < s->length){
+            size_t width;
+            classAt(regex, (const unsigned char*)s->bytes + end, &width);
+            from = end + width;
+        }else{
+            break;
+        }
+    }
+    if(count == 0){
+        return (Value){.type = VAL_STRING, .string = s};
+    }
+
+    size_t length = s->length + count * with->length;
+    for(size_t i = 0; i < count; i++){
+        length -= spans[2 * i + 1] - spans[2 * i];
+    }
+    String* result = stringAlloc(length);
+    char* out = result->data;
+    size_t copied = 0;
+    for(size_t i = 0; i < count; i++){
+        memcpy(out, s->bytes + copied, spans[2 * i] - copied);
+        out += spans[2 * i] - copied;
+        memcpy(out, with->bytes, with->length);
+        out += with->length;
+        copied = spans[2 * i + 1];
+    }
+    memcpy(out, s->bytes + copied, s->length - copied);
+    memFree(spans);
+    stringSeal(result, length);
+    return (Value){.type = VAL_STRING, .string = result};
+}
+
+/**
+ * @brief Evaluate a regex builtin on already-evaluated arguments
+ * @param op RE_MATCH, RE_FIND or RE_REPLACE
+ * @param regex The pattern compiled when the program was parsed, or NULL
+ *        to compile (or look up) the one in args[1]
+ * @param args The argument values
+ * @param argc The number of arguments
+ * @return The result
+ */
+Value evaluateRegexOp(enum operators op, Regex* regex, Value* args, int argc){
+    switch(op){
+        case RE_MATCH: expectArgs(op, argc, 2, 2); break;
+        case RE_FIND: expectArgs(op, argc, 2, 3); break;
+        case RE_REPLACE: expectArgs(op, argc, 3, 3); break;
+        default:
+            fatalError(ERROR_UNSUPPORTED, "Error: Unknown regex operator %s\n", getOperatorSymbol(op));
+    }
+    String* s = expectString(op, args[0]);
+    String* with = op == RE_REPLACE ? expectString(op, args[2]) : NULL;
+    int temporary = 0;
+    if(regex == NULL){
+        regex = lookupPattern(expectString(op, args[1]), &temporary);
+    }
+
+    Value result;
+    size_t start, end;
+    switch(op){
+        case RE_MATCH:
+            result = makeIntValue(scanForward(regex, s, 0, 1, &end));
+            break;
+        case RE_FIND:
+            if(regexSearch(regex, s, 0, &start, &end)){
+                result = (Value){.type = VAL_STRING, .string = stringSlice(s, start, end - start)};
+            }else{
+                result = argc == 3 ? args[2] : makeStringValue("");
+            }
+            break;
+        default:
+            result = replaceAll(regex, s, with);
+            break;
+    }
+    if(temporary){
+        regexFree(regex);
+    }
+    return result;
+}
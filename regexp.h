@@ -0,0 +1,37 @@
+#ifndef LISP_LITE_REGEXP_H
+#define LISP_LITE_REGEXP_H
+#include "library.h"
+
+/*
+ * Regular expressions for re-match, re-find and re-replace.
+ *
+ * A pattern is compiled to a Thompson NFA over code points, which is turned
+ * into a DFA a state at a time as the text needs it. States are cached on
+ * the compiled pattern and shared by every thread using it, so a pattern
+ * that is used again runs on table lookups alone. There is no backtracking:
+ * a search reads each byte of the text at most a fixed number of times.
+ * When a pattern's cache fills up, the rest of a search works out each
+ * state as it goes instead of growing the cache further.
+ *
+ * Matches are leftmost-first, as in Perl: the match that starts earliest
+ * wins, and among those, alternatives and greedy or lazy (`*?`) repeats
+ * are preferred in the usual order. The forward DFA finds where that match
+ * ends; a second DFA, for the reversed pattern, then reads back from there
+ * to find where it starts.
+ *
+ * Syntax: literals, `.` (anything but a newline), `[...]` and `[^...]`
+ * classes with ranges, `\d \w \s` and their negations `\D \W \S`, `\n \t
+ * \r \xHH`, `\` before punctuation, `^` and `$` at the start and end of the
+ * text, `(...)` and `(?:...)` groups, `|`, and `* + ? {n} {n,} {n,m}`,
+ * each optionally followed by `?` to make it lazy. Groups do not capture.
+ */
+
+typedef struct Regex Regex;
+
+Regex* regexCompile(const String* pattern);
+
+void regexFree(Regex* regex);
+
+Value evaluateRegexOp(enum operators op, Regex* regex, Value* args, int argc);
+
+#endif //LISP_LITE_REGEXP_H
@@ -0,0 +1,72 @@
+#include "runtime.h"
+#include "input.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Build a closure for a compiled lambda
+ * @param entry Calls the lambda's code with an argument array
+ * @param captured The values of its free variables, copied into the closure
+ */
+Value rtClosure(CompiledEntry entry, int paramCount, int captureCount, const Value* captured){
+    CompiledClosure* closure = (CompiledClosure*)memAlloc(sizeof(CompiledClosure) + sizeof(Value) * (size_t)captureCount);
+    closure->entry = entry;
+    closure->paramCount = paramCount;
+    if(captureCount > 0){
+        memcpy(closure->captured, captured, sizeof(Value) * (size_t)captureCount);
+    }
+    return (Value){.type = VAL_CLOSURE, .closure = (Closure*)closure};
+}
+
+/**
+ * @brief Call a function value whose target is not known at compile time
+ */
+Value rtCall(Value fn, const Value* args, int argc){
+    if(fn.type != VAL_CLOSURE){
+        fatalError(ERROR_TYPE, "Error: Attempt to call a non-function\n");
+    }
+    CompiledClosure* closure = (CompiledClosure*)fn.closure;
+    if(argc != closure->paramCount){
+        fatalError(ERROR_ARITY, "Error: Expected %d arguments, got %d\n", closure->paramCount, argc);
+    }
+    return closure->entry(closure->captured, args);
+}
+
+Value rtUnbound(const char* name){
+    fatalError(ERROR_UNBOUND, "Error: Variable %s not found\n", name);
+}
+
+Value rtInput(void){
+    outputFlush();
+    String* line = inputReadLine();
+    if(line == NULL){
+        fatalError(ERROR_IO, "Error: Could not read input\n");
+    }
+    return rtString(line);
+}
+
+Value rtReadAll(void){
+    outputFlush();
+    return rtString(inputReadAll());
+}
+
+Value rtReadN(Value count){
+    if(count.type != VAL_INT || count.intValue < 0){
+        fatalError(ERROR_RANGE, "Error: Expected a non-negative INT for READ_N\n");
+    }
+    outputFlush();
+    return rtString(inputReadN((size_t)count.intValue));
+}
+
+Value rtReadLines(Value fn){
+    outputFlush();
+    long long count = 0;
+    String* line;
+    while((line = inputReadLine()) != NULL){
+        Value arg = rtString(line);
+        rtCall(fn, &arg, 1);
+        count++;
+    }
+    return rtInt(count);
+}
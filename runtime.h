@@ -0,0 +1,117 @@
+#ifndef LISP_LITE_RUNTIME_H
+#define LISP_LITE_RUNTIME_H
+#include "library.h"
+#include "output.h"
+#include "bigint.h"
+#include <limits.h>
+
+/*
+ * Runtime for programs compiled with --emit-c. The generated C includes this
+ * header and links against liblisp_lite, which supplies printing, input,
+ * bignums, strings, vectors and maps exactly as the interpreter has them.
+ * The fast paths below are inline so the C compiler can drop their type
+ * checks wherever it can see the operand types.
+ *
+ * In a compiled program a VAL_CLOSURE points at a CompiledClosure rather
+ * than an interpreter Closure; the two never meet.
+ */
+
+typedef Value (*CompiledEntry)(const Value* captured, const Value* args);
+
+typedef struct {
+    CompiledEntry entry;
+    int paramCount;
+    Value captured[];
+} CompiledClosure;
+
+Value rtClosure(CompiledEntry entry, int paramCount, int captureCount, const Value* captured);
+
+Value rtCall(Value fn, const Value* args, int argc);
+
+static inline void rtCallable(Value fn){
+    if(fn.type != VAL_CLOSURE){
+        fatalError(ERROR_TYPE, "Error: Attempt to call a non-function\n");
+    }
+}
+
+_Noreturn Value rtUnbound(const char* name);
+
+Value rtInput(void);
+
+Value rtReadAll(void);
+
+Value rtReadN(Value count);
+
+Value rtReadLines(Value fn);
+
+static inline Value rtInt(long long value){
+    return (Value){.type = VAL_INT, .intValue = value};
+}
+
+static inline Value rtFloat(double value){
+    return (Value){.type = VAL_FLOAT, .floatValue = value};
+}
+
+static inline Value rtBig(BigInt* value){
+    return (Value){.type = VAL_BIGINT, .bigValue = value};
+}
+
+static inline Value rtString(String* value){
+    return (Value){.type = VAL_STRING, .string = value};
+}
+
+/**
+ * @brief Two-operand + - * or /, as the interpreter's fast path does it
+ */
+static inline Value rtArith(enum operators op, Value a, Value b){
+    if(a.type == VAL_INT && b.type == VAL_INT){
+        long long r;
+        switch(op){
+            case ADD:
+                if(!__builtin_add_overflow(a.intValue, b.intValue, &r)) return rtInt(r);
+                break;
+            case SUB:
+                if(!__builtin_sub_overflow(a.intValue, b.intValue, &r)) return rtInt(r);
+                break;
+            case MUL:
+                if(!__builtin_mul_overflow(a.intValue, b.intValue, &r)) return rtInt(r);
+                break;
+            default:
+                if(b.intValue == 0){
+                    fatalError(ERROR_RANGE, "Error: Division by zero\n");
+                }
+                if(b.intValue != -1 || a.intValue != LLONG_MIN) return rtInt(a.intValue / b.intValue);
+                break;
+        }
+    }
+    Value pair[2] = {a, b};
+    return applyBuiltin(op, pair, 2);
+}
+
+/**
+ * @brief Two-operand comparison, and or or
+ */
+static inline long long rtCompare(enum operators op, Value a, Value b){
+    if(a.type == VAL_INT && b.type == VAL_INT){
+        switch(op){
+            case GT: return a.intValue > b.intValue;
+            case LT: return a.intValue < b.intValue;
+            case GTE: return a.intValue >= b.intValue;
+            case LTE: return a.intValue <= b.intValue;
+            case EQ: return a.intValue == b.intValue;
+            case AND: return a.intValue && b.intValue;
+            default: return a.intValue || b.intValue;
+        }
+    }
+    Value pair[2] = {a, b};
+    return applyBuiltin(op, pair, 2).intValue;
+}
+
+static inline long long rtNot(Value value){
+    if(value.type != VAL_INT){
+        fatalError(ERROR_TYPE, "Error: Expected INT\n");
+    }
+    return !value.intValue;
+}
+
+#endif //LISP_LITE_RUNTIME_H
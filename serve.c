@@ -0,0 +1,410 @@
+#include "serve.h"
+#include "library.h"
+#include "lexer.h"
+#include "output.h"
+#include "input.h"
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include "protocol.h"
+#include "alloc.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Power of two
+#define CACHE_BUCKETS 1024
+
+typedef struct CachedProgram {
+    uint64_t hash;
+    char* text;     // as the client sent it, to confirm a hash match
+    uint32_t length;
+    Node* tree;
+    struct CachedProgram* next;
+} CachedProgram;
+
+/*
+ * Everything shared between handler threads, under one lock. Cached trees
+ * are never freed or changed once published, so handlers run them without
+ * holding it.
+ */
+static struct {
+    pthread_mutex_t lock;
+    CachedProgram* buckets[CACHE_BUCKETS];
+    int entries;
+    unsigned long long connections;
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned long long hits;
+    unsigned long long misses;
+    LatencyStats latency;
+    double started;
+} server = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+typedef struct {
+    int fd;
+    int broken;     // the client went away or broke protocol
+    EnvEntry* env;  // the running request's globals
+} Connection;
+
+static const char* boundPath = NULL;
+
+// FNV-1a
+static uint64_t hashText(const char* text, uint32_t length){
+    uint64_t hash = 14695981039346656037ULL;
+    for(uint32_t i = 0; i < length; i++){
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Call with the lock held
+static CachedProgram* findProgram(uint64_t hash, const char* text, uint32_t length){
+    CachedProgram* program = server.buckets[hash & (CACHE_BUCKETS - 1)];
+    for(; program != NULL; program = program->next){
+        if(program->hash == hash && program->length == length && memcmp(program->text, text, length) == 0){
+            return program;
+        }
+    }
+    return NULL;
+}
+
+static void freeProgram(CachedProgram* program){
+    freeTree(program->tree);
+    memFree(program->text);
+    memFree(program);
+}
+
+/**
+ * @brief Lex and parse a program
+ * @param error Receives the message on a syntax error
+ * @return The program, not yet in the cache, or NULL on a syntax error
+ */
+static CachedProgram* compileProgram(const char* text, uint32_t length, uint64_t hash, char* error){
+    CachedProgram* program = (CachedProgram*)memCalloc(1, sizeof(CachedProgram));
+    program->hash = hash;
+    program->length = length;
+    program->text = (char*)memAlloc((size_t)length + 1);
+    memcpy(program->text, text, length);
+    program->text[length] = '\0';
+
+    char* source = (char*)memAlloc((size_t)length + 1);
+    memcpy(source, text, length);
+    source[length] = '\0';
+    normalizeSource(source, length);
+
+    Token* volatile tokens = NULL;
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) != 0){
+        strcpy(error, trap.message);
+        freeTokens(tokens);
+        memFree(source);
+        memFree(program->text);
+        memFree(program);
+        return NULL;
+    }
+    tokens = lex(source);
+    program->tree = parse(tokens);
+    errorTrapPop(&trap);
+
+    freeTokens(tokens);
+    memFree(source);
+    return program;
+}
+
+static void sendOutput(void* user, const char* data, size_t length){
+    Connection* conn = (Connection*)user;
+    while(length > 0 && !conn->broken){
+        uint32_t part = length > FRAME_MAX_PAYLOAD ? FRAME_MAX_PAYLOAD : (uint32_t)length;
+        if(writeFrame(conn->fd, FRAME_OUTPUT, data, part) != 0){
+            // Keep running the request, dropping what it prints
+            conn->broken = 1;
+        }
+        data += part;
+        length -= part;
+    }
+}
+
+/**
+ * @brief Ask the client for stdin; the answer is an empty frame at its end
+ */
+static size_t receiveInput(void* user, char* buffer, size_t capacity){
+    Connection* conn = (Connection*)user;
+    if(conn->broken){
+        return 0;
+    }
+    uint32_t want = capacity > FRAME_MAX_PAYLOAD ? FRAME_MAX_PAYLOAD : (uint32_t)capacity;
+    unsigned char request[4] = {(unsigned char)(want >> 24), (unsigned char)(want >> 16),
+                                (unsigned char)(want >> 8), (unsigned char)want};
+    Frame frame;
+    if(writeFrame(conn->fd, FRAME_READ, request, 4) != 0 || readFrame(conn->fd, &frame) != 0){
+        conn->broken = 1;
+        return 0;
+    }
+    // Frames come from protocol.c, which the client shares, so they are the
+    // C library's blocks rather than memAlloc's
+    if(frame.kind != FRAME_INPUT || frame.length > want){
+        free(frame.payload);
+        conn->broken = 1;
+        return 0;
+    }
+    memcpy(buffer, frame.payload, frame.length);
+    free(frame.payload);
+    return frame.length;
+}
+
+/**
+ * @brief Evaluate a parsed program in a fresh environment, with this
+ *        connection as its stdout and stdin
+ * @return The exit status: 0, or 1 if it failed with `error` set
+ */
+static int runProgram(Connection* conn, Node* tree, char* error){
+    InputSource* input = inputSourceCreate(receiveInput, conn);
+    int status = 0;
+    // Whatever the request makes goes when it ends, cached tree or not
+    AllocArena* arena = allocArenaCreate();
+    if(arena == NULL){
+        fatalError(ERROR_RESOURCE, "Error: Out of memory starting a request\n");
+    }
+
+    resetEvaluator();
+    allocArenaUse(arena);
+    outputRedirect(sendOutput, conn);
+    inputUse(input);
+
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) == 0){
+        evaluateTree(tree, &conn->env);
+        errorTrapPop(&trap);
+    }else{
+        strcpy(error, trap.message);
+        resetEvaluator();
+        status = 1;
+    }
+
+    // What was printed before an error still reaches the client
+    outputFlush();
+    outputRedirect(NULL, NULL);
+    inputUse(NULL);
+    inputSourceFree(input);
+    env_free(conn->env);
+    conn->env = NULL;
+    allocArenaUse(NULL);
+    allocArenaFree(arena);
+    return status;
+}
+
+static void finishRequest(Connection* conn, int status, const char* error){
+    if(error[0] != '\0'){
+        writeFrame(conn->fd, FRAME_ERROR, error, (uint32_t)strlen(error));
+    }
+    unsigned char code = (unsigned char)status;
+    if(writeFrame(conn->fd, FRAME_EXIT, &code, 1) != 0){
+        conn->broken = 1;
+    }
+}
+
+static void handleRun(Connection* conn, const char* text, uint32_t length){
+    double started = nowSeconds();
+    uint64_t hash = hashText(text, length);
+    char error[ERROR_MESSAGE_SIZE] = "";
+
+    pthread_mutex_lock(&server.lock);
+    CachedProgram* program = findProgram(hash, text, length);
+    if(program != NULL){
+        server.hits++;
+    }else{
+        server.misses++;
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    // Set when the program could not be cached and is ours to free
+    CachedProgram* uncached = NULL;
+    if(program == NULL){
+        program = compileProgram(text, length, hash, error);
+        if(program != NULL){
+            pthread_mutex_lock(&server.lock);
+            CachedProgram* existing = findProgram(hash, text, length);
+            if(existing != NULL){
+                // Another handler parsed it meanwhile
+                freeProgram(program);
+                program = existing;
+            }else if(server.entries < SERVE_CACHE_ENTRIES){
+                CachedProgram** bucket = &server.buckets[hash & (CACHE_BUCKETS - 1)];
+                program->next = *bucket;
+                *bucket = program;
+                server.entries++;
+            }else{
+                uncached = program;
+            }
+            pthread_mutex_unlock(&server.lock);
+        }
+    }
+
+    int status = program != NULL ? runProgram(conn, program->tree, error) : 1;
+    if(uncached != NULL){
+        freeProgram(uncached);
+    }
+    finishRequest(conn, status, error);
+
+    pthread_mutex_lock(&server.lock);
+    server.requests++;
+    if(status != 0){
+        server.errors++;
+    }
+    recordLatency(&server.latency, nowSeconds() - started);
+    pthread_mutex_unlock(&server.lock);
+}
+
+static void handleStats(Connection* conn){
+    char text[1024];
+    int used = 0;
+
+    pthread_mutex_lock(&server.lock);
+    unsigned long long lookups = server.hits + server.misses;
+    used += snprintf(text + used, sizeof(text) - (size_t)used,
+                     "uptime:       %.0f s\n"
+                     "connections:  %llu\n"
+                     "requests:     %llu\n"
+                     "errors:       %llu\n"
+                     "cache hits:   %llu\n"
+                     "cache misses: %llu\n"
+                     "hit rate:     %.1f%%\n"
+                     "cached:       %d programs\n",
+                     nowSeconds() - server.started, server.connections, server.requests, server.errors,
+                     server.hits, server.misses,
+                     lookups > 0 ? 100.0 * (double)server.hits / (double)lookups : 0.0,
+                     server.entries);
+    const LatencyStats* stats = &server.latency;
+    if(stats->count > 0){
+        used += snprintf(text + used, sizeof(text) - (size_t)used,
+                         "latency mean: %.0f ns\n"
+                         "latency p50:  %llu ns\n"
+                         "latency p90:  %llu ns\n"
+                         "latency p99:  %llu ns\n"
+                         "latency max:  %llu ns\n",
+                         stats->totalSeconds * 1e9 / (double)stats->count,
+                         latencyPercentile(stats, 0.50), latencyPercentile(stats, 0.90),
+                         latencyPercentile(stats, 0.99), stats->maxNs);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    if(writeFrame(conn->fd, FRAME_OUTPUT, text, (uint32_t)used) != 0){
+        conn->broken = 1;
+        return;
+    }
+    finishRequest(conn, 0, "");
+}
+
+static void serveConnection(int fd){
+    Connection conn = {fd, 0, NULL};
+    Frame frame;
+    while(!conn.broken && readFrame(fd, &frame) == 0){
+        if(frame.kind == FRAME_RUN){
+            handleRun(&conn, frame.payload != NULL ? frame.payload : "", frame.length);
+        }else if(frame.kind == FRAME_STATS){
+            handleStats(&conn);
+        }else{
+            conn.broken = 1;
+        }
+        free(frame.payload);
+    }
+}
+
+static void* handlerMain(void* arg){
+    int listener = (int)(intptr_t)arg;
+    // Requests read stdin through their connection only
+    inputDeny();
+    for(;;){
+        int fd = accept(listener, NULL, NULL);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE){
+                continue;
+            }
+            fatalError(ERROR_IO, "Error: Could not accept a connection: %s\n", strerror(errno));
+        }
+        pthread_mutex_lock(&server.lock);
+        server.connections++;
+        pthread_mutex_unlock(&server.lock);
+
+        serveConnection(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void stopServer(int sig){
+    (void)sig;
+    unlink(boundPath);
+    _exit(0);
+}
+#endif
+
+/**
+ * @brief Listen on `socketPath` and serve requests until killed
+ * @return An exit status, only on failing to start
+ */
+int runServer(const char* socketPath, const ServeOptions* options){
+#ifdef _WIN32
+    fprintf(stderr, "Error: --serve needs Unix domain sockets\n");
+    return 1;
+#else
+    // Requests run in arenas, and main has allocated nothing yet
+    allocHeadersEnable();
+
+    struct sockaddr_un address;
+    if(strlen(socketPath) >= sizeof(address.sun_path)){
+        fprintf(stderr, "Error: Socket path %s is too long\n", socketPath);
+        return 1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    // Replace a socket left by an earlier run, but nothing else
+    struct stat existing;
+    if(lstat(socketPath, &existing) == 0){
+        if(!S_ISSOCK(existing.st_mode)){
+            fprintf(stderr, "Error: %s exists and is not a socket\n", socketPath);
+            return 1;
+        }
+        unlink(socketPath);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0
+       || listen(listener, 128) != 0){
+        fprintf(stderr, "Error: Could not listen on %s: %s\n", socketPath, strerror(errno));
+        return 1;
+    }
+
+    boundPath = socketPath;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    server.started = nowSeconds();
+    fprintf(stderr, "Serving on %s with %d handler%s\n", socketPath, options->jobs, options->jobs == 1 ? "" : "s");
+
+    // Every handler accepts on the shared socket; this thread is one of them
+    for(int i = 1; i < options->jobs; i++){
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, handlerMain, (void*)(intptr_t)listener) != 0){
+            fatalError(ERROR_RESOURCE, "Error: Could not start handler thread\n");
+        }
+        pthread_detach(thread);
+    }
+    handlerMain((void*)(intptr_t)listener);
+    return 0;
+#endif
+}
@@ -0,0 +1,22 @@
+#ifndef LISP_LITE_SERVE_H
+#define LISP_LITE_SERVE_H
+
+/*
+ * --serve: a resident interpreter listening on a Unix socket, so short
+ * scripts skip process startup and, when they have been seen before, lexing
+ * and parsing too. Parsed programs are cached by a hash of their text and
+ * shared read-only by the handler threads; every request still runs in a
+ * fresh environment and allocates in its own arena (alloc.h), freed when it
+ * ends. See protocol.h for the wire format.
+ */
+
+// Programs kept parsed; past this, new programs are parsed per request
+#define SERVE_CACHE_ENTRIES 1024
+
+typedef struct {
+    int jobs;   // connections handled at once
+} ServeOptions;
+
+int runServer(const char* socketPath, const ServeOptions* options);
+
+#endif //LISP_LITE_SERVE_H
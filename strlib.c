@@ -0,0 +1,562 @@
+#include "strlib.h"
+#include "vector.h"
+#include "list.h"
+#include "alloc.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define STRLIB_X86 1
+#include <immintrin.h>
+#endif
+
+// False candidates the filter may check before handing over to Two-Way,
+// plus one for every 16 bytes it has scanned
+#define FILTER_SLACK 64
+
+typedef struct {
+    const char* (*search)(const char* haystack, size_t n, const char* needle, size_t m);
+    void (*asciiCase)(char* out, const char* in, size_t n, int upper);
+} StringKernels;
+
+static StringKernels kernels;
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+/* --------------------------------------------------------------- Two-Way */
+
+/**
+ * @brief Start of the needle's maximal suffix (-1 for all of it) and its period
+ * @param reversed Use the reversed alphabet order
+ */
+static ptrdiff_t maximalSuffix(const unsigned char* x, ptrdiff_t m, ptrdiff_t* period, int reversed){
+    ptrdiff_t ms = -1, j = 0, k = 1, p = 1;
+    while(j + k < m){
+        unsigned char a = x[j + k];
+        unsigned char b = x[ms + k];
+        if(reversed ? a > b : a < b){
+            j += k;
+            k = 1;
+            p = j - ms;
+        }else if(a == b){
+            if(k != p){
+                k++;
+            }else{
+                j += p;
+                k = 1;
+            }
+        }else{
+            ms = j;
+            j = ms + 1;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ms;
+}
+
+/**
+ * @brief First occurrence of the needle, in O(n + m) time and O(1) space
+ *
+ * The needle is split at a critical factorization; the right part is
+ * matched left to right and the left part right to left, and a mismatch
+ * shifts by the right part's progress or by the period.
+ */
+static const char* searchTwoWay(const char* haystack, size_t n, const char* needle, size_t m){
+    const unsigned char* y = (const unsigned char*)haystack;
+    const unsigned char* x = (const unsigned char*)needle;
+    ptrdiff_t length = (ptrdiff_t)m, end = (ptrdiff_t)n - length;
+    if(end < 0){
+        return NULL;
+    }
+
+    ptrdiff_t p, q;
+    ptrdiff_t i = maximalSuffix(x, length, &p, 0);
+    ptrdiff_t j = maximalSuffix(x, length, &q, 1);
+    ptrdiff_t ell = i > j ? i : j;
+    ptrdiff_t period = i > j ? p : q;
+
+    if(memcmp(x, x + period, (size_t)(ell + 1)) == 0){
+        // Periodic needle: after a match or a shift by the period, the
+        // first `memory` bytes are already known to match
+        ptrdiff_t memory = -1;
+        for(ptrdiff_t at = 0; at <= end;){
+            ptrdiff_t k = (ell > memory ? ell : memory) + 1;
+            while(k < length && x[k] == y[at + k]) k++;
+            if(k < length){
+                at += k - ell;
+                memory = -1;
+                continue;
+            }
+            k = ell;
+            while(k > memory && x[k] == y[at + k]) k--;
+            if(k <= memory){
+                return haystack + at;
+            }
+            at += period;
+            memory = length - period - 1;
+        }
+        return NULL;
+    }
+
+    period = (ell + 1 > length - ell - 1 ? ell + 1 : length - ell - 1) + 1;
+    for(ptrdiff_t at = 0; at <= end;){
+        ptrdiff_t k = ell + 1;
+        while(k < length && x[k] == y[at + k]) k++;
+        if(k < length){
+            at += k - ell;
+            continue;
+        }
+        k = ell;
+        while(k >= 0 && x[k] == y[at + k]) k--;
+        if(k < 0){
+            return haystack + at;
+        }
+        at += period;
+    }
+    return NULL;
+}
+
+/* ---------------------------------------------------------------- scalar */
+
+static void scalarCase(char* out, const char* in, size_t n, int upper){
+    for(size_t i = 0; i < n; i++){
+        char c = in[i];
+        int letter = upper ? (c >= 'a' && c <= 'z') : (c >= 'A' && c <= 'Z');
+        out[i] = letter ? (char)(c ^ 0x20) : c;
+    }
+}
+
+#ifdef STRLIB_X86
+
+/* ------------------------------------------------------------------ SSE2 */
+
+static const char* sse2Search(const char* haystack, size_t n, const char* needle, size_t m){
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t checks = 0;
+    size_t i = 0;
+    for(; i + m - 1 + 16 <= n; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(haystack + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(haystack + i + m - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        for(; mask != 0; mask &= mask - 1){
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if(memcmp(haystack + at + 1, needle + 1, m - 2) == 0){
+                return haystack + at;
+            }
+            checks++;
+        }
+        if(checks > FILTER_SLACK + i / 16){
+            i += 16;
+            break;
+        }
+    }
+    return searchTwoWay(haystack + i, n - i, needle, m);
+}
+
+static void sse2Case(char* out, const char* in, size_t n, int upper){
+    // Bytes above 0x7F are negative, so they never fall in the range
+    const __m128i below = _mm_set1_epi8(upper ? 'a' - 1 : 'A' - 1);
+    const __m128i above = _mm_set1_epi8(upper ? 'z' + 1 : 'Z' + 1);
+    const __m128i flip = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(x, below), _mm_cmplt_epi8(x, above));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(x, _mm_and_si128(letter, flip)));
+    }
+    scalarCase(out + i, in + i, n - i, upper);
+}
+
+/* ------------------------------------------------------------------ AVX2 */
+
+__attribute__((target("avx2")))
+static const char* avx2Search(const char* haystack, size_t n, const char* needle, size_t m){
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t checks = 0;
+    size_t i = 0;
+    for(; i + m - 1 + 32 <= n; i += 32){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(haystack + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(haystack + i + m - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                         _mm256_cmpeq_epi8(b, last)));
+        for(; mask != 0; mask &= mask - 1){
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if(memcmp(haystack + at + 1, needle + 1, m - 2) == 0){
+                return haystack + at;
+            }
+            checks++;
+        }
+        if(checks > FILTER_SLACK + i / 16){
+            i += 32;
+            break;
+        }
+    }
+    return searchTwoWay(haystack + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+static void avx2Case(char* out, const char* in, size_t n, int upper){
+    const __m256i below = _mm256_set1_epi8(upper ? 'a' - 1 : 'A' - 1);
+    const __m256i above = _mm256_set1_epi8(upper ? 'z' + 1 : 'Z' + 1);
+    const __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(x, below), _mm256_cmpgt_epi8(above, x));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(x, _mm256_and_si256(letter, flip)));
+    }
+    scalarCase(out + i, in + i, n - i, upper);
+}
+
+#endif // STRLIB_X86
+
+static void selectKernels(void){
+    kernels = (StringKernels){searchTwoWay, scalarCase};
+#ifdef STRLIB_X86
+    SimdLevel level = vectorSimdLevel();
+    if(level == SIMD_SSE2){
+        kernels = (StringKernels){sse2Search, sse2Case};
+    }else if(level == SIMD_AVX2){
+        kernels = (StringKernels){avx2Search, avx2Case};
+    }
+#endif
+}
+
+/**
+ * @brief First occurrence of `needle` in `haystack`, or NULL
+ */
+const char* stringSearch(const char* haystack, size_t length, const char* needle, size_t needleLength){
+    if(needleLength == 0){
+        return haystack;
+    }
+    if(needleLength > length){
+        return NULL;
+    }
+    if(needleLength == 1){
+        return (const char*)memchr(haystack, needle[0], length);
+    }
+    pthread_once(&kernelsOnce, selectKernels);
+    return kernels.search(haystack, length, needle, needleLength);
+}
+
+/* -------------------------------------------------------------- builtins */
+
+/*
+ * Growable list of byte offsets, so split and replace search the string
+ * once and then allocate their result at its exact size.
+ */
+typedef struct {
+    size_t* at;
+    size_t count;
+    size_t capacity;
+} Matches;
+
+static void addMatch(Matches* matches, size_t offset){
+    if(matches->count == matches->capacity){
+        matches->capacity = matches->capacity ? matches->capacity * 2 : 16;
+        matches->at = (size_t*)memRealloc(matches->at, matches->capacity * sizeof(size_t));
+    }
+    matches->at[matches->count++] = offset;
+}
+
+/**
+ * @brief Offsets of the non-overlapping occurrences of `needle`, left to right
+ */
+static Matches findAll(const String* s, const String* needle){
+    Matches matches = {NULL, 0, 0};
+    const char* end = s->bytes + s->length;
+    const char* from = s->bytes;
+    const char* found;
+    while((found = stringSearch(from, (size_t)(end - from), needle->bytes, needle->length)) != NULL){
+        addMatch(&matches, (size_t)(found - s->bytes));
+        from = found + needle->length;
+    }
+    return matches;
+}
+
+/**
+ * @brief The case partner of a code point in Latin-1, Greek or Cyrillic
+ *
+ * Every pair is encoded in two bytes, so mapping never changes a string's
+ * length. Letters outside these blocks are left as they are.
+ */
+static unsigned mapCase(unsigned c, int upper){
+    if(upper){
+        if((c >= 0xE0 && c <= 0xFE && c != 0xF7) || (c >= 0x3B1 && c <= 0x3C9 && c != 0x3C2) ||
+           (c >= 0x430 && c <= 0x44F)){
+            return c - 0x20;
+        }
+        if(c == 0x3C2){
+            return 0x3A3;   // final sigma
+        }
+        if(c >= 0x450 && c <= 0x45F){
+            return c - 0x50;
+        }
+    }else{
+        if((c >= 0xC0 && c <= 0xDE && c != 0xD7) || (c >= 0x391 && c <= 0x3A9 && c != 0x3A2) ||
+           (c >= 0x410 && c <= 0x42F)){
+            return c + 0x20;
+        }
+        if(c >= 0x400 && c <= 0x40F){
+            return c + 0x50;
+        }
+    }
+    return c;
+}
+
+static String* changeCase(const String* s, int upper){
+    String* result = stringAlloc(s->length);
+    char* out = result->data;
+    kernels.asciiCase(out, s->bytes, s->length, upper);
+    if(!s->ascii){
+        for(size_t i = 0; i + 1 < s->length; i++){
+            unsigned char lead = (unsigned char)out[i];
+            if(lead < 0xC2 || lead > 0xDF){
+                continue;
+            }
+            unsigned c = mapCase(((lead & 0x1Fu) << 6) | ((unsigned char)out[i + 1] & 0x3Fu), upper);
+            out[i] = (char)(0xC0 | (c >> 6));
+            out[i + 1] = (char)(0x80 | (c & 0x3F));
+            i++;
+        }
+    }
+    out[s->length] = '\0';
+    result->length = s->length;
+    result->codePoints = s->codePoints;
+    result->ascii = s->ascii;
+    return result;
+}
+
+static void expectArgs(enum operators op, int argc, int min, int max){
+    if(argc < min || argc > max){
+        fatalError(ERROR_ARITY, "Error: Wrong number of arguments for %s\n", getOperatorSymbol(op));
+    }
+}
+
+static String* expectString(enum operators op, Value value){
+    if(value.type != VAL_STRING){
+        fatalError(ERROR_TYPE, "Error: Expected STRING in %s\n", getOperatorSymbol(op));
+    }
+    return value.string;
+}
+
+/**
+ * @brief A code point position as a byte offset, checked against the string
+ */
+static size_t expectPosition(enum operators op, const String* s, Value value){
+    if(value.type != VAL_INT){
+        fatalError(ERROR_TYPE, "Error: Expected INT in %s\n", getOperatorSymbol(op));
+    }
+    if(value.intValue < 0 || (unsigned long long)value.intValue > s->codePoints){
+        fatalError(ERROR_RANGE, "Error: Position %lld out of range for string of length %zu in %s\n",
+                   value.intValue, s->codePoints, getOperatorSymbol(op));
+    }
+    size_t position = (size_t)value.intValue;
+    return s->ascii ? position : utf8Offset(s->bytes, s->length, position);
+}
+
+static Value stringValue(String* s){
+    return (Value){.type = VAL_STRING, .string = s};
+}
+
+static Value split(const String* s, const String* separator){
+    Vector* pieces;
+    if(separator->length == 0){
+        // Every code point on its own
+        pieces = createVector(VEC_OF_STRING, s->codePoints);
+        size_t offset = 0;
+        for(size_t i = 0; i < s->codePoints; i++){
+            unsigned char lead = (unsigned char)s->bytes[offset];
+            size_t width = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+            pieces->strings[i] = stringSlice(s, offset, width);
+            offset += width;
+        }
+        return (Value){.type = VAL_VECTOR, .vector = pieces};
+    }
+
+    Matches matches = findAll(s, separator);
+    pieces = createVector(VEC_OF_STRING, matches.count + 1);
+    size_t start = 0;
+    for(size_t i = 0; i < matches.count; i++){
+        pieces->strings[i] = stringSlice(s, start, matches.at[i] - start);
+        start = matches.at[i] + separator->length;
+    }
+    pieces->strings[matches.count] = stringSlice(s, start, s->length - start);
+    memFree(matches.at);
+    return (Value){.type = VAL_VECTOR, .vector = pieces};
+}
+
+static Value join(String* const* strings, size_t count, const String* separator){
+    if(count == 0){
+        return makeStringValue("");
+    }
+    size_t gaps = count - 1;
+    size_t length = separator->length * gaps;
+    size_t codePoints = separator->codePoints * gaps;
+    for(size_t i = 0; i < count; i++){
+        length += strings[i]->length;
+        codePoints += strings[i]->codePoints;
+    }
+
+    String* result = stringAlloc(length);
+    char* out = result->data;
+    for(size_t i = 0; i < count; i++){
+        if(i > 0){
+            memcpy(out, separator->bytes, separator->length);
+            out += separator->length;
+        }
+        memcpy(out, strings[i]->bytes, strings[i]->length);
+        out += strings[i]->length;
+    }
+    *out = '\0';
+    result->length = length;
+    result->codePoints = codePoints;
+    result->ascii = codePoints == length;
+    return stringValue(result);
+}
+
+/**
+ * @brief Join the strings of a list, which are lined up first
+ */
+static Value joinList(enum operators op, const List* list, const String* separator){
+    size_t count = listLength(list);
+    Value* items = (Value*)memAlloc(sizeof(Value) * (count > 0 ? count : 1));
+    String** strings = (String**)memAlloc(sizeof(String*) * (count > 0 ? count : 1));
+    if(items == NULL || strings == NULL){
+        fatalError(ERROR_RESOURCE, "Error: Out of memory joining %zu strings\n", count);
+    }
+    listItems(list, items);
+    for(size_t i = 0; i < count; i++){
+        if(items[i].type != VAL_STRING){
+            memFree(items);
+            memFree(strings);
+            fatalError(ERROR_TYPE, "Error: Expected a list of strings in %s\n", getOperatorSymbol(op));
+        }
+        strings[i] = items[i].string;
+    }
+    Value result = join(strings, count, separator);
+    memFree(items);
+    memFree(strings);
+    return result;
+}
+
+static Value replace(enum operators op, String* s, const String* from, const String* to){
+    if(from->length == 0){
+        fatalError(ERROR_RANGE, "Error: Empty pattern in %s\n", getOperatorSymbol(op));
+    }
+    Matches matches = findAll(s, from);
+    if(matches.count == 0){
+        return stringValue(s);
+    }
+
+    size_t length = s->length - matches.count * from->length + matches.count * to->length;
+    String* result = stringAlloc(length);
+    char* out = result->data;
+    size_t start = 0;
+    for(size_t i = 0; i < matches.count; i++){
+        memcpy(out, s->bytes + start, matches.at[i] - start);
+        out += matches.at[i] - start;
+        memcpy(out, to->bytes, to->length);
+        out += to->length;
+        start = matches.at[i] + from->length;
+    }
+    memcpy(out, s->bytes + start, s->length - start);
+    out += s->length - start;
+    *out = '\0';
+    result->length = length;
+    result->codePoints = s->codePoints - matches.count * from->codePoints + matches.count * to->codePoints;
+    result->ascii = result->codePoints == length;
+    memFree(matches.at);
+    return stringValue(result);
+}
+
+/**
+ * @brief Evaluate a string builtin on already-evaluated arguments
+ * @param op One of the string operators
+ * @param args The argument values
+ * @param argc The number of arguments
+ * @return The result
+ */
+Value evaluateStringOp(enum operators op, Value* args, int argc){
+    pthread_once(&kernelsOnce, selectKernels);
+
+    switch(op){
+        case LENGTH:
+            expectArgs(op, argc, 1, 1);
+            if(args[0].type == VAL_VECTOR){
+                return makeIntValue((long long)args[0].vector->length);
+            }
+            if(args[0].type == VAL_LIST){
+                return makeIntValue((long long)listLength(args[0].list));
+            }
+            return makeIntValue((long long)expectString(op, args[0])->codePoints);
+        case SUBSTRING: {
+            expectArgs(op, argc, 2, 3);
+            String* s = expectString(op, args[0]);
+            size_t start = expectPosition(op, s, args[1]);
+            size_t end = argc == 3 ? expectPosition(op, s, args[2]) : s->length;
+            if(end < start){
+                fatalError(ERROR_RANGE, "Error: End before start in %s\n", getOperatorSymbol(op));
+            }
+            if(start == 0 && end == s->length){
+                return stringValue(s);
+            }
+            return stringValue(stringSlice(s, start, end - start));
+        }
+        case INDEX_OF: {
+            expectArgs(op, argc, 2, 3);
+            String* s = expectString(op, args[0]);
+            String* needle = expectString(op, args[1]);
+            size_t from = argc == 3 ? expectPosition(op, s, args[2]) : 0;
+            const char* found = stringSearch(s->bytes + from, s->length - from, needle->bytes, needle->length);
+            if(found == NULL){
+                return makeIntValue(-1);
+            }
+            size_t offset = (size_t)(found - s->bytes);
+            return makeIntValue((long long)(s->ascii ? offset : utf8CodePoints(s->bytes, offset)));
+        }
+        case CONTAINS: {
+            expectArgs(op, argc, 2, 2);
+            String* s = expectString(op, args[0]);
+            String* needle = expectString(op, args[1]);
+            return makeIntValue(stringSearch(s->bytes, s->length, needle->bytes, needle->length) != NULL);
+        }
+        case STARTS_WITH: {
+            expectArgs(op, argc, 2, 2);
+            String* s = expectString(op, args[0]);
+            String* prefix = expectString(op, args[1]);
+            return makeIntValue(prefix->length <= s->length && memcmp(s->bytes, prefix->bytes, prefix->length) == 0);
+        }
+        case SPLIT:
+            expectArgs(op, argc, 2, 2);
+            return split(expectString(op, args[0]), expectString(op, args[1]));
+        case JOIN: {
+            expectArgs(op, argc, 1, 2);
+            if(args[0].type != VAL_VECTOR && args[0].type != VAL_LIST){
+                fatalError(ERROR_TYPE, "Error: Expected vector or list in %s\n", getOperatorSymbol(op));
+            }
+            String empty = {"", 0, 0, 1};
+            const String* separator = argc == 2 ? expectString(op, args[1]) : &empty;
+            if(args[0].type == VAL_LIST){
+                return joinList(op, args[0].list, separator);
+            }
+            Vector* vector = args[0].vector;
+            if(vector->length > 0 && vector->type != VEC_OF_STRING){
+                fatalError(ERROR_TYPE, "Error: Expected a vector of strings in %s\n", getOperatorSymbol(op));
+            }
+            return join(vector->strings, vector->length, separator);
+        }
+        case REPLACE:
+            expectArgs(op, argc, 3, 3);
+            return replace(op, expectString(op, args[0]), expectString(op, args[1]), expectString(op, args[2]));
+        case UPPER:
+        case LOWER:
+            expectArgs(op, argc, 1, 1);
+            return stringValue(changeCase(expectString(op, args[0]), op == UPPER));
+        default:
+            fatalError(ERROR_UNSUPPORTED, "Error: Unknown string operator %s\n", getOperatorSymbol(op));
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef LISP_LITE_STRLIB_H
+#define LISP_LITE_STRLIB_H
+#include "library.h"
+#include <stddef.h>
+
+/*
+ * String builtins. Positions and lengths count code points; an ASCII string
+ * (see utf8.h) maps them straight to bytes, others are walked a block at a
+ * time. `substring` and `split` return slices that share the parent's bytes.
+ *
+ * Searching filters candidate positions 32 (AVX2) or 16 (SSE2) at a time on
+ * the needle's first and last bytes, and only compares the rest at positions
+ * where both match. If too many candidates turn out false, as on very
+ * repetitive text, the rest of the haystack is searched with the Two-Way
+ * algorithm of Crochemore and Perrin, which is linear in the worst case and
+ * is also what the scalar level uses throughout.
+ */
+
+const char* stringSearch(const char* haystack, size_t length, const char* needle, size_t needleLength);
+
+Value evaluateStringOp(enum operators op, Value* args, int argc);
+
+#endif //LISP_LITE_STRLIB_H
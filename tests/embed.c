@@ -0,0 +1,76 @@
+#include "lisp.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Errors through the embedding API (lisp.h): each program below must fail
+ * with the given status rather than take the host down, and the context
+ * must still run programs afterwards.
+ */
+
+typedef struct {
+    const char* source;
+    lisp_status status;
+} FailingProgram;
+
+static const FailingProgram failing[] = {
+    {"(def)", LISP_ERROR_SYNTAX},
+    {"(def x)", LISP_ERROR_SYNTAX},
+    // Far past the depth limit, which stops it before the C stack runs out
+    {"(def deep (lambda (n) (if (= n 0) 0 (+ 1 (deep (- n 1)))))) (deep 1000000)", LISP_ERROR_RESOURCE},
+};
+
+static int failures = 0;
+
+static void discard(void* user, const char* data, size_t length){
+    (void)user;
+    (void)data;
+    (void)length;
+}
+
+/**
+ * @brief Load and run a program, which must fail with `expected`
+ */
+static void expectFailure(lisp_ctx* ctx, const char* source, lisp_status expected){
+    lisp_program* program = lisp_load(ctx, source, strlen(source));
+    int status = program != NULL ? lisp_eval(ctx, program, NULL) : -1;
+    if(status != -1 || lisp_error_code(ctx) != expected){
+        fprintf(stderr, "FAIL %s: status %d, error %d (%s), expected error %d\n",
+                source, status, (int)lisp_error_code(ctx), lisp_error(ctx), (int)expected);
+        failures++;
+    }
+}
+
+/**
+ * @brief Load and run a program, which must give the integer `expected`
+ */
+static void expectInt(lisp_ctx* ctx, const char* source, long long expected){
+    lisp_program* program = lisp_load(ctx, source, strlen(source));
+    lisp_value result;
+    if(program == NULL || lisp_eval(ctx, program, &result) != 0
+       || result.type != LISP_INT || result.as.int_value != expected){
+        fprintf(stderr, "FAIL %s: %s, expected %lld\n", source, lisp_error(ctx), expected);
+        failures++;
+    }
+}
+
+int main(void){
+    lisp_ctx* ctx = lisp_create();
+    if(ctx == NULL){
+        fprintf(stderr, "FAIL lisp_create\n");
+        return 1;
+    }
+    lisp_set_io(ctx, discard, NULL, NULL);
+
+    for(size_t i = 0; i < sizeof(failing) / sizeof(failing[0]); i++){
+        expectFailure(ctx, failing[i].source, failing[i].status);
+        // The error must leave the context usable
+        expectInt(ctx, "(def y 41) (+ y 1)", 42);
+    }
+
+    lisp_destroy(ctx);
+    if(failures == 0){
+        printf("%zu failing programs reported their errors\n", sizeof(failing) / sizeof(failing[0]));
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,446 @@
+#include "utf8.h"
+#include "vector.h"
+#include "alloc.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Each scan has a scalar version and, on x86-64, SSE2 and AVX2 versions,
+ * picked at the level vector.c settles on (so LISP_SIMD caps both).
+ * `valid` only answers yes or no; the scalar check then finds the offset of
+ * a bad byte, which only matters on the way to an error.
+ */
+typedef struct {
+    int (*valid)(const unsigned char *s, size_t n, int *ascii);
+    size_t (*codePoints)(const unsigned char *s, size_t n);
+} Utf8Kernels;
+
+static Utf8Kernels kernels;
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+/* ---------------------------------------------------------------- scalar */
+
+/**
+ * @brief Length of the well-formed sequence starting at s[i], or 0
+ */
+static size_t sequenceAt(const unsigned char *s, size_t n, size_t i){
+    unsigned char c = s[i];
+    if(c < 0x80){
+        return 1;
+    }
+    size_t need;
+    unsigned char low = 0x80, high = 0xBF;
+    if(c >= 0xC2 && c <= 0xDF){
+        need = 1;
+    }else if(c == 0xE0){
+        need = 2;
+        low = 0xA0;     // shorter forms are overlong
+    }else if(c == 0xED){
+        need = 2;
+        high = 0x9F;    // U+D800..U+DFFF are surrogates
+    }else if(c >= 0xE1 && c <= 0xEF){
+        need = 2;
+    }else if(c == 0xF0){
+        need = 3;
+        low = 0x90;
+    }else if(c >= 0xF1 && c <= 0xF3){
+        need = 3;
+    }else if(c == 0xF4){
+        need = 3;
+        high = 0x8F;    // nothing above U+10FFFF
+    }else{
+        return 0;
+    }
+    if(n - i <= need || s[i + 1] < low || s[i + 1] > high){
+        return 0;
+    }
+    for(size_t k = 2; k <= need; k++){
+        if((s[i + k] & 0xC0) != 0x80){
+            return 0;
+        }
+    }
+    return need + 1;
+}
+
+/**
+ * @brief Offset of the first byte that does not start a well-formed sequence, or n
+ */
+static size_t scalarCheck(const unsigned char *s, size_t n, size_t i){
+    while(i < n){
+        // Eight ASCII bytes at a time
+        while(i + 8 <= n){
+            uint64_t word;
+            memcpy(&word, s + i, 8);
+            if(word & 0x8080808080808080ULL){
+                break;
+            }
+            i += 8;
+        }
+        if(i == n){
+            break;
+        }
+        size_t step = sequenceAt(s, n, i);
+        if(step == 0){
+            return i;
+        }
+        i += step;
+    }
+    return n;
+}
+
+static int scalarValid(const unsigned char *s, size_t n, int *ascii){
+    unsigned char high = 0;
+    for(size_t i = 0; i < n; i++){
+        high |= s[i];
+    }
+    *ascii = high < 0x80;
+    return *ascii || scalarCheck(s, n, 0) == n;
+}
+
+static size_t scalarCodePoints(const unsigned char *s, size_t n){
+    size_t count = 0;
+    for(size_t i = 0; i < n; i++){
+        count += (s[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+#ifdef UTF8_X86
+
+/* ------------------------------------------------------------------ SSE2 */
+
+static int sse2Valid(const unsigned char *s, size_t n, int *ascii){
+    size_t i = 0;
+    *ascii = 1;
+    while(i + 16 <= n){
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+        if(mask == 0){
+            i += 16;
+            continue;
+        }
+        // Check sequences one by one from the first non-ASCII byte
+        *ascii = 0;
+        i += (size_t)__builtin_ctz((unsigned)mask);
+        size_t step = sequenceAt(s, n, i);
+        if(step == 0){
+            return 0;
+        }
+        i += step;
+    }
+    for(size_t k = i; k < n; k++){
+        if(s[k] >= 0x80){
+            *ascii = 0;
+            break;
+        }
+    }
+    return scalarCheck(s, n, i) == n;
+}
+
+static size_t sse2CodePoints(const unsigned char *s, size_t n){
+    // Everything but continuation bytes (0x80..0xBF, below -64 as signed)
+    const __m128i limit = _mm_set1_epi8(-65);
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(s + i));
+        count += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(bytes, limit)));
+    }
+    return count + scalarCodePoints(s + i, n - i);
+}
+
+/* ------------------------------------------------------------------ AVX2 */
+
+/*
+ * Each byte is classified by the high nibble of the byte before it, the low
+ * nibble of the byte before it, and its own high nibble; the three lookups
+ * are ANDed, and a bit left standing names an error. Continuations that a
+ * three- or four-byte lead two or three bytes back calls for are checked
+ * separately against the "two continuations in a row" bit.
+ */
+#define TOO_SHORT      (1 << 0)   // a lead byte not followed by a continuation
+#define TOO_LONG       (1 << 1)   // ASCII followed by a continuation
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define TABLE16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+#define B(x) ((char)(x))
+
+__attribute__((target("avx2")))
+static inline __m256i highNibble(__m256i v){
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+// The block shifted right by n bytes, with the end of the previous block in front
+#define PREVIOUS(input, previous, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((previous), (input), 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static int avx2Valid(const unsigned char *s, size_t n, int *ascii){
+    const __m256i byte1High = TABLE16(
+        B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),
+        B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),
+        B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS),
+        B(TOO_SHORT | OVERLONG_2),
+        B(TOO_SHORT),
+        B(TOO_SHORT | OVERLONG_3 | SURROGATE),
+        B(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+    const __m256i byte1Low = TABLE16(
+        B(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+        B(CARRY | OVERLONG_2),
+        B(CARRY), B(CARRY),
+        B(CARRY | TOO_LARGE),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000));
+    const __m256i byte2High = TABLE16(
+        B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),
+        B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT));
+    // A lead byte in the last three positions needs the next block
+    const __m256i incompleteAbove = _mm256_setr_epi8(
+        B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+        B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+        B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+        B(255), B(255), B(255), B(255), B(255), B(0xF0 - 1), B(0xE0 - 1), B(0xC0 - 1));
+
+    __m256i error = _mm256_setzero_si256();
+    __m256i previous = _mm256_setzero_si256();
+    __m256i previousIncomplete = _mm256_setzero_si256();
+    int sawHigh = 0;
+    unsigned char tail[32];
+
+    for(size_t i = 0; i < n; i += 32){
+        __m256i input;
+        if(n - i >= 32){
+            input = _mm256_loadu_si256((const __m256i *)(s + i));
+        }else{
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, n - i);
+            input = _mm256_loadu_si256((const __m256i *)tail);
+        }
+
+        if(_mm256_movemask_epi8(input) == 0){
+            error = _mm256_or_si256(error, previousIncomplete);
+        }else{
+            sawHigh = 1;
+            __m256i prev1 = PREVIOUS(input, previous, 1);
+            __m256i special = _mm256_and_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(byte1High, highNibble(prev1)),
+                                 _mm256_shuffle_epi8(byte1Low, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+                _mm256_shuffle_epi8(byte2High, highNibble(input)));
+
+            // Only 111_____ two back and 1111____ three back reach 0x80
+            __m256i third = _mm256_subs_epu8(PREVIOUS(input, previous, 2), _mm256_set1_epi8(B(0xE0 - 0x80)));
+            __m256i fourth = _mm256_subs_epu8(PREVIOUS(input, previous, 3), _mm256_set1_epi8(B(0xF0 - 0x80)));
+            __m256i mustContinue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(B(0x80)));
+            error = _mm256_or_si256(error, _mm256_xor_si256(mustContinue, special));
+
+            previousIncomplete = _mm256_subs_epu8(input, incompleteAbove);
+        }
+        previous = input;
+    }
+    error = _mm256_or_si256(error, previousIncomplete);
+    *ascii = !sawHigh;
+    return _mm256_testz_si256(error, error);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2CodePoints(const unsigned char *s, size_t n){
+    const __m256i limit = _mm256_set1_epi8(-65);
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(s + i));
+        count += (size_t)__builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(bytes, limit)));
+    }
+    return count + scalarCodePoints(s + i, n - i);
+}
+
+#endif // UTF8_X86
+
+static void selectKernels(void){
+    kernels = (Utf8Kernels){scalarValid, scalarCodePoints};
+#ifdef UTF8_X86
+    SimdLevel level = vectorSimdLevel();
+    if(level == SIMD_SSE2){
+        kernels = (Utf8Kernels){sse2Valid, sse2CodePoints};
+    }else if(level == SIMD_AVX2){
+        kernels = (Utf8Kernels){avx2Valid, avx2CodePoints};
+    }
+#endif
+}
+
+/* --------------------------------------------------------------- public */
+
+/**
+ * @brief Offset of the first byte that is not part of well-formed UTF-8
+ * @return `length` when the whole buffer is valid
+ */
+size_t utf8Check(const char* bytes, size_t length){
+    pthread_once(&kernelsOnce, selectKernels);
+    int ascii;
+    if(kernels.valid((const unsigned char*)bytes, length, &ascii)){
+        return length;
+    }
+    return scalarCheck((const unsigned char*)bytes, length, 0);
+}
+
+/**
+ * @brief Count the code points in valid UTF-8
+ */
+size_t utf8CodePoints(const char* bytes, size_t length){
+    pthread_once(&kernelsOnce, selectKernels);
+    return kernels.codePoints((const unsigned char*)bytes, length);
+}
+
+/**
+ * @brief Byte offset of code point number `codePoint` in valid UTF-8
+ * @return `length` if there are not that many
+ *
+ * Whole blocks are skipped by counting them with the vector kernel.
+ */
+size_t utf8Offset(const char* bytes, size_t length, size_t codePoint){
+    pthread_once(&kernelsOnce, selectKernels);
+    const unsigned char* s = (const unsigned char*)bytes;
+    size_t i = 0;
+    while(length - i >= 256){
+        size_t count = kernels.codePoints(s + i, 256);
+        // A block that holds the target is walked byte by byte below
+        if(count > codePoint){
+            break;
+        }
+        codePoint -= count;
+        i += 256;
+    }
+    for(; i < length; i++){
+        if((s[i] & 0xC0) != 0x80 && codePoint-- == 0){
+            return i;
+        }
+    }
+    return length;
+}
+
+/**
+ * @brief How many continuation bytes the last sequence still lacks
+ * @return 0 when the buffer ends on a whole code point
+ */
+size_t utf8Missing(const char* bytes, size_t length){
+    const unsigned char* s = (const unsigned char*)bytes;
+    for(size_t back = 1; back <= 4 && back <= length; back++){
+        unsigned char c = s[length - back];
+        if((c & 0xC0) == 0x80){
+            continue;
+        }
+        size_t want = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return want > back ? want - back : 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Allocate a string with room for `capacity` bytes and a NUL
+ *
+ * Only `bytes` is set until stringSeal.
+ */
+String* stringAlloc(size_t capacity){
+    String* s = (String*)memAlloc(sizeof(String) + capacity + 1);
+    s->bytes = s->data;
+    return s;
+}
+
+/**
+ * @brief Grow an unsealed string (or NULL) to hold `capacity` bytes and a NUL
+ */
+String* stringResize(String* s, size_t capacity){
+    s = (String*)memRealloc(s, sizeof(String) + capacity + 1);
+    s->bytes = s->data;
+    return s;
+}
+
+/**
+ * @brief Finish a string whose first `length` bytes have been written
+ * @return `length` if they are valid UTF-8, or the offset of the first bad byte
+ *
+ * Terminates it and records its length, code point count and whether it
+ * is ASCII. Invalid text is still sealed, with its code points counted as
+ * if it were valid.
+ */
+size_t stringSeal(String* s, size_t length){
+    pthread_once(&kernelsOnce, selectKernels);
+    s->data[length] = '\0';
+    s->length = length;
+    int ascii;
+    size_t bad = length;
+    if(!kernels.valid((const unsigned char*)s->data, length, &ascii)){
+        bad = scalarCheck((const unsigned char*)s->data, length, 0);
+    }
+    s->ascii = ascii;
+    s->codePoints = ascii ? length : kernels.codePoints((const unsigned char*)s->data, length);
+    return bad;
+}
+
+/**
+ * @brief A new string holding a copy of `length` bytes, which should be UTF-8
+ */
+String* stringCopy(const char* bytes, size_t length){
+    String* s = stringAlloc(length);
+    memcpy(s->data, bytes, length);
+    stringSeal(s, length);
+    return s;
+}
+
+/**
+ * @brief A string for `length` bytes of `parent` from `offset`, sharing them
+ *
+ * The range must fall on code point boundaries. Strings are never changed
+ * once made, so the slice stays valid for as long as the parent does.
+ */
+String* stringSlice(const String* parent, size_t offset, size_t length){
+    String* s = (String*)memAlloc(sizeof(String));
+    s->bytes = parent->bytes + offset;
+    s->length = length;
+    if(parent->ascii || length == parent->length){
+        s->ascii = parent->ascii;
+        s->codePoints = parent->ascii ? length : parent->codePoints;
+    }else{
+        s->codePoints = utf8CodePoints(s->bytes, length);
+        s->ascii = s->codePoints == length;
+    }
+    return s;
+}
+
+/**
+ * @brief The string as a NUL-terminated C string
+ *
+ * A slice is copied, and the copy is never freed (like other values).
+ */
+const char* stringCString(const String* s){
+    if(s->bytes == s->data){
+        return s->data;
+    }
+    return stringCopy(s->bytes, s->length)->data;
+}
+
+void stringFree(String* s){
+    memFree(s);
+}
@@ -0,0 +1,56 @@
+#ifndef LISP_LITE_UTF8_H
+#define LISP_LITE_UTF8_H
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Strings are UTF-8 bytes. A string records, once when it is made, its
+ * length in bytes and in code points and whether it is plain ASCII. Most
+ * strings own their bytes, stored right after the header and NUL-terminated;
+ * a slice (see stringSlice) points into another string's bytes instead, so
+ * `bytes` is only a C string when it is `data`.
+ *
+ * Text from outside (source files and input) is checked with utf8Check on
+ * the way in. With AVX2 it validates 32 bytes per step with the lookup
+ * method of Keiser and Lemire; with SSE2 it skips ASCII 16 bytes at a time
+ * and checks the rest byte by byte, as the scalar version does throughout.
+ */
+
+typedef struct String {
+    const char* bytes;
+    size_t length;      // bytes
+    size_t codePoints;
+    int ascii;          // no byte above 0x7F
+    char data[];        // the bytes of a string that owns them
+} String;
+
+/**
+ * @brief Byte-wise equality, settled by the lengths when they differ
+ */
+static inline int stringEqual(const String* a, const String* b){
+    return a == b || (a->length == b->length && memcmp(a->bytes, b->bytes, a->length) == 0);
+}
+
+String* stringAlloc(size_t capacity);
+
+String* stringResize(String* s, size_t capacity);
+
+size_t stringSeal(String* s, size_t length);
+
+String* stringCopy(const char* bytes, size_t length);
+
+String* stringSlice(const String* parent, size_t offset, size_t length);
+
+const char* stringCString(const String* s);
+
+void stringFree(String* s);
+
+size_t utf8Check(const char* bytes, size_t length);
+
+size_t utf8CodePoints(const char* bytes, size_t length);
+
+size_t utf8Offset(const char* bytes, size_t length, size_t codePoint);
+
+size_t utf8Missing(const char* bytes, size_t length);
+
+#endif //LISP_LITE_UTF8_H
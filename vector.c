@@ -0,0 +1,739 @@
+#include "vector.h"
+#include "output.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VECTOR_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Bulk kernels. Each operation has a scalar version and, on x86-64, SSE2 and
+ * AVX2 versions; the widest one the CPU supports is picked on first use.
+ * `broadcast` means `b` points at a single value applied to every element.
+ *
+ * Integer vectors use wrapping 64-bit arithmetic: checking every lane for
+ * overflow would give up the point of the bulk path. Float sums and dot
+ * products accumulate in several lanes, so they can differ from a strict
+ * left-to-right sum in the last bits.
+ */
+typedef struct {
+    void (*floatOp)(enum operators op, double *r, const double *a, const double *b, int broadcast, size_t n);
+    void (*intOp)(enum operators op, long long *r, const long long *a, const long long *b, int broadcast, size_t n);
+    double (*floatSum)(const double *a, size_t n);
+    long long (*intSum)(const long long *a, size_t n);
+    double (*floatDot)(const double *a, const double *b, size_t n);
+    double (*floatExtreme)(const double *a, size_t n, int wantMax);
+    long long (*intExtreme)(const long long *a, size_t n, int wantMax);
+    void (*floatCompare)(enum operators op, long long *r, const double *a, const double *b, int broadcast, size_t n);
+    void (*intCompare)(enum operators op, long long *r, const long long *a, const long long *b, int broadcast, size_t n);
+} VectorKernels;
+
+static SimdLevel simdLevel;
+static VectorKernels kernels;
+// Worker threads may hit their first vector op at the same time
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+/* ---------------------------------------------------------------- scalar */
+
+static void scalarFloatOp(enum operators op, double *r, const double *a, const double *b, int broadcast, size_t n){
+    size_t step = broadcast ? 0 : 1;
+    switch(op){
+        case VEC_ADD: for(size_t i = 0; i < n; i++) r[i] = a[i] + b[i * step]; break;
+        case VEC_SUB: for(size_t i = 0; i < n; i++) r[i] = a[i] - b[i * step]; break;
+        case VEC_MUL: for(size_t i = 0; i < n; i++) r[i] = a[i] * b[i * step]; break;
+        default:      for(size_t i = 0; i < n; i++) r[i] = a[i] / b[i * step]; break;
+    }
+}
+
+static void scalarIntOp(enum operators op, long long *r, const long long *a, const long long *b, int broadcast, size_t n){
+    size_t step = broadcast ? 0 : 1;
+    // Go through unsigned so wrapping is defined
+    switch(op){
+        case VEC_ADD: for(size_t i = 0; i < n; i++) r[i] = (long long)((uint64_t)a[i] + (uint64_t)b[i * step]); break;
+        case VEC_SUB: for(size_t i = 0; i < n; i++) r[i] = (long long)((uint64_t)a[i] - (uint64_t)b[i * step]); break;
+        case VEC_MUL: for(size_t i = 0; i < n; i++) r[i] = (long long)((uint64_t)a[i] * (uint64_t)b[i * step]); break;
+        default:
+            // Divisors were checked for zero by the caller
+            for(size_t i = 0; i < n; i++){
+                long long d = b[i * step];
+                r[i] = d == -1 ? (long long)(0 - (uint64_t)a[i]) : a[i] / d;
+            }
+            break;
+    }
+}
+
+static double scalarFloatSum(const double *a, size_t n){
+    double sum = 0.0;
+    for(size_t i = 0; i < n; i++) sum += a[i];
+    return sum;
+}
+
+static long long scalarIntSum(const long long *a, size_t n){
+    uint64_t sum = 0;
+    for(size_t i = 0; i < n; i++) sum += (uint64_t)a[i];
+    return (long long)sum;
+}
+
+static double scalarFloatDot(const double *a, const double *b, size_t n){
+    double sum = 0.0;
+    for(size_t i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static double scalarFloatExtreme(const double *a, size_t n, int wantMax){
+    double best = a[0];
+    for(size_t i = 1; i < n; i++){
+        if(wantMax ? a[i] > best : a[i] < best) best = a[i];
+    }
+    return best;
+}
+
+static long long scalarIntExtreme(const long long *a, size_t n, int wantMax){
+    long long best = a[0];
+    for(size_t i = 1; i < n; i++){
+        if(wantMax ? a[i] > best : a[i] < best) best = a[i];
+    }
+    return best;
+}
+
+static void scalarFloatCompare(enum operators op, long long *r, const double *a, const double *b, int broadcast, size_t n){
+    size_t step = broadcast ? 0 : 1;
+    switch(op){
+        case VEC_LT: for(size_t i = 0; i < n; i++) r[i] = a[i] < b[i * step]; break;
+        case VEC_GT: for(size_t i = 0; i < n; i++) r[i] = a[i] > b[i * step]; break;
+        default:     for(size_t i = 0; i < n; i++) r[i] = a[i] == b[i * step]; break;
+    }
+}
+
+static void scalarIntCompare(enum operators op, long long *r, const long long *a, const long long *b, int broadcast, size_t n){
+    size_t step = broadcast ? 0 : 1;
+    switch(op){
+        case VEC_LT: for(size_t i = 0; i < n; i++) r[i] = a[i] < b[i * step]; break;
+        case VEC_GT: for(size_t i = 0; i < n; i++) r[i] = a[i] > b[i * step]; break;
+        default:     for(size_t i = 0; i < n; i++) r[i] = a[i] == b[i * step]; break;
+    }
+}
+
+#ifdef VECTOR_X86
+
+/*
+ * Each SIMD kernel runs full-width over as much of the input as it can and
+ * hands the remaining tail to the scalar kernel.
+ */
+#define SIMD_BINARY_LOOP(width, load, store, combine, splat)          \
+    for(; i + (width) <= n; i += (width)){                            \
+        store(r + i, combine(load(a + i), broadcast ? (splat) : load(b + i))); \
+    }
+
+#define TAIL_B (broadcast ? b : b + i)
+
+/* ------------------------------------------------------------------ SSE2 */
+
+static void sse2FloatOp(enum operators op, double *r, const double *a, const double *b, int broadcast, size_t n){
+    size_t i = 0;
+    __m128d s = _mm_set1_pd(b[0]);
+    switch(op){
+        case VEC_ADD: SIMD_BINARY_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, s) break;
+        case VEC_SUB: SIMD_BINARY_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, s) break;
+        case VEC_MUL: SIMD_BINARY_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, s) break;
+        default:      SIMD_BINARY_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd, s) break;
+    }
+    scalarFloatOp(op, r + i, a + i, TAIL_B, broadcast, n - i);
+}
+
+#define SSE2_LOAD_I(p) _mm_loadu_si128((const __m128i *)(p))
+#define SSE2_STORE_I(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+
+static void sse2IntOp(enum operators op, long long *r, const long long *a, const long long *b, int broadcast, size_t n){
+    size_t i = 0;
+    __m128i s = _mm_set1_epi64x(b[0]);
+    switch(op){
+        case VEC_ADD: SIMD_BINARY_LOOP(2, SSE2_LOAD_I, SSE2_STORE_I, _mm_add_epi64, s) break;
+        case VEC_SUB: SIMD_BINARY_LOOP(2, SSE2_LOAD_I, SSE2_STORE_I, _mm_sub_epi64, s) break;
+        default: break; // no 64-bit multiply or divide below AVX-512
+    }
+    scalarIntOp(op, r + i, a + i, TAIL_B, broadcast, n - i);
+}
+
+static double sse2FloatSum(const double *a, size_t n){
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + scalarFloatSum(a + i, n - i);
+}
+
+static long long sse2IntSum(const long long *a, size_t n){
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2){
+        acc = _mm_add_epi64(acc, SSE2_LOAD_I(a + i));
+    }
+    long long lanes[2];
+    SSE2_STORE_I(lanes, acc);
+    return (long long)((uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)scalarIntSum(a + i, n - i));
+}
+
+static double sse2FloatDot(const double *a, const double *b, size_t n){
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + scalarFloatDot(a + i, b + i, n - i);
+}
+
+static double sse2FloatExtreme(const double *a, size_t n, int wantMax){
+    if(n < 2){
+        return scalarFloatExtreme(a, n, wantMax);
+    }
+    __m128d best = _mm_loadu_pd(a);
+    size_t i = 2;
+    for(; i + 2 <= n; i += 2){
+        __m128d x = _mm_loadu_pd(a + i);
+        best = wantMax ? _mm_max_pd(best, x) : _mm_min_pd(best, x);
+    }
+    double lanes[3];
+    _mm_storeu_pd(lanes, best);
+    lanes[2] = scalarFloatExtreme(a + i - 1, n - i + 1, wantMax);
+    return scalarFloatExtreme(lanes, 3, wantMax);
+}
+
+static void sse2FloatCompare(enum operators op, long long *r, const double *a, const double *b, int broadcast, size_t n){
+    size_t i = 0;
+    __m128d s = _mm_set1_pd(b[0]);
+    __m128i one = _mm_set1_epi64x(1);
+    for(; i + 2 <= n; i += 2){
+        __m128d x = _mm_loadu_pd(a + i);
+        __m128d y = broadcast ? s : _mm_loadu_pd(b + i);
+        __m128d mask = op == VEC_LT ? _mm_cmplt_pd(x, y) : op == VEC_GT ? _mm_cmpgt_pd(x, y) : _mm_cmpeq_pd(x, y);
+        SSE2_STORE_I(r + i, _mm_and_si128(_mm_castpd_si128(mask), one));
+    }
+    scalarFloatCompare(op, r + i, a + i, TAIL_B, broadcast, n - i);
+}
+
+/* ------------------------------------------------------------------ AVX2 */
+
+#define AVX_LOAD_I(p) _mm256_loadu_si256((const __m256i *)(p))
+#define AVX_STORE_I(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+
+__attribute__((target("avx2")))
+static void avx2FloatOp(enum operators op, double *r, const double *a, const double *b, int broadcast, size_t n){
+    size_t i = 0;
+    __m256d s = _mm256_set1_pd(b[0]);
+    switch(op){
+        case VEC_ADD: SIMD_BINARY_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, s) break;
+        case VEC_SUB: SIMD_BINARY_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, s) break;
+        case VEC_MUL: SIMD_BINARY_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, s) break;
+        default:      SIMD_BINARY_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_div_pd, s) break;
+    }
+    scalarFloatOp(op, r + i, a + i, TAIL_B, broadcast, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2IntOp(enum operators op, long long *r, const long long *a, const long long *b, int broadcast, size_t n){
+    size_t i = 0;
+    __m256i s = _mm256_set1_epi64x(b[0]);
+    switch(op){
+        case VEC_ADD: SIMD_BINARY_LOOP(4, AVX_LOAD_I, AVX_STORE_I, _mm256_add_epi64, s) break;
+        case VEC_SUB: SIMD_BINARY_LOOP(4, AVX_LOAD_I, AVX_STORE_I, _mm256_sub_epi64, s) break;
+        default: break;
+    }
+    scalarIntOp(op, r + i, a + i, TAIL_B, broadcast, n - i);
+}
+
+__attribute__((target("avx2")))
+static double avx2FloatSum(const double *a, size_t n){
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalarFloatSum(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static long long avx2IntSum(const long long *a, size_t n){
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+        acc = _mm256_add_epi64(acc, AVX_LOAD_I(a + i));
+    }
+    long long lanes[4];
+    AVX_STORE_I(lanes, acc);
+    return (long long)((uint64_t)scalarIntSum(lanes, 4) + (uint64_t)scalarIntSum(a + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static double avx2FloatDot(const double *a, const double *b, size_t n){
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalarFloatDot(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static double avx2FloatExtreme(const double *a, size_t n, int wantMax){
+    if(n < 4){
+        return scalarFloatExtreme(a, n, wantMax);
+    }
+    __m256d best = _mm256_loadu_pd(a);
+    size_t i = 4;
+    for(; i + 4 <= n; i += 4){
+        __m256d x = _mm256_loadu_pd(a + i);
+        best = wantMax ? _mm256_max_pd(best, x) : _mm256_min_pd(best, x);
+    }
+    double lanes[5];
+    _mm256_storeu_pd(lanes, best);
+    lanes[4] = scalarFloatExtreme(a + i - 1, n - i + 1, wantMax);
+    return scalarFloatExtreme(lanes, 5, wantMax);
+}
+
+__attribute__((target("avx2")))
+static long long avx2IntExtreme(const long long *a, size_t n, int wantMax){
+    if(n < 4){
+        return scalarIntExtreme(a, n, wantMax);
+    }
+    __m256i best = AVX_LOAD_I(a);
+    size_t i = 4;
+    for(; i + 4 <= n; i += 4){
+        __m256i x = AVX_LOAD_I(a + i);
+        __m256i takeX = wantMax ? _mm256_cmpgt_epi64(x, best) : _mm256_cmpgt_epi64(best, x);
+        best = _mm256_blendv_epi8(best, x, takeX);
+    }
+    long long lanes[5];
+    AVX_STORE_I(lanes, best);
+    lanes[4] = scalarIntExtreme(a + i - 1, n - i + 1, wantMax);
+    return scalarIntExtreme(lanes, 5, wantMax);
+}
+
+__attribute__((target("avx2")))
+static void avx2FloatCompare(enum operators op, long long *r, const double *a, const double *b, int broadcast, size_t n){
+    size_t i = 0;
+    __m256d s = _mm256_set1_pd(b[0]);
+    __m256i one = _mm256_set1_epi64x(1);
+    for(; i + 4 <= n; i += 4){
+        __m256d x = _mm256_loadu_pd(a + i);
+        __m256d y = broadcast ? s : _mm256_loadu_pd(b + i);
+        __m256d mask = op == VEC_LT ? _mm256_cmp_pd(x, y, _CMP_LT_OQ)
+                     : op == VEC_GT ? _mm256_cmp_pd(x, y, _CMP_GT_OQ)
+                     : _mm256_cmp_pd(x, y, _CMP_EQ_OQ);
+        AVX_STORE_I(r + i, _mm256_and_si256(_mm256_castpd_si256(mask), one));
+    }
+    scalarFloatCompare(op, r + i, a + i, TAIL_B, broadcast, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2IntCompare(enum operators op, long long *r, const long long *a, const long long *b, int broadcast, size_t n){
+    size_t i = 0;
+    __m256i s = _mm256_set1_epi64x(b[0]);
+    __m256i one = _mm256_set1_epi64x(1);
+    for(; i + 4 <= n; i += 4){
+        __m256i x = AVX_LOAD_I(a + i);
+        __m256i y = broadcast ? s : AVX_LOAD_I(b + i);
+        __m256i mask = op == VEC_LT ? _mm256_cmpgt_epi64(y, x)
+                     : op == VEC_GT ? _mm256_cmpgt_epi64(x, y)
+                     : _mm256_cmpeq_epi64(x, y);
+        AVX_STORE_I(r + i, _mm256_and_si256(mask, one));
+    }
+    scalarIntCompare(op, r + i, a + i, TAIL_B, broadcast, n - i);
+}
+
+#endif // VECTOR_X86
+
+/**
+ * @brief Pick the widest kernels the CPU supports
+ *
+ * LISP_SIMD=scalar or LISP_SIMD=sse2 caps the choice, which is how the
+ * benchmarks compare paths on one machine.
+ */
+static void selectKernels(void){
+    simdLevel = SIMD_SCALAR;
+#ifdef VECTOR_X86
+    simdLevel = SIMD_SSE2; // part of the x86-64 baseline
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        simdLevel = SIMD_AVX2;
+    }
+#endif
+    const char *cap = getenv("LISP_SIMD");
+    if(cap != NULL){
+        if(strcmp(cap, "scalar") == 0) simdLevel = SIMD_SCALAR;
+        else if(strcmp(cap, "sse2") == 0 && simdLevel > SIMD_SSE2) simdLevel = SIMD_SSE2;
+    }
+
+    kernels = (VectorKernels){scalarFloatOp, scalarIntOp, scalarFloatSum, scalarIntSum, scalarFloatDot,
+                              scalarFloatExtreme, scalarIntExtreme, scalarFloatCompare, scalarIntCompare};
+#ifdef VECTOR_X86
+    if(simdLevel == SIMD_SSE2){
+        kernels = (VectorKernels){sse2FloatOp, sse2IntOp, sse2FloatSum, sse2IntSum, sse2FloatDot,
+                                  sse2FloatExtreme, scalarIntExtreme, sse2FloatCompare, scalarIntCompare};
+    }else if(simdLevel == SIMD_AVX2){
+        kernels = (VectorKernels){avx2FloatOp, avx2IntOp, avx2FloatSum, avx2IntSum, avx2FloatDot,
+                                  avx2FloatExtreme, avx2IntExtreme, avx2FloatCompare, avx2IntCompare};
+    }
+#endif
+}
+
+SimdLevel vectorSimdLevel(void){
+    pthread_once(&kernelsOnce, selectKernels);
+    return simdLevel;
+}
+
+/**
+ * @brief Allocate a vector with 32-byte aligned, uninitialized elements
+ * @param type Element type
+ * @param length Number of elements
+ * @return The new vector
+ */
+Vector* createVector(VectorType type, size_t length){
+    // One block: header, then padding up to the first aligned element (every
+    // element type is 8 bytes). Always room for one element, since kernels
+    // read b[0] to build a broadcast.
+    char *block = (char*)memAlloc(sizeof(Vector) + 32 + (length > 0 ? length : 1) * 8);
+    if(block == NULL){
+        fatalError(ERROR_RESOURCE, "Error: Out of memory allocating a vector of %zu elements\n", length);
+    }
+    Vector *vector = (Vector*)block;
+    uintptr_t data = ((uintptr_t)(block + sizeof(Vector)) + 31) & ~(uintptr_t)31;
+    vector->type = type;
+    vector->length = length;
+    vector->ints = (long long*)data;
+    return vector;
+}
+
+static Vector* expectVector(enum operators op, Value value){
+    if(value.type != VAL_VECTOR){
+        fatalError(ERROR_TYPE, "Error: Expected vector in %s\n", getOperatorSymbol(op));
+    }
+    return value.vector;
+}
+
+static Vector* expectNumbers(enum operators op, Vector* vector){
+    if(vector->type == VEC_OF_STRING){
+        fatalError(ERROR_TYPE, "Error: Expected a vector of numbers in %s\n", getOperatorSymbol(op));
+    }
+    return vector;
+}
+
+static void expectArgs(enum operators op, int argc, int expected){
+    if(argc != expected){
+        fatalError(ERROR_ARITY, "Error: Expected %d arguments for %s\n", expected, getOperatorSymbol(op));
+    }
+}
+
+static long long expectInt(enum operators op, Value value){
+    if(value.type != VAL_INT){
+        fatalError(ERROR_TYPE, "Error: Expected INT in %s\n", getOperatorSymbol(op));
+    }
+    return value.intValue;
+}
+
+// Lanes of an int vector converted to doubles at a time, into a stack buffer
+#define CONVERT_BLOCK 512
+
+/**
+ * @brief Elements [start, start + n) of a numeric vector as doubles
+ * @param buffer Where int elements are converted to; float vectors are
+ *        read in place
+ */
+static const double* floatLanes(const Vector *vector, size_t start, size_t n, double *buffer){
+    if(vector->type == VEC_OF_FLOAT){
+        return vector->floats + start;
+    }
+    for(size_t i = 0; i < n; i++){
+        buffer[i] = (double)vector->ints[start + i];
+    }
+    return buffer;
+}
+
+/**
+ * @brief Line up the two operands of an element-wise builtin
+ * @param a Set to the left vector
+ * @param b Set to the right vector, or to NULL when `scalar` is broadcast
+ * @param scalar Set to a scalar right-hand side, as a double if the
+ *        operation is on floats
+ * @return The element type the operation works in
+ *
+ * The right-hand side may be a vector of the same length or a single number.
+ * If either side holds floats, both are treated as floats; int operands are
+ * converted a block at a time as the kernels go (see floatKernel), rather
+ * than copied up front.
+ */
+static VectorType alignOperands(enum operators op, Value left, Value right, Vector **a, const Vector **b,
+                                Value *scalar){
+    Vector *x = expectNumbers(op, expectVector(op, left));
+    int isFloat = x->type == VEC_OF_FLOAT;
+
+    if(right.type == VAL_VECTOR){
+        expectNumbers(op, right.vector);
+        if(right.vector->length != x->length){
+            fatalError(ERROR_RANGE, "Error: Vector lengths differ in %s (%zu and %zu)\n",
+                    getOperatorSymbol(op), x->length, right.vector->length);
+        }
+        isFloat |= right.vector->type == VEC_OF_FLOAT;
+        *b = right.vector;
+        *scalar = makeFloatValue(0.0);
+    }else if(right.type == VAL_INT || right.type == VAL_FLOAT){
+        isFloat |= right.type == VAL_FLOAT;
+        *scalar = right;
+        if(isFloat && right.type == VAL_INT){
+            scalar->floatValue = (double)right.intValue;
+        }
+        *b = NULL;
+    }else{
+        fatalError(ERROR_TYPE, "Error: Expected vector or number in %s\n", getOperatorSymbol(op));
+    }
+    *a = x;
+    return isFloat ? VEC_OF_FLOAT : VEC_OF_INT;
+}
+
+/**
+ * @brief Run the float kernel for an arithmetic or comparison builtin
+ * @param result The result's floats, or its ints for a comparison mask
+ * @param b The right-hand vector, or NULL to broadcast `scalar`
+ *
+ * Float operands go to the kernel whole. When either side holds ints, the
+ * work is split into blocks of CONVERT_BLOCK lanes, converted on the stack
+ * just before the kernel reads them, so no converted copy is ever made.
+ */
+static void floatKernel(enum operators op, void *result, const Vector *a, const Vector *b, double scalar){
+    double bufferA[CONVERT_BLOCK];
+    double bufferB[CONVERT_BLOCK];
+    int converting = a->type != VEC_OF_FLOAT || (b != NULL && b->type != VEC_OF_FLOAT);
+    size_t block = converting ? CONVERT_BLOCK : a->length;
+    for(size_t start = 0; start < a->length; start += block){
+        size_t n = a->length - start < block ? a->length - start : block;
+        const double *x = floatLanes(a, start, n, bufferA);
+        const double *y = b != NULL ? floatLanes(b, start, n, bufferB) : &scalar;
+        if(op == VEC_LT || op == VEC_GT || op == VEC_EQ){
+            kernels.floatCompare(op, (long long*)result + start, x, y, b == NULL, n);
+        }else{
+            kernels.floatOp(op, (double*)result + start, x, y, b == NULL, n);
+        }
+    }
+}
+
+static Value elementValue(const Vector *vector, size_t index){
+    if(vector->type == VEC_OF_STRING){
+        return (Value){.type = VAL_STRING, .string = vector->strings[index]};
+    }
+    if(vector->type == VEC_OF_FLOAT){
+        return makeFloatValue(vector->floats[index]);
+    }
+    return makeIntValue(vector->ints[index]);
+}
+
+/**
+ * @brief Evaluate a vector builtin on already-evaluated arguments
+ * @param op One of the VEC_* operators
+ * @param args The argument values
+ * @param argc The number of arguments
+ * @return The result
+ */
+Value evaluateVectorOp(enum operators op, Value* args, int argc){
+    pthread_once(&kernelsOnce, selectKernels);
+
+    switch(op){
+        case VEC: {
+            if(argc > 0 && args[0].type == VAL_STRING){
+                Vector *vector = createVector(VEC_OF_STRING, (size_t)argc);
+                for(int i = 0; i < argc; i++){
+                    if(args[i].type != VAL_STRING){
+                        fatalError(ERROR_TYPE, "Error: Expected all STRING in VEC\n");
+                    }
+                    vector->strings[i] = args[i].string;
+                }
+                return (Value){.type = VAL_VECTOR, .vector = vector};
+            }
+            int isFloat = 0;
+            for(int i = 0; i < argc; i++){
+                if(args[i].type == VAL_FLOAT){
+                    isFloat = 1;
+                }else if(args[i].type != VAL_INT){
+                    fatalError(ERROR_TYPE, "Error: Expected INT or FLOAT in VEC\n");
+                }
+            }
+            Vector *vector = createVector(isFloat ? VEC_OF_FLOAT : VEC_OF_INT, (size_t)argc);
+            for(int i = 0; i < argc; i++){
+                if(isFloat){
+                    vector->floats[i] = args[i].type == VAL_FLOAT ? args[i].floatValue : (double)args[i].intValue;
+                }else{
+                    vector->ints[i] = args[i].intValue;
+                }
+            }
+            return (Value){.type = VAL_VECTOR, .vector = vector};
+        }
+        case MAKE_VEC:
+        case VEC_RANGE: {
+            expectArgs(op, argc, op == MAKE_VEC ? 2 : 1);
+            long long length = expectInt(op, args[0]);
+            if(length < 0){
+                fatalError(ERROR_RANGE, "Error: Negative length in %s\n", getOperatorSymbol(op));
+            }
+            if(op == VEC_RANGE){
+                Vector *vector = createVector(VEC_OF_INT, (size_t)length);
+                for(long long i = 0; i < length; i++) vector->ints[i] = i;
+                return (Value){.type = VAL_VECTOR, .vector = vector};
+            }
+            if(args[1].type == VAL_STRING){
+                Vector *vector = createVector(VEC_OF_STRING, (size_t)length);
+                for(long long i = 0; i < length; i++) vector->strings[i] = args[1].string;
+                return (Value){.type = VAL_VECTOR, .vector = vector};
+            }
+            if(args[1].type == VAL_FLOAT){
+                Vector *vector = createVector(VEC_OF_FLOAT, (size_t)length);
+                for(long long i = 0; i < length; i++) vector->floats[i] = args[1].floatValue;
+                return (Value){.type = VAL_VECTOR, .vector = vector};
+            }
+            long long fill = expectInt(op, args[1]);
+            Vector *vector = createVector(VEC_OF_INT, (size_t)length);
+            for(long long i = 0; i < length; i++) vector->ints[i] = fill;
+            return (Value){.type = VAL_VECTOR, .vector = vector};
+        }
+        case VEC_REF: {
+            expectArgs(op, argc, 2);
+            Vector *vector = expectVector(op, args[0]);
+            long long index = expectInt(op, args[1]);
+            if(index < 0 || (size_t)index >= vector->length){
+                fatalError(ERROR_RANGE, "Error: Index %lld out of range for vector of length %zu\n", index, vector->length);
+            }
+            return elementValue(vector, (size_t)index);
+        }
+        case VEC_LEN:
+            expectArgs(op, argc, 1);
+            return makeIntValue((long long)expectVector(op, args[0])->length);
+        case VEC_ADD:
+        case VEC_SUB:
+        case VEC_MUL:
+        case VEC_DIV: {
+            expectArgs(op, argc, 2);
+            Vector *a;
+            const Vector *b;
+            Value scalar;
+            VectorType type = alignOperands(op, args[0], args[1], &a, &b, &scalar);
+            Vector *result = createVector(type, a->length);
+            if(type == VEC_OF_FLOAT){
+                floatKernel(op, result->floats, a, b, scalar.floatValue);
+            }else{
+                const long long *divisors = b != NULL ? b->ints : &scalar.intValue;
+                if(op == VEC_DIV){
+                    for(size_t i = 0; i < (b == NULL ? 1 : a->length); i++){
+                        if(divisors[i] == 0){
+                            fatalError(ERROR_RANGE, "Error: Division by zero\n");
+                        }
+                    }
+                }
+                kernels.intOp(op, result->ints, a->ints, divisors, b == NULL, a->length);
+            }
+            return (Value){.type = VAL_VECTOR, .vector = result};
+        }
+        case VEC_SUM: {
+            expectArgs(op, argc, 1);
+            Vector *vector = expectNumbers(op, expectVector(op, args[0]));
+            if(vector->type == VEC_OF_FLOAT){
+                return makeFloatValue(kernels.floatSum(vector->floats, vector->length));
+            }
+            return makeIntValue(kernels.intSum(vector->ints, vector->length));
+        }
+        case VEC_MIN:
+        case VEC_MAX: {
+            expectArgs(op, argc, 1);
+            Vector *vector = expectNumbers(op, expectVector(op, args[0]));
+            if(vector->length == 0){
+                fatalError(ERROR_RANGE, "Error: %s of an empty vector\n", getOperatorSymbol(op));
+            }
+            if(vector->type == VEC_OF_FLOAT){
+                return makeFloatValue(kernels.floatExtreme(vector->floats, vector->length, op == VEC_MAX));
+            }
+            return makeIntValue(kernels.intExtreme(vector->ints, vector->length, op == VEC_MAX));
+        }
+        case VEC_DOT: {
+            expectArgs(op, argc, 2);
+            Vector *a = expectNumbers(op, expectVector(op, args[0]));
+            Vector *b = expectNumbers(op, expectVector(op, args[1]));
+            if(a->length != b->length){
+                fatalError(ERROR_RANGE, "Error: Vector lengths differ in %s (%zu and %zu)\n", getOperatorSymbol(op), a->length, b->length);
+            }
+            if(a->type == VEC_OF_INT && b->type == VEC_OF_INT){
+                uint64_t sum = 0;
+                for(size_t i = 0; i < a->length; i++) sum += (uint64_t)a->ints[i] * (uint64_t)b->ints[i];
+                return makeIntValue((long long)sum);
+            }
+            if(a->type == VEC_OF_FLOAT && b->type == VEC_OF_FLOAT){
+                return makeFloatValue(kernels.floatDot(a->floats, b->floats, a->length));
+            }
+            // Mixed: convert the int side a block at a time and sum the blocks
+            double bufferA[CONVERT_BLOCK];
+            double bufferB[CONVERT_BLOCK];
+            double sum = 0.0;
+            for(size_t start = 0; start < a->length; start += CONVERT_BLOCK){
+                size_t n = a->length - start < CONVERT_BLOCK ? a->length - start : CONVERT_BLOCK;
+                sum += kernels.floatDot(floatLanes(a, start, n, bufferA), floatLanes(b, start, n, bufferB), n);
+            }
+            return makeFloatValue(sum);
+        }
+        case VEC_LT:
+        case VEC_GT:
+        case VEC_EQ: {
+            expectArgs(op, argc, 2);
+            Vector *a;
+            const Vector *b;
+            Value scalar;
+            VectorType type = alignOperands(op, args[0], args[1], &a, &b, &scalar);
+            Vector *mask = createVector(VEC_OF_INT, a->length);
+            if(type == VEC_OF_FLOAT){
+                floatKernel(op, mask->ints, a, b, scalar.floatValue);
+            }else{
+                kernels.intCompare(op, mask->ints, a->ints, b != NULL ? b->ints : &scalar.intValue, b == NULL, a->length);
+            }
+            return (Value){.type = VAL_VECTOR, .vector = mask};
+        }
+        default:
+            fatalError(ERROR_UNSUPPORTED, "Error: Unknown vector operator %s\n", getOperatorSymbol(op));
+    }
+}
+
+/**
+ * @brief Print a vector as [1 2 3]
+ * @param vector The vector
+ */
+void printVector(const Vector* vector){
+    outputChar('[');
+    for(size_t i = 0; i < vector->length; i++){
+        if(i > 0) outputChar(' ');
+        if(vector->type == VEC_OF_STRING){
+            outputChar('"');
+            outputWrite(vector->strings[i]->bytes, vector->strings[i]->length);
+            outputChar('"');
+        }else if(vector->type == VEC_OF_FLOAT){
+            char digits[32];
+            outputWrite(digits, (size_t)formatFloat(vector->floats[i], digits));
+        }else{
+            outputInt(vector->ints[i]);
+        }
+    }
+    outputChar(']');
+}
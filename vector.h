@@ -0,0 +1,41 @@
+#ifndef LISP_LITE_VECTOR_H
+#define LISP_LITE_VECTOR_H
+#include "library.h"
+#include <stddef.h>
+
+typedef enum {
+    VEC_OF_INT,
+    VEC_OF_FLOAT,
+    VEC_OF_STRING
+} VectorType;
+
+/*
+ * Contiguous vector. Numbers are stored unboxed and 32-byte aligned so the
+ * bulk kernels can use full-width SIMD loads; a vector of strings (what
+ * `split` returns) only supports building, indexing and `join`.
+ */
+struct Vector {
+    VectorType type;
+    size_t length;
+    union {
+        long long *ints;
+        double *floats;
+        String **strings;
+    };
+};
+
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2
+} SimdLevel;
+
+Vector* createVector(VectorType type, size_t length);
+
+Value evaluateVectorOp(enum operators op, Value* args, int argc);
+
+void printVector(const Vector* vector);
+
+SimdLevel vectorSimdLevel(void);
+
+#endif //LISP_LITE_VECTOR_H
@@ -0,0 +1,873 @@
+#include "watch.h"
+#include "library.h"
+#include "lexer.h"
+#include "effects.h"
+#include "output.h"
+#include "latency.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef __linux__
+
+typedef struct Form Form;
+
+/*
+ * A global name and the forms that use it: the edges of the dependency
+ * graph, from a definition to everything that has to run again when it
+ * changes.
+ */
+typedef struct {
+    char* name;
+    Form** users;           // forms that read or def it, each once
+    int userCount;
+    int definitions;        // defs of it in the current text
+    int function;           // some form has bound it to a lambda
+    unsigned int changed;   // generation it last changed in
+} Global;
+
+struct Form {
+    uint64_t hash;
+    char* text;             // with runs of spaces outside strings made one
+    Node* tree;             // from parse(), or NULL after a syntax error
+    Global** uses;          // every global it reads or defs, each once
+    int useCount;
+    Global** writes;        // the globals it defs, once per def
+    int writeCount;
+    uint64_t order;         // increases down the file; see labelForms
+    int failed;             // the last parse or evaluation raised an error
+    unsigned int claimed;   // generation it was matched to the new text in
+    unsigned int queued;    // generation it was picked to run in
+    unsigned int analyzed;  // generation its effects were last annotated in
+};
+
+typedef struct {
+    Form** items;
+    int count;
+    int capacity;
+} FormList;
+
+// The forms of one version of the file, in order, and where each one is
+typedef struct {
+    Form** items;
+    size_t* starts;
+    size_t* ends;
+    int count;
+    int capacity;
+} FileForms;
+
+// Labels are handed out this far apart, leaving room to insert between them
+#define WATCH_ORDER_GAP ((uint64_t)1 << 32)
+
+/*
+ * Forms edited out of the file are dropped from the graph but never freed:
+ * closures and strings made from their trees may still be held by globals,
+ * maps or vectors.
+ */
+static struct {
+    char* raw;              // the file as of the last reload
+    char* spare;            // the one before, to read the next into
+    char* source;           // the file after normalizeSource
+    size_t sourceLength;
+    size_t sourceCapacity;
+    FileForms forms;
+    int failedCount;
+    EnvEntry* env;
+    Global** globals;       // open-addressed by name
+    Global** functions;     // those with function set
+    int functionCount;
+    size_t globalCapacity;  // a power of two, or 0
+    size_t globalCount;
+    // Definitions of the whole file, kept while no function's change
+    EffectsTable* effects;
+    unsigned int generation;
+} watch;
+
+static void listAdd(FormList* list, Form* form){
+    if(list->count == list->capacity){
+        list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        list->items = (Form**)memRealloc(list->items, sizeof(Form*) * list->capacity);
+    }
+    list->items[list->count++] = form;
+}
+
+static uint64_t hashText(const char* text){
+    uint64_t hash = 14695981039346656037ULL;
+    for(; *text != '\0'; text++){
+        hash ^= (unsigned char)*text;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void insertGlobal(Global** table, size_t capacity, Global* global){
+    size_t i = (size_t)hashText(global->name) & (capacity - 1);
+    while(table[i] != NULL){
+        i = (i + 1) & (capacity - 1);
+    }
+    table[i] = global;
+}
+
+static Global* internGlobal(const char* name){
+    if(watch.globalCount > 0){
+        for(size_t i = (size_t)hashText(name) & (watch.globalCapacity - 1); watch.globals[i] != NULL;
+            i = (i + 1) & (watch.globalCapacity - 1)){
+            if(strcmp(watch.globals[i]->name, name) == 0){
+                return watch.globals[i];
+            }
+        }
+    }
+    if((watch.globalCount + 1) * 2 > watch.globalCapacity){
+        size_t capacity = watch.globalCapacity == 0 ? 64 : watch.globalCapacity * 2;
+        Global** table = (Global**)memCalloc(capacity, sizeof(Global*));
+        for(size_t i = 0; i < watch.globalCapacity; i++){
+            if(watch.globals[i] != NULL){
+                insertGlobal(table, capacity, watch.globals[i]);
+            }
+        }
+        memFree(watch.globals);
+        watch.globals = table;
+        watch.globalCapacity = capacity;
+    }
+    Global* global = (Global*)memCalloc(1, sizeof(Global));
+    global->name = memStrdup(name);
+    insertGlobal(watch.globals, watch.globalCapacity, global);
+    watch.globalCount++;
+    return global;
+}
+
+static void addUse(Form* form, Global* global){
+    for(int i = 0; i < form->useCount; i++){
+        if(form->uses[i] == global){
+            return;
+        }
+    }
+    form->uses = (Global**)memRealloc(form->uses, sizeof(Global*) * (form->useCount + 1));
+    form->uses[form->useCount++] = global;
+    global->users = (Form**)memRealloc(global->users, sizeof(Form*) * (global->userCount + 1));
+    global->users[global->userCount++] = form;
+}
+
+/**
+ * @brief Add the globals a resolved subtree reads and defines to the graph
+ */
+static void collectGlobals(Node* node, Form* form){
+    for(; node != NULL; node = node->nextNode){
+        if(node->type == NODE_VARIABLE){
+            addUse(form, internGlobal(node->val.strValue));
+        }else if(node->type == NODE_OPERATOR && node->val.op == DEF &&
+                 node->childNode != NULL && node->childNode->type == NODE_VARIABLE){
+            Global* global = internGlobal(node->childNode->val.strValue);
+            addUse(form, global);
+            form->writes = (Global**)memRealloc(form->writes, sizeof(Global*) * (form->writeCount + 1));
+            form->writes[form->writeCount++] = global;
+            global->definitions++;
+            if(!global->function && node->childNode->nextNode != NULL &&
+               node->childNode->nextNode->type == NODE_LAMBDA){
+                global->function = 1;
+                watch.functions = (Global**)memRealloc(watch.functions, sizeof(Global*) * (watch.functionCount + 1));
+                watch.functions[watch.functionCount++] = global;
+            }
+            collectGlobals(node->childNode->nextNode, form);
+        }else if(node->type == NODE_OPERATOR || node->type == NODE_LAMBDA){
+            collectGlobals(node->childNode, form);
+        }
+    }
+}
+
+/**
+ * @brief Take a form that is no longer in the file out of the graph
+ */
+static void retireForm(Form* form){
+    for(int i = 0; i < form->useCount; i++){
+        Global* global = form->uses[i];
+        for(int u = 0; u < global->userCount; u++){
+            if(global->users[u] == form){
+                global->users[u] = global->users[--global->userCount];
+                break;
+            }
+        }
+    }
+    // Nothing defines these any more, so reading them is an error again
+    for(int i = 0; i < form->writeCount; i++){
+        if(--form->writes[i]->definitions == 0){
+            env_remove(&watch.env, form->writes[i]->name);
+        }
+    }
+    if(form->failed){
+        watch.failedCount--;
+    }
+}
+
+/**
+ * @brief Find where the top-level form starting at or after `cursor` ends
+ * @return Its first character, or NULL at the end of the text
+ *
+ * A form is a parenthesised list, or a lone atom, which parse() will then
+ * reject as it would in the whole file.
+ */
+static const char* nextForm(const char* cursor, const char** end){
+    while(*cursor == ' '){
+        cursor++;
+    }
+    if(*cursor == '\0'){
+        return NULL;
+    }
+    const char* p = cursor;
+    if(*p == '('){
+        int depth = 0;
+        int inString = 0;
+        for(; *p != '\0'; p++){
+            if(*p == '"'){
+                inString = !inString;
+            }else if(!inString && *p == '('){
+                depth++;
+            }else if(!inString && *p == ')' && --depth == 0){
+                p++;
+                break;
+            }
+        }
+    }else{
+        while(*p != '\0' && *p != ' ' && *p != '(' && *p != ')'){
+            p++;
+        }
+        if(p == cursor){
+            p++;    // a stray ')'
+        }
+    }
+    *end = p;
+    return cursor;
+}
+
+/*
+ * A form's text is compared and hashed with every run of spaces outside
+ * strings taken as one, so re-indenting it is not an edit. nextCanonical
+ * steps through that view of the text without copying it.
+ */
+static const char* nextCanonical(const char* p, const char* end, int* inString){
+    if(*p == '"'){
+        *inString = !*inString;
+    }else if(!*inString && *p == ' '){
+        while(p + 1 < end && p[1] == ' '){
+            p++;
+        }
+    }
+    return p + 1;
+}
+
+static uint64_t hashForm(const char* start, const char* end){
+    uint64_t hash = 14695981039346656037ULL;
+    int inString = 0;
+    for(const char* p = start; p < end; p = nextCanonical(p, end, &inString)){
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int sameForm(const char* start, const char* end, const char* text){
+    int inString = 0;
+    for(const char* p = start; p < end; p = nextCanonical(p, end, &inString)){
+        if(*text++ != *p){
+            return 0;
+        }
+    }
+    return *text == '\0';
+}
+
+static char* copyForm(const char* start, const char* end){
+    char* text = (char*)memAlloc((size_t)(end - start) + 1);
+    size_t length = 0;
+    int inString = 0;
+    for(const char* p = start; p < end; p = nextCanonical(p, end, &inString)){
+        text[length++] = *p;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+/**
+ * @brief Lex and parse one form on its own, and add it to the graph
+ */
+static Form* compileForm(const char* start, const char* end, uint64_t hash){
+    Form* form = (Form*)memCalloc(1, sizeof(Form));
+    form->hash = hash;
+    form->text = copyForm(start, end);
+
+    Token* volatile tokens = NULL;
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) == 0){
+        tokens = lex(form->text);
+        form->tree = parse(tokens);
+        errorTrapPop(&trap);
+        collectGlobals(form->tree->childNode, form);
+    }else{
+        fprintf(stderr, "%s\n", trap.message);
+        form->tree = NULL;
+        form->failed = 1;
+        watch.failedCount++;
+    }
+    freeTokens(tokens);
+    return form;
+}
+
+static int callsFunctions(const Form* form){
+    for(int i = 0; i < form->useCount; i++){
+        if(form->uses[i]->function){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int definesFunctions(const Form* form){
+    for(int i = 0; i < form->writeCount; i++){
+        if(form->writes[i]->function){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Redo effect analysis of every form that defines or calls a function
+ *
+ * parse() analyses a form alone, which takes calls to functions defined in
+ * other forms to be impure. New forms that call functions are annotated
+ * against a table of the file's function definitions instead, and when a
+ * form that defines a function comes or goes the table is built again and
+ * every caller annotated against it. Forms that call no function do not
+ * depend on the table and are left as parse() annotated them.
+ */
+static void analyzeForms(void){
+    FormList involved = {NULL, 0, 0};
+    for(int i = 0; i < watch.functionCount; i++){
+        Global* global = watch.functions[i];
+        for(int u = 0; u < global->userCount; u++){
+            Form* form = global->users[u];
+            if(form->analyzed != watch.generation && form->tree != NULL && form->tree->childNode != NULL){
+                form->analyzed = watch.generation;
+                listAdd(&involved, form);
+            }
+        }
+    }
+
+    // The table is built from the definitions as one program
+    Node* root = createOperatorNode(SEQ);
+    Node** tails = (Node**)memCalloc((size_t)involved.count + 1, sizeof(Node*));
+    Node* tail = NULL;
+    for(int i = 0; i < involved.count; i++){
+        Form* form = involved.items[i];
+        if(!definesFunctions(form)){
+            continue;
+        }
+        if(tail == NULL){
+            root->childNode = form->tree->childNode;
+        }else{
+            tail->nextNode = form->tree->childNode;
+        }
+        tail = form->tree->childNode;
+        while(tail->nextNode != NULL){
+            tail = tail->nextNode;
+        }
+        tails[i] = tail;
+    }
+    if(watch.effects != NULL){
+        effectsTableFree(watch.effects);
+    }
+    watch.effects = effectsTableCreate(root);
+
+    // Give every form its own list back
+    for(int i = 0; i < involved.count; i++){
+        if(tails[i] != NULL){
+            tails[i]->nextNode = NULL;
+        }
+    }
+    memFree(tails);
+    root->childNode = NULL;
+    freeTree(root);
+
+    for(int i = 0; i < involved.count; i++){
+        effectsAnnotate(watch.effects, involved.items[i]->tree);
+    }
+    memFree(involved.items);
+}
+
+static void evaluateForm(Form* form){
+    int failed = form->failed;
+    ErrorTrap trap;
+    errorTrapPush(&trap);
+    if(setjmp(trap.jump) == 0){
+        evaluateTree(form->tree, &watch.env);
+        errorTrapPop(&trap);
+        form->failed = 0;
+    }else{
+        outputFlush();
+        fprintf(stderr, "%s\n", trap.message);
+        resetEvaluator();
+        form->failed = 1;
+    }
+    watch.failedCount += form->failed - failed;
+}
+
+// The previous version's forms around the edit, by hash
+typedef struct {
+    Form** slots;
+    size_t capacity;
+    size_t count;
+} FormIndex;
+
+static void indexInsert(Form** slots, size_t capacity, Form* form){
+    size_t slot = (size_t)form->hash & (capacity - 1);
+    while(slots[slot] != NULL){
+        slot = (slot + 1) & (capacity - 1);
+    }
+    slots[slot] = form;
+}
+
+static void indexAdd(FormIndex* index, Form* form){
+    if((index->count + 1) * 2 > index->capacity){
+        size_t capacity = index->capacity == 0 ? 16 : index->capacity * 2;
+        Form** slots = (Form**)memCalloc(capacity, sizeof(Form*));
+        for(size_t i = 0; i < index->capacity; i++){
+            if(index->slots[i] != NULL){
+                indexInsert(slots, capacity, index->slots[i]);
+            }
+        }
+        memFree(index->slots);
+        index->slots = slots;
+        index->capacity = capacity;
+    }
+    indexInsert(index->slots, index->capacity, form);
+    index->count++;
+}
+
+/**
+ * @brief Find an unclaimed form with this text, preferring the first after position `after`
+ */
+static Form* findForm(FormIndex* index, uint64_t hash, const char* start, const char* end, uint64_t after){
+    if(index->count == 0){
+        return NULL;
+    }
+    Form* next = NULL;
+    Form* first = NULL;
+    for(size_t slot = (size_t)hash & (index->capacity - 1); index->slots[slot] != NULL;
+        slot = (slot + 1) & (index->capacity - 1)){
+        Form* form = index->slots[slot];
+        if(form->claimed == watch.generation || form->hash != hash || !sameForm(start, end, form->text)){
+            continue;
+        }
+        if(form->order > after && (next == NULL || form->order < next->order)){
+            next = form;
+        }
+        if(first == NULL || form->order < first->order){
+            first = form;
+        }
+    }
+    return next != NULL ? next : first;
+}
+
+static size_t commonPrefix(const char* a, const char* b, size_t limit){
+    size_t n = 0;
+    while(n + 4096 <= limit && memcmp(a + n, b + n, 4096) == 0){
+        n += 4096;
+    }
+    while(n < limit && a[n] == b[n]){
+        n++;
+    }
+    return n;
+}
+
+static size_t commonSuffix(const char* a, size_t aLength, const char* b, size_t bLength, size_t limit){
+    size_t n = 0;
+    while(n + 4096 <= limit && memcmp(a + aLength - n - 4096, b + bLength - n - 4096, 4096) == 0){
+        n += 4096;
+    }
+    while(n < limit && a[aLength - n - 1] == b[bLength - n - 1]){
+        n++;
+    }
+    return n;
+}
+
+static void queueForm(FormList* queue, Form* form){
+    if(form->queued != watch.generation){
+        form->queued = watch.generation;
+        listAdd(queue, form);
+    }
+}
+
+static void markChanged(FormList* queue, Global* global){
+    if(global->changed != watch.generation){
+        global->changed = watch.generation;
+        for(int i = 0; i < global->userCount; i++){
+            queueForm(queue, global->users[i]);
+        }
+    }
+}
+
+static int byOrder(const void* a, const void* b){
+    uint64_t x = (*(Form* const*)a)->order;
+    uint64_t y = (*(Form* const*)b)->order;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * @brief Give the forms from `first` up to `last` (not included) labels
+ * that increase down the file
+ *
+ * Kept forms keep their labels, so putting new ones in order only touches
+ * the new ones, until there is no room left between two labels and all are
+ * spread out again.
+ */
+static void labelForms(FileForms* forms, int first, int last){
+    if(first == last){
+        return;
+    }
+    uint64_t low = first > 0 ? forms->items[first - 1]->order : 0;
+    uint64_t count = (uint64_t)(last - first) + 1;
+    uint64_t step = WATCH_ORDER_GAP;
+    if(last < forms->count){
+        step = (forms->items[last]->order - low) / count;
+    }else if(low > UINT64_MAX - step * count){
+        step = 0;
+    }
+    if(step == 0){
+        first = 0;
+        last = forms->count;
+        low = 0;
+        step = WATCH_ORDER_GAP;
+    }
+    for(int i = first; i < last; i++){
+        low += step;
+        forms->items[i]->order = low;
+    }
+}
+
+/**
+ * @brief Bring the normalized text up to date with a new version of the
+ * file, redoing only what lies between the bytes they have in common
+ */
+static void normalizeChange(const char* raw, size_t length, size_t prefix, size_t suffix){
+    size_t middle = length - prefix - suffix;
+    if(length + 1 > watch.sourceCapacity){
+        watch.sourceCapacity = (length + 1) * 2;
+        watch.source = (char*)memRealloc(watch.source, watch.sourceCapacity);
+    }
+    memmove(watch.source + prefix + middle, watch.source + watch.sourceLength - suffix, suffix);
+    memcpy(watch.source + prefix, raw + prefix, middle);
+    // normalizeSource runs to the first NUL, so stop it at the untouched end
+    char kept = watch.source[prefix + middle];
+    watch.source[prefix + middle] = '\0';
+    normalizeSource(watch.source + prefix, middle);
+    watch.source[prefix + middle] = kept;
+    watch.source[length] = '\0';
+    watch.sourceLength = length;
+}
+
+/**
+ * @brief Replace the forms from `head` up to `tail` with `middle`, and
+ * move those after them by `shift` bytes
+ */
+static void spliceForms(FileForms* forms, int head, int tail, const FormList* middle,
+                        const size_t* starts, const size_t* ends, ptrdiff_t shift){
+    int kept = forms->count - tail;
+    int count = head + middle->count + kept;
+    if(count > forms->capacity){
+        forms->capacity = count * 2;
+        forms->items = (Form**)memRealloc(forms->items, sizeof(Form*) * forms->capacity);
+        forms->starts = (size_t*)memRealloc(forms->starts, sizeof(size_t) * forms->capacity);
+        forms->ends = (size_t*)memRealloc(forms->ends, sizeof(size_t) * forms->capacity);
+    }
+    int moved = head + middle->count;
+    if(moved != tail){
+        memmove(forms->items + moved, forms->items + tail, sizeof(Form*) * kept);
+        memmove(forms->starts + moved, forms->starts + tail, sizeof(size_t) * kept);
+        memmove(forms->ends + moved, forms->ends + tail, sizeof(size_t) * kept);
+    }
+    if(shift != 0){
+        for(int i = moved; i < count; i++){
+            forms->starts[i] = (size_t)((ptrdiff_t)forms->starts[i] + shift);
+            forms->ends[i] = (size_t)((ptrdiff_t)forms->ends[i] + shift);
+        }
+    }
+    if(middle->count > 0){
+        memcpy(forms->items + head, middle->items, sizeof(Form*) * middle->count);
+        memcpy(forms->starts + head, starts, sizeof(size_t) * middle->count);
+        memcpy(forms->ends + head, ends, sizeof(size_t) * middle->count);
+    }
+    forms->count = count;
+}
+
+/**
+ * @brief Bring the environment up to date with a new version of the file
+ * @param raw Taken over, and kept to compare the next version against;
+ * the one it replaces becomes watch.spare
+ */
+static void reload(char* raw, size_t length){
+    double started = nowSeconds();
+    watch.generation++;
+
+    FileForms previous = watch.forms;
+    const char* old = watch.raw != NULL ? watch.raw : "";
+    size_t oldLength = watch.sourceLength;
+
+    /*
+     * Only the stretch between the bytes the edit left alone at either end
+     * is normalized, split and hashed again. Forms wholly before it are kept
+     * as they are, and so are those after it once splitting the new text
+     * lines up with the start of one of them.
+     */
+    size_t limit = length < oldLength ? length : oldLength;
+    size_t prefix = commonPrefix(old, raw, limit);
+    size_t suffix = commonSuffix(old, oldLength, raw, length, limit - prefix);
+    ptrdiff_t shift = (ptrdiff_t)length - (ptrdiff_t)oldLength;
+    normalizeChange(raw, length, prefix, suffix);
+    const char* source = watch.source;
+
+    // An atom ending right where the edit starts may run on into it, so
+    // a form is only kept if it ends before
+    int head = 0;
+    int high = previous.count;
+    while(head < high){
+        int middle = (head + high) / 2;
+        if(previous.ends[middle] < prefix){
+            head = middle + 1;
+        }else{
+            high = middle;
+        }
+    }
+    int tail = head;
+    high = previous.count;
+    while(tail < high){
+        int middle = (tail + high) / 2;
+        if(previous.starts[middle] < oldLength - suffix){
+            tail = middle + 1;
+        }else{
+            high = middle;
+        }
+    }
+
+    FormIndex index = {NULL, 0, 0};
+    for(int i = head; i < tail; i++){
+        indexAdd(&index, previous.items[i]);
+    }
+
+    FormList middle = {NULL, 0, 0};
+    size_t* starts = NULL;
+    size_t* ends = NULL;
+    int room = 0;
+    FormList queue = {NULL, 0, 0};
+    FormList added = {NULL, 0, 0};
+    int rebuildEffects = 0;
+    uint64_t lastMatched = head > 0 ? previous.items[head - 1]->order : 0;
+    const char* end = source + (head > 0 ? previous.ends[head - 1] : 0);
+    for(const char* start = nextForm(end, &end); start != NULL; start = nextForm(end, &end)){
+        ptrdiff_t offset = start - source;
+        while(tail < previous.count && (ptrdiff_t)previous.starts[tail] + shift < offset){
+            indexAdd(&index, previous.items[tail++]);
+        }
+        if(tail < previous.count && (ptrdiff_t)previous.starts[tail] + shift == offset){
+            // In step with the untouched end: the rest of the file is as it was
+            break;
+        }
+
+        uint64_t hash = hashForm(start, end);
+        Form* form = findForm(&index, hash, start, end, lastMatched);
+        if(form != NULL){
+            form->claimed = watch.generation;
+            // A form that moved above one it used to follow may now see different globals
+            if(form->order < lastMatched){
+                queueForm(&queue, form);
+            }else{
+                lastMatched = form->order;
+            }
+        }else{
+            form = compileForm(start, end, hash);
+            queueForm(&queue, form);
+            listAdd(&added, form);
+            rebuildEffects |= definesFunctions(form);
+        }
+        listAdd(&middle, form);
+        if(room < middle.capacity){
+            room = middle.capacity;
+            starts = (size_t*)memRealloc(starts, sizeof(size_t) * room);
+            ends = (size_t*)memRealloc(ends, sizeof(size_t) * room);
+        }
+        starts[middle.count - 1] = (size_t)offset;
+        ends[middle.count - 1] = (size_t)(end - source);
+    }
+
+    // Whatever a deleted form defined has changed, and may now be gone;
+    // all of them leave the graph first so none of them is queued
+    for(int i = head; i < tail; i++){
+        if(previous.items[i]->claimed != watch.generation){
+            retireForm(previous.items[i]);
+        }
+    }
+    for(int i = head; i < tail; i++){
+        Form* form = previous.items[i];
+        if(form->claimed == watch.generation){
+            continue;
+        }
+        for(int w = 0; w < form->writeCount; w++){
+            markChanged(&queue, form->writes[w]);
+        }
+        rebuildEffects |= definesFunctions(form);
+    }
+    memFree(index.slots);
+
+    spliceForms(&watch.forms, head, tail, &middle, starts, ends, shift);
+    labelForms(&watch.forms, head, head + middle.count);
+    memFree(middle.items);
+    memFree(starts);
+    memFree(ends);
+    watch.spare = watch.raw;
+    watch.raw = raw;
+
+    if(rebuildEffects || (watch.effects == NULL && added.count > 0)){
+        analyzeForms();
+    }else{
+        for(int i = 0; i < added.count; i++){
+            if(added.items[i]->tree != NULL && callsFunctions(added.items[i])){
+                effectsAnnotate(watch.effects, added.items[i]->tree);
+            }
+        }
+    }
+    memFree(added.items);
+
+    if(watch.failedCount > 0){
+        for(int i = 0; i < watch.forms.count; i++){
+            Form* form = watch.forms.items[i];
+            if(form->failed && form->tree != NULL){
+                queueForm(&queue, form);
+            }
+        }
+    }
+    // Follow the graph from what changed to everything downstream of it
+    for(int i = 0; i < queue.count; i++){
+        Form* form = queue.items[i];
+        for(int w = 0; w < form->writeCount; w++){
+            markChanged(&queue, form->writes[w]);
+        }
+    }
+
+    // and run them in file order
+    if(queue.count > 1){
+        qsort(queue.items, (size_t)queue.count, sizeof(Form*), byOrder);
+    }
+    int evaluated = 0;
+    for(int i = 0; i < queue.count; i++){
+        if(queue.items[i]->tree != NULL){
+            evaluateForm(queue.items[i]);
+            evaluated++;
+        }
+    }
+    memFree(queue.items);
+    outputFlush();
+
+    fprintf(stderr, "[watch] %d of %d forms parsed, %d evaluated in %.2f ms\n",
+            added.count, watch.forms.count, evaluated, (nowSeconds() - started) * 1000.0);
+}
+
+/**
+ * @brief Read the file and reload it
+ * @return 0 if it could not be read
+ */
+static int reloadFile(const char* path){
+    FILE* file = fopen(path, "r");
+    if(file == NULL){
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* raw = (char*)memRealloc(watch.spare, (size_t)length + 1);
+    watch.spare = NULL;
+    length = (long)fread(raw, 1, (size_t)length, file);
+    raw[length] = '\0';
+    fclose(file);
+
+    reload(raw, (size_t)length);
+    return 1;
+}
+
+/**
+ * @brief Wait for inotify to report an event on `name`
+ * @return 0 if reading the events failed
+ */
+static int waitForChange(int fd, const char* name){
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for(;;){
+        ssize_t length = read(fd, events, sizeof(events));
+        if(length < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return 0;
+        }
+        for(char* p = events; p < events + length; ){
+            struct inotify_event* event = (struct inotify_event*)p;
+            if(event->len > 0 && strcmp(event->name, name) == 0){
+                return 1;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+#endif
+
+/**
+ * @brief Run `path`, then keep it up to date as it changes, until killed
+ * @return An exit status, only on failing to start
+ */
+int runWatch(const char* path){
+#ifndef __linux__
+    fprintf(stderr, "Error: --watch needs inotify\n");
+    return 1;
+#else
+    // Editors often save by writing a new file and renaming it over the old
+    // one, so the directory is watched rather than the file
+    char* directory = memStrdup(path);
+    char* slash = strrchr(directory, '/');
+    const char* name = path;
+    if(slash != NULL){
+        name = path + (slash - directory) + 1;
+        slash[slash == directory ? 1 : 0] = '\0';
+    }else{
+        strcpy(directory, ".");
+    }
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if(fd < 0 || inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0){
+        fprintf(stderr, "Error: Could not watch %s: %s\n", directory, strerror(errno));
+        return 1;
+    }
+    memFree(directory);
+
+    if(!reloadFile(path)){
+        fprintf(stderr, "Error: Could not open file %s\n", path);
+        return 1;
+    }
+    while(waitForChange(fd, name)){
+        // Let the rest of the save land, then take it all as one change
+        struct pollfd poller = {fd, POLLIN, 0};
+        char drain[4096];
+        while(poll(&poller, 1, WATCH_SETTLE_MS) > 0 && read(fd, drain, sizeof(drain)) > 0){
+        }
+        reloadFile(path);
+    }
+    fprintf(stderr, "Error: Lost the watch on %s: %s\n", path, strerror(errno));
+    return 1;
+#endif
+}
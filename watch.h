@@ -0,0 +1,30 @@
+#ifndef LISP_LITE_WATCH_H
+#define LISP_LITE_WATCH_H
+
+/*
+ * --watch: run a script, then run it again every time it is saved, doing
+ * only the work the edit calls for.
+ *
+ * The file is split into its top-level forms and each form is keyed by a
+ * hash of its text (with runs of whitespace outside strings collapsed, so
+ * re-indenting is not a change). Forms seen before keep their parsed tree;
+ * only new or edited ones are lexed and parsed. Globals persist between
+ * runs, and a form is evaluated again only if it is new, edited, moved,
+ * failed last time, or reads or defines a global that a re-evaluated or
+ * deleted form defines. Everything else keeps the value its def left in the
+ * environment, and its output is not repeated.
+ *
+ * This assumes each global is defined by one form: with several, which
+ * definition wins can differ from a fresh run. Maps and vectors changed in
+ * place by forms that do not run again keep those changes. Globals only
+ * defined by deleted forms are removed.
+ *
+ * Needs inotify, so Linux only.
+ */
+
+// After a change, wait this long for the editor to finish writing
+#define WATCH_SETTLE_MS 50
+
+int runWatch(const char* path);
+
+#endif //LISP_LITE_WATCH_H